@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "nes_cpu.h"
+#include "nes_apu.h"
+#include "apu_synth.h"
+#include "nes_context.h"
+
+// Makes the APU's sound somewhere other than the CPU's side of it. The emulation thread only keeps what
+// the CPU can see (the registers, the frame sequencer and its IRQ, and the DMC's fetches from memory), and
+// logs every register write and fetched sample byte, stamped with the clock it happened on. The synthesis side
+// (the channels, the mixer and the output) replays the log, either at the end of each audio frame on the
+// emulation thread, or on a thread of its own. Both sides run the same clocks, so either way the sound
+// comes out exactly the same as the CPU heard it.
+//
+// Writes stamped with a clock happen before that clock, and DMC bytes during it, same as in nes_apu.c.
+
+const unsigned int APU_LOG_START_SIZE = 0x1000;
+
+void log_apu_event(unsigned int time, unsigned short address, unsigned char value)
+{
+	if (nes->filling_apu_log->length == nes->filling_apu_log->capacity)
+	{
+		nes->filling_apu_log->capacity = nes->filling_apu_log->capacity * 2;
+		nes->filling_apu_log->events = realloc(nes->filling_apu_log->events, sizeof(struct apu_log_event) * nes->filling_apu_log->capacity);
+	}
+
+	struct apu_log_event* event = &nes->filling_apu_log->events[nes->filling_apu_log->length];
+	event->time = time;
+	event->address = address;
+	event->value = value;
+	nes->filling_apu_log->length++;
+}
+
+// Started with the context it makes the audio for.
+void* synth_thread_loop(void* data)
+{
+	nes = data;
+	while (1)
+	{
+		pthread_mutex_lock(&nes->synth_lock);
+		while (!nes->apu_log_handed && !nes->synth_thread_quit)
+		{
+			pthread_cond_wait(&nes->apu_log_waiting, &nes->synth_lock);
+		}
+		pthread_mutex_unlock(&nes->synth_lock);
+		if (nes->synth_thread_quit)
+		{
+			break;
+		}
+
+		synthesize_apu_log(nes->handed_apu_log, 1);
+
+		pthread_mutex_lock(&nes->synth_lock);
+		nes->handed_apu_log->length = 0;
+		nes->apu_log_handed = 0;
+		pthread_cond_broadcast(&nes->synth_idle);
+		pthread_mutex_unlock(&nes->synth_lock);
+	}
+
+	return NULL;
+}
+
+// Nothing to wait for if the thread was never started.
+void wait_for_synth_thread()
+{
+	if (!nes->synth_thread_started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&nes->synth_lock);
+	while (nes->apu_log_handed)
+	{
+		pthread_cond_wait(&nes->synth_idle, &nes->synth_lock);
+	}
+	pthread_mutex_unlock(&nes->synth_lock);
+}
+
+// Ends the audio frame at end_time. Threaded, the frame is made in the background, unless the synthesis
+// thread is still on an older one, in which case this frame waits in the log with the next.
+void apu_synth_end_frame(unsigned int end_time, double output_rate, unsigned char mutes)
+{
+	nes->filling_apu_log->end_time = end_time;
+	nes->filling_apu_log->output_rate = output_rate;
+	nes->filling_apu_log->mutes = mutes;
+	if (!nes->apu_synth_threaded)
+	{
+		synthesize_apu_log(nes->filling_apu_log, 1);
+		nes->filling_apu_log->length = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&nes->synth_lock);
+	if (!nes->apu_log_handed)
+	{
+		struct apu_log* next_log = nes->handed_apu_log;
+		nes->handed_apu_log = nes->filling_apu_log;
+		nes->filling_apu_log = next_log;
+		nes->apu_log_handed = 1;
+		pthread_cond_signal(&nes->apu_log_waiting);
+	}
+	pthread_mutex_unlock(&nes->synth_lock);
+}
+
+// Brings the synthesis side up to time without ending the audio frame, so its state is complete (for saving a state).
+void apu_synth_sync(unsigned int time, unsigned char mutes)
+{
+	wait_for_synth_thread();
+	nes->filling_apu_log->end_time = time;
+	nes->filling_apu_log->mutes = mutes;
+	synthesize_apu_log(nes->filling_apu_log, 0);
+	nes->filling_apu_log->length = 0;
+}
+
+// Throws away anything logged so far, for when the APU state was replaced.
+// Once it returns, the synthesis thread is idle, so the channels can be replaced too.
+void apu_synth_restart()
+{
+	wait_for_synth_thread();
+	if (nes->filling_apu_log != NULL)
+	{
+		nes->filling_apu_log->length = 0;
+	}
+}
+
+void apu_synth_init()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		nes->apu_logs[i].capacity = APU_LOG_START_SIZE;
+		nes->apu_logs[i].events = malloc(sizeof(struct apu_log_event) * nes->apu_logs[i].capacity);
+		nes->apu_logs[i].length = 0;
+		nes->apu_logs[i].end_time = 0;
+	}
+	nes->filling_apu_log = &nes->apu_logs[0];
+	nes->handed_apu_log = &nes->apu_logs[1];
+	nes->apu_log_handed = 0;
+}
+
+void apu_synth_start()
+{
+	// The stems are read straight out of the synthesis side, so they only work without the thread.
+	if (apu_stems_enabled())
+	{
+		core_log("Threaded audio doesn't work with stems.");
+		return;
+	}
+	if (!nes->synth_thread_started)
+	{
+		pthread_mutex_init(&nes->synth_lock, NULL);
+		pthread_cond_init(&nes->apu_log_waiting, NULL);
+		pthread_cond_init(&nes->synth_idle, NULL);
+		if (pthread_create(&nes->synth_thread, NULL, synth_thread_loop, nes) != 0)
+		{
+			core_log("Could not start the audio thread.");
+			return;
+		}
+		nes->synth_thread_started = 1;
+	}
+	nes->apu_synth_threaded = 1;
+}
+
+// Whatever's still in the log gets made on the emulation thread at the end of the frame.
+void apu_synth_stop()
+{
+	wait_for_synth_thread();
+	nes->apu_synth_threaded = 0;
+}
+
+// Stops the thread (if it was ever started) and frees the logs, for when the context is thrown away.
+void apu_synth_free()
+{
+	if (nes->synth_thread_started)
+	{
+		pthread_mutex_lock(&nes->synth_lock);
+		nes->synth_thread_quit = 1;
+		pthread_cond_signal(&nes->apu_log_waiting);
+		pthread_mutex_unlock(&nes->synth_lock);
+		pthread_join(nes->synth_thread, NULL);
+		pthread_mutex_destroy(&nes->synth_lock);
+		pthread_cond_destroy(&nes->apu_log_waiting);
+		pthread_cond_destroy(&nes->synth_idle);
+		nes->synth_thread_started = 0;
+		nes->apu_synth_threaded = 0;
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		free(nes->apu_logs[i].events);
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef APU_SYNTH_HEADER
+#define APU_SYNTH_HEADER
+
+// Logged in place of a register address for each sample byte the DMC fetched.
+enum apu_log_addresses { APU_LOG_DMC_BYTE = 0 };
+
+struct apu_log_event
+{
+	unsigned int time;
+	unsigned short address;
+	unsigned char value;
+};
+
+struct apu_log
+{
+	struct apu_log_event* events;
+	unsigned int length;
+	unsigned int capacity;
+	// The synthesis side runs up to (but not including) this clock.
+	unsigned int end_time;
+	// What the output was set to when the log was handed over, see apu_set_output_rate and the silence flags.
+	double output_rate;
+	unsigned char mutes;
+};
+
+void apu_synth_init();
+void log_apu_event(unsigned int time, unsigned short address, unsigned char value);
+void apu_synth_end_frame(unsigned int end_time, double output_rate, unsigned char mutes);
+void apu_synth_sync(unsigned int time, unsigned char mutes);
+void apu_synth_restart();
+void apu_synth_start();
+void apu_synth_stop();
+void apu_synth_free();
+
+#endif
@@ -1,8 +1,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include "arachnes.h"
 #include "emu_nes.h"
-#include "controller.h"
+#include "audio_export.h"
 
 const unsigned char CONTROLLER_NONE = 0;
 const unsigned char CONTROLLER_STANDARD = 1;
@@ -21,12 +22,82 @@ int main(int argc, char *argv[])
 {
 	setbuf(stdout, NULL);
 	
-	if (argc != 3)
+	if (argc < 3)
 	{
 		printf("Error: Requires ROM and movie parameters.\n");
 		return 1;
 	}
 	
+	// Exporting the audio means it's a run for the output rather than for watching,
+	// so it quits when the movie's done instead of waiting around.
+	unsigned char quit_at_end = 0;
+	for (int i = 3; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--audio-out") && (i + 1 < argc))
+		{
+			i++;
+			audio_export_path = argv[i];
+			quit_at_end = 1;
+		}
+		else if (!strcmp(argv[i], "--stems-out") && (i + 1 < argc))
+		{
+			i++;
+			stems_export_path = argv[i];
+			quit_at_end = 1;
+		}
+		else if (!strcmp(argv[i], "--unbounded"))
+		{
+			unbound_framerate = 1;
+		}
+		// Only the sound is wanted, so skip drawing (and showing) the picture.
+		else if (!strcmp(argv[i], "--audio-only"))
+		{
+			emulator_options |= ARACHNES_AUDIO_ONLY;
+		}
+		// The other way around: no sound made at all, and no audio device.
+		else if (!strcmp(argv[i], "--video-only"))
+		{
+			emulator_options |= ARACHNES_VIDEO_ONLY;
+		}
+		else
+		{
+			printf("Error: Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	
+	if ((emulator_options & ARACHNES_VIDEO_ONLY) && ((emulator_options & ARACHNES_AUDIO_ONLY) || (audio_export_path != NULL) || (stems_export_path != NULL)))
+	{
+		printf("Error: --video-only can't be used with audio output.\n");
+		return 1;
+	}
+	
+	// Samples going to stdout need it to themselves, so from here on everything printed goes to stderr.
+	// That has to happen before anything else gets printed.
+	unsigned char audio_to_stdout = (audio_export_path != NULL) && !strcmp(audio_export_path, "-");
+	unsigned char stems_to_stdout = (stems_export_path != NULL) && !strcmp(stems_export_path, "-");
+	if (audio_to_stdout && stems_to_stdout)
+	{
+		printf("Error: Only one of --audio-out and --stems-out can go to stdout.\n");
+		return 1;
+	}
+	if ((audio_to_stdout || stems_to_stdout) && audio_export_take_stdout())
+	{
+		printf("Error: Could not take stdout for the audio.\n");
+		return 1;
+	}
+	
+	// An export is a run for the output, so the sound isn't played as well, and with --audio-only there's no picture to show either.
+	// That way it works on a machine with no display or sound card.
+	if (quit_at_end)
+	{
+		use_audio_device = 0;
+		if (emulator_options & ARACHNES_AUDIO_ONLY)
+		{
+			use_window = 0;
+		}
+	}
+	
 	FILE* movie = fopen(argv[2], "rb");
 	if (movie == NULL)
 	{
@@ -133,20 +204,14 @@ int main(int argc, char *argv[])
 	while (frame_count < frames)
 	{
 		nes_loop();
-	 
-		for (unsigned int i = 0; i < render_buffer_count; i++)
-		{
-			render_pixel(render_buffer[i]);
-			
-			if (frame_finished)
-			{
-				handle_movie_input(player_one_input[frame_count], commands[frame_count]);
-				frame_count++;
-				push_audio();
-				frame_finished = 0;
-			}
-		}
-		render_buffer_count = 0;
+		handle_movie_input(player_one_input[frame_count], commands[frame_count]);
+		frame_count++;
+		push_audio();
+	}
+	
+	if (quit_at_end)
+	{
+		quit_emulator();
 	}
 	
 	while (1)
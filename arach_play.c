@@ -3,6 +3,22 @@
 #include <stdlib.h>
 #include "emu_nes.h"
 
+// SDL keeps the period in 16 bits, and more than a second of latency is no use to anyone.
+const long MAX_AUDIO_PERIOD = 32768;
+const long MAX_AUDIO_LATENCY_MS = 1000;
+
+// Reads a whole number from 1 to maximum, or returns 0 if the text is anything else.
+unsigned int parse_option_number(const char* text, long maximum)
+{
+	char* end;
+	long value = strtol(text, &end, 10);
+	if ((end == text) || (*end != '\0') || (value <= 0) || (value > maximum))
+	{
+		return 0;
+	}
+	return value;
+}
+
 int main(int argc, char *argv[])
 {
 	setbuf(stdout, NULL);
@@ -13,24 +29,50 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	
+	for (int i = 2; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--audio-float"))
+		{
+			audio_float_output = 1;
+		}
+		else if (!strcmp(argv[i], "--audio-period") && (i + 1 < argc))
+		{
+			i++;
+			audio_device_samples = parse_option_number(argv[i], MAX_AUDIO_PERIOD);
+			if (audio_device_samples == 0)
+			{
+				printf("Audio period must be a number of samples from 1 to %ld.\n", MAX_AUDIO_PERIOD);
+				exit(1);
+			}
+		}
+		else if (!strcmp(argv[i], "--audio-latency") && (i + 1 < argc))
+		{
+			i++;
+			audio_latency_ms = parse_option_number(argv[i], MAX_AUDIO_LATENCY_MS);
+			if (audio_latency_ms == 0)
+			{
+				printf("Audio latency must be a number of milliseconds from 1 to %ld.\n", MAX_AUDIO_LATENCY_MS);
+				exit(1);
+			}
+		}
+		else if (!strcmp(argv[i], "--audio-stats"))
+		{
+			audio_stats = 1;
+		}
+		else
+		{
+			printf("Unknown option %s\n", argv[i]);
+			exit(1);
+		}
+	}
+	
 	sdl_init();
 	nes_init(argv[1]);
 	
 	while(1)
 	{
 		nes_loop();
-	 
-		for (unsigned int i = 0; i < render_buffer_count; i++)
-		{
-			render_pixel(render_buffer[i]);
-			
-			if (frame_finished)
-			{
-				handle_user_input();
-				push_audio();
-				frame_finished = 0;
-			}
-		}
-		render_buffer_count = 0;
+		handle_user_input();
+		push_audio();
 	}
 }
\ No newline at end of file
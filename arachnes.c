@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "nes_cpu.h"
+#include "nes_apu.h"
+#include "nes_ppu.h"
+#include "controller.h"
+#include "cartridge.h"
+#include "ppu_renderer.h"
+#include "nes_context.h"
+#include "arachnes.h"
+
+// The emulator core as a library: give it a ROM and some input, get back frames and samples.
+// Nothing in here (or in anything it calls) touches SDL, the clock or any file the caller didn't name,
+// so it runs the same anywhere. arach_play and arach_movie are just SDL frontends over it (see emu_nes.c).
+//
+// Each instance has its own nes_context, and every call below points nes at it before running anything,
+// so any number of them can run at once, on as many threads as you like (one thread per instance at a time).
+
+const unsigned int KB = 1024;
+const unsigned int STACK_PAGE = 0x100;
+
+const unsigned int FRAME_PIXELS = ARACHNES_FRAME_WIDTH * ARACHNES_FRAME_HEIGHT;
+
+struct arachnes
+{
+	// Lined up on a cache line somewhere inside context_memory.
+	struct nes_context* context;
+	void* context_memory;
+	unsigned int options;
+	unsigned char rom_loaded;
+	// Set when the core hit something it couldn't carry on from. Nothing more gets run after that.
+	unsigned char failed;
+	// Pixels go into the drawing frame as the PPU puts them out, and it's swapped with the finished one
+	// when it's full, since the last pixels of a frame can come out in the same CPU clock as the first of the next.
+	// Each pixel is the palette index in bits 0-5 and the emphasis bits in 6-8.
+	unsigned short* drawing_frame;
+	unsigned short* finished_frame;
+	unsigned int frame_position;
+};
+
+__thread struct nes_context* nes = NULL;
+
+// The core calls exit_emulator when it runs into something it can't handle (a bad mapper, a bad save state,
+// an address nothing answers to). Inside any of the calls below that run the core, that jumps back out
+// and the call fails instead of taking the whole process down with it. Each thread has its own, since
+// each thread could be running a different instance.
+__thread jmp_buf core_error;
+__thread unsigned char core_error_set = 0;
+
+// The core's lookup tables are the same for every instance, so the first one made builds them.
+pthread_once_t core_tables_built = PTHREAD_ONCE_INIT;
+
+void build_core_tables()
+{
+	cpu_build_tables();
+	ppu_build_tables();
+	apu_build_tables();
+	cartridge_build_tables();
+}
+
+void use_instance(struct arachnes* instance)
+{
+	nes = instance->context;
+}
+
+// Nothing in the core prints to stdout, since that belongs to whatever's using it.
+// Messages go to the log handler if there is one, or stderr.
+arachnes_log_handler log_handler = NULL;
+
+void arachnes_set_log_handler(arachnes_log_handler handler)
+{
+	log_handler = handler;
+}
+
+void core_log(const char* format, ...)
+{
+	char message[256];
+	va_list arguments;
+	va_start(arguments, format);
+	vsnprintf(message, sizeof(message), format, arguments);
+	va_end(arguments);
+	if (log_handler != NULL)
+	{
+		log_handler(message);
+	}
+	else
+	{
+		fprintf(stderr, "%s\n", message);
+	}
+}
+
+void exit_emulator()
+{
+	if (core_error_set)
+	{
+		core_error_set = 0;
+		longjmp(core_error, 1);
+	}
+	exit(1);
+}
+
+// The new instance is also left as the one the core is running on this thread, for frontends that
+// reach into the core themselves (see emu_nes.c).
+struct arachnes* arachnes_create(unsigned int options)
+{
+	pthread_once(&core_tables_built, build_core_tables);
+
+	struct arachnes* instance = malloc(sizeof(struct arachnes));
+	instance->context_memory = calloc(1, sizeof(struct nes_context) + NES_CACHE_LINE - 1);
+	instance->context = (struct nes_context*)(((uintptr_t)instance->context_memory + NES_CACHE_LINE - 1) & ~(uintptr_t)(NES_CACHE_LINE - 1));
+	instance->options = options;
+	instance->rom_loaded = 0;
+	instance->failed = 0;
+	instance->drawing_frame = calloc(FRAME_PIXELS, sizeof(short));
+	instance->finished_frame = calloc(FRAME_PIXELS, sizeof(short));
+	instance->frame_position = 0;
+
+	use_instance(instance);
+	nes->ppu_audio_only = (options & ARACHNES_AUDIO_ONLY) != 0;
+	nes->apu_video_only = (options & ARACHNES_VIDEO_ONLY) != 0;
+	return instance;
+}
+
+void arachnes_destroy(struct arachnes* instance)
+{
+	use_instance(instance);
+	ppu_renderer_free();
+	apu_free();
+	cartridge_free();
+	nes = NULL;
+
+	free(instance->drawing_frame);
+	free(instance->finished_frame);
+	free(instance->context_memory);
+	free(instance);
+}
+
+// Returns 0 once the ROM's running, or 1 if it couldn't be opened or isn't supported.
+// It can be called again on the same instance to swap games. Nothing's allocated again for that:
+// cartridge_init lets go of the old ROM first, and the audio output, the stems and the render and synthesis
+// threads' logs were made the first time and are reused (they're past snapshot_end, so the memset leaves them be).
+int arachnes_load_rom(struct arachnes* instance, const char* path)
+{
+	FILE* rom = fopen(path, "rb");
+	if (rom == NULL)
+	{
+		core_log("ROM file could not be opened.");
+		return 1;
+	}
+	unsigned char header[16];
+	if (fread(header, 1, 16, rom) != 16)
+	{
+		core_log("ROM file is too short.");
+		fclose(rom);
+		return 1;
+	}
+
+	unsigned char prg_pages = header[4];
+	unsigned char chr_pages = header[5];
+	unsigned char mapper = ((header[6] >> 4) & 0xF) | (header[7] & 0xF0);
+	unsigned char mirroring = header[6] & 0b1;
+
+	use_instance(instance);
+	if (setjmp(core_error))
+	{
+		fclose(rom);
+		instance->failed = 1;
+		return 1;
+	}
+	core_error_set = 1;
+
+	// The machine starts out all zeroes, like it did back when it was globals.
+	// The synthesis thread works on the channels, so it has to be idle first.
+	apu_synth_restart();
+	memset(nes, 0, NES_SNAPSHOT_SIZE);
+
+	// The PPU goes first, since the cartridge maps its nametables into PPU RAM.
+	ppu_init();
+	cartridge_init(mapper, prg_pages, chr_pages, mirroring, rom);
+	apu_init();
+	controller_init();
+	cpu_init();
+
+	core_error_set = 0;
+	fclose(rom);
+	instance->rom_loaded = 1;
+	instance->failed = 0;
+	return 0;
+}
+
+// The reset command from a movie, which just restarts the CPU at the reset vector.
+void arachnes_reset(struct arachnes* instance)
+{
+	if (instance->rom_loaded && !instance->failed)
+	{
+		use_instance(instance);
+		reset_cpu();
+	}
+}
+
+// Buttons held from now on, as arachnes_buttons bits.
+void arachnes_set_input(struct arachnes* instance, unsigned char player_one, unsigned char player_two)
+{
+	instance->context->controller_1_data = player_one;
+	instance->context->controller_2_data = player_two;
+}
+
+void add_pixel(struct arachnes* instance, unsigned char pixel, unsigned char* frame_done)
+{
+	// The emphasis bits are read as the pixel comes out, so changing them mid-frame shows up where it should.
+	instance->drawing_frame[instance->frame_position] = pixel | ((nes->ppu_mask & 0b11100000) << 1);
+	instance->frame_position++;
+	if (instance->frame_position == FRAME_PIXELS)
+	{
+		unsigned short* finished = instance->drawing_frame;
+		instance->drawing_frame = instance->finished_frame;
+		instance->finished_frame = finished;
+		instance->frame_position = 0;
+		*frame_done = 1;
+	}
+}
+
+// Runs until the PPU finishes a frame, then ends the audio frame there too.
+// Returns 0, or 1 if there's no ROM running or the core gave up partway through.
+int arachnes_run_frame(struct arachnes* instance)
+{
+	if (!instance->rom_loaded || instance->failed)
+	{
+		return 1;
+	}
+	use_instance(instance);
+	if (setjmp(core_error))
+	{
+		instance->failed = 1;
+		return 1;
+	}
+	core_error_set = 1;
+
+	unsigned char frame_done = 0;
+	while (!frame_done)
+	{
+		// PPU runs at triple the speed of the CPU.
+		// Call PPU tick three times for every CPU cycle.
+		// APU runs at half the CPU speed, but I'm doing half
+		// an APU cycle per tick here.
+		for (int i = 0; i < 3; i++)
+		{
+			unsigned char pixel = ppu_tick();
+			if (pixel != 255)
+			{
+				add_pixel(instance, pixel, &frame_done);
+			}
+		}
+		cpu_tick();
+		apu_tick();
+
+		// With threaded rendering (or none at all) the frame finishes without any pixels coming through here.
+		// If the render thread hasn't caught up yet, the last frame gets kept instead of waiting on it.
+		if (nes->ppu_frame_drawn)
+		{
+			nes->ppu_frame_drawn = 0;
+			if (!nes->ppu_audio_only)
+			{
+				unsigned short* frame = ppu_renderer_take_frame();
+				if (frame != NULL)
+				{
+					memcpy(instance->finished_frame, frame, sizeof(short) * FRAME_PIXELS);
+				}
+			}
+			frame_done = 1;
+		}
+	}
+
+	apu_end_audio_frame();
+	core_error_set = 0;
+	return 0;
+}
+
+// The last finished frame, ARACHNES_FRAME_WIDTH by ARACHNES_FRAME_HEIGHT. It stays put until the next arachnes_run_frame.
+const unsigned short* arachnes_get_framebuffer(struct arachnes* instance)
+{
+	return instance->finished_frame;
+}
+
+// The CPU's RAM as it is now, ARACHNES_RAM_SIZE bytes. Only good until the instance runs again.
+const unsigned char* arachnes_get_ram(struct arachnes* instance)
+{
+	return instance->context->cpu_ram;
+}
+
+// Reads up to count samples of the audio made so far (mono, signed 16 bit, at arachnes_sample_rate), and returns how many it got.
+// Anything not read by the end of the next frame may get dropped.
+unsigned int arachnes_get_audio(struct arachnes* instance, short* samples, unsigned int count)
+{
+	if (!instance->rom_loaded)
+	{
+		return 0;
+	}
+	use_instance(instance);
+	return apu_read_samples(samples, count);
+}
+
+unsigned int arachnes_sample_rate(struct arachnes* instance)
+{
+	return apu_sample_rate;
+}
+
+// Best done between frames. Returns 0, or 1 if there's no ROM running.
+int arachnes_save_state(struct arachnes* instance, FILE* file)
+{
+	if (!instance->rom_loaded || instance->failed)
+	{
+		return 1;
+	}
+	use_instance(instance);
+	cpu_save_state(file);
+	ppu_save_state(file);
+	apu_save_state(file);
+	controller_save_state(file);
+	cartridge_save_state(file);
+	return 0;
+}
+
+// Returns 0, or 1 if the state is for a different mapper. The state's been partly loaded by then,
+// so the instance can't carry on after that, and needs a fresh ROM load.
+int arachnes_load_state(struct arachnes* instance, FILE* file)
+{
+	if (!instance->rom_loaded)
+	{
+		return 1;
+	}
+	use_instance(instance);
+	if (setjmp(core_error))
+	{
+		instance->failed = 1;
+		return 1;
+	}
+	core_error_set = 1;
+
+	cpu_load_state(file);
+	ppu_load_state(file);
+	apu_load_state(file);
+	controller_load_state(file);
+	cartridge_load_state(file);
+
+	core_error_set = 0;
+	instance->failed = 0;
+	return 0;
+}
+
+// Snapshots are the whole machine in one block, copied straight out of the instance, so they're much quicker
+// than save states. They're only meant to go back into an instance running the same ROM, in the same process,
+// and don't carry over between versions. Both are best done between frames.
+size_t arachnes_snapshot_size()
+{
+	return NES_SNAPSHOT_SIZE;
+}
+
+// Copies the machine into snapshot, which needs arachnes_snapshot_size bytes. Returns 0, or 1 if there's no ROM running.
+int arachnes_snapshot(struct arachnes* instance, void* snapshot)
+{
+	if (!instance->rom_loaded || instance->failed)
+	{
+		return 1;
+	}
+	use_instance(instance);
+	// Both threads have to catch up first, since the channels and the sprites are only complete on their side.
+	apu_sync();
+	if (nes->ppu_render_threaded)
+	{
+		ppu_renderer_drain();
+	}
+	memcpy(snapshot, nes, NES_SNAPSHOT_SIZE);
+	return 0;
+}
+
+// Puts the machine back the way arachnes_snapshot found it. Returns 0, or 1 if there's no ROM loaded.
+int arachnes_restore(struct arachnes* instance, const void* snapshot)
+{
+	if (!instance->rom_loaded)
+	{
+		return 1;
+	}
+	use_instance(instance);
+	apu_synth_restart();
+	memcpy(nes, snapshot, NES_SNAPSHOT_SIZE);
+	apu_snapshot_restored();
+	cartridge_remap();
+	if (nes->ppu_render_threaded)
+	{
+		ppu_renderer_restart();
+	}
+	instance->frame_position = 0;
+	instance->failed = 0;
+	return 0;
+}
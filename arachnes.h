@@ -0,0 +1,65 @@
+#ifndef ARACHNES_HEADER
+#define ARACHNES_HEADER
+
+#include <stdio.h>
+
+// The emulator core on its own, with no SDL and nothing read from disk but the ROM. See arachnes.c.
+
+enum arachnes_frame_size { ARACHNES_FRAME_WIDTH = 256, ARACHNES_FRAME_HEIGHT = 240 };
+
+// The CPU's own 2 KB, which is where most games keep everything worth knowing about.
+enum arachnes_ram_size { ARACHNES_RAM_SIZE = 0x800 };
+
+// Options for arachnes_create. Audio only skips drawing the picture, and video only skips making the sound.
+// Neither changes anything the game can see.
+enum arachnes_options
+{
+	ARACHNES_AUDIO_ONLY = 0b01,
+	ARACHNES_VIDEO_ONLY = 0b10
+};
+
+// Controller bits, for arachnes_set_input.
+enum arachnes_buttons
+{
+	ARACHNES_A      = 0b00000001,
+	ARACHNES_B      = 0b00000010,
+	ARACHNES_SELECT = 0b00000100,
+	ARACHNES_START  = 0b00001000,
+	ARACHNES_UP     = 0b00010000,
+	ARACHNES_DOWN   = 0b00100000,
+	ARACHNES_LEFT   = 0b01000000,
+	ARACHNES_RIGHT  = 0b10000000
+};
+
+struct arachnes;
+
+// Gets the core's messages (bad ROMs, unhandled addresses and the like), one line at a time without the newline.
+// They go to stderr if nobody asks for them. It's for the whole process, and is called from whichever thread hit the problem.
+typedef void (*arachnes_log_handler) (const char* message);
+void arachnes_set_log_handler(arachnes_log_handler handler);
+
+struct arachnes* arachnes_create(unsigned int options);
+void arachnes_destroy(struct arachnes* instance);
+int arachnes_load_rom(struct arachnes* instance, const char* path);
+void arachnes_reset(struct arachnes* instance);
+void arachnes_set_input(struct arachnes* instance, unsigned char player_one, unsigned char player_two);
+int arachnes_run_frame(struct arachnes* instance);
+const unsigned short* arachnes_get_framebuffer(struct arachnes* instance);
+const unsigned char* arachnes_get_ram(struct arachnes* instance);
+unsigned int arachnes_get_audio(struct arachnes* instance, short* samples, unsigned int count);
+unsigned int arachnes_sample_rate(struct arachnes* instance);
+int arachnes_save_state(struct arachnes* instance, FILE* file);
+int arachnes_load_state(struct arachnes* instance, FILE* file);
+size_t arachnes_snapshot_size();
+int arachnes_snapshot(struct arachnes* instance, void* snapshot);
+int arachnes_restore(struct arachnes* instance, const void* snapshot);
+
+// Running lots of instances at once on a pool of threads. See arachnes_batch.c.
+struct arachnes_batch;
+
+struct arachnes_batch* arachnes_batch_create(unsigned int threads);
+void arachnes_batch_destroy(struct arachnes_batch* batch);
+unsigned int arachnes_batch_run(struct arachnes_batch* batch, struct arachnes** instances, unsigned int count, unsigned int frames,
+	const unsigned char* inputs, unsigned short* framebuffers, unsigned char* ram);
+
+#endif
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "nes_cpu.h"
+#include "arachnes.h"
+
+// Runs a whole batch of instances for some frames at once, for when there are far more games going than screens
+// (training bots, mostly). The batch keeps a thread for each core, pinned to it, and each arachnes_batch_run
+// hands every thread an even share of the instances. A thread that runs out of its own goes and takes from
+// the others, so a few slow games don't hold everyone up. Each instance runs all its frames on whichever
+// thread picked it up, so its state stays in that core's cache the whole time.
+//
+// Everything in here goes through the same calls as any other frontend, so a batch comes out exactly the same
+// as running the instances one after the other.
+
+// One worker's share of the instances, as a range of their indexes. The worker takes from the bottom,
+// and anyone stealing from it takes from the top.
+struct batch_queue
+{
+	pthread_mutex_t lock;
+	unsigned int top;
+	unsigned int bottom;
+	// How many of this worker's instances failed this run.
+	unsigned int failed;
+} __attribute__ ((aligned (64)));
+
+struct arachnes_batch;
+
+struct batch_worker
+{
+	struct arachnes_batch* batch;
+	unsigned int index;
+	pthread_t thread;
+};
+
+struct arachnes_batch
+{
+	unsigned int worker_count;
+	// Workers that actually got started, which is fewer than worker_count if starting one failed.
+	unsigned int workers_started;
+	struct batch_worker* workers;
+	struct batch_queue* queues;
+
+	// The run being worked on. Only changed while all the workers are waiting.
+	struct arachnes** instances;
+	unsigned int frames;
+	const unsigned char* inputs;
+	unsigned short* framebuffers;
+	unsigned char* ram;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+	// Goes up by one for every run, so the workers can tell a new one from waking up for nothing.
+	unsigned int run_number;
+	unsigned int workers_running;
+	unsigned char quit;
+};
+
+// Runs one instance through all of the run's frames, then copies out what it finished on.
+// Returns 1 if the instance failed (or already had).
+unsigned char run_batch_instance(struct arachnes_batch* batch, unsigned int index)
+{
+	struct arachnes* instance = batch->instances[index];
+	unsigned char failed = 0;
+	for (unsigned int frame = 0; frame < batch->frames; frame++)
+	{
+		if (batch->inputs != NULL)
+		{
+			const unsigned char* input = &batch->inputs[((size_t)index * batch->frames + frame) * 2];
+			arachnes_set_input(instance, input[0], input[1]);
+		}
+		if (arachnes_run_frame(instance))
+		{
+			failed = 1;
+			break;
+		}
+	}
+
+	if (batch->framebuffers != NULL)
+	{
+		memcpy(&batch->framebuffers[(size_t)index * ARACHNES_FRAME_WIDTH * ARACHNES_FRAME_HEIGHT], arachnes_get_framebuffer(instance),
+			sizeof(short) * ARACHNES_FRAME_WIDTH * ARACHNES_FRAME_HEIGHT);
+	}
+	if (batch->ram != NULL)
+	{
+		memcpy(&batch->ram[(size_t)index * ARACHNES_RAM_SIZE], arachnes_get_ram(instance), ARACHNES_RAM_SIZE);
+	}
+	return failed;
+}
+
+// Gets the next instance for worker to run, from its own queue if there's any left, or else from someone else's.
+// Returns 0 once every queue is empty. Nothing gets added partway through a run, so then the worker's done.
+unsigned char take_batch_work(struct arachnes_batch* batch, unsigned int worker, unsigned int* index)
+{
+	struct batch_queue* own = &batch->queues[worker];
+	pthread_mutex_lock(&own->lock);
+	if (own->top < own->bottom)
+	{
+		own->bottom--;
+		*index = own->bottom;
+		pthread_mutex_unlock(&own->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&own->lock);
+
+	// Starting from the next worker along, so the thieves don't all pile onto the first queue.
+	for (unsigned int i = 1; i < batch->worker_count; i++)
+	{
+		struct batch_queue* victim = &batch->queues[(worker + i) % batch->worker_count];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->top < victim->bottom)
+		{
+			*index = victim->top;
+			victim->top++;
+			pthread_mutex_unlock(&victim->lock);
+			return 1;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return 0;
+}
+
+void* batch_worker_loop(void* data)
+{
+	struct batch_worker* worker = data;
+	struct arachnes_batch* batch = worker->batch;
+	unsigned int last_run = 0;
+	while (1)
+	{
+		pthread_mutex_lock(&batch->lock);
+		while (batch->run_number == last_run && !batch->quit)
+		{
+			pthread_cond_wait(&batch->work_ready, &batch->lock);
+		}
+		last_run = batch->run_number;
+		pthread_mutex_unlock(&batch->lock);
+		if (batch->quit)
+		{
+			break;
+		}
+
+		unsigned int index;
+		unsigned int failed = 0;
+		while (take_batch_work(batch, worker->index, &index))
+		{
+			failed += run_batch_instance(batch, index);
+		}
+		batch->queues[worker->index].failed = failed;
+
+		pthread_mutex_lock(&batch->lock);
+		batch->workers_running--;
+		if (batch->workers_running == 0)
+		{
+			pthread_cond_signal(&batch->work_done);
+		}
+		pthread_mutex_unlock(&batch->lock);
+	}
+	return NULL;
+}
+
+// Where the next worker to be started gets pinned, counting through the cores the process is allowed on.
+// It carries on across batches, so two batches in one process spread out instead of piling onto the same cores.
+unsigned int next_batch_core = 0;
+pthread_mutex_t next_batch_core_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Keeps the workers on one core each, so the instances they run stay in that core's cache. They're dealt out
+// round the cores the process is allowed to run on (which under taskset or a cpuset needn't be the first few).
+// Only done where there's a way to do it. Anywhere else, or if the allowed cores can't be found out,
+// the workers just float.
+void pin_batch_workers(struct arachnes_batch* batch)
+{
+#ifdef __linux__
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0)
+	{
+		return;
+	}
+	unsigned int allowed_count = CPU_COUNT(&allowed);
+	if (allowed_count == 0)
+	{
+		return;
+	}
+	unsigned int* cores = malloc(sizeof(int) * allowed_count);
+	unsigned int found = 0;
+	for (unsigned int cpu = 0; (cpu < CPU_SETSIZE) && (found < allowed_count); cpu++)
+	{
+		if (CPU_ISSET(cpu, &allowed))
+		{
+			cores[found] = cpu;
+			found++;
+		}
+	}
+
+	pthread_mutex_lock(&next_batch_core_lock);
+	for (unsigned int i = 0; i < batch->workers_started; i++)
+	{
+		cpu_set_t core;
+		CPU_ZERO(&core);
+		CPU_SET(cores[next_batch_core % found], &core);
+		next_batch_core++;
+		// Not being pinned doesn't stop the worker working, so a failure here just leaves it floating.
+		pthread_setaffinity_np(batch->workers[i].thread, sizeof(cpu_set_t), &core);
+	}
+	pthread_mutex_unlock(&next_batch_core_lock);
+	free(cores);
+#endif
+}
+
+// Makes a batch with threads workers, or one for each core the process is allowed on if threads is 0. Returns NULL if the threads couldn't be started.
+struct arachnes_batch* arachnes_batch_create(unsigned int threads)
+{
+	if (threads == 0)
+	{
+		long online_cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online_cores > 0 ? online_cores : 1;
+#ifdef __linux__
+		cpu_set_t allowed;
+		if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0)
+		{
+			threads = CPU_COUNT(&allowed);
+		}
+#endif
+	}
+
+	struct arachnes_batch* batch = calloc(1, sizeof(struct arachnes_batch));
+	batch->worker_count = threads;
+	batch->workers_started = 0;
+	batch->workers = calloc(threads, sizeof(struct batch_worker));
+	batch->queues = aligned_alloc(64, sizeof(struct batch_queue) * threads);
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->work_ready, NULL);
+	pthread_cond_init(&batch->work_done, NULL);
+
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		pthread_mutex_init(&batch->queues[i].lock, NULL);
+		batch->queues[i].top = 0;
+		batch->queues[i].bottom = 0;
+		batch->queues[i].failed = 0;
+	}
+
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		batch->workers[i].batch = batch;
+		batch->workers[i].index = i;
+		if (pthread_create(&batch->workers[i].thread, NULL, batch_worker_loop, &batch->workers[i]) != 0)
+		{
+			core_log("Could not start the batch threads.");
+			arachnes_batch_destroy(batch);
+			return NULL;
+		}
+		batch->workers_started++;
+	}
+	pin_batch_workers(batch);
+	return batch;
+}
+
+void arachnes_batch_destroy(struct arachnes_batch* batch)
+{
+	pthread_mutex_lock(&batch->lock);
+	batch->quit = 1;
+	pthread_cond_broadcast(&batch->work_ready);
+	pthread_mutex_unlock(&batch->lock);
+	for (unsigned int i = 0; i < batch->workers_started; i++)
+	{
+		pthread_join(batch->workers[i].thread, NULL);
+	}
+
+	for (unsigned int i = 0; i < batch->worker_count; i++)
+	{
+		pthread_mutex_destroy(&batch->queues[i].lock);
+	}
+	pthread_mutex_destroy(&batch->lock);
+	pthread_cond_destroy(&batch->work_ready);
+	pthread_cond_destroy(&batch->work_done);
+	free(batch->queues);
+	free(batch->workers);
+	free(batch);
+}
+
+// Runs count instances for frames frames each, and returns once they've all finished.
+// Each instance can only be in the list once, and none of them can be in use anywhere else until this returns.
+//
+// inputs holds both controllers' buttons (arachnes_set_input) for every frame of every instance,
+// instance by instance, so instance i's input for frame f is at inputs[(i * frames + f) * 2].
+// If it's NULL, everyone keeps holding what they were.
+// framebuffers gets each instance's last frame (ARACHNES_FRAME_WIDTH * ARACHNES_FRAME_HEIGHT shorts each, one after the other),
+// and ram gets each one's ARACHNES_RAM_SIZE bytes of CPU RAM once it's done. Either can be NULL to skip it.
+//
+// Returns how many instances failed (see arachnes_run_frame). Their frames and RAM are copied anyway,
+// as they were when they stopped.
+unsigned int arachnes_batch_run(struct arachnes_batch* batch, struct arachnes** instances, unsigned int count, unsigned int frames,
+	const unsigned char* inputs, unsigned short* framebuffers, unsigned char* ram)
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	batch->instances = instances;
+	batch->frames = frames;
+	batch->inputs = inputs;
+	batch->framebuffers = framebuffers;
+	batch->ram = ram;
+
+	// Every worker starts out with an even run of instances next to each other.
+	for (unsigned int i = 0; i < batch->worker_count; i++)
+	{
+		batch->queues[i].top = (unsigned long long)count * i / batch->worker_count;
+		batch->queues[i].bottom = (unsigned long long)count * (i + 1) / batch->worker_count;
+		batch->queues[i].failed = 0;
+	}
+
+	pthread_mutex_lock(&batch->lock);
+	batch->workers_running = batch->worker_count;
+	batch->run_number++;
+	pthread_cond_broadcast(&batch->work_ready);
+	while (batch->workers_running > 0)
+	{
+		pthread_cond_wait(&batch->work_done, &batch->lock);
+	}
+	pthread_mutex_unlock(&batch->lock);
+
+	unsigned int failed = 0;
+	for (unsigned int i = 0; i < batch->worker_count; i++)
+	{
+		failed += batch->queues[i].failed;
+	}
+	return failed;
+}
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "audio_export.h"
+
+// Audio export, for getting sound out of runs nobody's listening to. Samples are written as they come out of
+// the APU, so there's no limit on how long a run can be, and nothing here cares how fast the emulator is going.
+// A path ending in .wav gets a WAV file, "-" sends raw samples to stdout (and everything printed to stderr),
+// and anything else gets raw samples.
+// Raw samples are signed 16 bit little endian, interleaved if there's more than one channel, at whatever rate
+// the export was opened with.
+
+// Samples converted per fwrite.
+const unsigned int EXPORT_CHUNK = 4096;
+// The file's own buffer, so writes go out in big pieces.
+const unsigned int EXPORT_FILE_BUFFER = 1 << 16;
+const unsigned int WAV_HEADER_SIZE = 44;
+
+// Where "-" writes. Everything else printed goes to stdout too (the core's errors, the frontend's messages),
+// and any of that landing between samples would wreck them, so the samples get stdout to themselves.
+FILE* export_stdout = NULL;
+
+// Keeps the real stdout for the samples, and points the stdout everyone else prints to at stderr instead.
+// It's done on the file descriptor, so it catches everything, however it was printed. Anything printed
+// before this still went to the real stdout, so frontends call it before doing anything that might print.
+// Returns 0, or 1 if stdout couldn't be taken.
+int audio_export_take_stdout()
+{
+	if (export_stdout != NULL)
+	{
+		return 0;
+	}
+	fflush(stdout);
+	int samples_fd = dup(STDOUT_FILENO);
+	if (samples_fd < 0)
+	{
+		return 1;
+	}
+	export_stdout = fdopen(samples_fd, "wb");
+	if ((export_stdout == NULL) || (dup2(STDERR_FILENO, STDOUT_FILENO) < 0))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+void write_le16(unsigned char* output, unsigned int value)
+{
+	output[0] = value & 0xFF;
+	output[1] = (value >> 8) & 0xFF;
+}
+
+void write_le32(unsigned char* output, unsigned int value)
+{
+	output[0] = value & 0xFF;
+	output[1] = (value >> 8) & 0xFF;
+	output[2] = (value >> 16) & 0xFF;
+	output[3] = (value >> 24) & 0xFF;
+}
+
+// The sizes aren't known until the end, so this gets written once up front and again on closing.
+void write_wav_header(struct audio_export* export)
+{
+	unsigned char header[WAV_HEADER_SIZE];
+	memcpy(&header[0], "RIFF", 4);
+	write_le32(&header[4], 36 + export->data_bytes);
+	memcpy(&header[8], "WAVE", 4);
+	memcpy(&header[12], "fmt ", 4);
+	// PCM, 16 bits.
+	write_le32(&header[16], 16);
+	write_le16(&header[20], 1);
+	write_le16(&header[22], export->channels);
+	write_le32(&header[24], export->sample_rate);
+	write_le32(&header[28], export->sample_rate * 2 * export->channels);
+	write_le16(&header[32], 2 * export->channels);
+	write_le16(&header[34], 16);
+	memcpy(&header[36], "data", 4);
+	write_le32(&header[40], export->data_bytes);
+	fwrite(header, 1, WAV_HEADER_SIZE, export->file);
+}
+
+// Returns NULL if the file couldn't be opened.
+struct audio_export* audio_export_open(const char* path, unsigned int sample_rate, unsigned int channels)
+{
+	FILE* file;
+	unsigned char format = EXPORT_RAW;
+	size_t length = strlen(path);
+	if (!strcmp(path, "-"))
+	{
+		if (audio_export_take_stdout())
+		{
+			return NULL;
+		}
+		file = export_stdout;
+	}
+	else
+	{
+		file = fopen(path, "wb");
+		if (file == NULL)
+		{
+			return NULL;
+		}
+		if ((length >= 4) && !strcmp(&path[length - 4], ".wav"))
+		{
+			format = EXPORT_WAV;
+		}
+	}
+	// Nothing's been written to the file yet, so it can still be given a buffer. For "-" that's the stream
+	// the samples have to themselves, not stdout, which frontends may well have made unbuffered by now.
+	setvbuf(file, NULL, _IOFBF, EXPORT_FILE_BUFFER);
+
+	struct audio_export* export = malloc(sizeof(struct audio_export));
+	export->file = file;
+	export->format = format;
+	export->sample_rate = sample_rate;
+	export->channels = channels;
+	export->data_bytes = 0;
+	export->bytes = malloc(sizeof(char) * 2 * EXPORT_CHUNK);
+	if (format == EXPORT_WAV)
+	{
+		write_wav_header(export);
+	}
+	return export;
+}
+
+// count is samples per channel.
+void audio_export_write(struct audio_export* export, short* samples, unsigned int count)
+{
+	count *= export->channels;
+	while (count > 0)
+	{
+		unsigned int chunk = (count < EXPORT_CHUNK) ? count : EXPORT_CHUNK;
+		for (unsigned int i = 0; i < chunk; i++)
+		{
+			write_le16(&export->bytes[i * 2], (unsigned short)samples[i]);
+		}
+		fwrite(export->bytes, 2, chunk, export->file);
+		export->data_bytes += chunk * 2;
+		samples += chunk;
+		count -= chunk;
+	}
+}
+
+// Fills in the WAV header now that the length is known, and closes the file.
+void audio_export_close(struct audio_export* export)
+{
+	if ((export->format == EXPORT_WAV) && (fseek(export->file, 0, SEEK_SET) == 0))
+	{
+		write_wav_header(export);
+	}
+	fclose(export->file);
+	if (export->file == export_stdout)
+	{
+		export_stdout = NULL;
+	}
+	free(export->bytes);
+	free(export);
+}
@@ -0,0 +1,24 @@
+#ifndef AUDIO_EXPORT_HEADER
+#define AUDIO_EXPORT_HEADER
+
+enum audio_export_formats { EXPORT_WAV, EXPORT_RAW };
+
+// Streams 16 bit samples out to a file as they're made. With more than one channel, samples are interleaved.
+struct audio_export
+{
+	FILE* file;
+	unsigned char format;
+	unsigned int sample_rate;
+	unsigned int channels;
+	// Bytes of samples written so far, for the WAV header.
+	unsigned int data_bytes;
+	// Samples get converted to little endian bytes in here on their way out.
+	unsigned char* bytes;
+};
+
+int audio_export_take_stdout();
+struct audio_export* audio_export_open(const char* path, unsigned int sample_rate, unsigned int channels);
+void audio_export_write(struct audio_export* export, short* samples, unsigned int count);
+void audio_export_close(struct audio_export* export);
+
+#endif
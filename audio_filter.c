@@ -0,0 +1,76 @@
+#include <math.h>
+#include "audio_filter.h"
+
+// First-order filters, run on the output samples rather than on every APU clock, since at 48 KHz
+// they do the same job for a tiny fraction of the work.
+// High-pass: out = a * (last out + in - last in), with a = RC / (RC + dt).
+// Low-pass: out = last out + b * (in - last out), with b = dt / (RC + dt).
+
+const int AUDIO_FILTER_BITS = 15;
+// The filter state holds samples with this many extra bits, so the rounding doesn't build up into noise.
+const int AUDIO_FILTER_STATE_BITS = 8;
+const double AUDIO_FILTER_PI = 3.14159265358979323846;
+
+int high_pass_coefficient(double cutoff, unsigned int sample_rate)
+{
+	double rc = 1 / (2 * AUDIO_FILTER_PI * cutoff);
+	double dt = 1.0 / sample_rate;
+	return (int)floor(((rc / (rc + dt)) * (1 << AUDIO_FILTER_BITS)) + 0.5);
+}
+
+int low_pass_coefficient(double cutoff, unsigned int sample_rate)
+{
+	double rc = 1 / (2 * AUDIO_FILTER_PI * cutoff);
+	double dt = 1.0 / sample_rate;
+	return (int)floor(((dt / (rc + dt)) * (1 << AUDIO_FILTER_BITS)) + 0.5);
+}
+
+void audio_filter_init(struct audio_filter* filter, unsigned int sample_rate)
+{
+	filter->high_pass_90_coefficient = high_pass_coefficient(90, sample_rate);
+	filter->high_pass_440_coefficient = high_pass_coefficient(440, sample_rate);
+	filter->low_pass_coefficient = low_pass_coefficient(14000, sample_rate);
+	audio_filter_reset(filter);
+}
+
+void audio_filter_reset(struct audio_filter* filter)
+{
+	filter->high_pass_90_input = 0;
+	filter->high_pass_90_output = 0;
+	filter->high_pass_440_input = 0;
+	filter->high_pass_440_output = 0;
+	filter->low_pass_output = 0;
+}
+
+// Filters the samples in place.
+void audio_filter_run(struct audio_filter* filter, short* samples, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		int input = samples[i] * (1 << AUDIO_FILTER_STATE_BITS);
+
+		long long high_pass = (long long)filter->high_pass_90_coefficient * (filter->high_pass_90_output + input - filter->high_pass_90_input);
+		filter->high_pass_90_input = input;
+		filter->high_pass_90_output = high_pass >> AUDIO_FILTER_BITS;
+		input = filter->high_pass_90_output;
+
+		high_pass = (long long)filter->high_pass_440_coefficient * (filter->high_pass_440_output + input - filter->high_pass_440_input);
+		filter->high_pass_440_input = input;
+		filter->high_pass_440_output = high_pass >> AUDIO_FILTER_BITS;
+		input = filter->high_pass_440_output;
+
+		long long low_pass = (long long)filter->low_pass_coefficient * (input - filter->low_pass_output);
+		filter->low_pass_output += low_pass >> AUDIO_FILTER_BITS;
+
+		int output = filter->low_pass_output >> AUDIO_FILTER_STATE_BITS;
+		if (output > 32767)
+		{
+			output = 32767;
+		}
+		else if (output < -32768)
+		{
+			output = -32768;
+		}
+		samples[i] = output;
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef AUDIO_FILTER_HEADER
+#define AUDIO_FILTER_HEADER
+
+// The NES's own output filters: high-pass at 90 Hz and 440 Hz, then low-pass at 14 KHz.
+// Coefficients are fixed point with AUDIO_FILTER_BITS fractional bits, and the state keeps a few extra bits of its own.
+struct audio_filter
+{
+	int high_pass_90_coefficient;
+	int high_pass_440_coefficient;
+	int low_pass_coefficient;
+	int high_pass_90_input;
+	int high_pass_90_output;
+	int high_pass_440_input;
+	int high_pass_440_output;
+	int low_pass_output;
+};
+
+void audio_filter_init(struct audio_filter* filter, unsigned int sample_rate);
+void audio_filter_reset(struct audio_filter* filter);
+void audio_filter_run(struct audio_filter* filter, short* samples, unsigned int count);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "audio_ring.h"
+
+// The writer publishes its position with a release store after copying the samples in, and the reader
+// picks it up with an acquire load before copying them out, so the reader never sees a position
+// ahead of the samples behind it. Same the other way around for the space the reader frees up.
+
+// capacity gets rounded up to a power of two.
+struct audio_ring* audio_ring_create(unsigned int capacity)
+{
+	struct audio_ring* ring = malloc(sizeof(struct audio_ring));
+	ring->size = 1;
+	while (ring->size < capacity)
+	{
+		ring->size <<= 1;
+	}
+	ring->mask = ring->size - 1;
+	ring->samples = calloc(ring->size, sizeof(short));
+	ring->write_position = 0;
+	ring->read_position = 0;
+	ring->underruns = 0;
+	ring->overflows = 0;
+	return ring;
+}
+
+void audio_ring_free(struct audio_ring* ring)
+{
+	free(ring->samples);
+	free(ring);
+}
+
+// Writes up to count samples. Returns how many fit. Only call from the writing thread.
+unsigned int audio_ring_write(struct audio_ring* ring, short* input, unsigned int count)
+{
+	unsigned int write_position = ring->write_position;
+	unsigned int read_position = __atomic_load_n(&ring->read_position, __ATOMIC_ACQUIRE);
+	unsigned int space = ring->size - (write_position - read_position);
+	if (count > space)
+	{
+		ring->overflows += count - space;
+		count = space;
+	}
+	unsigned int start = write_position & ring->mask;
+	unsigned int first = ring->size - start;
+	if (first > count)
+	{
+		first = count;
+	}
+	memcpy(&ring->samples[start], input, sizeof(short) * first);
+	memcpy(ring->samples, &input[first], sizeof(short) * (count - first));
+	__atomic_store_n(&ring->write_position, write_position + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+// Reads up to count samples. Returns how many there were. Only call from the reading thread.
+unsigned int audio_ring_read(struct audio_ring* ring, short* output, unsigned int count)
+{
+	unsigned int read_position = ring->read_position;
+	unsigned int write_position = __atomic_load_n(&ring->write_position, __ATOMIC_ACQUIRE);
+	unsigned int available = write_position - read_position;
+	if (count > available)
+	{
+		__atomic_store_n(&ring->underruns, ring->underruns + 1, __ATOMIC_RELAXED);
+		count = available;
+	}
+	unsigned int start = read_position & ring->mask;
+	unsigned int first = ring->size - start;
+	if (first > count)
+	{
+		first = count;
+	}
+	memcpy(output, &ring->samples[start], sizeof(short) * first);
+	memcpy(&output[first], ring->samples, sizeof(short) * (count - first));
+	__atomic_store_n(&ring->read_position, read_position + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+// How many samples are waiting to be read. Safe from either thread, though it can be out of date
+// by the time it's looked at.
+unsigned int audio_ring_fill(struct audio_ring* ring)
+{
+	unsigned int write_position = __atomic_load_n(&ring->write_position, __ATOMIC_ACQUIRE);
+	unsigned int read_position = __atomic_load_n(&ring->read_position, __ATOMIC_ACQUIRE);
+	return write_position - read_position;
+}
+
+// Safe from either thread.
+unsigned int audio_ring_underruns(struct audio_ring* ring)
+{
+	return __atomic_load_n(&ring->underruns, __ATOMIC_RELAXED);
+}
+
+// Empties the ring. This moves both positions, so the reader has to be stopped while it happens.
+void audio_ring_reset(struct audio_ring* ring)
+{
+	__atomic_store_n(&ring->read_position, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->write_position, 0, __ATOMIC_RELEASE);
+}
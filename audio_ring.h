@@ -0,0 +1,28 @@
+#ifndef AUDIO_RING_HEADER
+#define AUDIO_RING_HEADER
+
+// Single producer, single consumer ring of 16 bit samples. One thread writes, one thread reads, no locks.
+struct audio_ring
+{
+	short* samples;
+	// Always a power of two, so positions wrap with a mask.
+	unsigned int size;
+	unsigned int mask;
+	// These count up forever (well, until they wrap around together), and are only masked to index samples.
+	// The writer owns write_position and the reader owns read_position.
+	unsigned int write_position;
+	unsigned int read_position;
+	// Reads that came up short, counted by the reader. Samples that didn't fit, counted by the writer.
+	unsigned int underruns;
+	unsigned int overflows;
+};
+
+struct audio_ring* audio_ring_create(unsigned int capacity);
+void audio_ring_free(struct audio_ring* ring);
+unsigned int audio_ring_write(struct audio_ring* ring, short* input, unsigned int count);
+unsigned int audio_ring_read(struct audio_ring* ring, short* output, unsigned int count);
+unsigned int audio_ring_fill(struct audio_ring* ring);
+unsigned int audio_ring_underruns(struct audio_ring* ring);
+void audio_ring_reset(struct audio_ring* ring);
+
+#endif
@@ -1,7 +1,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include "emu_nes.h"
 #include "cartridge.h"
 #include "nes_cpu.h"
 #include "nes_ppu.h"
@@ -12,6 +11,8 @@
 #include "mappers/mmc3_04.h"
 #include "mappers/axrom_07.h"
 #include "mappers/mmc2_09.h"
+#include "rom_image.h"
+#include "nes_context.h"
 
 typedef void (*get_ptr_handler) (unsigned char*, unsigned int, unsigned char);
 typedef void (*mapper_init) (void);
@@ -23,169 +24,222 @@ const unsigned char HORIZONTAL = 0;
 const unsigned char VERTICAL = 1;
 const unsigned int CART_RAM_SIZE = 0x2000;
 
-unsigned char* prg_rom;
-unsigned char* prg_ram;
-unsigned char* chr_rom;
-unsigned char* chr_ram;
-
-unsigned int prg_rom_pages;
-unsigned int chr_rom_pages;
-unsigned int prg_rom_size;
-unsigned int prg_ram_size;
-unsigned int chr_rom_size;
-unsigned char use_chr_ram;
-unsigned char nametable_mirroring;
-unsigned char mapper;
-
 mapper_init* init_table;
 get_ptr_handler* mapper_prg_table;
-get_ptr_handler* mapper_chr_table;
-get_ptr_handler* mapper_nametable_table;
+a12_rise_handler* mapper_a12_rise_table;
+tile_fetch_handler* mapper_tile_fetch_table;
+mapper_init* mapper_remap_table;
 save_file_handler* mapper_save_state_table;
 save_file_handler* mapper_load_state_table;
 
 void get_pointer_at_prg_address(unsigned char* data, unsigned int address, unsigned char access_type)
 {
-	return mapper_prg_table[mapper](data, address, access_type);
+	return mapper_prg_table[nes->mapper](data, address, access_type);
 }
 
 void get_pointer_at_chr_address(unsigned char* data, unsigned int address, unsigned char access_type)
 {
-	return mapper_chr_table[mapper](data, address, access_type);
+	if (access_type == READ)
+	{
+		*data = nes->chr_windows[(address >> 10) & 0b111][address & 0x3FF];
+	}
+	else if (nes->use_chr_ram) // access_type == WRITE
+	{
+		nes->chr_windows[(address >> 10) & 0b111][address & 0x3FF] = *data;
+	}
 }
 
 // The cartridge has control over how the PPU accesses its RAM, normally controlling mirroring.
 // It could even alter it to point to cartridge RAM instead.
 void get_pointer_at_nametable_address(unsigned char* data, unsigned int address, unsigned char access_type)
 {
-	return mapper_nametable_table[mapper](data, address, access_type);
+	if (access_type == READ)
+	{
+		*data = nes->nametable_windows[(address >> 10) & 0b11][address & 0x3FF];
+	}
+	else // access_type == WRITE
+	{
+		nes->nametable_windows[(address >> 10) & 0b11][address & 0x3FF] = *data;
+	}
+}
+
+// Points one of the eight 1 KB CHR windows at a 1 KB bank of CHR ROM, or CHR RAM
+// if that's what the cartridge has. Out of range banks wrap around.
+// The windows are writable for CHR RAM's sake, but nothing writes through them with CHR ROM banked in.
+void map_chr_window(unsigned int window, unsigned int bank)
+{
+	if (nes->use_chr_ram)
+	{
+		nes->chr_windows[window] = nes->chr_ram + ((bank % (CART_RAM_SIZE / 0x400)) * 0x400);
+	}
+	else
+	{
+		nes->chr_windows[window] = (unsigned char*)nes->chr_rom + ((bank % (nes->chr_rom_size / 0x400)) * 0x400);
+	}
+}
+
+// Points the four nametables at the two 1 KB pages of PPU RAM.
+// Horizontal mirroring is (0, 0, 1, 1), vertical is (0, 1, 0, 1).
+void map_nametables(unsigned char top_left, unsigned char top_right, unsigned char bottom_left, unsigned char bottom_right)
+{
+	nes->nametable_windows[0] = nes->ppu_ram + (top_left * 0x400);
+	nes->nametable_windows[1] = nes->ppu_ram + (top_right * 0x400);
+	nes->nametable_windows[2] = nes->ppu_ram + (bottom_left * 0x400);
+	nes->nametable_windows[3] = nes->ppu_ram + (bottom_right * 0x400);
+}
+
+// For mappers with a tile fetch hook: asks to be told about fetches from the tile at the given CHR address.
+void watch_tile(unsigned int tile_address)
+{
+	nes->watched_tiles[(tile_address >> 4) & 0x1FF] = 1;
 }
 
 void cartridge_save_state(FILE* save_file)
 {
-	fwrite(&mapper, sizeof(char), 1, save_file);
-	fwrite(prg_ram, sizeof(char), CART_RAM_SIZE, save_file);
-	fwrite(chr_ram, sizeof(char), CART_RAM_SIZE, save_file);
-	return mapper_save_state_table[mapper](save_file);
+	fwrite(&nes->mapper, sizeof(char), 1, save_file);
+	fwrite(nes->prg_ram, sizeof(char), CART_RAM_SIZE, save_file);
+	fwrite(nes->chr_ram, sizeof(char), CART_RAM_SIZE, save_file);
+	return mapper_save_state_table[nes->mapper](save_file);
 }
 
 void cartridge_load_state(FILE* save_file)
 {
 	unsigned char save_state_mapper;
 	fread(&save_state_mapper, sizeof(char), 1, save_file);
-	if (mapper != save_state_mapper)
+	if (nes->mapper != save_state_mapper)
 	{
-		printf("Error: Incompatible save state.");
+		core_log("Error: Incompatible save state.");
 		exit_emulator();
 	}
-	fread(prg_ram, sizeof(char), CART_RAM_SIZE, save_file);
-	fread(chr_ram, sizeof(char), CART_RAM_SIZE, save_file);
-	return mapper_load_state_table[mapper](save_file);
+	fread(nes->prg_ram, sizeof(char), CART_RAM_SIZE, save_file);
+	fread(nes->chr_ram, sizeof(char), CART_RAM_SIZE, save_file);
+	return mapper_load_state_table[nes->mapper](save_file);
 }
 
 // Default stub for unimplemented mappers. Best to close gracefully rather than...do whatever
 // the emulator will do instead.
 void unsupported_init()
 {
-	printf("Error: Unsupported mapper %02X.\n", mapper);
+	core_log("Error: Unsupported mapper %02X.", nes->mapper);
 	exit_emulator();
 }
 
-// Initializes the cartridge. The mapper is the internal hardware that handles how cartridge addresses work.
-// mirroring controls how PPU nametables are mirrored. 0 is horizontal and 1 is vertical.
-void cartridge_init(unsigned char rom_mapper, unsigned char prg_pages, unsigned char chr_pages, unsigned char mirroring, FILE* rom)
+// The mapper tables are the same for every NES, so they're only built once, before any context is set up.
+void cartridge_build_tables()
 {
-	prg_rom_pages = prg_pages;
-	prg_rom_size = prg_pages * PRG_ROM_PAGE;
-	prg_rom = malloc(sizeof(char) * prg_rom_size);
-	fread(prg_rom, 1, prg_rom_size, rom);
-	
-	chr_rom_pages = chr_pages;
-	chr_rom_size = chr_pages * CHR_ROM_PAGE;
-	chr_ram = malloc(sizeof(char) * CART_RAM_SIZE);
-	for (unsigned int i = 0; i < CART_RAM_SIZE; i++)
-	{
-		chr_ram[i] = 0;
-	}
-	if (chr_rom_size == 0)
-	{
-		use_chr_ram = 1;
-	}
-	else
-	{
-		chr_rom = malloc(sizeof(char) * chr_rom_size);
-		fread(chr_rom, 1, chr_rom_size, rom);
-		use_chr_ram = 0;
-	}
-	nametable_mirroring = mirroring;
-	mapper = rom_mapper;
-	
 	init_table = calloc(256, sizeof(mapper_init*));
 	for (unsigned int i = 0; i < 256; i++)
 	{
 		init_table[i] = &unsupported_init;
 	}
 	mapper_prg_table = calloc(256, sizeof(get_ptr_handler*));
-	mapper_chr_table = calloc(256, sizeof(get_ptr_handler*));
-	mapper_nametable_table = calloc(256, sizeof(get_ptr_handler*));
+	mapper_a12_rise_table = calloc(256, sizeof(a12_rise_handler*));
+	mapper_tile_fetch_table = calloc(256, sizeof(tile_fetch_handler*));
+	mapper_remap_table = calloc(256, sizeof(mapper_init*));
 	mapper_save_state_table = calloc(256, sizeof(save_file_handler*));
 	mapper_load_state_table = calloc(256, sizeof(save_file_handler*));
 	
 	// NROM
 	init_table[0x00] = fixed_init;
 	mapper_prg_table[0x00] = fixed_get_pointer_at_prg_address;
-	mapper_chr_table[0x00] = fixed_get_pointer_at_chr_address;
-	mapper_nametable_table[0x00] = fixed_get_pointer_at_nametable_address;
 	mapper_save_state_table[0x00] = save_nothing;
 	mapper_load_state_table[0x00] = load_nothing;
 	
 	// MMC1
 	init_table[0x01] = mmc1_init;
 	mapper_prg_table[0x01] = mmc1_access_prg_memory;
-	mapper_chr_table[0x01] = mmc1_access_chr_memory;
-	mapper_nametable_table[0x01] = mmc1_access_nametable_memory;
+	mapper_remap_table[0x01] = mmc1_update_banks;
 	mapper_save_state_table[0x01] = mmc1_save_state;
 	mapper_load_state_table[0x01] = mmc1_load_state;
 
 	// UNROM
 	init_table[0x02] = fixed_init;
 	mapper_prg_table[0x02] = unrom02_get_pointer_at_prg_address;
-	mapper_chr_table[0x02] = fixed_get_pointer_at_chr_address;
-	mapper_nametable_table[0x02] = fixed_get_pointer_at_nametable_address;
 	mapper_save_state_table[0x02] = unrom02_save_state;
 	mapper_load_state_table[0x02] = unrom02_load_state;
 	
 	// CNROM
 	init_table[0x03] = fixed_init;
 	mapper_prg_table[0x03] = cnrom_03_access_prg_memory;
-	mapper_chr_table[0x03] = cnrom_03_access_chr_memory;
-	mapper_nametable_table[0x03] = fixed_get_pointer_at_nametable_address;
+	mapper_remap_table[0x03] = cnrom_03_update_banks;
 	mapper_save_state_table[0x03] = cnrom_03_save_state;
 	mapper_load_state_table[0x03] = cnrom_03_load_state;
 	
 	// MMC3
 	init_table[0x04] = mmc3_init;
 	mapper_prg_table[0x04] = mmc3_access_prg_memory;
-	mapper_chr_table[0x04] = mmc3_access_chr_memory;
-	mapper_nametable_table[0x04] = mmc3_access_nametable_memory;
+	mapper_a12_rise_table[0x04] = mmc3_watch_a12;
+	mapper_remap_table[0x04] = mmc3_update_banks;
 	mapper_save_state_table[0x04] = mmc3_save_state;
 	mapper_load_state_table[0x04] = mmc3_load_state;
 	
 	// AxROM
-	init_table[0x07] = fixed_init;
+	init_table[0x07] = axrom_07_init;
 	mapper_prg_table[0x07] = axrom_07_access_prg_memory;
-	mapper_chr_table[0x07] = fixed_get_pointer_at_chr_address;
-	mapper_nametable_table[0x07] = axrom_07_access_nametable;
+	mapper_remap_table[0x07] = axrom_07_update_banks;
 	mapper_save_state_table[0x07] = axrom_07_save_state;
 	mapper_load_state_table[0x07] = axrom_07_load_state;
 	
 	// MMC2
-	init_table[0x09] = fixed_init;
+	init_table[0x09] = mmc2_init;
 	mapper_prg_table[0x09] = mmc2_access_prg_memory;
-	mapper_chr_table[0x09] = mmc2_access_chr_memory;
-	mapper_nametable_table[0x09] = mmc2_access_nametable_memory;
+	mapper_tile_fetch_table[0x09] = mmc2_watch_tile_fetch;
+	mapper_remap_table[0x09] = mmc2_update_banks;
 	mapper_save_state_table[0x09] = mmc2_save_state;
 	mapper_load_state_table[0x09] = mmc2_load_state;
+}
+
+// Repoints the CHR and nametable windows from the mapper's registers, for when they were
+// replaced behind the mapper's back (restoring a snapshot). Mappers that never move them have nothing to do.
+void cartridge_remap()
+{
+	if (mapper_remap_table[nes->mapper] != NULL)
+	{
+		mapper_remap_table[nes->mapper]();
+	}
+}
+
+// Initializes the cartridge. The mapper is the internal hardware that handles how cartridge addresses work.
+// mirroring controls how PPU nametables are mirrored. 0 is horizontal and 1 is vertical.
+// The PPU must be initialized first, since the nametable windows point into its RAM.
+void cartridge_init(unsigned char rom_mapper, unsigned char prg_pages, unsigned char chr_pages, unsigned char mirroring, FILE* rom)
+{
+	// Whatever was loaded into this context before.
+	cartridge_free();
+	
+	nes->prg_rom_pages = prg_pages;
+	nes->prg_rom_size = prg_pages * PRG_ROM_PAGE;
+	nes->chr_rom_pages = chr_pages;
+	nes->chr_rom_size = chr_pages * CHR_ROM_PAGE;
+	
+	// PRG and CHR come one after the other in the file, so they're loaded (and shared) as one.
+	nes->rom = rom_image_load(rom, nes->prg_rom_size + nes->chr_rom_size);
+	nes->prg_rom = nes->rom->data;
+	memset(nes->chr_ram, 0, CART_RAM_SIZE);
+	if (nes->chr_rom_size == 0)
+	{
+		nes->chr_rom = NULL;
+		nes->use_chr_ram = 1;
+	}
+	else
+	{
+		nes->chr_rom = nes->rom->data + nes->prg_rom_size;
+		nes->use_chr_ram = 0;
+	}
+	nes->nametable_mirroring = mirroring;
+	nes->mapper = rom_mapper;
 	
-	init_table[mapper]();
-}
\ No newline at end of file
+	memset(nes->watched_tiles, 0, 0x200);
+	nes->a12_rise_hook = mapper_a12_rise_table[nes->mapper];
+	nes->tile_fetch_hook = mapper_tile_fetch_table[nes->mapper];
+	init_table[nes->mapper]();
+}
+
+// Lets go of the ROM, for when the context is done with it.
+void cartridge_free()
+{
+	rom_image_release(nes->rom);
+	nes->rom = NULL;
+	nes->prg_rom = NULL;
+	nes->chr_rom = NULL;
+}
@@ -6,24 +6,19 @@ extern const int CHR_ROM_PAGE;
 extern const unsigned char HORIZONTAL;
 extern const unsigned char VERTICAL;
 
-extern unsigned char* prg_rom;
-extern unsigned char* prg_ram;
-extern unsigned char* chr_rom;
-extern unsigned char* chr_ram;
-
-extern unsigned int prg_rom_pages;
-extern unsigned int chr_rom_pages;
-extern unsigned int prg_rom_size;
-extern unsigned int prg_ram_size;
-extern unsigned int chr_rom_size;
-extern unsigned char use_chr_ram;
-extern unsigned char nametable_mirroring;
-extern unsigned char mapper;
+typedef void (*a12_rise_handler) (unsigned int);
+typedef void (*tile_fetch_handler) (unsigned int);
 
+void cartridge_build_tables();
 void cartridge_init(unsigned char mapper, unsigned char prg_rom_pages, unsigned char chr_rom_pages, unsigned char mirroring, FILE* rom);
+void cartridge_remap();
+void cartridge_free();
 void get_pointer_at_prg_address(unsigned char* data, unsigned int address, unsigned char access_type);
 void get_pointer_at_chr_address(unsigned char* data, unsigned int address, unsigned char access_type);
 void get_pointer_at_nametable_address(unsigned char* data, unsigned int address, unsigned char access_type);
+void map_chr_window(unsigned int window, unsigned int bank);
+void map_nametables(unsigned char top_left, unsigned char top_right, unsigned char bottom_left, unsigned char bottom_right);
+void watch_tile(unsigned int tile_address);
 
 void cartridge_save_state(FILE* save_file);
 void cartridge_load_state(FILE* save_file);
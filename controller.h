@@ -3,9 +3,6 @@
 
 extern unsigned char controller_bus;
 
-extern unsigned char controller_1_data;
-extern unsigned char controller_2_data;
-
 void controller_init();
 void controller_tick();
 void write_controller_state(unsigned char* data, unsigned int address);
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "cartridge.h"
+#include "debug_dump.h"
+#include "nes_context.h"
+
+// Debug views of the PPU's memory, written out as images or as one binary blob for other tools to pick apart.
+// Everything is read straight through the CHR and nametable windows, so dumping doesn't poke the mapper
+// (no MMC3 IRQ clocks or MMC2 latch flips from a debug key).
+
+const unsigned int PATTERN_DUMP_WIDTH = 256;
+const unsigned int PATTERN_DUMP_HEIGHT = 128;
+const unsigned int NAMETABLE_DUMP_WIDTH = 512;
+const unsigned int NAMETABLE_DUMP_HEIGHT = 480;
+// 64 sprites in an 8x8 grid, with room for 8x16 sprites.
+const unsigned int OAM_DUMP_WIDTH = 64;
+const unsigned int OAM_DUMP_HEIGHT = 128;
+
+// The largest block deflate can store uncompressed.
+const unsigned int PNG_STORED_BLOCK_MAX = 0xFFFF;
+
+unsigned int* png_crc_table = NULL;
+
+unsigned char peek_chr(unsigned int address)
+{
+	return nes->chr_windows[(address >> 10) & 0b111][address & 0x3FF];
+}
+
+unsigned char peek_nametable(unsigned int address)
+{
+	return nes->nametable_windows[(address >> 10) & 0b11][address & 0x3FF];
+}
+
+void put_color(unsigned char* pixels, unsigned int width, unsigned int x, unsigned int y, unsigned char* colors, unsigned char color_index)
+{
+	unsigned char* pixel = &pixels[((y * width) + x) * 3];
+	unsigned char* color = &colors[(color_index & 0b111111) * 3];
+	pixel[0] = color[0];
+	pixel[1] = color[1];
+	pixel[2] = color[2];
+}
+
+// Returns the 2 bit colour of one pixel of a tile.
+unsigned char tile_pixel(unsigned int tile_address, unsigned int x, unsigned int y)
+{
+	unsigned char low = peek_chr(tile_address + y);
+	unsigned char high = peek_chr(tile_address + y + 8);
+	return (((high >> (7 - x)) & 1) << 1) | ((low >> (7 - x)) & 1);
+}
+
+void draw_tile(unsigned char* pixels, unsigned int width, unsigned int left, unsigned int top, unsigned int tile_address, unsigned char* colors, unsigned char* tile_palette)
+{
+	for (unsigned int y = 0; y < 8; y++)
+	{
+		for (unsigned int x = 0; x < 8; x++)
+		{
+			unsigned char color = tile_pixel(tile_address, x, y);
+			// Colour 0 is always the backdrop.
+			put_color(pixels, width, left + x, top + y, colors, (color == 0) ? nes->palette_ram[0] : tile_palette[color]);
+		}
+	}
+}
+
+unsigned int crc_png(unsigned int crc, unsigned char* data, unsigned int length)
+{
+	if (png_crc_table == NULL)
+	{
+		png_crc_table = malloc(sizeof(int) * 256);
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			unsigned int value = i;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				value = (value & 1) ? (0xEDB88320 ^ (value >> 1)) : (value >> 1);
+			}
+			png_crc_table[i] = value;
+		}
+	}
+
+	crc = crc ^ 0xFFFFFFFF;
+	for (unsigned int i = 0; i < length; i++)
+	{
+		crc = png_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+void put_big_endian(unsigned char* data, unsigned int value)
+{
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+void write_png_chunk(FILE* file, const char* type, unsigned char* data, unsigned int length)
+{
+	unsigned char header[8];
+	put_big_endian(header, length);
+	memcpy(&header[4], type, 4);
+	fwrite(header, sizeof(char), 8, file);
+	fwrite(data, sizeof(char), length, file);
+
+	unsigned char crc[4];
+	put_big_endian(crc, crc_png(crc_png(0, &header[4], 4), data, length));
+	fwrite(crc, sizeof(char), 4, file);
+}
+
+// Writes 24 bit RGB pixels as a PNG. The image data is stored without compression, which keeps the encoder
+// tiny and fast. The files are bigger than they need to be, but these are debug dumps.
+void write_png(FILE* file, unsigned char* pixels, unsigned int width, unsigned int height)
+{
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, sizeof(char), 8, file);
+
+	unsigned char header[13];
+	put_big_endian(&header[0], width);
+	put_big_endian(&header[4], height);
+	header[8] = 8;  // Bit depth
+	header[9] = 2;  // RGB
+	header[10] = 0; // Deflate
+	header[11] = 0; // Standard filters
+	header[12] = 0; // No interlacing
+	write_png_chunk(file, "IHDR", header, 13);
+
+	// Every row gets a filter byte in front of it, always 0 (none) here.
+	unsigned int row_length = (width * 3) + 1;
+	unsigned int raw_length = row_length * height;
+	unsigned int block_count = (raw_length + PNG_STORED_BLOCK_MAX - 1) / PNG_STORED_BLOCK_MAX;
+	unsigned int data_length = 2 + (block_count * 5) + raw_length + 4;
+	unsigned char* data = malloc(data_length);
+	unsigned char* raw = malloc(raw_length);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		raw[y * row_length] = 0;
+		memcpy(&raw[(y * row_length) + 1], &pixels[y * width * 3], width * 3);
+	}
+
+	// zlib header for deflate with a 32K window and no dictionary.
+	unsigned int position = 0;
+	data[position++] = 0x78;
+	data[position++] = 0x01;
+	unsigned int adler_low = 1;
+	unsigned int adler_high = 0;
+	for (unsigned int offset = 0; offset < raw_length; offset += PNG_STORED_BLOCK_MAX)
+	{
+		unsigned int length = raw_length - offset;
+		if (length > PNG_STORED_BLOCK_MAX)
+		{
+			length = PNG_STORED_BLOCK_MAX;
+		}
+		data[position++] = ((offset + length) == raw_length) ? 1 : 0;
+		data[position++] = length & 0xFF;
+		data[position++] = length >> 8;
+		data[position++] = ~length & 0xFF;
+		data[position++] = (~length >> 8) & 0xFF;
+		memcpy(&data[position], &raw[offset], length);
+		position += length;
+
+		for (unsigned int i = 0; i < length; i++)
+		{
+			adler_low = (adler_low + raw[offset + i]) % 65521;
+			adler_high = (adler_high + adler_low) % 65521;
+		}
+	}
+	put_big_endian(&data[position], (adler_high << 16) | adler_low);
+
+	write_png_chunk(file, "IDAT", data, data_length);
+	write_png_chunk(file, "IEND", NULL, 0);
+	free(raw);
+	free(data);
+}
+
+// Writes the image to name.png or name.rgb, depending on the format.
+void write_image(const char* name, unsigned char* pixels, unsigned int width, unsigned int height, unsigned char format)
+{
+	char file_name[256];
+	snprintf(file_name, sizeof(file_name), "%s.%s", name, (format == DUMP_PNG) ? "png" : "rgb");
+	FILE* file = fopen(file_name, "wb");
+	if (file == NULL)
+	{
+		printf("Could not open %s for writing.\n", file_name);
+		return;
+	}
+
+	if (format == DUMP_PNG)
+	{
+		write_png(file, pixels, width, height);
+	}
+	else
+	{
+		fwrite(pixels, sizeof(char), width * height * 3, file);
+	}
+	fclose(file);
+	printf("Wrote %s (%ux%u)\n", file_name, width, height);
+}
+
+// Both pattern tables side by side, coloured with the first background palette.
+void dump_pattern_tables(const char* name, unsigned char* colors, unsigned char format)
+{
+	unsigned char* pixels = malloc(PATTERN_DUMP_WIDTH * PATTERN_DUMP_HEIGHT * 3);
+	for (unsigned int tile = 0; tile < 0x200; tile++)
+	{
+		unsigned int table = tile >> 8;
+		unsigned int left = (table * 128) + ((tile & 0xF) * 8);
+		unsigned int top = ((tile >> 4) & 0xF) * 8;
+		draw_tile(pixels, PATTERN_DUMP_WIDTH, left, top, tile * 16, colors, nes->palette_ram);
+	}
+	write_image(name, pixels, PATTERN_DUMP_WIDTH, PATTERN_DUMP_HEIGHT, format);
+	free(pixels);
+}
+
+// All four nametables as they're currently mirrored, with the scroll position outlined.
+void dump_nametables(const char* name, unsigned char* colors, unsigned char format)
+{
+	unsigned char* pixels = malloc(NAMETABLE_DUMP_WIDTH * NAMETABLE_DUMP_HEIGHT * 3);
+	unsigned int pattern_table = (nes->ppu_control & 0b10000) << 8;
+	for (unsigned int table = 0; table < 4; table++)
+	{
+		unsigned int table_address = 0x2000 + (table * 0x400);
+		for (unsigned int row = 0; row < 30; row++)
+		{
+			for (unsigned int column = 0; column < 32; column++)
+			{
+				unsigned char tile = peek_nametable(table_address + (row * 32) + column);
+				unsigned char attribute = peek_nametable(table_address + 0x3C0 + ((row / 4) * 8) + (column / 4));
+				unsigned char palette_select = (attribute >> ((((row >> 1) & 1) * 4) + (((column >> 1) & 1) * 2))) & 0b11;
+				unsigned int left = ((table & 1) * 256) + (column * 8);
+				unsigned int top = ((table >> 1) * 240) + (row * 8);
+				draw_tile(pixels, NAMETABLE_DUMP_WIDTH, left, top, pattern_table | (tile * 16), colors, &nes->palette_ram[palette_select * 4]);
+			}
+		}
+	}
+
+	// The top left of the screen comes from the temporary VRAM address and fine X, which is where
+	// the next frame starts (and the current one, unless the game changes it mid-frame).
+	unsigned int scroll_x = ((nes->vram_temp >> 10) & 1) * 256 + ((nes->vram_temp & 0b11111) * 8) + nes->fine_x_scroll;
+	unsigned int scroll_y = ((nes->vram_temp >> 11) & 1) * 240 + (((nes->vram_temp >> 5) & 0b11111) * 8) + ((nes->vram_temp >> 12) & 0b111);
+	for (unsigned int i = 0; i < 256; i++)
+	{
+		unsigned int x = (scroll_x + i) % NAMETABLE_DUMP_WIDTH;
+		unsigned int top = scroll_y % NAMETABLE_DUMP_HEIGHT;
+		unsigned int bottom = (scroll_y + 239) % NAMETABLE_DUMP_HEIGHT;
+		memset(&pixels[((top * NAMETABLE_DUMP_WIDTH) + x) * 3], 0xFF, 3);
+		memset(&pixels[((bottom * NAMETABLE_DUMP_WIDTH) + x) * 3], 0xFF, 3);
+	}
+	for (unsigned int i = 0; i < 240; i++)
+	{
+		unsigned int y = (scroll_y + i) % NAMETABLE_DUMP_HEIGHT;
+		unsigned int left = scroll_x % NAMETABLE_DUMP_WIDTH;
+		unsigned int right = (scroll_x + 255) % NAMETABLE_DUMP_WIDTH;
+		memset(&pixels[((y * NAMETABLE_DUMP_WIDTH) + left) * 3], 0xFF, 3);
+		memset(&pixels[((y * NAMETABLE_DUMP_WIDTH) + right) * 3], 0xFF, 3);
+	}
+
+	write_image(name, pixels, NAMETABLE_DUMP_WIDTH, NAMETABLE_DUMP_HEIGHT, format);
+	free(pixels);
+}
+
+// The 64 sprites in OAM order, 8 to a row, each in a 8x16 cell with its own palette and flips.
+void dump_oam(const char* name, unsigned char* colors, unsigned char format)
+{
+	unsigned char* pixels = malloc(OAM_DUMP_WIDTH * OAM_DUMP_HEIGHT * 3);
+	unsigned char tall_sprites = (nes->ppu_control & 0b100000) != 0;
+	for (unsigned int sprite = 0; sprite < 64; sprite++)
+	{
+		unsigned char tile_number = nes->oam[(sprite * 4) + 1];
+		unsigned char attributes = nes->oam[(sprite * 4) + 2];
+		unsigned char* sprite_palette = &nes->palette_ram[0x10 + ((attributes & 0b11) * 4)];
+		unsigned int left = (sprite % 8) * 8;
+		unsigned int top = (sprite / 8) * 16;
+
+		unsigned int tile_address;
+		if (tall_sprites)
+		{
+			tile_address = ((tile_number & 1) << 12) | ((tile_number & 0xFE) << 4);
+		}
+		else
+		{
+			tile_address = ((nes->ppu_control & 0b1000) << 9) | (tile_number << 4);
+		}
+		unsigned int height = tall_sprites ? 16 : 8;
+
+		for (unsigned int y = 0; y < 16; y++)
+		{
+			for (unsigned int x = 0; x < 8; x++)
+			{
+				unsigned char color = 0;
+				if (y < height)
+				{
+					unsigned int tile_x = (attributes & 0b01000000) ? (7 - x) : x;
+					unsigned int tile_y = (attributes & 0b10000000) ? (height - 1 - y) : y;
+					// The bottom half of an 8x16 sprite is the next tile along.
+					color = tile_pixel(tile_address + ((tile_y & 0b1000) << 1), tile_x, tile_y & 0b111);
+				}
+				put_color(pixels, OAM_DUMP_WIDTH, left + x, top + y, colors, (color == 0) ? nes->palette_ram[0] : sprite_palette[color]);
+			}
+		}
+	}
+	write_image(name, pixels, OAM_DUMP_WIDTH, OAM_DUMP_HEIGHT, format);
+	free(pixels);
+}
+
+// Raw memory for tooling: CPU RAM (2KB), the pattern tables as mapped (8KB), the four nametables
+// as mirrored (4KB), palette RAM (32 bytes) and OAM (256 bytes), one after the other.
+void dump_memory(const char* file_name)
+{
+	FILE* file = fopen(file_name, "wb");
+	if (file == NULL)
+	{
+		printf("Could not open %s for writing.\n", file_name);
+		return;
+	}
+
+	fwrite(nes->cpu_ram, sizeof(char), 0x800, file);
+	for (unsigned int window = 0; window < 8; window++)
+	{
+		fwrite(nes->chr_windows[window], sizeof(char), 0x400, file);
+	}
+	for (unsigned int window = 0; window < 4; window++)
+	{
+		fwrite(nes->nametable_windows[window], sizeof(char), 0x400, file);
+	}
+	fwrite(nes->palette_ram, sizeof(char), 0x20, file);
+	fwrite(nes->oam, sizeof(char), 0x100, file);
+	fclose(file);
+	printf("Wrote %s\n", file_name);
+}
@@ -0,0 +1,14 @@
+#ifndef DEBUG_DUMP_HEADER
+#define DEBUG_DUMP_HEADER
+
+enum dump_formats { DUMP_PNG, DUMP_RAW };
+
+// colors is the 64 entry master palette as RGB triples. Images go to name.png, or name.rgb for raw pixels.
+void dump_pattern_tables(const char* name, unsigned char* colors, unsigned char format);
+void dump_nametables(const char* name, unsigned char* colors, unsigned char format);
+void dump_oam(const char* name, unsigned char* colors, unsigned char format);
+void dump_memory(const char* file_name);
+
+void write_png(FILE* file, unsigned char* pixels, unsigned int width, unsigned int height);
+
+#endif
@@ -5,11 +5,17 @@
 #include <math.h>
 #include <limits.h>
 #include <SDL.h>
-#include "nes_cpu.h"
+#include "arachnes.h"
 #include "nes_apu.h"
 #include "nes_ppu.h"
-#include "controller.h"
-#include "cartridge.h"
+#include "ntsc_filter.h"
+#include "scaler.h"
+#include "ppu_renderer.h"
+#include "apu_synth.h"
+#include "debug_dump.h"
+#include "audio_ring.h"
+#include "audio_export.h"
+#include "nes_context.h"
 
 #define RENDER 1
 
@@ -23,43 +29,81 @@ SDL_Rect rect;
 SDL_Renderer *renderer;
 SDL_Window *window;
 SDL_Texture *texture = NULL;
-void *pixels;
-Uint8 *base;
-int pitch;
-unsigned const int frame_millisecs = 16;
-unsigned int x;
-unsigned int y;
-unsigned char* render_buffer;
-const unsigned int RENDER_BUFFER_MAX = 5000;
-unsigned int render_buffer_count;
-unsigned int current_frame;
-unsigned int next_frame;
-unsigned char unbound_framerate;
-unsigned char frame_finished;
+// Pixels of the frame on screen (palette index in bits 0-5, emphasis bits in 6-8), and the same frame converted to texture pixels.
+// Scanlines are only converted and uploaded when a pixel on them changed since the last frame.
+unsigned short* frame_buffer;
+Uint8* texture_buffer;
+unsigned char* scanline_dirty;
+// The NTSC filter replaces the palette conversion when it's on. It runs on its own thread
+// and gets a texture of its own, since its output is wider.
+unsigned char ntsc_enabled = 0;
+SDL_Texture *ntsc_texture = NULL;
+// Texture for the output of the software scaler, when one is picked.
+SDL_Texture *scaled_texture = NULL;
+// The NES draws 29780.5 CPU clocks worth of frame, which comes to about 60.0988 frames a second.
+// Frames are paced on the performance counter, and each one is due a frame after the last one was due
+// (not after it finished), so rounding in SDL_Delay doesn't pile up.
+const double FRAMES_PER_SECOND = 1789773.0 / 29780.5;
+Uint64 frame_ticks;
+Uint64 current_frame;
+Uint64 next_frame;
+unsigned char unbound_framerate = 0;
+
+// The emulator itself (see arachnes.c), and the options it gets made with. Frontends can set these before sdl_init.
+struct arachnes* emulator;
+unsigned int emulator_options = 0;
+// Frontends can turn these off before sdl_init for a run nobody's watching or listening to, so it works on a machine
+// with no display or no sound card. With no window nothing's drawn or read from the keyboard,
+// and with no audio device the samples only go wherever the exports send them.
+unsigned char use_window = 1;
+unsigned char use_audio_device = 1;
+// What the keyboard and pad are holding down, handed to the emulator once a frame.
+unsigned char player_one_buttons = 0;
 
 unsigned char dummy;
 unsigned char full_log = 0;
 
 SDL_AudioSpec want;
 SDL_AudioDeviceID device;
-unsigned const int audio_frequency = 48000;
-float target_samples_per_frame;
-float current_samples_per_frame;
-float samples_this_frame;
-
-// Trying out using a ring buffer that is written by the emulator
-// and read by the audio callback.
-unsigned char* audio_buffer;
-unsigned int audio_buffer_writer = 0;
-unsigned int audio_buffer_reader = 0;
-unsigned char audio_buffer_last_value = 128;
-const unsigned int audio_device_samples = 2048;
-const unsigned int audio_buffer_max = 2048 * 4;
+// Samples read out of the APU each frame, on their way to the ring buffer.
+short* audio_samples;
+
+// The emulator writes samples into the ring, and the audio callback reads them out on SDL's audio thread.
+struct audio_ring* audio_ring;
+// Samples the device asks for in each callback. Lower means less latency, but less slack if the emulator falls behind.
+// Frontends can change this and audio_float_output before calling sdl_init.
+unsigned int audio_device_samples = 512;
+unsigned char audio_float_output = 0;
+// The ring holds at least this many device periods, and at least twice the latency target.
+const unsigned int AUDIO_RING_PERIODS = 8;
+// Dynamic rate control. The audio device's clock and the frame pacing never quite agree, so at a fixed rate the ring
+// slowly fills up or runs dry. Instead, the APU's output rate gets nudged up or down (half a percent at most,
+// which nobody can hear) to keep the ring at audio_latency_ms worth of samples.
+unsigned int audio_latency_ms = 30;
+unsigned int audio_latency_samples;
+const double AUDIO_MAX_RATE_ADJUST = 0.005;
+// The fill level jumps around as frames go in and device periods come out, so it's smoothed out a bit first.
+double audio_fill_average;
+// When set, the rate control prints how it's doing every few seconds, for tuning the latency.
+unsigned char audio_stats = 0;
+const unsigned int AUDIO_STATS_FRAMES = 300;
+unsigned int audio_stats_frame_count = 0;
+double audio_stats_adjust_total = 0;
+unsigned int audio_stats_last_underruns = 0;
+unsigned int audio_stats_last_overflows = 0;
+// Only touched by the audio callback. When the ring runs dry, the last sample is held instead of dropping to 0.
+short* callback_samples;
+short callback_last_sample = 0;
 unsigned char audio_paused = 1;
-unsigned char silence = 128;
-// Value for how fast the audio can move between playing and silence.
-unsigned char limit_step = 1;
 unsigned char debug_log_sound;
+// When a frontend sets this before sdl_init, every sample also goes out to this file (see audio_export.c).
+// The rate control is left off then, so the file comes out the same however fast the emulator runs.
+char* audio_export_path = NULL;
+struct audio_export* audio_export = NULL;
+// Same for each channel on its own, as one file with a channel per APU channel (see apu_stems).
+char* stems_export_path = NULL;
+struct audio_export* stems_export = NULL;
+short* stem_buffer;
 
 struct Color
 {
@@ -68,9 +112,6 @@ struct Color
 	unsigned char blue;
 };
 
-const unsigned int KB = 1024;
-const unsigned int STACK_PAGE = 0x100;
-
 SDL_GameController* pad;
 struct Color* palette;
 const unsigned int PALETTE_SIZE = 64;
@@ -81,90 +122,169 @@ unsigned char pause_emulator = 0;
 // Mappers
 // Sound
 // Most of PPUMASK
-void exit_emulator()
+// Finishes off the export files. Safe to call more than once.
+void finish_audio_export()
 {
+	if (audio_export != NULL)
+	{
+		audio_export_close(audio_export);
+		audio_export = NULL;
+	}
+	if (stems_export != NULL)
+	{
+		audio_export_close(stems_export);
+		stems_export = NULL;
+	}
+}
+
+void quit_emulator()
+{
+	finish_audio_export();
     SDL_Quit();
 	
 	exit(0);
 }
 
+// Opens whichever exports the frontend asked for. Called right after the APU starts, so nothing's missed.
+void open_audio_exports()
+{
+	if (audio_export_path != NULL)
+	{
+		audio_export = audio_export_open(audio_export_path, apu_sample_rate, 1);
+		if (audio_export == NULL)
+		{
+			printf("Audio export file %s could not be opened.\n", audio_export_path);
+			quit_emulator();
+		}
+	}
+	if (stems_export_path != NULL)
+	{
+		apu_enable_stems();
+		stem_buffer = malloc(sizeof(short) * audio_device_samples * APU_STEM_COUNT);
+		stems_export = audio_export_open(stems_export_path, apu_sample_rate, APU_STEM_COUNT);
+		if (stems_export == NULL)
+		{
+			printf("Audio export file %s could not be opened.\n", stems_export_path);
+			quit_emulator();
+		}
+	}
+}
+
 void audio_callback(void* userdata, Uint8* stream, int len)
 {
-	for (int i = 0; i < len; i++)
+	unsigned int sample_size = audio_float_output ? sizeof(float) : sizeof(short);
+	unsigned int total = len / sample_size;
+	// SDL should only ever ask for one device period, but go a period at a time in case it doesn't.
+	for (unsigned int done = 0; done < total;)
 	{
-		if (audio_buffer_reader == audio_buffer_writer)
+		unsigned int count = total - done;
+		if (count > audio_device_samples)
+		{
+			count = audio_device_samples;
+		}
+		unsigned int read = audio_ring_read(audio_ring, callback_samples, count);
+		if (read > 0)
+		{
+			callback_last_sample = callback_samples[read - 1];
+		}
+		for (unsigned int i = read; i < count; i++)
+		{
+			callback_samples[i] = callback_last_sample;
+		}
+		
+		if (audio_float_output)
 		{
-			stream[i] = audio_buffer_last_value;
+			float* output = (float*)stream + done;
+			for (unsigned int i = 0; i < count; i++)
+			{
+				output[i] = callback_samples[i] / 32768.0f;
+			}
 		}
 		else
 		{
-			stream[i] = audio_buffer[audio_buffer_reader];
-			audio_buffer[audio_buffer_reader] = 128;
-			audio_buffer_reader = (audio_buffer_reader + 1) % audio_buffer_max;
+			memcpy((short*)stream + done, callback_samples, sizeof(short) * count);
 		}
+		done += count;
 	}
 }
 
-// Calculate how to squeeze the NES samples down into the sample frequency of the audio output.
-// Currently downsampling by averaging each group of samples.
-void push_audio()
+// Prints what the rate control has been up to since the last report.
+void report_audio_stats(double rate_adjust)
 {
-	// Nothing to do if there's no APU samples, and also we don't
-	// want to divide by zero.
-	if (apu_buffer_length == 0)
+	audio_stats_adjust_total += rate_adjust;
+	audio_stats_frame_count++;
+	if (audio_stats_frame_count < AUDIO_STATS_FRAMES)
 	{
 		return;
 	}
 	
-	float index;
-	// The plus 15 is a little bit magic? I don't want to touch it.
-	samples_this_frame += current_samples_per_frame + 15;
-	float sample_fraction = samples_this_frame / apu_buffer_length;
-	float apu_sample_processing = 0;
-	unsigned int apu_sample_count = 0;
-	for (index = 1; index <= samples_this_frame; index++)
-	{
-		unsigned char sample_size = 0;
-		float sample_total = 0;
-		while ((apu_sample_processing < index) && (apu_sample_count < apu_buffer_length))
+	unsigned int underruns = audio_ring_underruns(audio_ring);
+	unsigned int overflows = audio_ring->overflows;
+	printf("Audio: fill %u/%u samples, drift %+.0f ppm, %u underruns, %u samples dropped\n",
+		audio_ring_fill(audio_ring), audio_latency_samples, (audio_stats_adjust_total / audio_stats_frame_count) * 1000000,
+		underruns - audio_stats_last_underruns, overflows - audio_stats_last_overflows);
+	audio_stats_last_underruns = underruns;
+	audio_stats_last_overflows = overflows;
+	audio_stats_frame_count = 0;
+	audio_stats_adjust_total = 0;
+}
+
+// Moves the frame's samples from the emulator into the ring buffer for the audio callback,
+// then adjusts the APU's output rate for the next frame based on how full the ring is.
+void push_audio()
+{
+	// Nothing comes out, and there's no device to keep fed.
+	if (emulator_options & ARACHNES_VIDEO_ONLY)
+	{
+		return;
+	}
+	unsigned int count;
+	while ((count = arachnes_get_audio(emulator, audio_samples, audio_device_samples)) > 0)
+	{
+		// Anything that doesn't fit is dropped.
+		audio_ring_write(audio_ring, audio_samples, count);
+		if (audio_export != NULL)
 		{
-			sample_total += mixer_buffer[apu_sample_count];
-			sample_size++;
-			apu_sample_processing += sample_fraction;
-			apu_sample_count++;
+			audio_export_write(audio_export, audio_samples, count);
 		}
-		if (((audio_buffer_writer + 1) % audio_buffer_max) != audio_buffer_reader)
+		if (debug_log_sound)
 		{
-			unsigned char next_value = audio_buffer_last_value;
-			if (sample_size > 0)
+			for (unsigned int i = 0; i < count; i++)
 			{
-				next_value = (signed char)((roundf((sample_total / sample_size) * 1000) / 1000) * UCHAR_MAX);
-			}
-			
-			audio_buffer[audio_buffer_writer] = next_value;
-			audio_buffer_last_value = next_value;
-			audio_buffer_writer = (audio_buffer_writer + 1) % audio_buffer_max;
-			
-			if (debug_log_sound)
-			{
-				printf("Sample value %d\n", next_value);
+				printf("Sample value %d\n", audio_samples[i]);
 			}
 		}
 	}
 	
-	// Any leftover samples get moved to the start of the buffer to be processed in the next frame.
-	unsigned int next_apu_buffer_length = 0;
-	for (int i = 0; (apu_sample_count + i) < apu_buffer_length; i++)
+	// Produce more when the ring is running low, and less when it's filling up.
+	audio_fill_average += (audio_ring_fill(audio_ring) - audio_fill_average) / 16;
+	double rate_adjust = ((audio_latency_samples - audio_fill_average) / audio_latency_samples) * AUDIO_MAX_RATE_ADJUST;
+	if (rate_adjust > AUDIO_MAX_RATE_ADJUST)
 	{
-		mixer_buffer[i] = mixer_buffer[apu_sample_count + i];
-		next_apu_buffer_length++;
+		rate_adjust = AUDIO_MAX_RATE_ADJUST;
+	}
+	else if (rate_adjust < -AUDIO_MAX_RATE_ADJUST)
+	{
+		rate_adjust = -AUDIO_MAX_RATE_ADJUST;
+	}
+	if (stems_export != NULL)
+	{
+		while ((count = apu_read_stems(stem_buffer, audio_device_samples)) > 0)
+		{
+			audio_export_write(stems_export, stem_buffer, count);
+		}
 	}
-	apu_buffer_length = next_apu_buffer_length;
-	
-	index--;
-	samples_this_frame -= index;
 	
-	//SDL_QueueAudio(device, audio_buffer, audio_buffer_writer);
+	// Exports stay at the real rate.
+	if ((audio_export != NULL) || (stems_export != NULL))
+	{
+		rate_adjust = 0;
+	}
+	apu_set_output_rate(apu_sample_rate * (1 + rate_adjust));
+	if (audio_stats)
+	{
+		report_audio_stats(rate_adjust);
+	}
 	
 	if (audio_paused > 1)
 	{
@@ -177,39 +297,12 @@ void push_audio()
 	}
 }
 
-void process_ppu_tick()
-{
-	unsigned char pixel_data = ppu_tick();
-	if (render_buffer_count < RENDER_BUFFER_MAX)
-	{
-		render_buffer[render_buffer_count] = pixel_data;
-		render_buffer_count++;
-	}
-}
-
-void nes_loop()
-{
-	// PPU runs at triple the speed of the CPU.
-	// Call PPU tick three times for every CPU cycle.
-	// APU runs at half the CPU speed, but I'm doing half
-	// an APU cycle per tick here.
-	process_ppu_tick();
-	process_ppu_tick();
-	process_ppu_tick();
-	cpu_tick();
-	apu_tick();
-}
-
 void save_state()
 {
 	FILE* save_state = fopen("arachNES_save_state", "wb");
 	if (save_state != NULL)
 	{
-		cpu_save_state(save_state);
-		ppu_save_state(save_state);
-		apu_save_state(save_state);
-		controller_save_state(save_state);
-		cartridge_save_state(save_state);
+		arachnes_save_state(emulator, save_state);
 		fclose(save_state);
 	}
 }
@@ -219,63 +312,258 @@ void load_state()
 	FILE* save_state = fopen("arachNES_save_state", "rb");
 	if (save_state != NULL)
 	{
-		cpu_load_state(save_state);
-		ppu_load_state(save_state);
-		apu_load_state(save_state);
-		controller_load_state(save_state);
-		cartridge_load_state(save_state);
+		int failed = arachnes_load_state(emulator, save_state);
 		fclose(save_state);
-		audio_buffer_writer = 0;
-		audio_buffer_reader = 0;
-		audio_buffer_last_value = 128;
+		if (failed)
+		{
+			quit_emulator();
+		}
+		// The callback reads the ring, so it has to be held off while the ring is emptied.
+		if (!(emulator_options & ARACHNES_VIDEO_ONLY))
+		{
+			SDL_LockAudioDevice(device);
+			audio_ring_reset(audio_ring);
+			SDL_UnlockAudioDevice(device);
+			audio_fill_average = audio_latency_samples;
+		}
+	}
+}
 
+// Sends the frame off to the NTSC filter, and draws whatever the filter finished last.
+// The dirty scanlines are left alone, so they're still uploaded if the filter gets turned off.
+void present_ntsc_frame()
+{
+	ntsc_filter_submit(frame_buffer);
+	
+	unsigned char* output = ntsc_filter_take_output();
+	if (output != NULL)
+	{
+		SDL_UpdateTexture(ntsc_texture, NULL, output, 4 * NTSC_OUTPUT_WIDTH);
+		SDL_RenderCopy(renderer, ntsc_texture, NULL, NULL);
+		SDL_RenderPresent(renderer);
 	}
 }
 
-void render_pixel(unsigned char pixel)
+void toggle_ntsc_filter()
 {
-	if (pixel != 255)
+	if (ntsc_texture == NULL)
 	{
-		if ((x == 0) && (y == 0))
+		ntsc_filter_init();
+		ntsc_filter_start_worker();
+		ntsc_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, NTSC_OUTPUT_WIDTH, NTSC_INPUT_HEIGHT);
+	}
+	
+	ntsc_enabled = !ntsc_enabled;
+	printf("Setting NTSC filter to %d\n", ntsc_enabled);
+}
+
+// The biggest whole number scale that fits in the window.
+unsigned int nearest_scale_factor()
+{
+	unsigned int factor = window_width / TEXTURE_WIDTH;
+	if ((window_height / TEXTURE_HEIGHT) < factor)
+	{
+		factor = window_height / TEXTURE_HEIGHT;
+	}
+	return (factor > 0) ? factor : 1;
+}
+
+void select_scaler(unsigned char mode)
+{
+	if (mode != SCALER_OFF)
+	{
+		scaler_init();
+	}
+	
+	scaler_set_mode(mode, nearest_scale_factor());
+	if (scaled_texture != NULL)
+	{
+		SDL_DestroyTexture(scaled_texture);
+		scaled_texture = NULL;
+	}
+	if (mode != SCALER_OFF)
+	{
+		scaled_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, scaler_output_width, scaler_output_height);
+	}
+	
+	// The screen texture isn't kept up to date while scaling, so the whole frame needs to go through again.
+	memset(scanline_dirty, 1, TEXTURE_HEIGHT);
+	printf("Setting scaler to %d\n", mode);
+}
+
+// Sends the frame to the scaler if it changed, and draws whatever the scaler finished last.
+void present_scaled_frame(unsigned char frame_changed)
+{
+	if (frame_changed)
+	{
+		scaler_submit((Uint32*)texture_buffer);
+	}
+	
+	Uint32* output = scaler_take_output();
+	if (output != NULL)
+	{
+		SDL_UpdateTexture(scaled_texture, NULL, output, sizeof(Uint32) * scaler_output_width);
+		SDL_RenderCopy(renderer, scaled_texture, NULL, NULL);
+		SDL_RenderPresent(renderer);
+	}
+}
+
+// Converts and uploads each run of changed scanlines to the texture, then draws it.
+// A frame identical to the last one doesn't touch the texture at all.
+void present_frame()
+{
+	if (ntsc_enabled)
+	{
+		present_ntsc_frame();
+		return;
+	}
+	
+	unsigned char frame_changed = 0;
+	unsigned int line = 0;
+	while (line < TEXTURE_HEIGHT)
+	{
+		if (!scanline_dirty[line])
 		{
-			SDL_LockTexture(texture, NULL, &pixels, &pitch);
+			line++;
+			continue;
 		}
 		
-		base = ((Uint8 *)pixels) + (4 * (y * TEXTURE_WIDTH + x));
-		struct Color pixel_data = palette[pixel];
-		
-		base[0] = pixel_data.blue;
-		base[1] = pixel_data.green;
-		base[2] = pixel_data.red;
-		base[3] = 0;
-		
-		x++;
-		if (x >= TEXTURE_WIDTH)
+		unsigned int first_line = line;
+		while ((line < TEXTURE_HEIGHT) && scanline_dirty[line])
 		{
-			x = 0;
-			y++;
+			for (unsigned int i = line * TEXTURE_WIDTH; i < (line + 1) * TEXTURE_WIDTH; i++)
+			{
+				Uint8* base = texture_buffer + (4 * i);
+				// Emphasis only shows up through the NTSC filter.
+				struct Color pixel_data = palette[frame_buffer[i] & 0b111111];
+				
+				base[0] = pixel_data.blue;
+				base[1] = pixel_data.green;
+				base[2] = pixel_data.red;
+				base[3] = 0;
+			}
+			scanline_dirty[line] = 0;
+			line++;
 		}
+		frame_changed = 1;
 		
-		if (y >= TEXTURE_HEIGHT)
+		// The scaler works from the converted frame, so it doesn't need the screen texture.
+		if (scaler_mode == SCALER_OFF)
 		{
-			y = 0;
-			SDL_UnlockTexture(texture);
-			SDL_RenderCopy(renderer, texture, NULL, NULL);
-			SDL_RenderPresent(renderer);
-			
-			frame_finished = 1;
-			
-			current_frame = SDL_GetTicks();
-			if ((current_frame < next_frame) && (!unbound_framerate))
-			{
-				SDL_Delay(next_frame - current_frame);
-			}
-			current_frame = SDL_GetTicks();
-			next_frame = current_frame + frame_millisecs;
+			SDL_Rect lines = { .x = 0, .y = first_line, .w = TEXTURE_WIDTH, .h = line - first_line };
+			SDL_UpdateTexture(texture, &lines, texture_buffer + (4 * first_line * TEXTURE_WIDTH), 4 * TEXTURE_WIDTH);
+		}
+	}
+	
+	if (scaler_mode != SCALER_OFF)
+	{
+		present_scaled_frame(frame_changed);
+		return;
+	}
+	
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
+	SDL_RenderPresent(renderer);
+}
+
+// Picks up the frame the emulator just finished. Only the scanlines that changed since the last frame get marked for converting.
+void take_frame()
+{
+	const unsigned short* frame = arachnes_get_framebuffer(emulator);
+	for (unsigned int line = 0; line < TEXTURE_HEIGHT; line++)
+	{
+		unsigned short* current = &frame_buffer[line * TEXTURE_WIDTH];
+		const unsigned short* finished = &frame[line * TEXTURE_WIDTH];
+		if (memcmp(current, finished, TEXTURE_WIDTH * sizeof(short)) != 0)
+		{
+			memcpy(current, finished, TEXTURE_WIDTH * sizeof(short));
+			scanline_dirty[line] = 1;
+		}
+	}
+}
+
+void finish_frame()
+{
+	if (!(emulator_options & ARACHNES_AUDIO_ONLY))
+	{
+		take_frame();
+		present_frame();
+	}
+	
+	current_frame = SDL_GetPerformanceCounter();
+	if ((current_frame < next_frame) && (!unbound_framerate))
+	{
+		SDL_Delay(((next_frame - current_frame) * 1000) / SDL_GetPerformanceFrequency());
+	}
+	current_frame = SDL_GetPerformanceCounter();
+	// If it's fallen more than a few frames behind (or isn't being paced at all), don't try to catch up, just start over from now.
+	if (unbound_framerate || (current_frame > next_frame + (frame_ticks * 4)))
+	{
+		next_frame = current_frame;
+	}
+	next_frame += frame_ticks;
+}
+
+void toggle_threaded_rendering()
+{
+	if (nes->ppu_render_threaded)
+	{
+		ppu_renderer_stop();
+		printf("Threaded PPU rendering off.\n");
+	}
+	else
+	{
+		ppu_renderer_start();
+		printf("Threaded PPU rendering on.\n");
+	}
+}
+
+void toggle_threaded_audio()
+{
+	if (nes->apu_synth_threaded)
+	{
+		apu_synth_stop();
+		printf("Threaded audio off.\n");
+	}
+	else
+	{
+		apu_synth_start();
+		if (nes->apu_synth_threaded)
+		{
+			printf("Threaded audio on.\n");
+		}
+	}
+}
+
+// Runs the emulator for a frame, then shows it once it's due.
+void nes_loop()
+{
+	if (arachnes_run_frame(emulator) != 0)
+	{
+		quit_emulator();
+	}
+	finish_frame();
+}
+
+void handle_window_event()
+{
+	if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+	{
+		window_width = event.window.data1;
+		window_height = event.window.data2;
+		// Nearest neighbour scales to fit the window, so it needs redoing.
+		if (scaler_mode == SCALER_NEAREST)
+		{
+			select_scaler(SCALER_NEAREST);
 		}
 	}
 }
 
+// Debug images are PNGs, or raw 24 bit RGB with Ctrl held.
+unsigned char debug_image_format()
+{
+	return (SDL_GetModState() & KMOD_CTRL) ? DUMP_RAW : DUMP_PNG;
+}
+
 void handle_user_input()
 {
 	unsigned char queued_event = 1;
@@ -290,7 +578,12 @@ void handle_user_input()
 				case SDL_QUIT:
 				{
 					printf("Quitting.\n");
-					exit_emulator();
+					quit_emulator();
+					break;
+				}
+				case SDL_WINDOWEVENT:
+				{
+					handle_window_event();
 					break;
 				}
 				case SDL_CONTROLLERBUTTONDOWN:
@@ -300,43 +593,43 @@ void handle_user_input()
 						case SDL_CONTROLLER_BUTTON_A:
 						case SDL_CONTROLLER_BUTTON_Y:
 						{
-							controller_1_data = controller_1_data | 0b00000001;
+							player_one_buttons = player_one_buttons | 0b00000001;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_B:
 						case SDL_CONTROLLER_BUTTON_X:
 						{
-							controller_1_data = controller_1_data | 0b00000010;
+							player_one_buttons = player_one_buttons | 0b00000010;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_BACK:
 						{
-							controller_1_data = controller_1_data | 0b00000100;
+							player_one_buttons = player_one_buttons | 0b00000100;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_START:
 						{
-							controller_1_data = controller_1_data | 0b00001000;
+							player_one_buttons = player_one_buttons | 0b00001000;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_UP:
 						{
-							controller_1_data = controller_1_data | 0b00010000;
+							player_one_buttons = player_one_buttons | 0b00010000;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
 						{
-							controller_1_data = controller_1_data | 0b00100000;
+							player_one_buttons = player_one_buttons | 0b00100000;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
 						{
-							controller_1_data = controller_1_data | 0b01000000;
+							player_one_buttons = player_one_buttons | 0b01000000;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
 						{
-							controller_1_data = controller_1_data | 0b10000000;
+							player_one_buttons = player_one_buttons | 0b10000000;
 							break;
 						}
 					}
@@ -349,43 +642,43 @@ void handle_user_input()
 						case SDL_CONTROLLER_BUTTON_A:
 						case SDL_CONTROLLER_BUTTON_Y:
 						{
-							controller_1_data = controller_1_data & 0b11111110;
+							player_one_buttons = player_one_buttons & 0b11111110;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_B:
 						case SDL_CONTROLLER_BUTTON_X:
 						{
-							controller_1_data = controller_1_data & 0b11111101;
+							player_one_buttons = player_one_buttons & 0b11111101;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_BACK:
 						{
-							controller_1_data = controller_1_data & 0b11111011;
+							player_one_buttons = player_one_buttons & 0b11111011;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_START:
 						{
-							controller_1_data = controller_1_data & 0b11110111;
+							player_one_buttons = player_one_buttons & 0b11110111;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_UP:
 						{
-							controller_1_data = controller_1_data & 0b11101111;
+							player_one_buttons = player_one_buttons & 0b11101111;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
 						{
-							controller_1_data = controller_1_data & 0b11011111;
+							player_one_buttons = player_one_buttons & 0b11011111;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
 						{
-							controller_1_data = controller_1_data & 0b10111111;
+							player_one_buttons = player_one_buttons & 0b10111111;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
 						{
-							controller_1_data = controller_1_data & 0b01111111;
+							player_one_buttons = player_one_buttons & 0b01111111;
 							break;
 						}
 						case SDL_CONTROLLER_BUTTON_LEFTSHOULDER:
@@ -409,43 +702,43 @@ void handle_user_input()
 						{
 							case SDL_SCANCODE_Z:
 							{
-								controller_1_data = controller_1_data | 0b00000001;
+								player_one_buttons = player_one_buttons | 0b00000001;
 								break;
 							}
 							case SDL_SCANCODE_X:
 							{
-								controller_1_data = controller_1_data | 0b00000010;
+								player_one_buttons = player_one_buttons | 0b00000010;
 								break;
 							}
 							case SDL_SCANCODE_RSHIFT:
 							case SDL_SCANCODE_LSHIFT:
 							{
-								controller_1_data = controller_1_data | 0b00000100;
+								player_one_buttons = player_one_buttons | 0b00000100;
 								break;
 							}
 							case SDL_SCANCODE_RETURN:
 							{
-								controller_1_data = controller_1_data | 0b00001000;
+								player_one_buttons = player_one_buttons | 0b00001000;
 								break;
 							}
 							case SDL_SCANCODE_UP:
 							{
-								controller_1_data = controller_1_data | 0b00010000;
+								player_one_buttons = player_one_buttons | 0b00010000;
 								break;
 							}
 							case SDL_SCANCODE_DOWN:
 							{
-								controller_1_data = controller_1_data | 0b00100000;
+								player_one_buttons = player_one_buttons | 0b00100000;
 								break;
 							}
 							case SDL_SCANCODE_LEFT:
 							{
-								controller_1_data = controller_1_data | 0b01000000;
+								player_one_buttons = player_one_buttons | 0b01000000;
 								break;
 							}
 							case SDL_SCANCODE_RIGHT:
 							{
-								controller_1_data = controller_1_data | 0b10000000;
+								player_one_buttons = player_one_buttons | 0b10000000;
 								break;
 							}
 							// Savestate
@@ -462,35 +755,22 @@ void handle_user_input()
 							// debug hotkeys
 							case SDL_SCANCODE_R:
 							{
-								printf("ROM DUMP\n");
-								for (int i = 0; i < 0x1000; i++)
-								{
-									unsigned char data;
-									access_cpu_memory(&data, i, READ);
-									printf("%04X: %02X\n", i, data);
-								}
+								dump_memory("arachNES_memory.bin");
 								break;
 							}
 							case SDL_SCANCODE_N:
 							{
-								printf("NAMETABLE DUMP\n");
-								for (int i = 0x2000; i <= 0x2FFF; i++)
-								{
-									unsigned char data;
-									get_pointer_at_nametable_address(&data, i, READ);
-									printf("%04X: %02X\n", i, data);
-								}
+								dump_nametables("arachNES_nametables", (unsigned char*)palette, debug_image_format());
 								break;
 							}
 							case SDL_SCANCODE_P:
 							{
-								printf("PATTERN TABLE DUMP\n");
-								for (int i = 0; i <= 0x1FFF; i++)
-								{
-									unsigned char data;
-									get_pointer_at_chr_address(&data, i, READ);
-									printf("%04X: %02X\n", i, data);
-								}
+								dump_pattern_tables("arachNES_pattern_tables", (unsigned char*)palette, debug_image_format());
+								break;
+							}
+							case SDL_SCANCODE_O:
+							{
+								dump_oam("arachNES_oam", (unsigned char*)palette, debug_image_format());
 								break;
 							}
 							case SDL_SCANCODE_S:
@@ -498,6 +778,26 @@ void handle_user_input()
 								debug_log_sound = 1;
 								break;
 							}
+							case SDL_SCANCODE_F3:
+							{
+								toggle_ntsc_filter();
+								break;
+							}
+							case SDL_SCANCODE_F4:
+							{
+								select_scaler((scaler_mode + 1) % SCALER_MODE_COUNT);
+								break;
+							}
+							case SDL_SCANCODE_F5:
+							{
+								toggle_threaded_rendering();
+								break;
+							}
+							case SDL_SCANCODE_F6:
+							{
+								toggle_threaded_audio();
+								break;
+							}
 							case SDL_SCANCODE_PAUSE:
 							{
 								pause_emulator = !pause_emulator;
@@ -507,27 +807,27 @@ void handle_user_input()
 							// Silence controls for APU channels.
 							case SDL_SCANCODE_1:
 							{
-								pulse_1_silence = !pulse_1_silence;
+								nes->pulse_1_silence = !nes->pulse_1_silence;
 								break;
 							}
 							case SDL_SCANCODE_2:
 							{
-								pulse_2_silence = !pulse_2_silence;
+								nes->pulse_2_silence = !nes->pulse_2_silence;
 								break;
 							}
 							case SDL_SCANCODE_3:
 							{
-								triangle_silence = !triangle_silence;
+								nes->triangle_silence = !nes->triangle_silence;
 								break;
 							}
 							case SDL_SCANCODE_4:
 							{
-								noise_silence = !noise_silence;
+								nes->noise_silence = !nes->noise_silence;
 								break;
 							}
 							case SDL_SCANCODE_5:
 							{
-								sample_silence = !sample_silence;
+								nes->sample_silence = !nes->sample_silence;
 							}
 						}
 					}
@@ -541,43 +841,43 @@ void handle_user_input()
 						{
 							case SDL_SCANCODE_Z:
 							{
-								controller_1_data = controller_1_data & 0b11111110;
+								player_one_buttons = player_one_buttons & 0b11111110;
 								break;
 							}
 							case SDL_SCANCODE_X:
 							{
-								controller_1_data = controller_1_data & 0b11111101;
+								player_one_buttons = player_one_buttons & 0b11111101;
 								break;
 							}
 							case SDL_SCANCODE_RSHIFT:
 							case SDL_SCANCODE_LSHIFT:
 							{
-								controller_1_data = controller_1_data & 0b11111011;
+								player_one_buttons = player_one_buttons & 0b11111011;
 								break;
 							}
 							case SDL_SCANCODE_RETURN:
 							{
-								controller_1_data = controller_1_data & 0b11110111;
+								player_one_buttons = player_one_buttons & 0b11110111;
 								break;
 							}
 							case SDL_SCANCODE_UP:
 							{
-								controller_1_data = controller_1_data & 0b11101111;
+								player_one_buttons = player_one_buttons & 0b11101111;
 								break;
 							}
 							case SDL_SCANCODE_DOWN:
 							{
-								controller_1_data = controller_1_data & 0b11011111;
+								player_one_buttons = player_one_buttons & 0b11011111;
 								break;
 							}
 							case SDL_SCANCODE_LEFT:
 							{
-								controller_1_data = controller_1_data & 0b10111111;
+								player_one_buttons = player_one_buttons & 0b10111111;
 								break;
 							}
 							case SDL_SCANCODE_RIGHT:
 							{
-								controller_1_data = controller_1_data & 0b01111111;
+								player_one_buttons = player_one_buttons & 0b01111111;
 								break;
 							}
 							// debug hotkeys
@@ -597,14 +897,15 @@ void handle_user_input()
 			SDL_Delay(10);
 		}
 	}
+	arachnes_set_input(emulator, player_one_buttons, 0);
 }
 
 void handle_movie_input(unsigned char player_one_input, unsigned char command)
 {
-	controller_1_data = player_one_input;
+	arachnes_set_input(emulator, player_one_input, 0);
 	if (command & 0b1)
 	{
-		reset_cpu();
+		arachnes_reset(emulator);
 	}
 	
 	unsigned char queued_event = 1;
@@ -618,7 +919,12 @@ void handle_movie_input(unsigned char player_one_input, unsigned char command)
 				case SDL_QUIT:
 				{
 					printf("Quitting.\n");
-					exit_emulator();
+					quit_emulator();
+					break;
+				}
+				case SDL_WINDOWEVENT:
+				{
+					handle_window_event();
 					break;
 				}
 				case SDL_KEYDOWN:
@@ -669,62 +975,79 @@ void sdl_init()
 {
 	window_width = TEXTURE_WIDTH * 2;
     window_height = TEXTURE_HEIGHT * 2;
-	unbound_framerate = 0;
 	
-	SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER | SDL_INIT_JOYSTICK | SDL_INIT_AUDIO);
-	window = SDL_CreateWindow("arachNES Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_width, window_height, 0);
-	renderer = SDL_CreateRenderer(window, -1, 0);
-	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, TEXTURE_WIDTH, TEXTURE_HEIGHT);
-	render_buffer_count = 0;
+	// Only the parts of SDL that'll be used get started, since the others fail on a machine that doesn't have them.
+	// Video only makes no sound, so it has no use for an audio device either.
+	if (emulator_options & ARACHNES_VIDEO_ONLY)
+	{
+		use_audio_device = 0;
+	}
+	Uint32 subsystems = SDL_INIT_TIMER | SDL_INIT_EVENTS;
+	if (use_window)
+	{
+		subsystems |= SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER | SDL_INIT_JOYSTICK;
+	}
+	if (use_audio_device)
+	{
+		subsystems |= SDL_INIT_AUDIO;
+	}
+	SDL_Init(subsystems);
+	if (use_window)
+	{
+		window = SDL_CreateWindow("arachNES Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_width, window_height, (emulator_options & ARACHNES_AUDIO_ONLY) ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE);
+		renderer = SDL_CreateRenderer(window, -1, 0);
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, TEXTURE_WIDTH, TEXTURE_HEIGHT);
+	}
+	
+	frame_buffer = malloc(sizeof(short) * TEXTURE_WIDTH * TEXTURE_HEIGHT);
+	// No pixel is 0xFFFF, so the first frame is uploaded in full.
+	memset(frame_buffer, 0xFF, sizeof(short) * TEXTURE_WIDTH * TEXTURE_HEIGHT);
+	texture_buffer = malloc(sizeof(Uint8) * 4 * TEXTURE_WIDTH * TEXTURE_HEIGHT);
+	scanline_dirty = calloc(TEXTURE_HEIGHT, sizeof(char));
 	
 	SDL_memset(&want, 0, sizeof(want));
-	want.freq = audio_frequency;
-	want.format = AUDIO_U8;
+	want.freq = apu_sample_rate;
+	want.format = audio_float_output ? AUDIO_F32SYS : AUDIO_S16SYS;
 	want.channels = 1;
 	want.samples = audio_device_samples;
 	want.callback = audio_callback;
-	device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
-	target_samples_per_frame = (float)audio_frequency * (frame_millisecs / 1000.0f);
-	current_samples_per_frame = target_samples_per_frame;
-	samples_this_frame = 0;
-	audio_buffer = malloc(sizeof(int32_t) * audio_buffer_max);
+	audio_latency_samples = (apu_sample_rate * audio_latency_ms) / 1000;
+	audio_fill_average = audio_latency_samples;
+	unsigned int ring_size = audio_device_samples * AUDIO_RING_PERIODS;
+	if (ring_size < audio_latency_samples * 2)
+	{
+		ring_size = audio_latency_samples * 2;
+	}
+	audio_ring = audio_ring_create(ring_size);
+	audio_samples = malloc(sizeof(short) * audio_device_samples);
+	callback_samples = malloc(sizeof(short) * audio_device_samples);
+	// No changes allowed, so SDL converts to whatever the hardware wants and the callback always gets what it asked for.
+	// Without a device, it stays 0, which the pause and lock calls just ignore.
+	if (use_audio_device)
+	{
+		device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+	}
 	debug_log_sound = 0;
 	
-	x = 0;
-    y = 0;
-	
-	int num_joysticks = SDL_NumJoysticks();
-	if (num_joysticks > 0)
+	if (use_window)
 	{
-		pad = SDL_GameControllerOpen(0);
+		int num_joysticks = SDL_NumJoysticks();
+		if (num_joysticks > 0)
+		{
+			pad = SDL_GameControllerOpen(0);
+		}
 	}
 }
 
 void nes_init(char* rom_name)
 {
-	FILE* rom = fopen(rom_name, "rb");
-	if (rom == NULL)
+	emulator = arachnes_create(emulator_options);
+	if (arachnes_load_rom(emulator, rom_name) != 0)
 	{
-		printf("ROM file could not be opened.\n");
-		exit_emulator();
+		quit_emulator();
 	}
-	fseek(rom, SEEK_SET, 0);
-	unsigned char header[16];
-	fread(header, 1, 16, rom);
-	
-	unsigned char prg_pages = header[4];
-	unsigned char chr_pages = header[5];
-	unsigned char mapper = ((header[6] >> 4) & 0xF) | (header[7] & 0xF0);
-	unsigned char mirroring = header[6] & 0b1;
-	
-	cartridge_init(mapper, prg_pages, chr_pages, mirroring, rom);
-	apu_init();
-	ppu_init();
-	controller_init();
-	cpu_init();
-	
-	fclose(rom);
+	open_audio_exports();
 	
 	palette = malloc(sizeof(struct Color) * PALETTE_SIZE);
 	
@@ -733,9 +1056,7 @@ void nes_init(char* rom_name)
 	fread(palette, sizeof(struct Color), PALETTE_SIZE, paletteData);
 	fclose(paletteData);
 	
-	current_frame = SDL_GetTicks();
-	next_frame = current_frame + frame_millisecs;
-	
-	render_buffer = malloc(sizeof(char) * RENDER_BUFFER_MAX);
-	frame_finished = 0;
+	frame_ticks = SDL_GetPerformanceFrequency() / FRAMES_PER_SECOND;
+	current_frame = SDL_GetPerformanceCounter();
+	next_frame = current_frame + frame_ticks;
 }
@@ -1,22 +1,29 @@
 #ifndef EMU_HEADER
 #define EMU_HEADER
 
-extern unsigned char* render_buffer;
-extern unsigned int render_buffer_count;
-extern unsigned char frame_finished;
+extern unsigned int emulator_options;
+extern unsigned char use_window;
+extern unsigned char use_audio_device;
 extern unsigned char debug_log_sound;
+extern unsigned int audio_device_samples;
+extern unsigned char audio_float_output;
+extern unsigned int audio_latency_ms;
+extern unsigned char audio_stats;
+extern char* audio_export_path;
+extern char* stems_export_path;
+extern unsigned char unbound_framerate;
 
 // Dummy register for stubbing unimplemented registers and capturing 'ignored' writes.
 extern unsigned char dummy;
 extern unsigned char full_log;
 
-void exit_emulator();
+void quit_emulator();
+void finish_audio_export();
 void sdl_init();
 void nes_init(char* rom_name);
 void nes_loop();
 void handle_user_input();
 void handle_movie_input(unsigned char player_one_input, unsigned char command);
 void push_audio();
-void render_pixel(unsigned char pixel_data);
 
 #endif
\ No newline at end of file
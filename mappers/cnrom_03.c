@@ -3,13 +3,12 @@
 #include <stdlib.h>
 #include "nrom_00.h"
 #include "cnrom_03.h"
-#include "../emu_nes.h"
 #include "../cartridge.h"
 #include "../nes_cpu.h"
 #include "../nes_ppu.h"
+#include "../nes_context.h"
 
 const unsigned int CNROM_BANK_SIZE = 0x2000;
-unsigned char cnrom_bank_select = 0;
 
 void cnrom_03_access_prg_memory(unsigned char* data, unsigned int address, unsigned char access_type)
 {
@@ -19,26 +18,28 @@ void cnrom_03_access_prg_memory(unsigned char* data, unsigned int address, unsig
 	}
 	else // access_type == WRITE
 	{
-		cnrom_bank_select = *data % chr_rom_pages;
+		nes->cnrom_bank_select = *data % nes->chr_rom_pages;
+		cnrom_03_update_banks();
 	}
 }
 
-void cnrom_03_access_chr_memory(unsigned char* data, unsigned int address, unsigned char access_type)
+// Maps the selected 8 KB bank across all eight CHR windows.
+void cnrom_03_update_banks()
 {
-	if (access_type == READ)
+	unsigned char bank = nes->cnrom_bank_select % nes->chr_rom_pages;
+	for (unsigned int i = 0; i < 8; i++)
 	{
-		unsigned char bank = cnrom_bank_select % chr_rom_pages;
-		unsigned int chr_rom_address = address + (bank * CNROM_BANK_SIZE);
-		*data = chr_rom[chr_rom_address];
+		map_chr_window(i, (bank * (CNROM_BANK_SIZE / 0x400)) + i);
 	}
 }
 
 void cnrom_03_save_state(FILE* save_file)
 {
-	fwrite(&cnrom_bank_select, sizeof(char), 1, save_file);
+	fwrite(&nes->cnrom_bank_select, sizeof(char), 1, save_file);
 }
 
 void cnrom_03_load_state(FILE* save_file)
 {
-	fread(&cnrom_bank_select, sizeof(char), 1, save_file);
+	fread(&nes->cnrom_bank_select, sizeof(char), 1, save_file);
+	cnrom_03_update_banks();
 }
\ No newline at end of file
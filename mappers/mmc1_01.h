@@ -3,8 +3,7 @@
 
 void mmc1_init();
 void mmc1_access_prg_memory(unsigned char* data, unsigned int address, unsigned char access_type);
-void mmc1_access_chr_memory(unsigned char* data, unsigned int address, unsigned char access_type);
-void mmc1_access_nametable_memory(unsigned char* data, unsigned int address, unsigned char access_type);
+void mmc1_update_banks();
 void mmc1_save_state(FILE* save_file);
 void mmc1_load_state(FILE* save_file);
 
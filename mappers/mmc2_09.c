@@ -1,25 +1,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include "nrom_00.h"
 #include "mmc2_09.h"
-#include "../emu_nes.h"
 #include "../cartridge.h"
 #include "../nes_cpu.h"
 #include "../nes_ppu.h"
+#include "../nes_context.h"
 
-unsigned int MMC2_PRG_ROM_BANK = 0x2000;
-unsigned int MMC2_CHR_ROM_BANK = 0x1000;
-
-unsigned char mmc2_prg_bank_select = 0;
-unsigned char mmc2_chr_bank_left_FD_select = 0;
-unsigned char mmc2_chr_bank_left_FE_select = 0;
-// Flag for the left pattern table bank select. 0 for $FD, 1 for $FE.
-unsigned char mmc2_chr_bank_left_select = 0;
-unsigned char mmc2_chr_bank_right_FD_select = 0;
-unsigned char mmc2_chr_bank_right_FE_select = 0;
-// Flag for the right pattern table bank select. 0 for $FD, 1 for $FE.
-unsigned char mmc2_chr_bank_right_select = 0;
-unsigned char mmc2_mirroring_select = 0;
+const unsigned int MMC2_PRG_ROM_BANK = 0x2000;
+const unsigned int MMC2_CHR_ROM_BANK = 0x1000;
 
 void mmc2_access_prg_memory(unsigned char* data, unsigned int address, unsigned char access_type)
 {
@@ -28,7 +18,7 @@ void mmc2_access_prg_memory(unsigned char* data, unsigned int address, unsigned
 		 // PRG RAM
 		if ((address >= 0x6000) && (address <= 0x7FFF))
 		{
-			*data = prg_ram[address & 0x1FFF];
+			*data = nes->prg_ram[address & 0x1FFF];
 		}
 		// PRG ROM
 		else
@@ -42,29 +32,29 @@ void mmc2_access_prg_memory(unsigned char* data, unsigned int address, unsigned
 				case 0b00:
 				{
 					// Switchable bank
-					bank_select = mmc2_prg_bank_select;
+					bank_select = nes->mmc2_prg_bank_select;
 					break;
 				}
 				case 0b01:
 				{
 					// Fixed bank -3
-					bank_select = (prg_rom_pages * 2) - 3;
+					bank_select = (nes->prg_rom_pages * 2) - 3;
 					break;
 				}
 				case 0b10:
 				{
 					// Fixed bank -2
-					bank_select = (prg_rom_pages * 2) - 2;
+					bank_select = (nes->prg_rom_pages * 2) - 2;
 					break;
 				}
 				case 0b11:
 				{
 					// Fixed bank -1
-					bank_select = (prg_rom_pages * 2) - 1;
+					bank_select = (nes->prg_rom_pages * 2) - 1;
 					break; 
 				}
 			}
-			*data = prg_rom[bank_address | (bank_select << 13)];
+			*data = nes->prg_rom[bank_address | (bank_select << 13)];
 		}
 	}
 	else // access_type == WRITE
@@ -72,7 +62,7 @@ void mmc2_access_prg_memory(unsigned char* data, unsigned int address, unsigned
 		// PRG RAM
 		if ((address >= 0x6000) && (address <= 0x7FFF))
 		{
-			prg_ram[address & 0x1FFF] = *data;
+			nes->prg_ram[address & 0x1FFF] = *data;
 		}
 		// PRG ROM
 		{
@@ -82,143 +72,148 @@ void mmc2_access_prg_memory(unsigned char* data, unsigned int address, unsigned
 			{
 				case 0xA:
 				{
-					mmc2_prg_bank_select = *data % (prg_rom_pages * 2);
+					nes->mmc2_prg_bank_select = *data % (nes->prg_rom_pages * 2);
 					break;
 				}
 				case 0xB:
 				{
-					mmc2_chr_bank_left_FD_select = *data % (chr_rom_pages * 2);
+					nes->mmc2_chr_bank_left_FD_select = *data % (nes->chr_rom_pages * 2);
 					break;
 				}
 				case 0xC:
 				{
-					mmc2_chr_bank_left_FE_select = *data % (chr_rom_pages * 2);
+					nes->mmc2_chr_bank_left_FE_select = *data % (nes->chr_rom_pages * 2);
 					break;
 				}
 				case 0xD:
 				{
-					mmc2_chr_bank_right_FD_select = *data % (chr_rom_pages * 2);
+					nes->mmc2_chr_bank_right_FD_select = *data % (nes->chr_rom_pages * 2);
 					break;
 				}
 				case 0xE:
 				{
-					mmc2_chr_bank_right_FE_select = *data % (chr_rom_pages * 2);
+					nes->mmc2_chr_bank_right_FE_select = *data % (nes->chr_rom_pages * 2);
 					break;
 				}
 				case 0xF:
 				{
-					mmc2_mirroring_select = *data & 0b1;
+					nes->mmc2_mirroring_select = *data & 0b1;
 					break;
 				}
 			}
+			mmc2_update_banks();
 		}
 	}
 }
 
-void mmc2_access_chr_memory(unsigned char* data, unsigned int address, unsigned char access_type)
+// Repoints the PPU's CHR and nametable windows after a register or latch change.
+void mmc2_update_banks()
 {
-	if (access_type == READ)
+	unsigned char left_bank_select;
+	if (nes->mmc2_chr_bank_left_select == 0)
 	{
-		// Which of the two 4 KB PPU banks the address is in.
-		unsigned char ppu_bank = (address & 0x1000) >> 12;
-		// The address within the selected bank.
-		unsigned int bank_address = address & 0xFFF;
-		unsigned char bank_select = 0;
-		switch (ppu_bank)
-		{
-			case 0b0:
-			{
-				if (mmc2_chr_bank_left_select == 0)
-				{
-					bank_select = mmc2_chr_bank_left_FD_select;
-				}
-				else
-				{
-					bank_select = mmc2_chr_bank_left_FE_select;
-				}
-				
-				// Bankswitch on top row of special tiles $FD and $FE
-				if (bank_address == 0xFD8)
-				{
-					mmc2_chr_bank_left_select = 0;
-				}
-				else if (bank_address == 0xFE8)
-				{
-					mmc2_chr_bank_left_select = 1;
-				}
-				break;
-			}
-			case 0b1:
-			{
-				if (mmc2_chr_bank_right_select == 0)
-				{
-					bank_select = mmc2_chr_bank_right_FD_select;
-				}
-				else
-				{
-					bank_select = mmc2_chr_bank_right_FE_select;
-				}
-				
-				// Bankswitch on all rows of special tiles $FD and $FE
-				if ((bank_address & 0xFF8) == 0xFD8)
-				{
-					mmc2_chr_bank_right_select = 0;
-				}
-				else if ((bank_address & 0xFF8) == 0xFE8)
-				{
-					mmc2_chr_bank_right_select = 1;
-				}
-				break;
-			}
-		}
-		*data = chr_rom[bank_address | (bank_select << 12)];
+		left_bank_select = nes->mmc2_chr_bank_left_FD_select;
+	}
+	else
+	{
+		left_bank_select = nes->mmc2_chr_bank_left_FE_select;
+	}
+	unsigned char right_bank_select;
+	if (nes->mmc2_chr_bank_right_select == 0)
+	{
+		right_bank_select = nes->mmc2_chr_bank_right_FD_select;
+	}
+	else
+	{
+		right_bank_select = nes->mmc2_chr_bank_right_FE_select;
+	}
+	// Each 4 KB bank covers four 1 KB windows.
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		map_chr_window(i, (left_bank_select * 4) + i);
+		map_chr_window(i + 4, (right_bank_select * 4) + i);
+	}
+	
+	if (nes->mmc2_mirroring_select == 0b1) //horizontal
+	{
+		map_nametables(0, 0, 1, 1);
+	}
+	else //vertical
+	{
+		map_nametables(0, 1, 0, 1);
 	}
 }
 
-void mmc2_access_nametable_memory(unsigned char* data, unsigned int address, unsigned char access_type)
+// The latches switch banks after the PPU reads the special tiles $FD and $FE,
+// so the fetch that trips the latch still sees the old bank.
+// Only called for fetches from those tiles, which mmc2_init asks the PPU to watch.
+void mmc2_watch_tile_fetch(unsigned int address)
 {
-	unsigned int nametable_address;
-	if (mmc2_mirroring_select == 0b1) //horizontal
+	// The address within the selected bank.
+	unsigned int bank_address = address & 0xFFF;
+	unsigned char left_select = nes->mmc2_chr_bank_left_select;
+	unsigned char right_select = nes->mmc2_chr_bank_right_select;
+	// Which of the two 4 KB PPU banks the address is in.
+	if ((address & 0x1000) == 0)
 	{
-		nametable_address = address % 0x400;
-		if ((address & 0x800) == 0x800)
+		// Bankswitch on top row of special tiles $FD and $FE
+		if (bank_address == 0xFD8)
+		{
+			nes->mmc2_chr_bank_left_select = 0;
+		}
+		else if (bank_address == 0xFE8)
 		{
-			nametable_address += 0x400;
+			nes->mmc2_chr_bank_left_select = 1;
 		}
 	}
-	else //vertical
+	else
 	{
-		nametable_address = address % 0x800;
+		// Bankswitch on all rows of special tiles $FD and $FE
+		if ((bank_address & 0xFF8) == 0xFD8)
+		{
+			nes->mmc2_chr_bank_right_select = 0;
+		}
+		else if ((bank_address & 0xFF8) == 0xFE8)
+		{
+			nes->mmc2_chr_bank_right_select = 1;
+		}
 	}
 	
-	if (access_type == READ)
+	if ((left_select != nes->mmc2_chr_bank_left_select) || (right_select != nes->mmc2_chr_bank_right_select))
 	{
-		*data = ppu_ram[nametable_address];
-	}
-	else
-	{
-		ppu_ram[nametable_address] = *data;
+		mmc2_update_banks();
 	}
 }
 
 void mmc2_save_state(FILE* save_file)
 {
-	fwrite(&mmc2_prg_bank_select, sizeof(char), 1, save_file);
-	fwrite(&mmc2_chr_bank_left_FD_select, sizeof(char), 1, save_file);
-	fwrite(&mmc2_chr_bank_left_FE_select, sizeof(char), 1, save_file);
-	fwrite(&mmc2_chr_bank_left_select, sizeof(char), 1, save_file);
-	fwrite(&mmc2_chr_bank_right_FD_select, sizeof(char), 1, save_file);
-	fwrite(&mmc2_chr_bank_right_FE_select, sizeof(char), 1, save_file);
-	fwrite(&mmc2_chr_bank_right_select, sizeof(char), 1, save_file);
+	fwrite(&nes->mmc2_prg_bank_select, sizeof(char), 1, save_file);
+	fwrite(&nes->mmc2_chr_bank_left_FD_select, sizeof(char), 1, save_file);
+	fwrite(&nes->mmc2_chr_bank_left_FE_select, sizeof(char), 1, save_file);
+	fwrite(&nes->mmc2_chr_bank_left_select, sizeof(char), 1, save_file);
+	fwrite(&nes->mmc2_chr_bank_right_FD_select, sizeof(char), 1, save_file);
+	fwrite(&nes->mmc2_chr_bank_right_FE_select, sizeof(char), 1, save_file);
+	fwrite(&nes->mmc2_chr_bank_right_select, sizeof(char), 1, save_file);
 }
 
 void mmc2_load_state(FILE* save_file)
 {
-	fread(&mmc2_prg_bank_select, sizeof(char), 1, save_file);
-	fread(&mmc2_chr_bank_left_FD_select, sizeof(char), 1, save_file);
-	fread(&mmc2_chr_bank_left_FE_select, sizeof(char), 1, save_file);
-	fread(&mmc2_chr_bank_left_select, sizeof(char), 1, save_file);
-	fread(&mmc2_chr_bank_right_FD_select, sizeof(char), 1, save_file);
-	fread(&mmc2_chr_bank_right_FE_select, sizeof(char), 1, save_file);
-	fread(&mmc2_chr_bank_right_select, sizeof(char), 1, save_file);
+	fread(&nes->mmc2_prg_bank_select, sizeof(char), 1, save_file);
+	fread(&nes->mmc2_chr_bank_left_FD_select, sizeof(char), 1, save_file);
+	fread(&nes->mmc2_chr_bank_left_FE_select, sizeof(char), 1, save_file);
+	fread(&nes->mmc2_chr_bank_left_select, sizeof(char), 1, save_file);
+	fread(&nes->mmc2_chr_bank_right_FD_select, sizeof(char), 1, save_file);
+	fread(&nes->mmc2_chr_bank_right_FE_select, sizeof(char), 1, save_file);
+	fread(&nes->mmc2_chr_bank_right_select, sizeof(char), 1, save_file);
+	mmc2_update_banks();
+}
+
+void mmc2_init()
+{
+	fixed_init();
+	mmc2_update_banks();
+	watch_tile(0x0FD0);
+	watch_tile(0x0FE0);
+	watch_tile(0x1FD0);
+	watch_tile(0x1FE0);
 }
\ No newline at end of file
@@ -2,8 +2,9 @@
 #define MMC2_09_HEADER
 
 void mmc2_access_prg_memory(unsigned char* data, unsigned int address, unsigned char access_type);
-void mmc2_access_chr_memory(unsigned char* data, unsigned int address, unsigned char access_type);
-void mmc2_access_nametable_memory(unsigned char* data, unsigned int address, unsigned char access_type);
+void mmc2_update_banks();
+void mmc2_watch_tile_fetch(unsigned int address);
+void mmc2_init();
 void mmc2_save_state(FILE* save_file);
 void mmc2_load_state(FILE* save_file);
 
@@ -2,10 +2,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include "nrom_00.h"
-#include "../emu_nes.h"
 #include "../cartridge.h"
 #include "../nes_cpu.h"
 #include "../nes_ppu.h"
+#include "../nes_context.h"
 
 void fixed_get_pointer_at_prg_address(unsigned char* data, unsigned int address, unsigned char access_type)
 {
@@ -14,70 +14,39 @@ void fixed_get_pointer_at_prg_address(unsigned char* data, unsigned int address,
 		// 0x6000 through 0x7FFF are for the cartridge's PRG RAM.
 		if (address >= 0x6000 && address <= 0x7FFF)
 		{
-			*data = prg_ram[address - 0x6000];
+			*data = nes->prg_ram[address - 0x6000];
 		}
 		// 0x8000 through 0xBFFF addresses the first 16KB bytes of ROM.
 		// 0xC000 through 0xFFFF addresses the second 16KB bytes if the exist, otherwise it mirrors the first 16KB instead.
 		else if (address >= 0x8000 && address <= 0xFFFF)
 		{
-			unsigned int prg_rom_address = (address - 0x8000) % prg_rom_size;
-			*data = prg_rom[prg_rom_address];
+			unsigned int prg_rom_address = (address - 0x8000) % nes->prg_rom_size;
+			*data = nes->prg_rom[prg_rom_address];
 		}
 	}
 }
 
 // For mappers that do not use CHR bank-switching.
 // Multiple mappers could used this.
-void fixed_get_pointer_at_chr_address(unsigned char* data, unsigned int address, unsigned char access_type)
+void fixed_map_chr_windows()
 {
-	if (access_type == READ)
+	for (unsigned int i = 0; i < 8; i++)
 	{
-		// Typically the pattern tables would be stored here.
-		if (address <= 0x1FFF)
-		{
-			if (use_chr_ram)
-			{
-				*data = chr_ram[address];
-			}
-			else
-			{
-				*data = chr_rom[address];
-			}
-		}
-	}
-	else // access type == WRITE
-	{
-		if (use_chr_ram)
-		{
-			chr_ram[address] = *data;
-		}
+		map_chr_window(i, i);
 	}
 }
 
 // For mappers that use a fixed horizontal or vertical nametable configuration.
 // Multiple mappers could use this.
-void fixed_get_pointer_at_nametable_address(unsigned char* data, unsigned int address, unsigned char access_type)
+void fixed_map_nametables()
 {
-	unsigned int nametable_address;
-	if (nametable_mirroring == HORIZONTAL)
-	{
-		nametable_address = address % 0x400;
-		if ((address & 0x800) == 0x800)
-		{
-			nametable_address += 0x400;
-		}
-	}
-	else
+	if (nes->nametable_mirroring == HORIZONTAL)
 	{
-		nametable_address = address % 0x800;
-	}
-	if (access_type == READ)
-	{
-		*data = ppu_ram[nametable_address];
+		map_nametables(0, 0, 1, 1);
 	}
 	else
 	{
-		ppu_ram[nametable_address] = *data;
+		map_nametables(0, 1, 0, 1);
 	}
 }
 
@@ -96,10 +65,9 @@ void load_nothing(FILE* save_file __attribute__ ((unused)))
 // For mappers with the default init.
 void fixed_init()
 {
-	prg_ram = malloc(sizeof(char) * 0x2000);
-	for (unsigned int i = 0; i < 0x2000; i++)
-	{
-		prg_ram[i] = 0;
-	}
-	prg_ram_size = 0x2000;
+	memset(nes->prg_ram, 0, 0x2000);
+	nes->prg_ram_size = 0x2000;
+	
+	fixed_map_chr_windows();
+	fixed_map_nametables();
 }
\ No newline at end of file
@@ -2,92 +2,31 @@
 #include<string.h>
 #include<stdlib.h>
 #include<stdint.h>
-#include "emu_nes.h"
+#include<limits.h>
+#include<math.h>
 #include "nes_apu.h"
 #include "nes_cpu.h"
+#include "step_buffer.h"
+#include "audio_filter.h"
+#include "audio_ring.h"
+#include "apu_synth.h"
+#include "nes_context.h"
 
-unsigned int apu_half_clock_count;
-const unsigned int FOUR_STEP_FRAME_LENGTH = 29830;
-const unsigned int FIVE_STEP_FRAME_LENGTH = 37282;
 const unsigned char COARSE_MAX_VOLUME = 15;
 const unsigned char FINE_MAX_VOLUME = 127;
 
-unsigned char apu_status;
-unsigned char apu_frame_settings;
-
-// Bits 6-7 are the duty, bit 5 is the length counter halt, bit 4 is the envelope toggle, bits 0-3
-// are the volume/envelope divider period.
-unsigned char pulse_1_control;
-unsigned char pulse_1_sweep;
-// Controls the period of the pulse wave. Counts down every half clock.
-unsigned char pulse_1_timer_low;
-// The low 3 bits are the high bits of the period timer. The high 5 bits are for the length load value.
-unsigned char pulse_1_timer_high;
-unsigned int pulse_1_timer_count;
-unsigned char pulse_1_duty_index;
-unsigned char pulse_1_length_counter;
-unsigned char pulse_1_sweep_divider;
-unsigned char pulse_1_sweep_reload;
-unsigned int pulse_1_target_period;
-unsigned char pulse_1_envelope_start;
-unsigned char pulse_1_envelope_divider;
-unsigned char pulse_1_envelope_decay;
-
-// Bits 6-7 are the duty, bit 5 is the length counter halt, bit 4 is the envelope toggle, bits 0-3
-// are the volume/envelope divider period.
-unsigned char pulse_2_control;
-unsigned char pulse_2_sweep;
-// Controls the period of the pulse wave. Counts down every half clock.
-unsigned char pulse_2_timer_low;
-// The low 3 bits are the high bits of the period timer. The high 5 bits are for the length load value.
-unsigned char pulse_2_timer_high;
-unsigned int pulse_2_timer_count;
-unsigned char pulse_2_duty_index;
-unsigned char pulse_2_length_counter;
-unsigned char pulse_2_sweep_divider;
-unsigned char pulse_2_sweep_reload;
-unsigned int pulse_2_target_period;
-unsigned char pulse_2_envelope_start;
-unsigned char pulse_2_envelope_divider;
-unsigned char pulse_2_envelope_decay;
-
-// Contains the linear control flag in bit 7 and the linear load value in bits 6-0.
-// Bit 7 is also the length counter halt flag?
-unsigned char triangle_linear_control;
-// Controls the period of the triangle wave. Counts down every half clock.
-unsigned char triangle_timer_low;
-// The low 3 bits are the high bits of the period timer. The high 5 bits are for the length load value.
-unsigned char triangle_timer_high;
-unsigned int triangle_timer_count;
-unsigned char triangle_linear_reload;
-unsigned char triangle_linear_counter;
-unsigned char triangle_length_counter;
-
-// Bit 5 is the envelope loop/disable length counter flag, bit 4 is the constant volume flag, bits 0-3
-// are the volume/envelope divider period.
-unsigned char noise_control;
-// Bit 7 is the mode flag, bits 0-3 control the period.
-unsigned char noise_period_control;
-unsigned char noise_length_counter_load;
-unsigned int noise_timer_count;
-// The pseudo-random register used to produce the 'noise'.
-unsigned int noise_bit_stream;
-unsigned char noise_length_counter;
-unsigned char noise_envelope_start;
-unsigned char noise_envelope_divider;
-unsigned char noise_envelope_decay;
-
-// Bit 7 is the IRQ enable flag. Bit 6 is the loop flag. Bits 0-3 is the rate index.
-unsigned char dmc_control = 0;
-unsigned char dmc_sample_address = 0;
-unsigned char dmc_sample_length = 0;
-unsigned char dmc_sample_buffer = 0;
-unsigned char dmc_bits_remaining = 0;
-unsigned int dmc_current_address = 0;
-unsigned int dmc_bytes_remaining = 0;
-unsigned int dmc_rate_count = 0;
-unsigned char dmc_output_level = 0;
-unsigned char dmc_silence_flag = 0;
+// What the frame sequencer does on each of its steps, and which half clock each step lands on.
+// The last step is the end of the frame, and the count goes back to 0 after it.
+enum frame_actions { FRAME_QUARTER = 0b1, FRAME_HALF = 0b10, FRAME_IRQ = 0b100 };
+struct frame_event
+{
+	unsigned int clock;
+	unsigned char actions;
+};
+const struct frame_event FOUR_STEP_EVENTS[4] = { { 7457, FRAME_QUARTER }, { 14913, FRAME_QUARTER | FRAME_HALF },
+	{ 22371, FRAME_QUARTER }, { 29829, FRAME_QUARTER | FRAME_HALF | FRAME_IRQ } };
+const struct frame_event FIVE_STEP_EVENTS[4] = { { 7457, FRAME_QUARTER }, { 14913, FRAME_QUARTER | FRAME_HALF },
+	{ 22371, FRAME_QUARTER }, { 37281, FRAME_QUARTER | FRAME_HALF } };
 
 unsigned int* noise_period_table;
 
@@ -95,7 +34,6 @@ unsigned char* length_table;
 unsigned int* dmc_rate_table;
 
 unsigned char* sequencer;
-unsigned char sequencer_index;
 const unsigned char sequencer_size = 32;
 
 // There are four duty waveforms, each with one bit per sample. So why not stuff all four bits in one char for efficiency?
@@ -103,260 +41,410 @@ const unsigned char sequencer_size = 32;
 unsigned char* duty_sequence;
 const unsigned char duty_size = 8;
 
-float* mixer_buffer;
-unsigned int apu_buffer_length;
-unsigned const int APU_BUFFER_MAX = 0x10000;
+// apu_tick runs once per CPU cycle, so output level changes are timed in CPU clocks.
+const unsigned int APU_CLOCK_RATE = 1789773;
+unsigned int apu_sample_rate = 48000;
 
-// Flags to let the user control which channels are played.
-unsigned char pulse_1_silence;
-unsigned char pulse_2_silence;
-unsigned char triangle_silence;
-unsigned char noise_silence;
-unsigned char sample_silence;
+// The NES mixes the two pulses together, and the triangle, noise and DMC together, and neither mix is linear.
+// These are its output for every combined level, scaled so full volume is about a full 16 bit sample.
+// pulse_table is indexed by pulse 1 + pulse 2, tnd_table by 3 * triangle + 2 * noise + DMC.
+const double MIXER_SCALE = 32767;
+int* pulse_table;
+int* tnd_table;
 
-void apu_write(unsigned char* data, unsigned int address)
+// Goes in the mutes along with the silence flags, for turning off all output.
+const unsigned char MUTE_OUTPUT = 0b10000000;
+
+const struct frame_event* current_frame_events(unsigned char frame_settings)
 {
-	switch(address)
+	if ((frame_settings & 0b10000000) == 0b10000000)
 	{
-		case 0x4000:
+		return FIVE_STEP_EVENTS;
+	}
+	return FOUR_STEP_EVENTS;
+}
+
+// Clocks from half clock count until the next one the frame sequencer does something on. 0 means this clock.
+unsigned int clocks_to_sequencer(unsigned char frame_settings, unsigned int count)
+{
+	const struct frame_event* events = current_frame_events(frame_settings);
+	for (int i = 0; i < 4; i++)
+	{
+		if (count <= events[i].clock)
 		{
-			pulse_1_control = *data;
-			break;
+			return events[i].clock - count;
 		}
-		case 0x4001:
+	}
+	// Past the end of the frame, which happens when switching from five step to four step.
+	// The next clock starts the frame over.
+	return 0;
+}
+
+// Holds the CPU's IRQ line down for as long as the frame IRQ's up. The cartridge can hold it down too.
+void set_frame_irq(unsigned char raised)
+{
+	nes->apu_frame_irq = raised;
+	set_irq(IRQ_APU_FRAME, raised);
+}
+
+// Runs the CPU side's frame sequencer up to (but not including) time. Only the IRQ matters over here.
+void advance_frame_counter(unsigned int time)
+{
+	unsigned char frame_settings = nes->apu_registers[0x17];
+	const struct frame_event* events = current_frame_events(frame_settings);
+	while (nes->frame_counter_time != time)
+	{
+		unsigned int until_step = clocks_to_sequencer(frame_settings, nes->frame_counter_count);
+		if (until_step >= time - nes->frame_counter_time)
 		{
-			pulse_1_sweep_reload = 1;
-			pulse_1_sweep = *data;
+			nes->frame_counter_count += time - nes->frame_counter_time;
+			nes->frame_counter_time = time;
 			break;
 		}
-		case 0x4002:
+		nes->frame_counter_count += until_step;
+		nes->frame_counter_time += until_step;
+		for (int i = 0; i < 4; i++)
 		{
-			pulse_1_timer_low = *data;
-			break;
+			if ((events[i].clock == nes->frame_counter_count) && (events[i].actions & FRAME_IRQ) && ((frame_settings & 0b01000000) == 0))
+			{
+				set_frame_irq(1);
+			}
 		}
-		case 0x4003:
+		if (nes->frame_counter_count >= events[3].clock)
 		{
-			pulse_1_envelope_start = 1;
-			pulse_1_timer_high = *data;
-			pulse_1_length_counter = length_table[(pulse_1_timer_high & 0b11111000) >> 3];
-			break;
+			nes->frame_counter_count = 0;
 		}
-		case 0x4004:
+		else
 		{
-			pulse_2_control = *data;
-			break;
+			nes->frame_counter_count++;
 		}
-		case 0x4005:
+		nes->frame_counter_time++;
+	}
+}
+
+void fetch_dmc_byte(unsigned int time)
+{
+	unsigned char value;
+	// TODO: This is a bit quick and dirty. To be more cycle-accurate, should halt
+	// the CPU to allow it to do a read from memory. But it works for now.
+	access_cpu_memory(&value, nes->dmc_fetch_address, READ);
+	log_apu_event(time, APU_LOG_DMC_BYTE, value);
+}
+
+// The CPU side's half of clock_dmc, which fetches the same bytes at the same times, and hands them
+// to the synthesis side through the log.
+void clock_dmc_fetch(unsigned int time)
+{
+	if (nes->dmc_fetch_bits == 0)
+	{
+		if (nes->dmc_fetch_bytes > 0)
 		{
-			pulse_2_sweep_reload = 1;
-			pulse_2_sweep = *data;
-			break;
+			nes->dmc_fetch_silence = 0;
+			nes->dmc_fetch_address++;
+			if (nes->dmc_fetch_address > 0xFFFF)
+			{
+				nes->dmc_fetch_address = 0x8000;
+			}
+			fetch_dmc_byte(time);
+			nes->dmc_fetch_bytes--;
+			nes->dmc_fetch_bits = 8;
+			
+			if ((nes->dmc_fetch_bytes == 0) && ((nes->apu_registers[0x10] >> 6) & 0b1))
+			{
+				nes->dmc_fetch_silence = 0;
+				nes->dmc_fetch_address = 0xC000 | (nes->apu_registers[0x12] << 6);
+				nes->dmc_fetch_bytes = (nes->apu_registers[0x13] << 4) | 1;
+				fetch_dmc_byte(time);
+				nes->dmc_fetch_bytes--;
+				nes->dmc_fetch_bits = 8;
+			}
 		}
-		case 0x4006:
+		else
 		{
-			pulse_2_timer_low = *data;
-			break;
+			nes->dmc_fetch_silence = 1;
 		}
-		case 0x4007:
+	}
+	
+	if (!nes->dmc_fetch_silence)
+	{
+		nes->dmc_fetch_bits--;
+	}
+}
+
+// Runs the CPU side's DMC up to (but not including) time. dmc_fetch_time is the clock its timer next runs out on.
+void advance_dmc_fetch(unsigned int time)
+{
+	unsigned int period = dmc_rate_table[nes->apu_registers[0x10] & 0b1111] + 1;
+	// Compared as a difference so the clock wrapping around doesn't matter.
+	while ((int)(time - nes->dmc_fetch_time) > 0)
+	{
+		if ((nes->dmc_fetch_bits == 0) && (nes->dmc_fetch_bytes == 0) && nes->dmc_fetch_silence)
 		{
-			pulse_2_envelope_start = 1;
-			pulse_2_timer_high = *data;
-			pulse_2_length_counter = length_table[(pulse_2_timer_high & 0b11111000) >> 3];
+			// Stopped, so nothing is going to happen on any of the timer's clocks.
+			nes->dmc_fetch_time += ((time - nes->dmc_fetch_time + period - 1) / period) * period;
 			break;
 		}
-		case 0x4008:
+		clock_dmc_fetch(nes->dmc_fetch_time);
+		nes->dmc_fetch_time += period;
+	}
+}
+
+// Clocks from now until the DMC's next fetch, or UINT_MAX if it won't fetch until something's written.
+unsigned int clocks_to_dmc_fetch()
+{
+	if (nes->dmc_fetch_bytes == 0)
+	{
+		return UINT_MAX;
+	}
+	unsigned int until_timer = nes->dmc_fetch_time - nes->apu_clock;
+	if (nes->dmc_fetch_bits == 0)
+	{
+		return until_timer;
+	}
+	if (nes->dmc_fetch_silence)
+	{
+		return UINT_MAX;
+	}
+	return until_timer + (nes->dmc_fetch_bits * (dmc_rate_table[nes->apu_registers[0x10] & 0b1111] + 1));
+}
+
+// Only works out the next event when the CPU side is run up to apu_clock.
+void schedule_apu_event()
+{
+	unsigned int until_sequencer = clocks_to_sequencer(nes->apu_registers[0x17], nes->frame_counter_count);
+	unsigned int until_fetch = clocks_to_dmc_fetch();
+	nes->apu_event_clock = nes->apu_clock + ((until_fetch < until_sequencer) ? until_fetch : until_sequencer) + 1;
+}
+
+void run_apu_events()
+{
+	advance_frame_counter(nes->apu_clock);
+	advance_dmc_fetch(nes->apu_clock);
+	schedule_apu_event();
+}
+
+void apu_write(unsigned char* data, unsigned int address)
+{
+	run_apu_events();
+	switch(address)
+	{
+		case 0x4010:
 		{
-			triangle_linear_control = *data;
+			nes->apu_registers[0x10] = *data;
+			nes->dmc_fetch_time = nes->apu_clock + dmc_rate_table[*data & 0b1111];
 			break;
 		}
-		case 0x400A:
+		case 0x4015:
 		{
-			triangle_timer_low = *data;
+			nes->apu_registers[0x15] = *data;
+			if (((*data >> 4) & 0b1) == 0)
+			{
+				nes->dmc_fetch_bytes = 0;
+			}
+			else if (nes->dmc_fetch_bytes == 0)
+			{
+				nes->dmc_fetch_address = 0xC000 | (nes->apu_registers[0x12] << 6);
+				nes->dmc_fetch_bytes = (nes->apu_registers[0x13] << 4) | 1;
+				nes->dmc_fetch_bits = 0;
+			}
 			break;
 		}
-		case 0x400B:
+		case 0x4017:
 		{
-			triangle_linear_reload = 1;
-			triangle_timer_high = *data;
-			triangle_length_counter = length_table[(triangle_timer_high & 0b11111000) >> 3];
+			nes->apu_registers[0x17] = *data;
+			// Bit 6 inhibits the frame IRQ, and clears it if it's already up.
+			if ((*data & 0b01000000) == 0b01000000)
+			{
+				set_frame_irq(0);
+			}
 			break;
 		}
-		case 0x400C:
+		case 0x4014:
+		case 0x4016:
 		{
-			noise_control = *data;
-			break;
+			core_log("Unhandled APU register %04X", address);
+			exit_emulator();
+			return;
 		}
-		case 0x400E:
+		default:
 		{
-			noise_period_control = *data;
+			nes->apu_registers[address - 0x4000] = *data;
 			break;
 		}
-		case 0x400F:
+	}
+	log_apu_event(nes->apu_clock, address, *data);
+	// The mode or the DMC might have changed, which moves the next event.
+	schedule_apu_event();
+}
+
+void apu_read(unsigned char* data, unsigned int address)
+{
+	run_apu_events();
+	switch(address)
+	{
+		case 0x4015:
 		{
-			noise_envelope_start = 1;
-			noise_length_counter_load = *data;
-			noise_length_counter = length_table[(noise_length_counter_load & 0b11111000) >> 3];
+			// Bit 6 is the frame IRQ, and reading it acknowledges it.
+			*data = (nes->apu_registers[0x15] & 0b10111111) | (nes->apu_frame_irq << 6);
+			set_frame_irq(0);
 			break;
 		}
+		// Unused registers, and the DMC's, which have never read back anything here.
+		case 0x4009:
+		case 0x400D:
 		case 0x4010:
-		{
-			dmc_control = *data;
-			dmc_rate_count = dmc_rate_table[dmc_control & 0b1111];
-			break;
-		}
 		case 0x4011:
-		{
-			dmc_output_level = *data;
-			break;
-		}
 		case 0x4012:
-		{
-			dmc_sample_address = *data;
-			break;
-		}
 		case 0x4013:
 		{
-			dmc_sample_length = *data;
-			break;
-		}
-		case 0x4015:
-		{
-			apu_status = *data;
-			// Set the DMC bytes remaining to 0 on disabling DMC,
-			// thus halting it.
-			if (((apu_status >> 4) & 0b1) == 0)
-			{
-				dmc_bytes_remaining = 0;
-			}
-			// If DMC bytes remaining is 0, then 
-			else if (dmc_bytes_remaining == 0)
-			{
-				// Sample address = %11AAAAAA.AA000000
-				dmc_current_address = 0xC000 | (dmc_sample_address << 6);
-				// Sample length = %LLLL.LLLL0001
-				dmc_bytes_remaining = (dmc_sample_length << 4) | 1;
-				dmc_bits_remaining = 0;
-			}
-			break;
-		}
-		case 0x4017:
-		{
-			apu_frame_settings = *data;
 			break;
 		}
-		// Unused registers. Is any value stored here?
-		// Not sure. Seems simpler to do nothing.
-		case 0x4009:
-		case 0x400D:
+		case 0x4014:
+		case 0x4016:
 		{
+			core_log("Unhandled APU register %04X", address);
+			exit_emulator();
 			break;
 		}
 		default:
 		{
-			printf("Unhandled APU register %04X\n", address);
-			exit_emulator();
+			*data = nes->apu_registers[address - 0x4000];
+			break;
 		}
 	}
 }
 
-void apu_read(unsigned char* data, unsigned int address)
+// The synthesis side's half of a register write.
+void synth_apu_write(unsigned int address, unsigned char value)
 {
+	nes->apu_settled = 0;
 	switch(address)
 	{
 		case 0x4000:
 		{
-			*data = pulse_1_control;
+			nes->pulse_1_control = value;
 			break;
 		}
 		case 0x4001:
 		{
-			*data = pulse_1_sweep;
+			nes->pulse_1_sweep_reload = 1;
+			nes->pulse_1_sweep = value;
 			break;
 		}
 		case 0x4002:
 		{
-			*data = pulse_1_timer_low;
+			nes->pulse_1_timer_low = value;
 			break;
 		}
 		case 0x4003:
 		{
-			*data = pulse_1_timer_high;
+			nes->pulse_1_envelope_start = 1;
+			nes->pulse_1_timer_high = value;
+			nes->pulse_1_length_counter = length_table[(nes->pulse_1_timer_high & 0b11111000) >> 3];
 			break;
 		}
 		case 0x4004:
 		{
-			*data = pulse_2_control;
+			nes->pulse_2_control = value;
 			break;
 		}
 		case 0x4005:
 		{
-			*data = pulse_2_sweep;
+			nes->pulse_2_sweep_reload = 1;
+			nes->pulse_2_sweep = value;
 			break;
 		}
 		case 0x4006:
 		{
-			*data = pulse_2_timer_low;
+			nes->pulse_2_timer_low = value;
 			break;
 		}
 		case 0x4007:
 		{
-			*data = pulse_2_timer_high;
+			nes->pulse_2_envelope_start = 1;
+			nes->pulse_2_timer_high = value;
+			nes->pulse_2_length_counter = length_table[(nes->pulse_2_timer_high & 0b11111000) >> 3];
 			break;
 		}
 		case 0x4008:
 		{
-			*data = triangle_linear_control;
+			nes->triangle_linear_control = value;
 			break;
 		}
 		case 0x400A:
 		{
-			*data = triangle_timer_low;
+			nes->triangle_timer_low = value;
 			break;
 		}
 		case 0x400B:
 		{
-			*data = triangle_timer_high;
+			nes->triangle_linear_reload = 1;
+			nes->triangle_timer_high = value;
+			nes->triangle_length_counter = length_table[(nes->triangle_timer_high & 0b11111000) >> 3];
 			break;
 		}
 		case 0x400C:
 		{
-			*data = noise_control;
+			nes->noise_control = value;
 			break;
 		}
 		case 0x400E:
 		{
-			*data = noise_period_control;
+			nes->noise_period_control = value;
 			break;
 		}
 		case 0x400F:
 		{
-			*data = noise_length_counter_load;
+			nes->noise_envelope_start = 1;
+			nes->noise_length_counter_load = value;
+			nes->noise_length_counter = length_table[(nes->noise_length_counter_load & 0b11111000) >> 3];
 			break;
 		}
 		case 0x4010:
 		{
+			nes->dmc_control = value;
+			nes->dmc_rate_count = dmc_rate_table[nes->dmc_control & 0b1111];
 			break;
 		}
 		case 0x4011:
 		{
+			nes->dmc_output_level = value;
 			break;
 		}
 		case 0x4012:
 		{
+			nes->dmc_sample_address = value;
 			break;
 		}
 		case 0x4013:
 		{
+			nes->dmc_sample_length = value;
 			break;
 		}
 		case 0x4015:
 		{
-			*data = apu_status;
+			nes->apu_status = value;
+			// Set the DMC bytes remaining to 0 on disabling DMC,
+			// thus halting it.
+			if (((nes->apu_status >> 4) & 0b1) == 0)
+			{
+				nes->dmc_bytes_remaining = 0;
+			}
+			// If DMC bytes remaining is 0, then 
+			else if (nes->dmc_bytes_remaining == 0)
+			{
+				// Sample address = %11AAAAAA.AA000000
+				nes->dmc_current_address = 0xC000 | (nes->dmc_sample_address << 6);
+				// Sample length = %LLLL.LLLL0001
+				nes->dmc_bytes_remaining = (nes->dmc_sample_length << 4) | 1;
+				nes->dmc_bits_remaining = 0;
+			}
 			break;
 		}
 		case 0x4017:
 		{
-			*data = apu_frame_settings;
+			// The IRQ is the CPU side's business.
+			nes->apu_frame_settings = value;
 			break;
 		}
 		// Unused registers. Is any value stored here?
@@ -366,159 +454,311 @@ void apu_read(unsigned char* data, unsigned int address)
 		{
 			break;
 		}
-		default:
+	}
+}
+
+// Drops any audio that hasn't been read yet, and starts the output over from silence.
+// Only call it while the synthesis side is idle.
+void clear_audio_output()
+{
+	step_buffer_clear(nes->apu_output);
+	audio_filter_reset(&nes->apu_output_filter);
+	audio_ring_reset(nes->apu_samples);
+	nes->apu_frame_start = nes->apu_time;
+	if (nes->stem_outputs != NULL)
+	{
+		for (int i = 0; i < APU_STEM_COUNT; i++)
 		{
-			printf("Unhandled APU register %04X\n", address);
-			exit_emulator();
+			step_buffer_clear(nes->stem_outputs[i]);
+			audio_filter_reset(&nes->stem_filters[i]);
+			nes->stem_levels[i] = 0;
 		}
 	}
+	nes->pulse_output = 0;
+	nes->tnd_output = 0;
+}
+
+// The silence flags, packed up for the synthesis side.
+unsigned char current_mutes()
+{
+	return (nes->pulse_1_silence << STEM_PULSE_1) | (nes->pulse_2_silence << STEM_PULSE_2) | (nes->triangle_silence << STEM_TRIANGLE)
+		| (nes->noise_silence << STEM_NOISE) | (nes->sample_silence << STEM_DMC) | (nes->apu_video_only ? MUTE_OUTPUT : 0);
 }
 
+// Brings the synthesis side up to the CPU side, so the channels are complete (for saving a state or taking a snapshot).
+void apu_sync()
+{
+	apu_synth_sync(nes->apu_clock, current_mutes());
+}
+
+// For after the whole APU was copied in from a snapshot. Both sides were in step when it was taken,
+// so they still are, and only the output has to start over.
+void apu_snapshot_restored()
+{
+	clear_audio_output();
+	nes->apu_mix_pending = 1;
+}
+
+// The channels' bits are all saved from the synthesis side, and the CPU side is set up from them on loading.
 void apu_save_state(FILE* save_file)
 {
-	fwrite(&apu_half_clock_count, sizeof(int), 1, save_file);
-	fwrite(&apu_status, sizeof(char), 1, save_file);
-	fwrite(&apu_frame_settings, sizeof(char), 1, save_file);
-	
-	fwrite(&pulse_1_control, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_sweep, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_timer_low, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_timer_high, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_timer_count, sizeof(int), 1, save_file);
-	fwrite(&pulse_1_duty_index, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_length_counter, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_sweep_divider, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_sweep_reload, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_target_period, sizeof(int), 1, save_file);
-	fwrite(&pulse_1_envelope_start, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_envelope_divider, sizeof(char), 1, save_file);
-	fwrite(&pulse_1_envelope_decay, sizeof(char), 1, save_file);
-	
-	fwrite(&pulse_2_control, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_sweep, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_timer_low, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_timer_high, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_timer_count, sizeof(int), 1, save_file);
-	fwrite(&pulse_2_duty_index, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_length_counter, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_sweep_divider, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_sweep_reload, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_target_period, sizeof(int), 1, save_file);
-	fwrite(&pulse_2_envelope_start, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_envelope_divider, sizeof(char), 1, save_file);
-	fwrite(&pulse_2_envelope_decay, sizeof(char), 1, save_file);
-	
-	fwrite(&triangle_linear_control, sizeof(char), 1, save_file);
-	fwrite(&triangle_timer_low, sizeof(char), 1, save_file);
-	fwrite(&triangle_timer_high, sizeof(char), 1, save_file);
-	fwrite(&triangle_timer_count, sizeof(int), 1, save_file);
-	fwrite(&triangle_linear_reload, sizeof(char), 1, save_file);
-	fwrite(&triangle_linear_counter, sizeof(char), 1, save_file);
-	fwrite(&triangle_length_counter, sizeof(char), 1, save_file);
-	
-	fwrite(&noise_control, sizeof(char), 1, save_file);
-	fwrite(&noise_period_control, sizeof(char), 1, save_file);
-	fwrite(&noise_length_counter_load, sizeof(char), 1, save_file);
-	fwrite(&noise_timer_count, sizeof(int), 1, save_file);
-	fwrite(&noise_bit_stream, sizeof(int), 1, save_file);
-	fwrite(&noise_length_counter, sizeof(char), 1, save_file);
-	fwrite(&noise_envelope_start, sizeof(char), 1, save_file);
-	fwrite(&noise_envelope_divider, sizeof(char), 1, save_file);
-	fwrite(&noise_envelope_decay, sizeof(char), 1, save_file);
-	
-	fwrite(&dmc_control, sizeof(char), 1, save_file);
-	fwrite(&dmc_sample_address, sizeof(char), 1, save_file);
-	fwrite(&dmc_sample_length, sizeof(char), 1, save_file);
-	fwrite(&dmc_sample_buffer, sizeof(char), 1, save_file);
-	fwrite(&dmc_bits_remaining, sizeof(char), 1, save_file);
-	fwrite(&dmc_current_address, sizeof(int), 1, save_file);
-	fwrite(&dmc_bytes_remaining, sizeof(int), 1, save_file);
-	fwrite(&dmc_rate_count, sizeof(int), 1, save_file);
-	fwrite(&dmc_output_level, sizeof(char), 1, save_file);
-	fwrite(&dmc_silence_flag, sizeof(char), 1, save_file);
-	
-	fwrite(&sequencer_index, sizeof(char), 1, save_file);
+	apu_sync();
+	fwrite(&nes->apu_half_clock_count, sizeof(int), 1, save_file);
+	fwrite(&nes->apu_status, sizeof(char), 1, save_file);
+	fwrite(&nes->apu_frame_settings, sizeof(char), 1, save_file);
+	
+	fwrite(&nes->pulse_1_control, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_sweep, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_timer_low, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_timer_high, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_timer_count, sizeof(int), 1, save_file);
+	fwrite(&nes->pulse_1_duty_index, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_length_counter, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_sweep_divider, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_sweep_reload, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_target_period, sizeof(int), 1, save_file);
+	fwrite(&nes->pulse_1_envelope_start, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_envelope_divider, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_1_envelope_decay, sizeof(char), 1, save_file);
+	
+	fwrite(&nes->pulse_2_control, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_sweep, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_timer_low, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_timer_high, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_timer_count, sizeof(int), 1, save_file);
+	fwrite(&nes->pulse_2_duty_index, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_length_counter, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_sweep_divider, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_sweep_reload, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_target_period, sizeof(int), 1, save_file);
+	fwrite(&nes->pulse_2_envelope_start, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_envelope_divider, sizeof(char), 1, save_file);
+	fwrite(&nes->pulse_2_envelope_decay, sizeof(char), 1, save_file);
+	
+	fwrite(&nes->triangle_linear_control, sizeof(char), 1, save_file);
+	fwrite(&nes->triangle_timer_low, sizeof(char), 1, save_file);
+	fwrite(&nes->triangle_timer_high, sizeof(char), 1, save_file);
+	fwrite(&nes->triangle_timer_count, sizeof(int), 1, save_file);
+	fwrite(&nes->triangle_linear_reload, sizeof(char), 1, save_file);
+	fwrite(&nes->triangle_linear_counter, sizeof(char), 1, save_file);
+	fwrite(&nes->triangle_length_counter, sizeof(char), 1, save_file);
+	
+	fwrite(&nes->noise_control, sizeof(char), 1, save_file);
+	fwrite(&nes->noise_period_control, sizeof(char), 1, save_file);
+	fwrite(&nes->noise_length_counter_load, sizeof(char), 1, save_file);
+	fwrite(&nes->noise_timer_count, sizeof(int), 1, save_file);
+	fwrite(&nes->noise_bit_stream, sizeof(int), 1, save_file);
+	fwrite(&nes->noise_length_counter, sizeof(char), 1, save_file);
+	fwrite(&nes->noise_envelope_start, sizeof(char), 1, save_file);
+	fwrite(&nes->noise_envelope_divider, sizeof(char), 1, save_file);
+	fwrite(&nes->noise_envelope_decay, sizeof(char), 1, save_file);
+	
+	fwrite(&nes->dmc_control, sizeof(char), 1, save_file);
+	fwrite(&nes->dmc_sample_address, sizeof(char), 1, save_file);
+	fwrite(&nes->dmc_sample_length, sizeof(char), 1, save_file);
+	fwrite(&nes->dmc_sample_buffer, sizeof(char), 1, save_file);
+	fwrite(&nes->dmc_bits_remaining, sizeof(char), 1, save_file);
+	fwrite(&nes->dmc_current_address, sizeof(int), 1, save_file);
+	fwrite(&nes->dmc_bytes_remaining, sizeof(int), 1, save_file);
+	fwrite(&nes->dmc_rate_count, sizeof(int), 1, save_file);
+	fwrite(&nes->dmc_output_level, sizeof(char), 1, save_file);
+	fwrite(&nes->dmc_silence_flag, sizeof(char), 1, save_file);
+	
+	fwrite(&nes->sequencer_index, sizeof(char), 1, save_file);
+	fwrite(&nes->apu_frame_irq, sizeof(char), 1, save_file);
 }
 
 void apu_load_state(FILE* save_file)
 {
-	fread(&apu_half_clock_count, sizeof(int), 1, save_file);
-	fread(&apu_status, sizeof(char), 1, save_file);
-	fread(&apu_frame_settings, sizeof(char), 1, save_file);
-	
-	fread(&pulse_1_control, sizeof(char), 1, save_file);
-	fread(&pulse_1_sweep, sizeof(char), 1, save_file);
-	fread(&pulse_1_timer_low, sizeof(char), 1, save_file);
-	fread(&pulse_1_timer_high, sizeof(char), 1, save_file);
-	fread(&pulse_1_timer_count, sizeof(int), 1, save_file);
-	fread(&pulse_1_duty_index, sizeof(char), 1, save_file);
-	fread(&pulse_1_length_counter, sizeof(char), 1, save_file);
-	fread(&pulse_1_sweep_divider, sizeof(char), 1, save_file);
-	fread(&pulse_1_sweep_reload, sizeof(char), 1, save_file);
-	fread(&pulse_1_target_period, sizeof(int), 1, save_file);
-	fread(&pulse_1_envelope_start, sizeof(char), 1, save_file);
-	fread(&pulse_1_envelope_divider, sizeof(char), 1, save_file);
-	fread(&pulse_1_envelope_decay, sizeof(char), 1, save_file);
-	
-	fread(&pulse_2_control, sizeof(char), 1, save_file);
-	fread(&pulse_2_sweep, sizeof(char), 1, save_file);
-	fread(&pulse_2_timer_low, sizeof(char), 1, save_file);
-	fread(&pulse_2_timer_high, sizeof(char), 1, save_file);
-	fread(&pulse_2_timer_count, sizeof(int), 1, save_file);
-	fread(&pulse_2_duty_index, sizeof(char), 1, save_file);
-	fread(&pulse_2_length_counter, sizeof(char), 1, save_file);
-	fread(&pulse_2_sweep_divider, sizeof(char), 1, save_file);
-	fread(&pulse_2_sweep_reload, sizeof(char), 1, save_file);
-	fread(&pulse_2_target_period, sizeof(int), 1, save_file);
-	fread(&pulse_2_envelope_start, sizeof(char), 1, save_file);
-	fread(&pulse_2_envelope_divider, sizeof(char), 1, save_file);
-	fread(&pulse_2_envelope_decay, sizeof(char), 1, save_file);
-	
-	fread(&triangle_linear_control, sizeof(char), 1, save_file);
-	fread(&triangle_timer_low, sizeof(char), 1, save_file);
-	fread(&triangle_timer_high, sizeof(char), 1, save_file);
-	fread(&triangle_timer_count, sizeof(int), 1, save_file);
-	fread(&triangle_linear_reload, sizeof(char), 1, save_file);
-	fread(&triangle_linear_counter, sizeof(char), 1, save_file);
-	fread(&triangle_length_counter, sizeof(char), 1, save_file);
-	
-	fread(&noise_control, sizeof(char), 1, save_file);
-	fread(&noise_period_control, sizeof(char), 1, save_file);
-	fread(&noise_length_counter_load, sizeof(char), 1, save_file);
-	fread(&noise_timer_count, sizeof(int), 1, save_file);
-	fread(&noise_bit_stream, sizeof(int), 1, save_file);
-	fread(&noise_length_counter, sizeof(char), 1, save_file);
-	fread(&noise_envelope_start, sizeof(char), 1, save_file);
-	fread(&noise_envelope_divider, sizeof(char), 1, save_file);
-	fread(&noise_envelope_decay, sizeof(char), 1, save_file);
-	
-	fread(&dmc_control, sizeof(char), 1, save_file);
-	fread(&dmc_sample_address, sizeof(char), 1, save_file);
-	fread(&dmc_sample_length, sizeof(char), 1, save_file);
-	fread(&dmc_sample_buffer, sizeof(char), 1, save_file);
-	fread(&dmc_bits_remaining, sizeof(char), 1, save_file);
-	fread(&dmc_current_address, sizeof(int), 1, save_file);
-	fread(&dmc_bytes_remaining, sizeof(int), 1, save_file);
-	fread(&dmc_rate_count, sizeof(int), 1, save_file);
-	fread(&dmc_output_level, sizeof(char), 1, save_file);
-	fread(&dmc_silence_flag, sizeof(char), 1, save_file);
-	
-	fread(&sequencer_index, sizeof(char), 1, save_file);
-	
-	apu_buffer_length = 0;
+	// Anything still in the log belonged to the old state.
+	apu_synth_restart();
+	fread(&nes->apu_half_clock_count, sizeof(int), 1, save_file);
+	fread(&nes->apu_status, sizeof(char), 1, save_file);
+	fread(&nes->apu_frame_settings, sizeof(char), 1, save_file);
+	
+	fread(&nes->pulse_1_control, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_sweep, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_timer_low, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_timer_high, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_timer_count, sizeof(int), 1, save_file);
+	fread(&nes->pulse_1_duty_index, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_length_counter, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_sweep_divider, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_sweep_reload, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_target_period, sizeof(int), 1, save_file);
+	fread(&nes->pulse_1_envelope_start, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_envelope_divider, sizeof(char), 1, save_file);
+	fread(&nes->pulse_1_envelope_decay, sizeof(char), 1, save_file);
+	
+	fread(&nes->pulse_2_control, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_sweep, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_timer_low, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_timer_high, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_timer_count, sizeof(int), 1, save_file);
+	fread(&nes->pulse_2_duty_index, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_length_counter, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_sweep_divider, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_sweep_reload, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_target_period, sizeof(int), 1, save_file);
+	fread(&nes->pulse_2_envelope_start, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_envelope_divider, sizeof(char), 1, save_file);
+	fread(&nes->pulse_2_envelope_decay, sizeof(char), 1, save_file);
+	
+	fread(&nes->triangle_linear_control, sizeof(char), 1, save_file);
+	fread(&nes->triangle_timer_low, sizeof(char), 1, save_file);
+	fread(&nes->triangle_timer_high, sizeof(char), 1, save_file);
+	fread(&nes->triangle_timer_count, sizeof(int), 1, save_file);
+	fread(&nes->triangle_linear_reload, sizeof(char), 1, save_file);
+	fread(&nes->triangle_linear_counter, sizeof(char), 1, save_file);
+	fread(&nes->triangle_length_counter, sizeof(char), 1, save_file);
+	
+	fread(&nes->noise_control, sizeof(char), 1, save_file);
+	fread(&nes->noise_period_control, sizeof(char), 1, save_file);
+	fread(&nes->noise_length_counter_load, sizeof(char), 1, save_file);
+	fread(&nes->noise_timer_count, sizeof(int), 1, save_file);
+	fread(&nes->noise_bit_stream, sizeof(int), 1, save_file);
+	fread(&nes->noise_length_counter, sizeof(char), 1, save_file);
+	fread(&nes->noise_envelope_start, sizeof(char), 1, save_file);
+	fread(&nes->noise_envelope_divider, sizeof(char), 1, save_file);
+	fread(&nes->noise_envelope_decay, sizeof(char), 1, save_file);
+	
+	fread(&nes->dmc_control, sizeof(char), 1, save_file);
+	fread(&nes->dmc_sample_address, sizeof(char), 1, save_file);
+	fread(&nes->dmc_sample_length, sizeof(char), 1, save_file);
+	fread(&nes->dmc_sample_buffer, sizeof(char), 1, save_file);
+	fread(&nes->dmc_bits_remaining, sizeof(char), 1, save_file);
+	fread(&nes->dmc_current_address, sizeof(int), 1, save_file);
+	fread(&nes->dmc_bytes_remaining, sizeof(int), 1, save_file);
+	fread(&nes->dmc_rate_count, sizeof(int), 1, save_file);
+	fread(&nes->dmc_output_level, sizeof(char), 1, save_file);
+	fread(&nes->dmc_silence_flag, sizeof(char), 1, save_file);
+	
+	fread(&nes->sequencer_index, sizeof(char), 1, save_file);
+	fread(&nes->apu_frame_irq, sizeof(char), 1, save_file);
+	set_irq(IRQ_APU_FRAME, nes->apu_frame_irq);
+	
+	nes->apu_time = nes->apu_clock;
+	nes->apu_settled = 0;
+	nes->dmc_logged_read = nes->dmc_logged_write;
+	clear_audio_output();
+	
+	nes->apu_registers[0x00] = nes->pulse_1_control;
+	nes->apu_registers[0x01] = nes->pulse_1_sweep;
+	nes->apu_registers[0x02] = nes->pulse_1_timer_low;
+	nes->apu_registers[0x03] = nes->pulse_1_timer_high;
+	nes->apu_registers[0x04] = nes->pulse_2_control;
+	nes->apu_registers[0x05] = nes->pulse_2_sweep;
+	nes->apu_registers[0x06] = nes->pulse_2_timer_low;
+	nes->apu_registers[0x07] = nes->pulse_2_timer_high;
+	nes->apu_registers[0x08] = nes->triangle_linear_control;
+	nes->apu_registers[0x0A] = nes->triangle_timer_low;
+	nes->apu_registers[0x0B] = nes->triangle_timer_high;
+	nes->apu_registers[0x0C] = nes->noise_control;
+	nes->apu_registers[0x0E] = nes->noise_period_control;
+	nes->apu_registers[0x0F] = nes->noise_length_counter_load;
+	nes->apu_registers[0x10] = nes->dmc_control;
+	nes->apu_registers[0x11] = nes->dmc_output_level;
+	nes->apu_registers[0x12] = nes->dmc_sample_address;
+	nes->apu_registers[0x13] = nes->dmc_sample_length;
+	nes->apu_registers[0x15] = nes->apu_status;
+	nes->apu_registers[0x17] = nes->apu_frame_settings;
+	nes->frame_counter_count = nes->apu_half_clock_count;
+	nes->frame_counter_time = nes->apu_clock;
+	nes->dmc_fetch_time = nes->apu_clock + nes->dmc_rate_count;
+	nes->dmc_fetch_bits = nes->dmc_bits_remaining;
+	nes->dmc_fetch_address = nes->dmc_current_address;
+	nes->dmc_fetch_bytes = nes->dmc_bytes_remaining;
+	nes->dmc_fetch_silence = nes->dmc_silence_flag;
+	schedule_apu_event();
+}
+
+// Ends the audio frame at the current clock. Returns how many samples are ready to be read.
+// With the synthesis thread on, this frame's samples show up a little later, on some later call.
+unsigned int apu_end_audio_frame()
+{
+	apu_synth_end_frame(nes->apu_clock, nes->apu_output_rate, current_mutes());
+	return audio_ring_fill(nes->apu_samples);
+}
+
+// Changes the rate the output is actually produced at, without touching apu_sample_rate.
+// Used to nudge the output a little faster or slower to keep pace with the audio device.
+// It takes effect from the next audio frame.
+void apu_set_output_rate(double sample_rate)
+{
+	nes->apu_output_rate = sample_rate;
+}
+
+// Reads up to count signed 16 bit samples at apu_sample_rate. Returns how many were read.
+unsigned int apu_read_samples(short* output, unsigned int count)
+{
+	return audio_ring_read(nes->apu_samples, output, count);
+}
+
+unsigned char apu_stems_enabled()
+{
+	return nes->stem_outputs != NULL;
+}
+
+// Starts producing the per-channel outputs. They start from silence, so call it before the audio worth comparing.
+void apu_enable_stems()
+{
+	if (nes->stem_outputs != NULL)
+	{
+		return;
+	}
+	// The stems are read straight out of the synthesis side, so it has to stay on this thread.
+	apu_synth_stop();
+	nes->stem_outputs = malloc(sizeof(struct step_buffer*) * APU_STEM_COUNT);
+	nes->stem_levels = malloc(sizeof(int) * APU_STEM_COUNT);
+	nes->stem_filters = malloc(sizeof(struct audio_filter) * APU_STEM_COUNT);
+	for (int i = 0; i < APU_STEM_COUNT; i++)
+	{
+		audio_filter_init(&nes->stem_filters[i], apu_sample_rate);
+		nes->stem_outputs[i] = step_buffer_create(APU_CLOCK_RATE, apu_sample_rate, nes->apu_output->capacity);
+		nes->stem_levels[i] = 0;
+		// Same position in the output as the mix, so the samples line up.
+		nes->stem_outputs[i]->factor = nes->apu_output->factor;
+		nes->stem_outputs[i]->offset = nes->apu_output->offset & 0xFFFFFFFF;
+	}
+	nes->stem_samples = malloc(sizeof(short) * nes->apu_output->capacity);
+}
+
+// Reads up to count samples of each channel, interleaved in apu_stems order (so output needs room for
+// count * APU_STEM_COUNT). Returns how many samples of each channel were read.
+unsigned int apu_read_stems(short* output, unsigned int count)
+{
+	if (nes->stem_outputs == NULL)
+	{
+		return 0;
+	}
+	if (count > nes->apu_output->capacity)
+	{
+		count = nes->apu_output->capacity;
+	}
+	unsigned int read = 0;
+	for (int i = 0; i < APU_STEM_COUNT; i++)
+	{
+		read = step_buffer_read_samples(nes->stem_outputs[i], nes->stem_samples, count);
+		audio_filter_run(&nes->stem_filters[i], nes->stem_samples, read);
+		for (unsigned int j = 0; j < read; j++)
+		{
+			output[(j * APU_STEM_COUNT) + i] = nes->stem_samples[j];
+		}
+	}
+	return read;
 }
 
 // Handles the sweep algorithm that manipulates the frequency of the pulse channels.
 void sweep_pulse()
 {
 	// Pulse 1
-	unsigned char sweep_enabled = (pulse_1_sweep & 0b10000000) == 0b10000000;
-	unsigned char sweep_negate = (pulse_1_sweep & 0b00001000) == 0b00001000;
-	unsigned int current_period = pulse_1_timer_low + ((pulse_1_timer_high & 0b111) << 8);
-	unsigned char sweep_shift = pulse_1_sweep & 0b111;
-	unsigned char sweep_period = (pulse_1_sweep >> 4) & 0b111;
+	unsigned char sweep_enabled = (nes->pulse_1_sweep & 0b10000000) == 0b10000000;
+	unsigned char sweep_negate = (nes->pulse_1_sweep & 0b00001000) == 0b00001000;
+	unsigned int current_period = nes->pulse_1_timer_low + ((nes->pulse_1_timer_high & 0b111) << 8);
+	unsigned char sweep_shift = nes->pulse_1_sweep & 0b111;
+	unsigned char sweep_period = (nes->pulse_1_sweep >> 4) & 0b111;
 	
-	if ((pulse_1_sweep_divider == 0) && sweep_enabled)
+	if ((nes->pulse_1_sweep_divider == 0) && sweep_enabled)
 	{
 		signed char sweep_sign;
 		// Due to a bit of oddness in pulse channel 1, in negate mode it subtracts the shifted
@@ -534,33 +774,33 @@ void sweep_pulse()
 			sweep_sign = 1;
 			sweep_modifier = 0;
 		}
-		pulse_1_target_period = current_period + (((current_period >> sweep_shift) * sweep_sign) + sweep_modifier);
-		if ((pulse_1_target_period <= 0x7FF) && (sweep_shift > 0))
+		nes->pulse_1_target_period = current_period + (((current_period >> sweep_shift) * sweep_sign) + sweep_modifier);
+		if ((nes->pulse_1_target_period <= 0x7FF) && (sweep_shift > 0))
 		{
-			pulse_1_timer_low = pulse_1_target_period & 0xFF;
-			pulse_1_timer_high = (pulse_1_timer_high & 0b11111000) | ((pulse_1_target_period >> 8) & 0b111);
+			nes->pulse_1_timer_low = nes->pulse_1_target_period & 0xFF;
+			nes->pulse_1_timer_high = (nes->pulse_1_timer_high & 0b11111000) | ((nes->pulse_1_target_period >> 8) & 0b111);
 		}
 	}
 	
-	if (((pulse_1_sweep_divider == 0) && sweep_enabled) || pulse_1_sweep_reload)
+	if (((nes->pulse_1_sweep_divider == 0) && sweep_enabled) || nes->pulse_1_sweep_reload)
 	{
-		pulse_1_sweep_divider = sweep_period;
+		nes->pulse_1_sweep_divider = sweep_period;
 	}
-	else if (pulse_1_sweep_divider > 0)
+	else if (nes->pulse_1_sweep_divider > 0)
 	{
-		pulse_1_sweep_divider--;
+		nes->pulse_1_sweep_divider--;
 	}
 	
-	pulse_1_sweep_reload = 0;
+	nes->pulse_1_sweep_reload = 0;
 	
 	// Pulse 2
-	sweep_enabled = (pulse_2_sweep & 0b10000000) == 0b10000000;
-	sweep_negate = (pulse_2_sweep & 0b00001000) == 0b00001000;
-	current_period = pulse_2_timer_low + ((pulse_2_timer_high & 0b111) << 8);
-	sweep_shift = pulse_2_sweep & 0b111;
-	sweep_period = (pulse_2_sweep >> 4) & 0b111;
+	sweep_enabled = (nes->pulse_2_sweep & 0b10000000) == 0b10000000;
+	sweep_negate = (nes->pulse_2_sweep & 0b00001000) == 0b00001000;
+	current_period = nes->pulse_2_timer_low + ((nes->pulse_2_timer_high & 0b111) << 8);
+	sweep_shift = nes->pulse_2_sweep & 0b111;
+	sweep_period = (nes->pulse_2_sweep >> 4) & 0b111;
 	
-	if ((pulse_2_sweep_divider == 0) && sweep_enabled)
+	if ((nes->pulse_2_sweep_divider == 0) && sweep_enabled)
 	{
 		signed char sweep_sign;
 		if (sweep_negate)
@@ -571,111 +811,111 @@ void sweep_pulse()
 		{
 			sweep_sign = 1;
 		}
-		pulse_2_target_period = current_period + ((current_period >> sweep_shift) * sweep_sign);
-		if ((pulse_2_target_period <= 0x7FF) && (sweep_shift > 0))
+		nes->pulse_2_target_period = current_period + ((current_period >> sweep_shift) * sweep_sign);
+		if ((nes->pulse_2_target_period <= 0x7FF) && (sweep_shift > 0))
 		{
-			pulse_2_timer_low = pulse_2_target_period & 0xFF;
-			pulse_2_timer_high = (pulse_2_timer_high & 0b11111000) | ((pulse_2_target_period >> 8) & 0b111);
+			nes->pulse_2_timer_low = nes->pulse_2_target_period & 0xFF;
+			nes->pulse_2_timer_high = (nes->pulse_2_timer_high & 0b11111000) | ((nes->pulse_2_target_period >> 8) & 0b111);
 		}
 	}
 	
-	if (((pulse_2_sweep_divider == 0) && sweep_enabled) || pulse_2_sweep_reload)
+	if (((nes->pulse_2_sweep_divider == 0) && sweep_enabled) || nes->pulse_2_sweep_reload)
 	{
-		pulse_2_sweep_divider = sweep_period;
+		nes->pulse_2_sweep_divider = sweep_period;
 	}
-	else if (pulse_2_sweep_divider > 0)
+	else if (nes->pulse_2_sweep_divider > 0)
 	{
-		pulse_2_sweep_divider--;
+		nes->pulse_2_sweep_divider--;
 	}
 	
-	pulse_2_sweep_reload = 0;
+	nes->pulse_2_sweep_reload = 0;
 }
 
 void clock_envelope()
 {
 	// Pulse 1
-	unsigned char pulse_1_envelope_loop = (pulse_1_control & 0b00100000) == 0b00100000;
+	unsigned char pulse_1_envelope_loop = (nes->pulse_1_control & 0b00100000) == 0b00100000;
 	
-	if (pulse_1_envelope_start)
+	if (nes->pulse_1_envelope_start)
 	{
-		pulse_1_envelope_decay = COARSE_MAX_VOLUME;
-		pulse_1_envelope_divider = pulse_1_control & 0b1111;
-		pulse_1_envelope_start = 0;
+		nes->pulse_1_envelope_decay = COARSE_MAX_VOLUME;
+		nes->pulse_1_envelope_divider = nes->pulse_1_control & 0b1111;
+		nes->pulse_1_envelope_start = 0;
 	}
 	else
 	{
-		if (pulse_1_envelope_divider > 0)
+		if (nes->pulse_1_envelope_divider > 0)
 		{
-			pulse_1_envelope_divider--;
+			nes->pulse_1_envelope_divider--;
 		}
 		else
 		{
-			pulse_1_envelope_divider = pulse_1_control & 0b1111;
-			if (pulse_1_envelope_decay > 0)
+			nes->pulse_1_envelope_divider = nes->pulse_1_control & 0b1111;
+			if (nes->pulse_1_envelope_decay > 0)
 			{
-				pulse_1_envelope_decay--;
+				nes->pulse_1_envelope_decay--;
 			}
 			else if (pulse_1_envelope_loop)
 			{
-				pulse_1_envelope_decay = COARSE_MAX_VOLUME;
+				nes->pulse_1_envelope_decay = COARSE_MAX_VOLUME;
 			}
 		}
 	}
 	
 	// Pulse 2
-	unsigned char pulse_2_envelope_loop = (pulse_1_control & 0b00100000) == 0b00100000;
+	unsigned char pulse_2_envelope_loop = (nes->pulse_1_control & 0b00100000) == 0b00100000;
 	
-	if (pulse_2_envelope_start)
+	if (nes->pulse_2_envelope_start)
 	{
-		pulse_2_envelope_decay = COARSE_MAX_VOLUME;
-		pulse_2_envelope_divider = pulse_2_control & 0b1111;
-		pulse_2_envelope_start = 0;
+		nes->pulse_2_envelope_decay = COARSE_MAX_VOLUME;
+		nes->pulse_2_envelope_divider = nes->pulse_2_control & 0b1111;
+		nes->pulse_2_envelope_start = 0;
 	}
 	else
 	{
-		if (pulse_2_envelope_divider > 0)
+		if (nes->pulse_2_envelope_divider > 0)
 		{
-			pulse_2_envelope_divider--;
+			nes->pulse_2_envelope_divider--;
 		}
 		else
 		{
-			pulse_2_envelope_divider = pulse_2_control & 0b1111;
-			if (pulse_2_envelope_decay > 0)
+			nes->pulse_2_envelope_divider = nes->pulse_2_control & 0b1111;
+			if (nes->pulse_2_envelope_decay > 0)
 			{
-				pulse_2_envelope_decay--;
+				nes->pulse_2_envelope_decay--;
 			}
 			else if (pulse_2_envelope_loop)
 			{
-				pulse_2_envelope_decay = COARSE_MAX_VOLUME;
+				nes->pulse_2_envelope_decay = COARSE_MAX_VOLUME;
 			}
 		}
 	}
 	
 	// Noise
-	unsigned char noise_envelope_loop = (noise_control & 0b00100000) == 0b00100000;
+	unsigned char noise_envelope_loop = (nes->noise_control & 0b00100000) == 0b00100000;
 	
-	if (noise_envelope_start)
+	if (nes->noise_envelope_start)
 	{
-		noise_envelope_decay = COARSE_MAX_VOLUME;
-		noise_envelope_divider = noise_control & 0b1111;
-		noise_envelope_start = 0;
+		nes->noise_envelope_decay = COARSE_MAX_VOLUME;
+		nes->noise_envelope_divider = nes->noise_control & 0b1111;
+		nes->noise_envelope_start = 0;
 	}
 	else
 	{
-		if (noise_envelope_divider > 0)
+		if (nes->noise_envelope_divider > 0)
 		{
-			noise_envelope_divider--;
+			nes->noise_envelope_divider--;
 		}
 		else
 		{
-			noise_envelope_divider = noise_control & 0b1111;
-			if (noise_envelope_decay > 0)
+			nes->noise_envelope_divider = nes->noise_control & 0b1111;
+			if (nes->noise_envelope_decay > 0)
 			{
-				noise_envelope_decay--;
+				nes->noise_envelope_decay--;
 			}
 			else if (noise_envelope_loop)
 			{
-				noise_envelope_decay = COARSE_MAX_VOLUME;
+				nes->noise_envelope_decay = COARSE_MAX_VOLUME;
 			}
 		}
 	}
@@ -686,36 +926,36 @@ void clock_envelope()
 // depending on the loop mode.
 void shift_noise_bit_stream()
 {
-	unsigned char loop_mode = (noise_period_control & 0b10000000) == 0b10000000;
+	unsigned char loop_mode = (nes->noise_period_control & 0b10000000) == 0b10000000;
 	unsigned char feedback_bit;
 	// bit 0 XOR bit 6 mode
 	if (loop_mode)
 	{
-		feedback_bit = (noise_bit_stream & 0b1) ^ ((noise_bit_stream >> 6) & 0b1);
+		feedback_bit = (nes->noise_bit_stream & 0b1) ^ ((nes->noise_bit_stream >> 6) & 0b1);
 	}
 	// bit 0 XOR bit 1 mode
 	else
 	{
-		feedback_bit = (noise_bit_stream & 0b1) ^ ((noise_bit_stream >> 1) & 0b1);
+		feedback_bit = (nes->noise_bit_stream & 0b1) ^ ((nes->noise_bit_stream >> 1) & 0b1);
 	}
 	
-	noise_bit_stream = ((noise_bit_stream >> 1) & 0b11111111111111) | ((feedback_bit << 14) & 0b100000000000000);
+	nes->noise_bit_stream = ((nes->noise_bit_stream >> 1) & 0b11111111111111) | ((feedback_bit << 14) & 0b100000000000000);
 }
 
 void quarter_frame_clock()
 {
-	if (triangle_linear_reload)
+	if (nes->triangle_linear_reload)
 	{
-		triangle_linear_counter = triangle_linear_control & 0b1111111;
+		nes->triangle_linear_counter = nes->triangle_linear_control & 0b1111111;
 	}
-	else if (triangle_linear_counter > 0)
+	else if (nes->triangle_linear_counter > 0)
 	{
-		triangle_linear_counter--;
+		nes->triangle_linear_counter--;
 	}
 	
-	if ((triangle_linear_control & 0b10000000) == 0)
+	if ((nes->triangle_linear_control & 0b10000000) == 0)
 	{
-		triangle_linear_reload = 0;
+		nes->triangle_linear_reload = 0;
 	}
 	
 	clock_envelope();
@@ -723,301 +963,524 @@ void quarter_frame_clock()
 
 void half_frame_clock()
 {
-	if ((triangle_length_counter > 0) && ((triangle_linear_control & 0b10000000) == 0))
+	if ((nes->triangle_length_counter > 0) && ((nes->triangle_linear_control & 0b10000000) == 0))
 	{
-		triangle_length_counter--;
+		nes->triangle_length_counter--;
 	}
 	
-	if ((pulse_1_length_counter > 0) && ((pulse_1_control & 0b00100000) == 0))
+	if ((nes->pulse_1_length_counter > 0) && ((nes->pulse_1_control & 0b00100000) == 0))
 	{
-		pulse_1_length_counter--;
+		nes->pulse_1_length_counter--;
 	}
 	
-	if ((pulse_2_length_counter > 0) && ((pulse_2_control & 0b00100000) == 0))
+	if ((nes->pulse_2_length_counter > 0) && ((nes->pulse_2_control & 0b00100000) == 0))
 	{
-		pulse_2_length_counter--;
+		nes->pulse_2_length_counter--;
 	}
 	
-	if ((noise_length_counter > 0) && (noise_control & 0b00100000) == 0)
+	if ((nes->noise_length_counter > 0) && (nes->noise_control & 0b00100000) == 0)
 	{
-		noise_length_counter--;
+		nes->noise_length_counter--;
 	}
 	
 	sweep_pulse();
 }
 
+// Sends a new level to an output, if it changed.
+void update_channel_output(struct step_buffer* buffer, int* last_output, int output)
+{
+	if (output != *last_output)
+	{
+		step_buffer_add_delta(buffer, nes->apu_time - nes->apu_frame_start, output - *last_output);
+		*last_output = output;
+	}
+}
+
 void mix_audio()
 {
-	if (apu_buffer_length >= APU_BUFFER_MAX)
+	if (nes->synth_mutes & MUTE_OUTPUT)
 	{
 		return;
 	}
 	
-	unsigned char duty_select = (pulse_1_control >> 6) & 0b11;
+	unsigned char duty_select = (nes->pulse_1_control >> 6) & 0b11;
 	// 0 == use envelope decay, 1 == use constant volume
-	unsigned char pulse_1_volume_flag = (pulse_1_control & 0b00010000) == 0b00010000;
+	unsigned char pulse_1_volume_flag = (nes->pulse_1_control & 0b00010000) == 0b00010000;
 	unsigned char pulse_1_high;
 	if (pulse_1_volume_flag)
 	{
-		pulse_1_high = (pulse_1_control & 0b1111);
+		pulse_1_high = (nes->pulse_1_control & 0b1111);
 	}
 	else
 	{
-		pulse_1_high = pulse_1_envelope_decay;
+		pulse_1_high = nes->pulse_1_envelope_decay;
 	}
-	unsigned char pulse_1_volume = pulse_1_high * ((duty_sequence[pulse_1_duty_index] >> duty_select) & 0b1);
-	unsigned int pulse_1_timer_value = pulse_1_timer_low + ((pulse_1_timer_high & 0b111) << 8);
-	if ((pulse_1_timer_value < 8) || (pulse_1_length_counter == 0))
+	unsigned char pulse_1_volume = pulse_1_high * ((duty_sequence[nes->pulse_1_duty_index] >> duty_select) & 0b1);
+	unsigned int pulse_1_timer_value = nes->pulse_1_timer_low + ((nes->pulse_1_timer_high & 0b111) << 8);
+	if ((pulse_1_timer_value < 8) || (nes->pulse_1_length_counter == 0))
 	{
 		pulse_1_volume = 0;
-		pulse_1_high = 0;
 	}
 	
-	duty_select = (pulse_2_control >> 6) & 0b11;
+	duty_select = (nes->pulse_2_control >> 6) & 0b11;
 	// 0 == use envelope decay, 1 == use constant volume
-	unsigned char pulse_2_volume_flag = (pulse_2_control & 0b00010000) == 0b00010000;
+	unsigned char pulse_2_volume_flag = (nes->pulse_2_control & 0b00010000) == 0b00010000;
 	unsigned char pulse_2_high;
 	if (pulse_2_volume_flag)
 	{
-		pulse_2_high = (pulse_2_control & 0b1111);
+		pulse_2_high = (nes->pulse_2_control & 0b1111);
 	}
 	else
 	{
-		pulse_2_high = pulse_2_envelope_decay;
+		pulse_2_high = nes->pulse_2_envelope_decay;
 	}
-	unsigned char pulse_2_volume = pulse_2_high * ((duty_sequence[pulse_2_duty_index] >> duty_select) & 0b1);
-	unsigned int pulse_2_timer_value = pulse_2_timer_low + ((pulse_2_timer_high & 0b111) << 8);
-	if ((pulse_2_timer_value < 8) || (pulse_2_length_counter == 0))
+	unsigned char pulse_2_volume = pulse_2_high * ((duty_sequence[nes->pulse_2_duty_index] >> duty_select) & 0b1);
+	unsigned int pulse_2_timer_value = nes->pulse_2_timer_low + ((nes->pulse_2_timer_high & 0b111) << 8);
+	if ((pulse_2_timer_value < 8) || (nes->pulse_2_length_counter == 0))
 	{
 		pulse_2_volume = 0;
-		pulse_2_high = 0;
 	}
 	
-	unsigned char noise_volume_flag = (noise_control & 0b00010000) == 0b00010000;
+	unsigned char noise_volume_flag = (nes->noise_control & 0b00010000) == 0b00010000;
 	unsigned char noise_high;
 	if (noise_volume_flag)
 	{
-		noise_high = (noise_control & 0b1111);
+		noise_high = (nes->noise_control & 0b1111);
 	}
 	else
 	{
-		noise_high = noise_envelope_decay;
+		noise_high = nes->noise_envelope_decay;
 	}
-	unsigned char noise_volume = noise_high * !(noise_bit_stream & 0b1);
-	if (noise_length_counter == 0)
+	unsigned char noise_volume = noise_high * !(nes->noise_bit_stream & 0b1);
+	if (nes->noise_length_counter == 0)
 	{
 		noise_volume = 0;
-		noise_high = 0;
 	}
 	
-	float pulse_1_mix = ((0.00752 * pulse_1_volume) - (0.00752 * (pulse_1_high / 2.0))) * !pulse_1_silence;
-	float pulse_2_mix = ((0.00752 * pulse_2_volume) - (0.00752 * (pulse_2_high / 2.0))) * !pulse_2_silence;
-	float triangle_mix = ((0.00851  * sequencer[sequencer_index]) - (0.00851 * 7.5)) * !triangle_silence;
-	float noise_mix = ((0.00494 * noise_volume) - (0.00494 * noise_high / 2.0)) * !noise_silence;
-	float dmc_mix = ((0.00335 * dmc_output_level) - (0.00335 * FINE_MAX_VOLUME / 2.0)) * !sample_silence;
+	// No need to center the channels around 0 any more, the output takes out the DC offset.
+	unsigned int pulse_level = (pulse_1_volume * !((nes->synth_mutes >> STEM_PULSE_1) & 1)) + (pulse_2_volume * !((nes->synth_mutes >> STEM_PULSE_2) & 1));
+	unsigned int tnd_level = (3 * sequencer[nes->sequencer_index] * !((nes->synth_mutes >> STEM_TRIANGLE) & 1))
+		+ (2 * noise_volume * !((nes->synth_mutes >> STEM_NOISE) & 1)) + (nes->dmc_output_level * !((nes->synth_mutes >> STEM_DMC) & 1));
+	update_channel_output(nes->apu_output, &nes->pulse_output, pulse_table[pulse_level]);
+	update_channel_output(nes->apu_output, &nes->tnd_output, tnd_table[tnd_level]);
+	
+	// Each channel as it would sound if the others were silent.
+	if (nes->stem_outputs != NULL)
+	{
+		update_channel_output(nes->stem_outputs[STEM_PULSE_1], &nes->stem_levels[STEM_PULSE_1], pulse_table[pulse_1_volume]);
+		update_channel_output(nes->stem_outputs[STEM_PULSE_2], &nes->stem_levels[STEM_PULSE_2], pulse_table[pulse_2_volume]);
+		update_channel_output(nes->stem_outputs[STEM_TRIANGLE], &nes->stem_levels[STEM_TRIANGLE], tnd_table[3 * sequencer[nes->sequencer_index]]);
+		update_channel_output(nes->stem_outputs[STEM_NOISE], &nes->stem_levels[STEM_NOISE], tnd_table[2 * noise_volume]);
+		update_channel_output(nes->stem_outputs[STEM_DMC], &nes->stem_levels[STEM_DMC], tnd_table[nes->dmc_output_level]);
+	}
+}
+
+// The CPU side fetched it at the same clock, see clock_dmc_fetch.
+unsigned char take_logged_dmc_byte()
+{
+	unsigned char value = nes->dmc_logged_bytes[nes->dmc_logged_read];
+	nes->dmc_logged_read = (nes->dmc_logged_read + 1) & 0b11;
+	return value;
+}
+
+// Runs the DMC when its rate timer runs out: outputs the next bit, fetching a new sample byte if it needs one.
+void clock_dmc()
+{
+	unsigned char dmc_loop = (nes->dmc_control >> 6) & 0b1;
+	if (nes->dmc_bits_remaining == 0)
+	{
+		if (nes->dmc_bytes_remaining > 0)
+		{
+			nes->dmc_silence_flag = 0;
+			nes->dmc_current_address++;
+			if (nes->dmc_current_address > 0xFFFF)
+			{
+				nes->dmc_current_address = 0x8000;
+			}
+			nes->dmc_sample_buffer = take_logged_dmc_byte();
+			nes->dmc_bytes_remaining--;
+			nes->dmc_bits_remaining = 8;
+			
+			if ((nes->dmc_bytes_remaining == 0) && dmc_loop)
+			{
+				nes->dmc_silence_flag = 0;
+				// Sample address = %11AAAAAA.AA000000
+				nes->dmc_current_address = 0xC000 | (nes->dmc_sample_address << 6);
+				// Sample length = %LLLL.LLLL0001
+				nes->dmc_bytes_remaining = (nes->dmc_sample_length << 4) | 1;
+				nes->dmc_sample_buffer = take_logged_dmc_byte();
+				nes->dmc_bytes_remaining--;
+				nes->dmc_bits_remaining = 8;
+			}
+		}
+		else
+		{
+			nes->dmc_silence_flag = 1;
+		}
+	}
 	
-	float pulse_out = pulse_1_mix + pulse_2_mix;
-	float tnd_out = triangle_mix + noise_mix + dmc_mix;
-	mixer_buffer[apu_buffer_length] = pulse_out + tnd_out + 0.5;
-	apu_buffer_length++;
+	if (!nes->dmc_silence_flag)
+	{
+		// Each bit of a sample changes the level. A 1 adds 2 to the output level,
+		// and a 0 subtracts 2 from the output level.
+		// The output level is clamped between 0 and 127.
+		unsigned char output_bit = nes->dmc_sample_buffer & 0b1;
+		if (output_bit && (nes->dmc_output_level < 126))
+		{
+			nes->dmc_output_level += 2;
+		}
+		else if (nes->dmc_output_level > 1)
+		{
+			nes->dmc_output_level -= 2;
+		}
+		nes->dmc_bits_remaining--;
+		nes->dmc_sample_buffer = nes->dmc_sample_buffer >> 1;
+	}
 }
 
 // For convenience, each tick will represent a half clock for the APU.
 // Period timers count down every clock, except triangle timer, which counts down every half clock.
 // Linear counters count down every quarter frame. Length counters count down every half frame.
-void apu_tick()
+void run_apu_tick()
 {
-	if ((apu_status & 0b1) == 0)
+	if ((nes->apu_status & 0b1) == 0)
 	{
-		pulse_1_length_counter = 0;
+		nes->pulse_1_length_counter = 0;
 	}
 	
-	if ((apu_status & 0b10) == 0)
+	if ((nes->apu_status & 0b10) == 0)
 	{
-		pulse_2_length_counter = 0;
+		nes->pulse_2_length_counter = 0;
 	}
 	
-	if ((apu_status & 0b1000) == 0)
+	if ((nes->apu_status & 0b1000) == 0)
 	{
-		noise_length_counter = 0;
+		nes->noise_length_counter = 0;
 	}
 	
-	if ((triangle_linear_counter > 0) && (triangle_length_counter > 0))
+	if ((nes->triangle_linear_counter > 0) && (nes->triangle_length_counter > 0))
 	{
-		unsigned int triangle_timer = triangle_timer_low + ((triangle_timer_high & 0b111) << 8);
+		unsigned int triangle_timer = nes->triangle_timer_low + ((nes->triangle_timer_high & 0b111) << 8);
 		
 		// Artificially silence the triangle if it's set to an extremely high frequency
 		if (triangle_timer > 0)
 		{
-			if (triangle_timer_count == 0)
+			if (nes->triangle_timer_count == 0)
 			{
-				sequencer_index = (sequencer_index + 1) % sequencer_size;
-				triangle_timer_count = triangle_timer;
+				nes->sequencer_index = (nes->sequencer_index + 1) % sequencer_size;
+				nes->triangle_timer_count = triangle_timer;
 			}
 			else
 			{
-				triangle_timer_count--;
+				nes->triangle_timer_count--;
 			}
 		}
 		
 	}
 	
-	if ((apu_status & 0b100) == 0)
+	if ((nes->apu_status & 0b100) == 0)
 	{
-		triangle_length_counter = 0;
+		nes->triangle_length_counter = 0;
 	}
 	
-	if ((apu_frame_settings & 0b10000000) == 0b10000000)
+	// The frame sequencer. run_apu_until only runs this on the clocks a step is due.
+	const struct frame_event* events = current_frame_events(nes->apu_frame_settings);
+	for (int i = 0; i < 4; i++)
 	{
-		switch(apu_half_clock_count)
+		if (events[i].clock == nes->apu_half_clock_count)
 		{
-			case 14913:
-			case 37281:
+			if (events[i].actions & FRAME_QUARTER)
 			{
-				half_frame_clock();
+				quarter_frame_clock();
 			}
-			case 7457:
-			case 22371:
+			if (events[i].actions & FRAME_HALF)
 			{
-				quarter_frame_clock();
+				half_frame_clock();
 			}
 		}
-		apu_half_clock_count = (apu_half_clock_count + 1) % FIVE_STEP_FRAME_LENGTH;
+	}
+	if (nes->apu_half_clock_count >= events[3].clock)
+	{
+		nes->apu_half_clock_count = 0;
 	}
 	else
 	{
-		switch(apu_half_clock_count)
-		{
-			case 14913:
-			case 29829:
-			{
-				half_frame_clock();
-			}
-			case 7457:
-			case 22371:
-			{
-				quarter_frame_clock();
-			}
-		}
-		apu_half_clock_count = (apu_half_clock_count + 1) % FOUR_STEP_FRAME_LENGTH;
+		nes->apu_half_clock_count++;
 	}
 	
-	unsigned char dmc_loop = (dmc_control >> 6) & 0b1;
-	if (dmc_rate_count == 0)
+	if (nes->dmc_rate_count == 0)
 	{
-		if (dmc_bits_remaining == 0)
-		{
-			if (dmc_bytes_remaining > 0)
-			{
-				dmc_silence_flag = 0;
-				dmc_current_address++;
-				if (dmc_current_address > 0xFFFF)
-				{
-					dmc_current_address = 0x8000;
-				}
-				// TODO: This is a bit quick and dirty. To be more cycle-accurate, should halt
-				// the CPU to allow it to do a read from memory. But it works for now.
-				access_cpu_memory(&dmc_sample_buffer, dmc_current_address, READ);
-				dmc_bytes_remaining--;
-				dmc_bits_remaining = 8;
-				
-				if ((dmc_bytes_remaining == 0) && dmc_loop)
-				{
-					dmc_silence_flag = 0;
-					// Sample address = %11AAAAAA.AA000000
-					dmc_current_address = 0xC000 | (dmc_sample_address << 6);
-					// Sample length = %LLLL.LLLL0001
-					dmc_bytes_remaining = (dmc_sample_length << 4) | 1;
-					// TODO: This is a bit quick and dirty. To be more cycle-accurate, should halt
-					// the CPU to allow it to do a read from memory. But it works for now.
-					access_cpu_memory(&dmc_sample_buffer, dmc_current_address, READ);
-					dmc_bytes_remaining--;
-					dmc_bits_remaining = 8;
-				}
-			}
-			else
-			{
-				dmc_silence_flag = 1;
-			}
-		}
-		
-		if (!dmc_silence_flag)
-		{
-			// Each bit of a sample changes the level. A 1 adds 2 to the output level,
-			// and a 0 subtracts 2 from the output level.
-			// The output level is clamped between 0 and 127.
-			unsigned char output_bit = dmc_sample_buffer & 0b1;
-			if (output_bit && (dmc_output_level < 126))
-			{
-				dmc_output_level += 2;
-			}
-			else if (dmc_output_level > 1)
-			{
-				dmc_output_level -= 2;
-			}
-			dmc_bits_remaining--;
-			dmc_sample_buffer = dmc_sample_buffer >> 1;
-		}
-		dmc_rate_count = dmc_rate_table[dmc_control & 0b1111];
+		clock_dmc();
+		nes->dmc_rate_count = dmc_rate_table[nes->dmc_control & 0b1111];
 	}
 	else
 	{
-		dmc_rate_count--;
+		nes->dmc_rate_count--;
 	}
 	
 	// Anything that should only occur on whole APU clocks goes here.
-	if ((apu_half_clock_count % 2) == 0)
+	if ((nes->apu_half_clock_count & 1) == 0)
 	{
-		if (pulse_1_length_counter > 0)
+		if (nes->pulse_1_length_counter > 0)
 		{
-			if (pulse_1_timer_count == 0)
+			if (nes->pulse_1_timer_count == 0)
 			{
-				pulse_1_duty_index = (pulse_1_duty_index + 1) % duty_size;
-				pulse_1_timer_count = pulse_1_timer_low + ((pulse_1_timer_high & 0b111) << 8);;
+				nes->pulse_1_duty_index = (nes->pulse_1_duty_index + 1) % duty_size;
+				nes->pulse_1_timer_count = nes->pulse_1_timer_low + ((nes->pulse_1_timer_high & 0b111) << 8);;
 			}
 			else
 			{
-				pulse_1_timer_count--;
+				nes->pulse_1_timer_count--;
 			}
 		}
 		
-		if (pulse_2_length_counter > 0)
+		if (nes->pulse_2_length_counter > 0)
 		{
-			if (pulse_2_timer_count == 0)
+			if (nes->pulse_2_timer_count == 0)
 			{
-				pulse_2_duty_index = (pulse_2_duty_index + 1) % duty_size;
-				pulse_2_timer_count = pulse_2_timer_low + ((pulse_2_timer_high & 0b111) << 8);;
+				nes->pulse_2_duty_index = (nes->pulse_2_duty_index + 1) % duty_size;
+				nes->pulse_2_timer_count = nes->pulse_2_timer_low + ((nes->pulse_2_timer_high & 0b111) << 8);;
 			}
 			else
 			{
-				pulse_2_timer_count--;
+				nes->pulse_2_timer_count--;
 			}
 		}
 		
-		if (noise_length_counter > 0)
+		if (nes->noise_length_counter > 0)
 		{
-			if (noise_timer_count == 0)
+			if (nes->noise_timer_count == 0)
 			{
 				shift_noise_bit_stream();
-				noise_timer_count = noise_period_table[noise_period_control & 0b1111];
+				nes->noise_timer_count = noise_period_table[nes->noise_period_control & 0b1111];
 			}
 			else
 			{
-				noise_timer_count--;
+				nes->noise_timer_count--;
 			}
 		}
 		
 		mix_audio();
+		nes->apu_mix_pending = 0;
+	}
+	else
+	{
+		nes->apu_mix_pending = 1;
 	}
+	
+	nes->apu_time++;
 }
 
-void apu_init()
+// Runs count clocks in one go. None of them can be a frame sequencer clock, or the first clock after
+// a register write, so nothing changes except the timers. Those run out on a fixed period, so rather than
+// counting each one down a clock at a time, this jumps straight from one timer running out to the next.
+// Everything is worked out as clocks from the start, with UINT_MAX meaning never.
+void run_apu_clocks(unsigned int count)
 {
-	apu_status = 0;
-	apu_frame_settings = 0;
+	unsigned int start = nes->apu_time;
+	// Whole clocks are every other clock, and the frame can't wrap in here, so they're every odd apu_half_clock_count.
+	unsigned int first_whole = (nes->apu_half_clock_count & 1) ? 0 : 1;
+	
+	unsigned int triangle_timer = nes->triangle_timer_low + ((nes->triangle_timer_high & 0b111) << 8);
+	unsigned char triangle_running = (nes->triangle_linear_counter > 0) && (nes->triangle_length_counter > 0) && (triangle_timer > 0);
+	unsigned int triangle_next = triangle_running ? nes->triangle_timer_count : UINT_MAX;
+	unsigned int dmc_next = nes->dmc_rate_count;
+	// The pulse and noise timers count whole clocks.
+	unsigned int pulse_1_period = nes->pulse_1_timer_low + ((nes->pulse_1_timer_high & 0b111) << 8);
+	unsigned int pulse_1_next = (nes->pulse_1_length_counter > 0) ? first_whole + (nes->pulse_1_timer_count * 2) : UINT_MAX;
+	unsigned int pulse_2_period = nes->pulse_2_timer_low + ((nes->pulse_2_timer_high & 0b111) << 8);
+	unsigned int pulse_2_next = (nes->pulse_2_length_counter > 0) ? first_whole + (nes->pulse_2_timer_count * 2) : UINT_MAX;
+	unsigned int noise_period = noise_period_table[nes->noise_period_control & 0b1111];
+	unsigned int noise_next = (nes->noise_length_counter > 0) ? first_whole + (nes->noise_timer_count * 2) : UINT_MAX;
+	
+	// With no output, there's no need to stop for mixing.
+	unsigned char mixing = !(nes->synth_mutes & MUTE_OUTPUT);
+	
+	unsigned int clock = 0;
+	while (1)
+	{
+		unsigned int next = triangle_next;
+		next = (dmc_next < next) ? dmc_next : next;
+		next = (pulse_1_next < next) ? pulse_1_next : next;
+		next = (pulse_2_next < next) ? pulse_2_next : next;
+		next = (noise_next < next) ? noise_next : next;
+		if (mixing && nes->apu_mix_pending)
+		{
+			// The next whole clock.
+			unsigned int mix_next = clock + ((clock - first_whole) & 1);
+			next = (mix_next < next) ? mix_next : next;
+		}
+		if (next >= count)
+		{
+			break;
+		}
+		
+		// Same order as run_apu_tick.
+		clock = next;
+		nes->apu_time = start + clock;
+		if (triangle_next == clock)
+		{
+			nes->sequencer_index = (nes->sequencer_index + 1) % sequencer_size;
+			triangle_next = clock + triangle_timer + 1;
+			nes->apu_mix_pending = 1;
+		}
+		if (dmc_next == clock)
+		{
+			clock_dmc();
+			dmc_next = clock + dmc_rate_table[nes->dmc_control & 0b1111] + 1;
+			nes->apu_mix_pending = 1;
+		}
+		if (pulse_1_next == clock)
+		{
+			nes->pulse_1_duty_index = (nes->pulse_1_duty_index + 1) % duty_size;
+			pulse_1_next = clock + ((pulse_1_period + 1) * 2);
+			nes->apu_mix_pending = 1;
+		}
+		if (pulse_2_next == clock)
+		{
+			nes->pulse_2_duty_index = (nes->pulse_2_duty_index + 1) % duty_size;
+			pulse_2_next = clock + ((pulse_2_period + 1) * 2);
+			nes->apu_mix_pending = 1;
+		}
+		if (noise_next == clock)
+		{
+			shift_noise_bit_stream();
+			noise_next = clock + ((noise_period + 1) * 2);
+			nes->apu_mix_pending = 1;
+		}
+		if (nes->apu_mix_pending && (((clock - first_whole) & 1) == 0))
+		{
+			mix_audio();
+			nes->apu_mix_pending = 0;
+		}
+		clock++;
+	}
 	
-	apu_half_clock_count = 0;
+	// Turn the event times back into the timers' own counts, as seen from the end.
+	nes->apu_half_clock_count += count;
+	nes->apu_time = start + count;
+	first_whole = (nes->apu_half_clock_count & 1) ? 0 : 1;
+	if (triangle_running)
+	{
+		nes->triangle_timer_count = triangle_next - count;
+	}
+	nes->dmc_rate_count = dmc_next - count;
+	if (nes->pulse_1_length_counter > 0)
+	{
+		nes->pulse_1_timer_count = (pulse_1_next - count - first_whole) / 2;
+	}
+	if (nes->pulse_2_length_counter > 0)
+	{
+		nes->pulse_2_timer_count = (pulse_2_next - count - first_whole) / 2;
+	}
+	if (nes->noise_length_counter > 0)
+	{
+		nes->noise_timer_count = (noise_next - count - first_whole) / 2;
+	}
+}
+
+// Runs the channels up to time. Frame sequencer clocks and the first clock after a write
+// go through run_apu_tick, and everything in between is done in bulk.
+void run_apu_until(unsigned int time)
+{
+	while (nes->apu_time != time)
+	{
+		unsigned int remaining = time - nes->apu_time;
+		unsigned int until_sequencer = clocks_to_sequencer(nes->apu_frame_settings, nes->apu_half_clock_count);
+		if (!nes->apu_settled || (until_sequencer == 0))
+		{
+			run_apu_tick();
+			nes->apu_settled = 1;
+		}
+		else
+		{
+			run_apu_clocks((remaining < until_sequencer) ? remaining : until_sequencer);
+		}
+	}
+}
+
+// Runs the synthesis side through a log, up to its end_time. If end_frame is set, the audio frame ends there,
+// and its samples go out to apu_samples. Called by apu_synth, on whichever thread is making the audio.
+void synthesize_apu_log(struct apu_log* log, unsigned char end_frame)
+{
+	if (log->mutes != nes->synth_mutes)
+	{
+		nes->synth_mutes = log->mutes;
+		nes->apu_mix_pending = 1;
+	}
+	// A new rate goes in at the start of a frame. If part of the frame was already made (see apu_synth_sync),
+	// that part stays at the old one, which is close enough.
+	if (end_frame && (log->output_rate != nes->synth_output_rate))
+	{
+		nes->synth_output_rate = log->output_rate;
+		step_buffer_set_rates(nes->apu_output, APU_CLOCK_RATE, nes->synth_output_rate);
+		if (nes->stem_outputs != NULL)
+		{
+			for (int i = 0; i < APU_STEM_COUNT; i++)
+			{
+				step_buffer_set_rates(nes->stem_outputs[i], APU_CLOCK_RATE, nes->synth_output_rate);
+			}
+		}
+	}
+	for (unsigned int i = 0; i < log->length; i++)
+	{
+		struct apu_log_event* event = &log->events[i];
+		run_apu_until(event->time);
+		if (event->address == APU_LOG_DMC_BYTE)
+		{
+			nes->dmc_logged_bytes[nes->dmc_logged_write] = event->value;
+			nes->dmc_logged_write = (nes->dmc_logged_write + 1) & 0b11;
+		}
+		else
+		{
+			synth_apu_write(event->address, event->value);
+		}
+	}
+	run_apu_until(log->end_time);
+	if (!end_frame)
+	{
+		return;
+	}
+	if (nes->synth_mutes & MUTE_OUTPUT)
+	{
+		nes->apu_frame_start = nes->apu_time;
+		return;
+	}
 	
+	step_buffer_end_frame(nes->apu_output, nes->apu_time - nes->apu_frame_start);
+	if (nes->stem_outputs != NULL)
+	{
+		for (int i = 0; i < APU_STEM_COUNT; i++)
+		{
+			step_buffer_end_frame(nes->stem_outputs[i], nes->apu_time - nes->apu_frame_start);
+		}
+	}
+	nes->apu_frame_start = nes->apu_time;
+	// The channel silence flags get flipped between frames, so make sure the next clock picks them up.
+	nes->apu_mix_pending = 1;
+	unsigned int count;
+	while ((count = step_buffer_read_samples(nes->apu_output, nes->synth_samples, nes->apu_output->capacity)) > 0)
+	{
+		audio_filter_run(&nes->apu_output_filter, nes->synth_samples, count);
+		audio_ring_write(nes->apu_samples, nes->synth_samples, count);
+	}
+
+}
+
+// Runs once per CPU cycle. All it does is count, the CPU side catches up when it's accessed,
+// or when the frame sequencer or the DMC has something to do.
+void apu_tick()
+{
+	nes->apu_clock++;
+	if (nes->apu_clock == nes->apu_event_clock)
+	{
+		run_apu_events();
+	}
+}
+
+// The sequences and lookup tables are the same for every NES, so they're only built once, before any context is set up.
+void apu_build_tables()
+{
 	sequencer = malloc(sizeof(char) * sequencer_size);
 	// Sequencer values range from 15 to 0, then 0 back up to 15.
 	for (int i = 0; i < 16; i++)
@@ -1026,34 +1489,6 @@ void apu_init()
 		sequencer[15 - i] = i;
 	}
 	
-	pulse_1_control = 0;
-	pulse_1_sweep = 0;
-	pulse_1_timer_low = 0;
-	pulse_1_timer_high = 0;
-	pulse_1_timer_count = 0;
-	pulse_1_duty_index = 0;
-	pulse_1_length_counter = 0;
-	pulse_1_sweep_divider = 0;
-	pulse_1_sweep_reload = 0;
-	pulse_1_target_period = 0;
-	pulse_1_envelope_start = 0;
-	pulse_1_envelope_divider = 0;
-	pulse_1_envelope_decay = 0;
-	
-	pulse_2_control = 0;
-	pulse_2_sweep = 0;
-	pulse_2_timer_low = 0;
-	pulse_2_timer_high = 0;
-	pulse_2_timer_count = 0;
-	pulse_2_duty_index = 0;
-	pulse_2_length_counter = 0;
-	pulse_2_sweep_divider = 0;
-	pulse_2_sweep_reload = 0;
-	pulse_2_target_period = 0;
-	pulse_2_envelope_start = 0;
-	pulse_2_envelope_divider = 0;
-	pulse_2_envelope_decay = 0;
-	
 	// Each duty byte consists of the four bits from each duty sequence.
 	// Bit X selects the sample from duty sequence X.
 	duty_sequence = malloc(sizeof(char) * duty_size);
@@ -1066,18 +1501,6 @@ void apu_init()
 	duty_sequence[6] = 0b0110;
 	duty_sequence[7] = 0b0111;
 	
-	noise_control = 0;
-	noise_period_control = 0;
-	noise_length_counter_load = 0;
-	noise_timer_count = 0;
-	// Noise channel's randomized bit stream must be initialized to 1, because if
-	// it is set to 0, it will only ever produce 0s.
-	noise_bit_stream = 1;
-	noise_length_counter = 0;
-	noise_envelope_start = 0;
-	noise_envelope_divider = 0;
-	noise_envelope_decay = 0;
-	
 	noise_period_table = malloc(sizeof(int) * 16);
 	noise_period_table[0] = 4;
 	noise_period_table[1] = 8;
@@ -1096,11 +1519,6 @@ void apu_init()
 	noise_period_table[14] = 2034;
 	noise_period_table[15] = 4068;
 	
-	apu_buffer_length = 0;
-	mixer_buffer = malloc(sizeof(int) * APU_BUFFER_MAX);
-	
-	triangle_linear_reload = 0;
-	triangle_length_counter = 0;
 	length_table = malloc(sizeof(char) * 32);
 	length_table[0] = 10;
 	length_table[1] = 254;
@@ -1153,11 +1571,140 @@ void apu_init()
 	dmc_rate_table[14] = 72;
 	dmc_rate_table[15] = 54;
 	
-	triangle_timer_count = 0;
+	// The usual approximations of the mixer, from the NESdev wiki.
+	pulse_table = malloc(sizeof(int) * 31);
+	pulse_table[0] = 0;
+	for (int i = 1; i < 31; i++)
+	{
+		pulse_table[i] = (int)floor((MIXER_SCALE * 95.52 / ((8128.0 / i) + 100)) + 0.5);
+	}
+	tnd_table = malloc(sizeof(int) * 203);
+	tnd_table[0] = 0;
+	for (int i = 1; i < 203; i++)
+	{
+		tnd_table[i] = (int)floor((MIXER_SCALE * 163.67 / ((24329.0 / i) + 100)) + 0.5);
+	}
+}
+
+// The output side of a context, made the first time a ROM's loaded into it and kept from then on.
+void create_apu_output()
+{
+	// Room for a quarter second of samples between reads.
+	nes->apu_output = step_buffer_create(APU_CLOCK_RATE, apu_sample_rate, apu_sample_rate / 4);
+	audio_filter_init(&nes->apu_output_filter, apu_sample_rate);
+	nes->apu_samples = audio_ring_create(apu_sample_rate / 4);
+	nes->synth_samples = malloc(sizeof(short) * nes->apu_output->capacity);
+	nes->apu_output_rate = apu_sample_rate;
+	nes->synth_output_rate = apu_sample_rate;
+	apu_synth_init();
+}
+
+// Frees the output side, for when the context is thrown away.
+void apu_free()
+{
+	if (nes->apu_output == NULL)
+	{
+		return;
+	}
+	apu_synth_free();
+	step_buffer_free(nes->apu_output);
+	audio_ring_free(nes->apu_samples);
+	free(nes->synth_samples);
+	if (nes->stem_outputs != NULL)
+	{
+		for (int i = 0; i < APU_STEM_COUNT; i++)
+		{
+			step_buffer_free(nes->stem_outputs[i]);
+		}
+		free(nes->stem_outputs);
+		free(nes->stem_levels);
+		free(nes->stem_filters);
+		free(nes->stem_samples);
+	}
+	nes->apu_output = NULL;
+}
+
+void apu_init()
+{
+	nes->apu_status = 0;
+	nes->apu_frame_settings = 0;
+	
+	nes->apu_half_clock_count = 0;
+	nes->apu_time = 0;
+	nes->apu_settled = 0;
+	nes->apu_mix_pending = 1;
+	nes->dmc_logged_read = 0;
+	nes->dmc_logged_write = 0;
+	nes->synth_mutes = 0;
+	
+	nes->pulse_1_control = 0;
+	nes->pulse_1_sweep = 0;
+	nes->pulse_1_timer_low = 0;
+	nes->pulse_1_timer_high = 0;
+	nes->pulse_1_timer_count = 0;
+	nes->pulse_1_duty_index = 0;
+	nes->pulse_1_length_counter = 0;
+	nes->pulse_1_sweep_divider = 0;
+	nes->pulse_1_sweep_reload = 0;
+	nes->pulse_1_target_period = 0;
+	nes->pulse_1_envelope_start = 0;
+	nes->pulse_1_envelope_divider = 0;
+	nes->pulse_1_envelope_decay = 0;
+	
+	nes->pulse_2_control = 0;
+	nes->pulse_2_sweep = 0;
+	nes->pulse_2_timer_low = 0;
+	nes->pulse_2_timer_high = 0;
+	nes->pulse_2_timer_count = 0;
+	nes->pulse_2_duty_index = 0;
+	nes->pulse_2_length_counter = 0;
+	nes->pulse_2_sweep_divider = 0;
+	nes->pulse_2_sweep_reload = 0;
+	nes->pulse_2_target_period = 0;
+	nes->pulse_2_envelope_start = 0;
+	nes->pulse_2_envelope_divider = 0;
+	nes->pulse_2_envelope_decay = 0;
+	
+	nes->noise_control = 0;
+	nes->noise_period_control = 0;
+	nes->noise_length_counter_load = 0;
+	nes->noise_timer_count = 0;
+	// Noise channel's randomized bit stream must be initialized to 1, because if
+	// it is set to 0, it will only ever produce 0s.
+	nes->noise_bit_stream = 1;
+	nes->noise_length_counter = 0;
+	nes->noise_envelope_start = 0;
+	nes->noise_envelope_divider = 0;
+	nes->noise_envelope_decay = 0;
+	
+	nes->triangle_linear_reload = 0;
+	nes->triangle_length_counter = 0;
+	nes->triangle_timer_count = 0;
+	
+	nes->pulse_1_silence = 0;
+	nes->pulse_2_silence = 0;
+	nes->triangle_silence = 0;
+	nes->noise_silence = 0;
+	nes->sample_silence = 0;
+	
+	if (nes->apu_output == NULL)
+	{
+		create_apu_output();
+	}
+	// Anything still logged belonged to the last ROM.
+	apu_synth_restart();
+	clear_audio_output();
 	
-	pulse_1_silence = 0;
-	pulse_2_silence = 0;
-	triangle_silence = 0;
-	noise_silence = 0;
-	sample_silence = 0;
-}
\ No newline at end of file
+	// The CPU side starts out the same as the synthesis side.
+	memset(nes->apu_registers, 0, 0x18);
+	nes->apu_frame_irq = 0;
+	nes->apu_clock = 0;
+	nes->frame_counter_count = 0;
+	nes->frame_counter_time = 0;
+	nes->dmc_fetch_time = 0;
+	nes->dmc_fetch_bits = 0;
+	nes->dmc_fetch_address = 0;
+	nes->dmc_fetch_bytes = 0;
+	nes->dmc_fetch_silence = 0;
+	schedule_apu_event();
+}
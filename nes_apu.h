@@ -1,26 +1,33 @@
 #ifndef APU_HEADER
 #define APU_HEADER
 
-extern unsigned char apu_status;
 extern unsigned char triangle_counter_control;
-extern unsigned char triangle_timer_low;
-extern unsigned char triangle_timer_high;
 
-extern float* mixer_buffer;
-extern unsigned int apu_buffer_length;
-extern unsigned const int apu_buffer_max;
+extern unsigned int apu_sample_rate;
 
-extern unsigned char pulse_1_silence;
-extern unsigned char pulse_2_silence;
-extern unsigned char triangle_silence;
-extern unsigned char noise_silence;
-extern unsigned char sample_silence;
+// The per-channel outputs, in the order apu_read_stems interleaves them.
+enum apu_stems { STEM_PULSE_1, STEM_PULSE_2, STEM_TRIANGLE, STEM_NOISE, STEM_DMC, APU_STEM_COUNT };
 
 void apu_read(unsigned char* data, unsigned int address);
 void apu_write(unsigned char* data, unsigned int address);
 void apu_tick();
+void apu_build_tables();
 void apu_init();
+void apu_free();
+unsigned int apu_end_audio_frame();
+unsigned int apu_read_samples(short* output, unsigned int count);
+void apu_set_output_rate(double sample_rate);
+void apu_enable_stems();
+unsigned int apu_read_stems(short* output, unsigned int count);
 
+unsigned char apu_stems_enabled();
+
+// Called by apu_synth to make the audio.
+struct apu_log;
+void synthesize_apu_log(struct apu_log* log, unsigned char end_frame);
+
+void apu_sync();
+void apu_snapshot_restored();
 void apu_save_state(FILE* save_file);
 void apu_load_state(FILE* save_file);
 
@@ -0,0 +1,438 @@
+#ifndef NES_CONTEXT_HEADER
+#define NES_CONTEXT_HEADER
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "nes_ppu.h"
+#include "cartridge.h"
+#include "rom_image.h"
+#include "step_buffer.h"
+#include "audio_filter.h"
+#include "audio_ring.h"
+#include "apu_synth.h"
+#include "ppu_renderer.h"
+
+// Everything one NES is made of, in one block. The core used to keep all of this in globals, so there could
+// only ever be one. Now every bit of it lives in here, and the core works on whichever context nes points at.
+//
+// The machine itself comes first: everything the game can see or that decides what happens next. That part is
+// a plain run of bytes (no pointers into anything), so a snapshot is just a memcpy of NES_SNAPSHOT_SIZE bytes.
+// After it comes what the context was set up with and the plumbing around it (the ROM, the windows the PPU
+// fetches through, the threads and the output), none of which gets copied.
+//
+// Each part starts on its own cache line. The render and audio threads only work on their own parts, so they
+// don't end up fighting the emulation thread over lines neither of them is really sharing.
+
+#define NES_CACHE_LINE 64
+#define NES_SECTION __attribute__ ((aligned (NES_CACHE_LINE)))
+
+struct nes_context
+{
+	// CPU (see nes_cpu.c).
+	unsigned char accumulator NES_SECTION;
+	unsigned char x_register;
+	unsigned char y_register;
+	unsigned int program_counter;
+	unsigned char stack_pointer;
+	// Bit 7: S - Sign Flag - Set if result is negative, cleared if positive. A number is considered 'negative' if its high bit is set.
+	// Bit 6: V - Overflow Flag - Set if result overflows.
+	// Bit 5: Not used. Should be 1 when saved to memory.
+	// Bit 4: Weird. When saved to memory, varies depending on what triggered the interrupt.
+	// Bit 3: D - Decimal Flag - Used for decimal mode. Not supported in the NES.
+	// Bit 2: I - Interrupt Disable Flag - Disables interrupts if set.
+	// Bit 1: Z - Zero Flag - Set if result is zero, cleared otherwise.
+	// Bit 0: C - Carry Flag - Set if arithmetic carry is required, or arithmetic borrow is not required. Cleared if not.
+	unsigned char status_flags;
+
+	unsigned char oam_dma_active;
+	unsigned char oam_dma_page;
+	unsigned char oam_dma_write;
+	unsigned char oam_dma_low;
+
+	unsigned char timing_cycle;
+	unsigned char next_timing_cycle;
+	unsigned int address_bus;
+	unsigned char address_low_bus;
+	unsigned char address_high_bus;
+	unsigned char data_bus;
+	unsigned char execute_bus;
+	// The two inputs and one output for the ALU. Most of our calculations
+	// can be done directly, but certain internal calculations use these registers.
+	unsigned char alu_in_a;
+	unsigned char alu_in_b;
+	unsigned char alu_out;
+	// Controls the CPU's reads and writes to memory. 1 == read, 0 == write.
+	unsigned char read_write;
+
+	// NMIs waiting to be taken. They're edges, so each one's taken once.
+	unsigned char pending_interrupt;
+	unsigned char interrupt_cycle;
+	// Which interrupt the sequence in interrupt_cycle is for. Only set when one starts.
+	unsigned char interrupt_type;
+	// The IRQ line is a level, held down by any of the irq_sources bits (see nes_cpu.h) until that source lets go.
+	// It's taken at every instruction boundary for as long as it's down, unless I is set.
+	unsigned char irq_line;
+
+	unsigned int total_cycles;
+
+	unsigned char cpu_ram[0x800];
+
+	// Controllers (see controller.c).
+	unsigned char controller_1_bus;
+	unsigned char controller_2_bus;
+	unsigned char controller_1_shift;
+	unsigned char controller_2_shift;
+	unsigned char controller_1_data;
+	unsigned char controller_2_data;
+
+	// PPU (see nes_ppu.c).
+	unsigned char ppu_bus NES_SECTION;
+
+	unsigned int vram_address;
+	unsigned int vram_temp;
+	unsigned char fine_x_scroll;
+
+	// PPU registers
+	unsigned char ppu_control;
+	unsigned char ppu_mask;
+	unsigned char ppu_status;
+	unsigned char oam_address;
+	// When the CPU reads PPUDATA, what it gets
+	// is the contents of this buffer, which is only updated
+	// after the read. Okay???
+	unsigned char ppu_data_buffer;
+
+	unsigned int register_accessed;
+	// Flag to indicate whether PPUSTATUS was just read. Due to
+	// a quirk of the PPU, if the vblank flag would be set during
+	// this period, it is immediately cleared.
+	unsigned char status_read;
+	unsigned char reset_cycle;
+	// FCEUX seems to skip the first vblank, so I should too in order to be
+	// compatible with FCEUX movies.
+	unsigned char vblank_skip;
+
+	// Controls the write mode of PPUSCROLL and PPUADDRESS
+	unsigned char write_toggle;
+	unsigned char odd_frame;
+
+	unsigned int scanline;
+	unsigned int scan_pixel;
+
+	// Everything that goes into picking the color of a pixel.
+	struct pixel_pipeline ppu_pipeline;
+
+	// Treated as two-bit shift registers to detect edges.
+	unsigned char nmi_occurred;
+	unsigned char nmi_output;
+
+	// Counts every dot the PPU runs, which is what the render thread's events are timed by. Wrapping around is fine.
+	unsigned int ppu_dot_count;
+	// Set when the last pixel of a frame is due while the render thread is drawing, or while nothing is drawn at all.
+	unsigned char ppu_frame_drawn;
+	// Where PPU address line 12 was left by the last bus access, for mappers that watch for it rising.
+	unsigned char ppu_address_bit_12;
+	// Rather than watch A12 on every fetch, the PPU works out each scanline's rising edges up front.
+	// A tile fetch reads the nametable (A12 low), two pattern bytes, then the attribute table (A12 low again),
+	// so it raises A12 exactly once if the background uses the right pattern table, and never otherwise.
+	// That's decided by PPUCTRL at the start of the line. Sprite fetches are worked out as they're loaded.
+	// If the game flips the background pattern table mid-line, the rest of that line goes back to watching every fetch.
+	unsigned char a12_tile_rise;
+	unsigned char a12_exact_line;
+
+	unsigned char palette_ram[0x20];
+	unsigned char secondary_oam[0x40];
+	unsigned char oam[0x100];
+	unsigned char ppu_ram[0x800];
+
+	// The cartridge's RAM and the mapper's registers (see cartridge.c and mappers/).
+	unsigned char prg_ram[0x2000] NES_SECTION;
+	unsigned char chr_ram[0x2000];
+
+	// NROM-like boards
+	unsigned char unrom_bank_select;
+	unsigned char cnrom_bank_select;
+	unsigned char axrom_bank_select;
+	unsigned char axrom_mirroring;
+
+	// MMC1
+	unsigned char shift_register;
+	unsigned char shift_count;
+	unsigned char control_register;
+	unsigned char chr_bank_0_register;
+	unsigned char chr_bank_1_register;
+	unsigned char prg_bank_register;
+
+	// MMC2
+	unsigned char mmc2_prg_bank_select;
+	unsigned char mmc2_chr_bank_left_FD_select;
+	unsigned char mmc2_chr_bank_left_FE_select;
+	// Flag for the left pattern table bank select. 0 for $FD, 1 for $FE.
+	unsigned char mmc2_chr_bank_left_select;
+	unsigned char mmc2_chr_bank_right_FD_select;
+	unsigned char mmc2_chr_bank_right_FE_select;
+	// Flag for the right pattern table bank select. 0 for $FD, 1 for $FE.
+	unsigned char mmc2_chr_bank_right_select;
+	unsigned char mmc2_mirroring_select;
+
+	// MMC3
+	unsigned char bank_select_register;
+	unsigned char bank_selects[8];
+	unsigned char mirroring_register;
+	unsigned char prg_ram_protect_register;
+	unsigned char irq_latch_register;
+	unsigned char irq_reload_register;
+	unsigned char irq_enable_register;
+	unsigned char holding_irq;
+	unsigned char irq_counter;
+
+	// The CPU's side of the APU (see nes_apu.c), which always runs on the emulation thread, on time.
+	// apu_tick only counts clocks, and the rest is worked out when a register is accessed, or when the
+	// frame sequencer or the DMC has something to do that the CPU would notice.
+	unsigned int apu_clock NES_SECTION;
+	// The apu_clock the next frame sequencer step or DMC fetch is finished at.
+	unsigned int apu_event_clock;
+	// The last value written to each register.
+	unsigned char apu_registers[0x18];
+	// Set when the frame sequencer raises its IRQ, until it's acknowledged by reading 0x4015 or inhibited through 0x4017.
+	unsigned char apu_frame_irq;
+	// The CPU side's copy of the frame sequencer: its half clock count as of the clock frame_counter_time.
+	unsigned int frame_counter_count;
+	unsigned int frame_counter_time;
+	// The CPU side's copy of the DMC's reader. Only what decides when it fetches and from where, not the output.
+	unsigned int dmc_fetch_time;
+	unsigned char dmc_fetch_bits;
+	unsigned int dmc_fetch_address;
+	unsigned int dmc_fetch_bytes;
+	unsigned char dmc_fetch_silence;
+
+	// The synthesis side of the APU, which replays the CPU side's log (see apu_synth.c). It owns all the channels.
+	unsigned int apu_half_clock_count NES_SECTION;
+	unsigned char apu_status;
+	unsigned char apu_frame_settings;
+	unsigned char sequencer_index;
+
+	// Bits 6-7 are the duty, bit 5 is the length counter halt, bit 4 is the envelope toggle, bits 0-3
+	// are the volume/envelope divider period.
+	unsigned char pulse_1_control;
+	unsigned char pulse_1_sweep;
+	// Controls the period of the pulse wave. Counts down every half clock.
+	unsigned char pulse_1_timer_low;
+	// The low 3 bits are the high bits of the period timer. The high 5 bits are for the length load value.
+	unsigned char pulse_1_timer_high;
+	unsigned int pulse_1_timer_count;
+	unsigned char pulse_1_duty_index;
+	unsigned char pulse_1_length_counter;
+	unsigned char pulse_1_sweep_divider;
+	unsigned char pulse_1_sweep_reload;
+	unsigned int pulse_1_target_period;
+	unsigned char pulse_1_envelope_start;
+	unsigned char pulse_1_envelope_divider;
+	unsigned char pulse_1_envelope_decay;
+
+	// Bits 6-7 are the duty, bit 5 is the length counter halt, bit 4 is the envelope toggle, bits 0-3
+	// are the volume/envelope divider period.
+	unsigned char pulse_2_control;
+	unsigned char pulse_2_sweep;
+	// Controls the period of the pulse wave. Counts down every half clock.
+	unsigned char pulse_2_timer_low;
+	// The low 3 bits are the high bits of the period timer. The high 5 bits are for the length load value.
+	unsigned char pulse_2_timer_high;
+	unsigned int pulse_2_timer_count;
+	unsigned char pulse_2_duty_index;
+	unsigned char pulse_2_length_counter;
+	unsigned char pulse_2_sweep_divider;
+	unsigned char pulse_2_sweep_reload;
+	unsigned int pulse_2_target_period;
+	unsigned char pulse_2_envelope_start;
+	unsigned char pulse_2_envelope_divider;
+	unsigned char pulse_2_envelope_decay;
+
+	// Contains the linear control flag in bit 7 and the linear load value in bits 6-0.
+	// Bit 7 is also the length counter halt flag?
+	unsigned char triangle_linear_control;
+	// Controls the period of the triangle wave. Counts down every half clock.
+	unsigned char triangle_timer_low;
+	// The low 3 bits are the high bits of the period timer. The high 5 bits are for the length load value.
+	unsigned char triangle_timer_high;
+	unsigned int triangle_timer_count;
+	unsigned char triangle_linear_reload;
+	unsigned char triangle_linear_counter;
+	unsigned char triangle_length_counter;
+
+	// Bit 5 is the envelope loop/disable length counter flag, bit 4 is the constant volume flag, bits 0-3
+	// are the volume/envelope divider period.
+	unsigned char noise_control;
+	// Bit 7 is the mode flag, bits 0-3 control the period.
+	unsigned char noise_period_control;
+	unsigned char noise_length_counter_load;
+	unsigned int noise_timer_count;
+	// The pseudo-random register used to produce the 'noise'.
+	unsigned int noise_bit_stream;
+	unsigned char noise_length_counter;
+	unsigned char noise_envelope_start;
+	unsigned char noise_envelope_divider;
+	unsigned char noise_envelope_decay;
+
+	// Bit 7 is the IRQ enable flag. Bit 6 is the loop flag. Bits 0-3 is the rate index.
+	unsigned char dmc_control;
+	unsigned char dmc_sample_address;
+	unsigned char dmc_sample_length;
+	unsigned char dmc_sample_buffer;
+	unsigned char dmc_bits_remaining;
+	unsigned int dmc_current_address;
+	unsigned int dmc_bytes_remaining;
+	unsigned int dmc_rate_count;
+	unsigned char dmc_output_level;
+	unsigned char dmc_silence_flag;
+
+	// The clock the channels have been run up to.
+	unsigned int apu_time;
+	// The clock the current audio frame started at.
+	unsigned int apu_frame_start;
+	// Cleared by register writes. The first clock after one is run on its own, since a write can
+	// change things that only settle after a clock (like disabled length counters getting zeroed).
+	unsigned char apu_settled;
+	// Sample bytes the DMC fetched, from the log, waiting for the synthesis side's DMC to get to them.
+	unsigned char dmc_logged_bytes[4];
+	unsigned char dmc_logged_read;
+	unsigned char dmc_logged_write;
+
+	// Nothing from here on is part of a snapshot.
+	char snapshot_end NES_SECTION;
+
+	// Where the synthesis side's output stands. That depends on how the output was set up (muted, video only)
+	// rather than on the machine, so it's left out of snapshots, and starts over after a restore.
+	// Set when a channel changed since the last mix, so the next whole clock has to mix.
+	unsigned char apu_mix_pending;
+	// The silence flags as of the log being replayed, one bit per channel in apu_stems order.
+	unsigned char synth_mutes;
+	// The level each group of channels last sent to apu_output.
+	int pulse_output;
+	int tnd_output;
+
+	// The cartridge as it was loaded. The ROM is shared with every other instance running the same game
+	// (see rom_image.c), so it's only ever read.
+	const struct rom_image* rom;
+	const unsigned char* prg_rom;
+	const unsigned char* chr_rom;
+	unsigned int prg_rom_pages;
+	unsigned int chr_rom_pages;
+	unsigned int prg_rom_size;
+	unsigned int prg_ram_size;
+	unsigned int chr_rom_size;
+	unsigned char use_chr_ram;
+	unsigned char nametable_mirroring;
+	unsigned char mapper;
+	// MMC1 is a mapper that appears on multiple boards, known as the SxROM family.
+	// Some of them use MMC1's registers in special ways, so we need to determine
+	// whether these special boards are being used, which can be inferred from
+	// the configuration of PRG ROM and CHR ROM.
+	unsigned char large_prg_banks;
+	unsigned char extra_prg_ram;
+
+	// The PPU sees the pattern tables as eight 1 KB windows, and the nametables as four.
+	// Each window points straight at the memory currently banked in, and the mapper
+	// repoints them whenever its bank or mirroring registers change. That way the PPU
+	// never has to ask the mapper where a fetch goes. They're worked out again from
+	// the mapper's registers after a snapshot is restored, see cartridge_remap.
+	unsigned char* chr_windows[8];
+	unsigned char* nametable_windows[4];
+	// Some mappers need to watch the PPU's bus (IRQ counters, CHR latches). Rather than seeing every fetch,
+	// they say which events they need, so the PPU is free to skip or batch the fetches nobody's watching:
+	// rising edges on PPU address line 12, given the PPU dot they happened on,
+	// and pattern fetches from the tiles marked in watched_tiles, given the CHR address.
+	// The hooks are NULL for mappers that don't care.
+	a12_rise_handler a12_rise_hook;
+	tile_fetch_handler tile_fetch_hook;
+	// One entry for each tile in the pattern tables, indexed by CHR address >> 4.
+	unsigned char watched_tiles[0x200];
+
+	// For runs that are only listened to. The PPU still does everything the CPU and the mapper can see
+	// (the status flags, NMI, every fetch, sprite 0 hits), but no pixels come out of it.
+	unsigned char ppu_audio_only;
+	// For runs that are only watched. The CPU side and the channels all still run exactly as usual (so the
+	// state is the same, down to what goes in a save state), but nothing gets mixed, filtered or output.
+	unsigned char apu_video_only;
+	// Flags to let the user control which channels are played.
+	unsigned char pulse_1_silence;
+	unsigned char pulse_2_silence;
+	unsigned char triangle_silence;
+	unsigned char noise_silence;
+	unsigned char sample_silence;
+
+	// The APU's output (see nes_apu.c).
+	// Each channel's output level goes into here as a step whenever it changes.
+	struct step_buffer* apu_output;
+	// Then on the way out, the samples go through the same filters the NES has on its output.
+	struct audio_filter apu_output_filter;
+	// Finished samples, filtered and ready to be read. Whichever side makes the audio writes them, see apu_synth.c.
+	struct audio_ring* apu_samples;
+	short* synth_samples;
+	// The rate apu_set_output_rate last asked for, and the one the synthesis side is actually using.
+	double apu_output_rate;
+	double synth_output_rate;
+	// Optional extra outputs with each channel on its own, for comparing channels separately.
+	// NULL until apu_enable_stems. The mutes don't apply to these.
+	struct step_buffer** stem_outputs;
+	int* stem_levels;
+	struct audio_filter* stem_filters;
+	short* stem_samples;
+
+	// The synthesis thread (see apu_synth.c).
+	unsigned char apu_synth_threaded;
+	// The emulation thread fills one log while the synthesis thread works through the other.
+	// If the synthesis thread is still busy at the end of a frame, the next frame just goes in the same log.
+	struct apu_log apu_logs[2];
+	struct apu_log* filling_apu_log;
+	struct apu_log* handed_apu_log;
+	unsigned char apu_log_handed;
+	unsigned char synth_thread_started;
+	unsigned char synth_thread_quit;
+	pthread_t synth_thread;
+	pthread_mutex_t synth_lock;
+	pthread_cond_t apu_log_waiting;
+	pthread_cond_t synth_idle;
+
+	// The render thread (see ppu_renderer.c).
+	unsigned char ppu_render_threaded NES_SECTION;
+	// The emulation thread fills one log while the render thread works through the other.
+	// If the render thread is still busy at the end of a frame, the next frame just goes in the same log.
+	struct render_log render_logs[2];
+	struct render_log* filling_log;
+	struct render_log* handed_log;
+	unsigned char render_log_handed;
+	unsigned char render_thread_started;
+	unsigned char render_thread_quit;
+	pthread_t render_thread;
+	pthread_mutex_t render_lock;
+	pthread_cond_t render_log_waiting;
+	pthread_cond_t render_idle;
+
+	// The render thread's copy of the PPU.
+	struct pixel_pipeline render_pipeline;
+	unsigned char render_mask;
+	unsigned char render_fine_x;
+	unsigned char render_palette[0x20];
+	unsigned int render_scanline;
+	unsigned int render_scan_pixel;
+	unsigned char render_odd_frame;
+	unsigned int render_time;
+
+	// Finished frames, in the same format as the frontend's frame buffer. Triple buffered like the video filters.
+	unsigned short* render_frames[3];
+	unsigned char render_back;
+	unsigned char render_ready;
+	unsigned char render_front;
+	unsigned char render_frame_ready;
+};
+
+#define NES_SNAPSHOT_SIZE offsetof(struct nes_context, snapshot_end)
+
+// The context the core is running on this thread. Set by arachnes.c before it runs anything,
+// and by the render and synthesis threads for the context they belong to.
+// Initial exec keeps each access a plain load off the thread pointer, even in the shared library.
+extern __thread struct nes_context* nes __attribute__ ((tls_model ("initial-exec")));
+
+#endif
@@ -1,12 +1,12 @@
 #include<stdio.h>
 #include<string.h>
 #include<stdlib.h>
-#include "emu_nes.h"
 #include "nes_cpu.h"
 #include "nes_apu.h"
 #include "nes_ppu.h"
 #include "controller.h"
 #include "cartridge.h"
+#include "nes_context.h"
 
 unsigned const char WRITE = 1;
 unsigned const char READ = 0;
@@ -31,46 +31,11 @@ struct DecodeLine
 	void (*rom_op)(void);
 };
 
-unsigned char accumulator = 0;
-unsigned char x_register = 0;
-unsigned char y_register = 0;
-unsigned int program_counter = 0;
-unsigned char stack_pointer = 0xFF;
-unsigned char status_flags = 0;
-
-unsigned char oam_dma_active = 0;
-unsigned char oam_dma_page = 0;
-unsigned char oam_dma_write = 0;
-unsigned char oam_dma_low = 0;
-
-unsigned char timing_cycle = 0b000010;
-unsigned char next_timing_cycle = 0;
-unsigned int address_bus = 0;
-unsigned char address_low_bus = 0;
-unsigned char address_high_bus = 0;
-unsigned char data_bus = 0;
-unsigned char execute_bus = 0;
-// The two inputs and one output for the ALU. Most of our calculations
-// can be done directly, but certain internal calculations use these registers.
-unsigned char alu_in_a = 0;
-unsigned char alu_in_b = 0;
-unsigned char alu_out = 0;
-// Controls the CPU's reads and writes to memory. 1 == read, 0 == write.
-unsigned char read_write = 1;
-
-unsigned char pending_interrupt = 0;
-unsigned char interrupt_cycle = 0;
-unsigned char interrupt_type = 0;
-
 // Represents lines for ops that do something in the first half of the cycle.
 struct DecodeLine* decode_lines_first_half;
 // Represents lines for ops that do something in the second half of the cycle.
 struct DecodeLine* decode_lines_second_half;
 
-unsigned int total_cycles = 0;
-
-unsigned char* cpu_ram;
-
 // Maps CPU addresses to memory pointers. 'access_type' is a flag to indicate whether it is a read or write access.
 void access_cpu_memory(unsigned char* data, unsigned int address, unsigned char access_type)
 {
@@ -81,7 +46,7 @@ void access_cpu_memory(unsigned char* data, unsigned int address, unsigned char
 		if (address <= 0x1FFF)
 		{
 			unsigned int cpu_ram_address = address % 0x800;
-			*data = cpu_ram[cpu_ram_address];
+			*data = nes->cpu_ram[cpu_ram_address];
 		}
 		// PPU registers. Found in 0x2000 through 0x2007, but they're mirrored every 8 bytes.
 		else if (address >= 0x2000 && address <= 0x3FFF)
@@ -91,8 +56,8 @@ void access_cpu_memory(unsigned char* data, unsigned int address, unsigned char
 		}
 		else if (address == 0x4014)
 		{
-			oam_dma_active = 1;
-			*data = oam_dma_page;
+			nes->oam_dma_active = 1;
+			*data = nes->oam_dma_page;
 		}
 		// Player 1 controller port.
 		// Will have to figure that out eventually.
@@ -116,7 +81,7 @@ void access_cpu_memory(unsigned char* data, unsigned int address, unsigned char
 		}
 		else
 		{
-			printf("Unhandled CPU address %04X\n", address);
+			core_log("Unhandled CPU address %04X", address);
 			exit_emulator();
 		}
 	}
@@ -127,7 +92,7 @@ void access_cpu_memory(unsigned char* data, unsigned int address, unsigned char
 		if (address <= 0x1FFF)
 		{
 			unsigned int cpu_ram_address = address % 0x800;
-			cpu_ram[cpu_ram_address] = *data;
+			nes->cpu_ram[cpu_ram_address] = *data;
 		}
 		// PPU registers. Found in 0x2000 through 0x2007, but they're mirrored every 8 bytes.
 		else if (address >= 0x2000 && address <= 0x3FFF)
@@ -137,8 +102,8 @@ void access_cpu_memory(unsigned char* data, unsigned int address, unsigned char
 		}
 		else if (address == 0x4014)
 		{
-			oam_dma_active = 1;
-			oam_dma_page = *data;
+			nes->oam_dma_active = 1;
+			nes->oam_dma_page = *data;
 		}
 		// Player 1 controller port.
 		else if (address == 0x4016)
@@ -157,7 +122,7 @@ void access_cpu_memory(unsigned char* data, unsigned int address, unsigned char
 		}
 		else
 		{
-			printf("Unhandled CPU address %04X\n", address);
+			core_log("Unhandled CPU address %04X", address);
 			exit_emulator();
 		}
 	}
@@ -168,11 +133,11 @@ void test_negative_flag(unsigned char byte)
 {
 	if ((byte & 0b10000000) == 0b10000000)
 	{
-		status_flags = status_flags | 0b10000000;
+		nes->status_flags = nes->status_flags | 0b10000000;
 	}
 	else
 	{
-		status_flags = status_flags & 0b01111111;
+		nes->status_flags = nes->status_flags & 0b01111111;
 	}
 }
 
@@ -181,11 +146,11 @@ void test_zero_flag(unsigned char byte)
 {
 	if (byte == 0)
 	{
-		status_flags = status_flags | 0b00000010;
+		nes->status_flags = nes->status_flags | 0b00000010;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11111101;
+		nes->status_flags = nes->status_flags & 0b11111101;
 	}
 }
 
@@ -194,11 +159,11 @@ void test_carry_addition(unsigned char operand_a, unsigned char operand_b, unsig
 {
 	if ((operand_a + operand_b + carry_bit) > 0xFF)
 	{
-		status_flags = status_flags | 0b00000001;
+		nes->status_flags = nes->status_flags | 0b00000001;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11111110;
+		nes->status_flags = nes->status_flags & 0b11111110;
 	}
 }
 
@@ -207,11 +172,11 @@ void test_carry_subtraction(unsigned char operand_a, unsigned char operand_b)
 {
 	if (operand_a >= operand_b)
 	{
-		status_flags = status_flags | 0b00000001;
+		nes->status_flags = nes->status_flags | 0b00000001;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11111110;
+		nes->status_flags = nes->status_flags & 0b11111110;
 	}
 }
 
@@ -221,7 +186,7 @@ void test_overflow_addition(unsigned char operand_a, unsigned char operand_b, un
 	// If the operands have opposite signs, they can't overflow.
 	if ((operand_a >= 0x80) != (operand_b >= 0x80))
 	{
-		status_flags = status_flags & 0b10111111;
+		nes->status_flags = nes->status_flags & 0b10111111;
 	}
 	else
 	{
@@ -229,11 +194,11 @@ void test_overflow_addition(unsigned char operand_a, unsigned char operand_b, un
 		// If A and B have the same sign, there's an overflow if the sum has a different sign.
 		if ((result >= 0x80) == (operand_a >= 0x80))
 		{
-			status_flags = status_flags & 0b10111111;
+			nes->status_flags = nes->status_flags & 0b10111111;
 		}
 		else
 		{
-			status_flags = status_flags | 0b01000000;
+			nes->status_flags = nes->status_flags | 0b01000000;
 		}
 	}
 }
@@ -243,11 +208,11 @@ void test_carry_right_shift(unsigned char byte)
 {
 	if ((byte & 0b1) == 0b1)
 	{
-		status_flags = status_flags | 0b00000001;
+		nes->status_flags = nes->status_flags | 0b00000001;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11111110;
+		nes->status_flags = nes->status_flags & 0b11111110;
 	}
 }
 
@@ -256,11 +221,11 @@ void test_carry_left_shift(unsigned char byte)
 {
 	if ((byte & 0b10000000) == 0b10000000)
 	{
-		status_flags = status_flags | 0b00000001;
+		nes->status_flags = nes->status_flags | 0b00000001;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11111110;
+		nes->status_flags = nes->status_flags & 0b11111110;
 	}
 }
 
@@ -270,46 +235,46 @@ void test_carry_left_shift(unsigned char byte)
 // Adds the data byte to the accumulator. Works as both signed or unsigned addition.
 void add_with_carry(unsigned char data)
 {
-	unsigned char carry_bit = status_flags & 0b1;
+	unsigned char carry_bit = nes->status_flags & 0b1;
 	// Carry bit is for unsigned addition, so we should test signed overflow before adding it.
-	test_overflow_addition(accumulator, data, carry_bit);
-	test_carry_addition(accumulator, data, carry_bit);
+	test_overflow_addition(nes->accumulator, data, carry_bit);
+	test_carry_addition(nes->accumulator, data, carry_bit);
 	// The carry bit is added to the data byte. Normally it should start cleared for addition.
-	accumulator += data + carry_bit;
-	test_negative_flag(accumulator);
-	test_zero_flag(accumulator);
+	nes->accumulator += data + carry_bit;
+	test_negative_flag(nes->accumulator);
+	test_zero_flag(nes->accumulator);
 }
 
 // Subtracts the data byte from the accumulator. Works by taking the two's complement of the data byte and adding it.
 void subtract_with_carry(unsigned char data)
 {
-	unsigned char carry_bit = status_flags & 0b1;
-	test_overflow_addition(accumulator, ~data, carry_bit);
-	test_carry_addition(accumulator, ~data, carry_bit);
-	accumulator += (~data) + carry_bit;
-	test_negative_flag(accumulator);
-	test_zero_flag(accumulator);
+	unsigned char carry_bit = nes->status_flags & 0b1;
+	test_overflow_addition(nes->accumulator, ~data, carry_bit);
+	test_carry_addition(nes->accumulator, ~data, carry_bit);
+	nes->accumulator += (~data) + carry_bit;
+	test_negative_flag(nes->accumulator);
+	test_zero_flag(nes->accumulator);
 }
 
 void bitwise_and(unsigned char data)
 {
-	accumulator = data & accumulator;
-	test_negative_flag(accumulator);
-	test_zero_flag(accumulator);
+	nes->accumulator = data & nes->accumulator;
+	test_negative_flag(nes->accumulator);
+	test_zero_flag(nes->accumulator);
 }
 
 void bitwise_or(unsigned char data)
 {
-	accumulator = data | accumulator;
-	test_negative_flag(accumulator);
-	test_zero_flag(accumulator);
+	nes->accumulator = data | nes->accumulator;
+	test_negative_flag(nes->accumulator);
+	test_zero_flag(nes->accumulator);
 }
 
 void bitwise_xor(unsigned char data)
 {
-	accumulator = data ^ accumulator;
-	test_negative_flag(accumulator);
-	test_zero_flag(accumulator);
+	nes->accumulator = data ^ nes->accumulator;
+	test_negative_flag(nes->accumulator);
+	test_zero_flag(nes->accumulator);
 }
 
 void compare_register(unsigned char nes_register, unsigned char data)
@@ -346,7 +311,7 @@ unsigned char logical_shift_right(unsigned char data)
 
 unsigned char rotate_left(unsigned char data)
 {
-	unsigned char carry_bit = status_flags & 0b1;
+	unsigned char carry_bit = nes->status_flags & 0b1;
 	test_carry_left_shift(data);
 	data = (data << 1) | carry_bit;
 	test_negative_flag(data);
@@ -356,7 +321,7 @@ unsigned char rotate_left(unsigned char data)
 
 unsigned char rotate_right(unsigned char data)
 {
-	unsigned char carry_bit = (status_flags & 0b1) << 7;
+	unsigned char carry_bit = (nes->status_flags & 0b1) << 7;
 	test_carry_right_shift(data);
 	data = (data >> 1) | carry_bit;
 	test_negative_flag(data);
@@ -367,86 +332,88 @@ unsigned char rotate_right(unsigned char data)
 // Pushes a byte to the stack. The stack starts at $01FF and grows downward.
 void push_to_stack(unsigned char byte)
 {
-	access_cpu_memory(&byte, STACK_PAGE + stack_pointer, WRITE);
-	stack_pointer--;
+	access_cpu_memory(&byte, STACK_PAGE + nes->stack_pointer, WRITE);
+	nes->stack_pointer--;
 }
 
 void stack_dump()
 {
-	printf("STACK DUMP\n");
-	for (unsigned int i = 0x01FF; i > (STACK_PAGE + stack_pointer); i--)
+	core_log("STACK DUMP");
+	for (unsigned int i = 0x01FF; i > (STACK_PAGE + nes->stack_pointer); i--)
 	{
-		printf("%04X: %02X\n", i, cpu_ram[i]);
+		core_log("%04X: %02X", i, nes->cpu_ram[i]);
 	}
 }
 
 void cpu_save_state(FILE* save_file)
 {
-	fwrite(&accumulator, sizeof(char), 1, save_file);
-	fwrite(&x_register, sizeof(char), 1, save_file);
-	fwrite(&y_register, sizeof(char), 1, save_file);
-	fwrite(&program_counter, sizeof(int), 1, save_file);
-	fwrite(&stack_pointer, sizeof(char), 1, save_file);
-	fwrite(&status_flags, sizeof(char), 1, save_file);
-	fwrite(&oam_dma_active, sizeof(char), 1, save_file);
-	fwrite(&oam_dma_page, sizeof(char), 1, save_file);
-	fwrite(&oam_dma_write, sizeof(char), 1, save_file);
-	fwrite(&oam_dma_low, sizeof(char), 1, save_file);
-	fwrite(&total_cycles, sizeof(int), 1, save_file);
+	fwrite(&nes->accumulator, sizeof(char), 1, save_file);
+	fwrite(&nes->x_register, sizeof(char), 1, save_file);
+	fwrite(&nes->y_register, sizeof(char), 1, save_file);
+	fwrite(&nes->program_counter, sizeof(int), 1, save_file);
+	fwrite(&nes->stack_pointer, sizeof(char), 1, save_file);
+	fwrite(&nes->status_flags, sizeof(char), 1, save_file);
+	fwrite(&nes->oam_dma_active, sizeof(char), 1, save_file);
+	fwrite(&nes->oam_dma_page, sizeof(char), 1, save_file);
+	fwrite(&nes->oam_dma_write, sizeof(char), 1, save_file);
+	fwrite(&nes->oam_dma_low, sizeof(char), 1, save_file);
+	fwrite(&nes->total_cycles, sizeof(int), 1, save_file);
 	
-	fwrite(&timing_cycle, sizeof(char), 1, save_file);
-	fwrite(&next_timing_cycle, sizeof(char), 1, save_file);
-	fwrite(&address_bus, sizeof(int), 1, save_file);
-	fwrite(&address_low_bus, sizeof(char), 1, save_file);
-	fwrite(&address_high_bus, sizeof(char), 1, save_file);
-	fwrite(&data_bus, sizeof(char), 1, save_file);
-	fwrite(&execute_bus, sizeof(char), 1, save_file);
-	fwrite(&alu_in_a, sizeof(char), 1, save_file);
-	fwrite(&alu_in_b, sizeof(char), 1, save_file);
-	fwrite(&alu_out, sizeof(char), 1, save_file);
-	fwrite(&read_write, sizeof(char), 1, save_file);
-	fwrite(&interrupt_cycle, sizeof(char), 1, save_file);
-	fwrite(&interrupt_type, sizeof(char), 1, save_file);
+	fwrite(&nes->timing_cycle, sizeof(char), 1, save_file);
+	fwrite(&nes->next_timing_cycle, sizeof(char), 1, save_file);
+	fwrite(&nes->address_bus, sizeof(int), 1, save_file);
+	fwrite(&nes->address_low_bus, sizeof(char), 1, save_file);
+	fwrite(&nes->address_high_bus, sizeof(char), 1, save_file);
+	fwrite(&nes->data_bus, sizeof(char), 1, save_file);
+	fwrite(&nes->execute_bus, sizeof(char), 1, save_file);
+	fwrite(&nes->alu_in_a, sizeof(char), 1, save_file);
+	fwrite(&nes->alu_in_b, sizeof(char), 1, save_file);
+	fwrite(&nes->alu_out, sizeof(char), 1, save_file);
+	fwrite(&nes->read_write, sizeof(char), 1, save_file);
+	fwrite(&nes->interrupt_cycle, sizeof(char), 1, save_file);
+	fwrite(&nes->interrupt_type, sizeof(char), 1, save_file);
 	
-	fwrite(cpu_ram, sizeof(char), RAM_SIZE, save_file);
+	fwrite(nes->cpu_ram, sizeof(char), RAM_SIZE, save_file);
 }
 
 void cpu_load_state(FILE* save_file)
 {
-	fread(&accumulator, sizeof(char), 1, save_file);
-	fread(&x_register, sizeof(char), 1, save_file);
-	fread(&y_register, sizeof(char), 1, save_file);
-	fread(&program_counter, sizeof(int), 1, save_file);
-	fread(&stack_pointer, sizeof(char), 1, save_file);
-	fread(&status_flags, sizeof(char), 1, save_file);
-	fread(&oam_dma_active, sizeof(char), 1, save_file);
-	fread(&oam_dma_page, sizeof(char), 1, save_file);
-	fread(&oam_dma_write, sizeof(char), 1, save_file);
-	fread(&oam_dma_low, sizeof(char), 1, save_file);
-	fread(&total_cycles, sizeof(int), 1, save_file);
+	fread(&nes->accumulator, sizeof(char), 1, save_file);
+	fread(&nes->x_register, sizeof(char), 1, save_file);
+	fread(&nes->y_register, sizeof(char), 1, save_file);
+	fread(&nes->program_counter, sizeof(int), 1, save_file);
+	fread(&nes->stack_pointer, sizeof(char), 1, save_file);
+	fread(&nes->status_flags, sizeof(char), 1, save_file);
+	fread(&nes->oam_dma_active, sizeof(char), 1, save_file);
+	fread(&nes->oam_dma_page, sizeof(char), 1, save_file);
+	fread(&nes->oam_dma_write, sizeof(char), 1, save_file);
+	fread(&nes->oam_dma_low, sizeof(char), 1, save_file);
+	fread(&nes->total_cycles, sizeof(int), 1, save_file);
 	
-	fread(&timing_cycle, sizeof(char), 1, save_file);
-	fread(&next_timing_cycle, sizeof(char), 1, save_file);
-	fread(&address_bus, sizeof(int), 1, save_file);
-	fread(&address_low_bus, sizeof(char), 1, save_file);
-	fread(&address_high_bus, sizeof(char), 1, save_file);
-	fread(&data_bus, sizeof(char), 1, save_file);
-	fread(&execute_bus, sizeof(char), 1, save_file);
-	fread(&alu_in_a, sizeof(char), 1, save_file);
-	fread(&alu_in_b, sizeof(char), 1, save_file);
-	fread(&alu_out, sizeof(char), 1, save_file);
-	fread(&read_write, sizeof(char), 1, save_file);
-	fread(&interrupt_cycle, sizeof(char), 1, save_file);
-	fread(&interrupt_type, sizeof(char), 1, save_file);
+	fread(&nes->timing_cycle, sizeof(char), 1, save_file);
+	fread(&nes->next_timing_cycle, sizeof(char), 1, save_file);
+	fread(&nes->address_bus, sizeof(int), 1, save_file);
+	fread(&nes->address_low_bus, sizeof(char), 1, save_file);
+	fread(&nes->address_high_bus, sizeof(char), 1, save_file);
+	fread(&nes->data_bus, sizeof(char), 1, save_file);
+	fread(&nes->execute_bus, sizeof(char), 1, save_file);
+	fread(&nes->alu_in_a, sizeof(char), 1, save_file);
+	fread(&nes->alu_in_b, sizeof(char), 1, save_file);
+	fread(&nes->alu_out, sizeof(char), 1, save_file);
+	fread(&nes->read_write, sizeof(char), 1, save_file);
+	fread(&nes->interrupt_cycle, sizeof(char), 1, save_file);
+	fread(&nes->interrupt_type, sizeof(char), 1, save_file);
+	// The IRQ line isn't saved. Whoever's holding it says so again as their own state's loaded.
+	nes->irq_line = 0;
 	
-	fread(cpu_ram, sizeof(char), RAM_SIZE, save_file);
+	fread(nes->cpu_ram, sizeof(char), RAM_SIZE, save_file);
 }
 
 // Should indicate true for ASL, ROL, LSR, ROR, INC, and DEX.
 unsigned char is_rmw_instruction()
 {
-	unsigned char group = execute_bus & 0b00000011;
-	unsigned char function_bits = (execute_bus & 0b11000000) >> 6;
+	unsigned char group = nes->execute_bus & 0b00000011;
+	unsigned char function_bits = (nes->execute_bus & 0b11000000) >> 6;
 	return (group == 0b10) && ((function_bits == 0b00) || (function_bits == 0b01) || (function_bits == 0b11));
 }
 
@@ -458,155 +425,155 @@ void do_nothing()
 // Clears the overflow flag. There is no corresponding set opcode.
 void op_clv()
 {
-	status_flags = status_flags & 0b10111111;
+	nes->status_flags = nes->status_flags & 0b10111111;
 }
 
 // Sets the carry flag to bit 5 of the opcode.
 void op_T0_clc_sec()
 {
-	if ((execute_bus & 0b00100000) == 0b00100000)
+	if ((nes->execute_bus & 0b00100000) == 0b00100000)
 	{
-		status_flags = status_flags | 0b00000001;
+		nes->status_flags = nes->status_flags | 0b00000001;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11111110;
+		nes->status_flags = nes->status_flags & 0b11111110;
 	}
 }
 
 // Sets the interrupt flag to bit 5 of the opcode.
 void op_T0_cli_sei()
 {
-	if ((execute_bus & 0b00100000) == 0b00100000)
+	if ((nes->execute_bus & 0b00100000) == 0b00100000)
 	{
-		status_flags = status_flags | 0b00000100;
+		nes->status_flags = nes->status_flags | 0b00000100;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11111011;
+		nes->status_flags = nes->status_flags & 0b11111011;
 	}
 }
 
 // Sets the decimal flag to bit 5 of the opcode.
 void op_T0_cld_sed()
 {
-	if ((execute_bus & 0b00100000) == 0b00100000)
+	if ((nes->execute_bus & 0b00100000) == 0b00100000)
 	{
-		status_flags = status_flags | 0b00001000;
+		nes->status_flags = nes->status_flags | 0b00001000;
 	}
 	else
 	{
-		status_flags = status_flags & 0b11110111;
+		nes->status_flags = nes->status_flags & 0b11110111;
 	}
 }
 
 void op_T0_lda()
 {
-	load_register(&accumulator, data_bus);
+	load_register(&nes->accumulator, nes->data_bus);
 }
 
 void op_T0_ldx()
 {
-	load_register(&x_register, data_bus);
+	load_register(&nes->x_register, nes->data_bus);
 }
 
 void op_T0_ldy()
 {
-	load_register(&y_register, data_bus);
+	load_register(&nes->y_register, nes->data_bus);
 }
 
 void op_T0_and()
 {
-	bitwise_and(data_bus);
+	bitwise_and(nes->data_bus);
 }
 
 void op_T0_ora()
 {
-	bitwise_or(data_bus);
+	bitwise_or(nes->data_bus);
 }
 
 void op_T0_eor()
 {
-	bitwise_xor(data_bus);
+	bitwise_xor(nes->data_bus);
 }
 
 void op_T0_adc()
 {
-	add_with_carry(data_bus);
+	add_with_carry(nes->data_bus);
 }
 
 void op_T0_sbc()
 {
-	subtract_with_carry(data_bus);
+	subtract_with_carry(nes->data_bus);
 }
 
 void op_T0_cmp()
 {
-	compare_register(accumulator, data_bus);
+	compare_register(nes->accumulator, nes->data_bus);
 }
 
 void op_T0_cpx()
 {
-	compare_register(x_register, data_bus);
+	compare_register(nes->x_register, nes->data_bus);
 }
 
 void op_T0_cpy()
 {
-	compare_register(y_register, data_bus);
+	compare_register(nes->y_register, nes->data_bus);
 }
 
 void op_T0_sta()
 {
 	// Bit of a hack to keep it from trying to do a write on immediate,
 	// thus turning it into a NOP #i as it's supposed to be.
-	if (timing_cycle == 0b000001)
+	if (nes->timing_cycle == 0b000001)
 	{
-		data_bus = accumulator;
+		nes->data_bus = nes->accumulator;
 	}
 }
 
 void op_T0_stx()
 {
-	data_bus = x_register;
+	nes->data_bus = nes->x_register;
 }
 
 void op_T0_sty()
 {
-	data_bus = y_register;
+	nes->data_bus = nes->y_register;
 }
 
 void op_T0_inc()
 {
-	data_bus++;
-	test_negative_flag(data_bus);
-	test_zero_flag(data_bus);
+	nes->data_bus++;
+	test_negative_flag(nes->data_bus);
+	test_zero_flag(nes->data_bus);
 }
 
 void op_T0_dec()
 {
-	data_bus--;
-	test_negative_flag(data_bus);
-	test_zero_flag(data_bus);
+	nes->data_bus--;
+	test_negative_flag(nes->data_bus);
+	test_zero_flag(nes->data_bus);
 }
 
 void op_T0_asl()
 {
-	data_bus = arithmetic_shift_left(data_bus);
+	nes->data_bus = arithmetic_shift_left(nes->data_bus);
 }
 
 void op_T0_lsr()
 {
-	data_bus = logical_shift_right(data_bus);
+	nes->data_bus = logical_shift_right(nes->data_bus);
 }
 
 void op_T0_rol()
 {
-	data_bus = rotate_left(data_bus);
+	nes->data_bus = rotate_left(nes->data_bus);
 }
 
 void op_T0_ror()
 {
-	data_bus = rotate_right(data_bus);
+	nes->data_bus = rotate_right(nes->data_bus);
 }
 
 // Bit of a hacky solution, although I believe it roughly imitates the CPU.
@@ -617,29 +584,29 @@ void op_T0_ror()
 // T5 in indirect,X and indirect,Y mode
 void op_sta()
 {
-	char addressing_mode = (execute_bus & 0b00011100) >> 2;
-	if (((addressing_mode == 0b001) && (timing_cycle == 0b000100))
-		|| (((addressing_mode == 0b101) || (addressing_mode == 0b011)) && (timing_cycle == 0b001000))
-		|| (((addressing_mode == 0b111) || (addressing_mode == 0b110)) && (timing_cycle == 0b010000))
-		|| (((addressing_mode == 0b100) || (addressing_mode == 0b000)) && (timing_cycle == 0b100000)))
+	char addressing_mode = (nes->execute_bus & 0b00011100) >> 2;
+	if (((addressing_mode == 0b001) && (nes->timing_cycle == 0b000100))
+		|| (((addressing_mode == 0b101) || (addressing_mode == 0b011)) && (nes->timing_cycle == 0b001000))
+		|| (((addressing_mode == 0b111) || (addressing_mode == 0b110)) && (nes->timing_cycle == 0b010000))
+		|| (((addressing_mode == 0b100) || (addressing_mode == 0b000)) && (nes->timing_cycle == 0b100000)))
 	{
-		read_write = 0;
+		nes->read_write = 0;
 	}
 }
 
 void op_rmw()
 {
-	if (read_write == 0)
+	if (nes->read_write == 0)
 	{
-		next_timing_cycle = 0b000001;
+		nes->next_timing_cycle = 0b000001;
 	}
 	
-	char addressing_mode = (execute_bus & 0b00011100) >> 2;
-	if (((addressing_mode == 0b001) && (timing_cycle == 0b001000))
-		|| (((addressing_mode == 0b101) || (addressing_mode == 0b011)) && (timing_cycle == 0b010000))
-		|| ((addressing_mode == 0b111) && (timing_cycle == 0b100000)))
+	char addressing_mode = (nes->execute_bus & 0b00011100) >> 2;
+	if (((addressing_mode == 0b001) && (nes->timing_cycle == 0b001000))
+		|| (((addressing_mode == 0b101) || (addressing_mode == 0b011)) && (nes->timing_cycle == 0b010000))
+		|| ((addressing_mode == 0b111) && (nes->timing_cycle == 0b100000)))
 	{
-		read_write = 0;
+		nes->read_write = 0;
 	}
 }
 
@@ -657,113 +624,113 @@ void op_asl_rol()
 // make sure the next cycle is T1 (to override T0+T2 rolling into T1+T3).
 void op_T0()
 {
-	next_timing_cycle = 0b000010;
-	address_low_bus = program_counter & 0x00FF;
-	address_high_bus = (program_counter >> 8) & 0x00FF;
-	read_write = 1;
+	nes->next_timing_cycle = 0b000010;
+	nes->address_low_bus = nes->program_counter & 0x00FF;
+	nes->address_high_bus = (nes->program_counter >> 8) & 0x00FF;
+	nes->read_write = 1;
 }
 
 void op_T1_asl_acc()
 {
-	accumulator = arithmetic_shift_left(accumulator);
+	nes->accumulator = arithmetic_shift_left(nes->accumulator);
 }
 
 void op_T1_lsr_acc()
 {
-	accumulator = logical_shift_right(accumulator);
+	nes->accumulator = logical_shift_right(nes->accumulator);
 }
 
 void op_T1_rol_acc()
 {
-	accumulator = rotate_left(accumulator);
+	nes->accumulator = rotate_left(nes->accumulator);
 }
 
 void op_T1_ror_acc()
 {
-	accumulator = rotate_right(accumulator);
+	nes->accumulator = rotate_right(nes->accumulator);
 }
 
 // Artificial line. It looks like ALU instructions always increment the
 // program counter on T2.
 void op_T2_acc()
 {
-	program_counter++;
+	nes->program_counter++;
 }
 
 void op_T2_zp_abs()
 {
-	program_counter++;
+	nes->program_counter++;
 }
 
 // Need to read the next byte for address high, but address low needs
 // to be stuffed somewhere to use later.
 void op_T2_abs()
 {
-	address_low_bus = (program_counter + 1) & 0x00FF;
-	address_high_bus = ((program_counter + 1) >> 8) & 0x00FF;
-	alu_in_b = data_bus;
+	nes->address_low_bus = (nes->program_counter + 1) & 0x00FF;
+	nes->address_high_bus = ((nes->program_counter + 1) >> 8) & 0x00FF;
+	nes->alu_in_b = nes->data_bus;
 }
 
 // Artificial line. Stores x in alua and the low address byte in
 // alub to be added together next cycle.
 void op_T2_abs_x()
 {
-	address_low_bus = (program_counter + 1) & 0x00FF;
-	address_high_bus = ((program_counter + 1) >> 8) & 0x00FF;
+	nes->address_low_bus = (nes->program_counter + 1) & 0x00FF;
+	nes->address_high_bus = ((nes->program_counter + 1) >> 8) & 0x00FF;
 	// LDX and STX need to use Y for indexing instead.
-	if ((execute_bus & 0b11011110) == 0b10011110)
+	if ((nes->execute_bus & 0b11011110) == 0b10011110)
 	{
-		alu_in_a = y_register;
+		nes->alu_in_a = nes->y_register;
 	}
 	else
 	{
-		alu_in_a = x_register;
+		nes->alu_in_a = nes->x_register;
 	}
 	
-	alu_in_b = data_bus;
+	nes->alu_in_b = nes->data_bus;
 }
 
 // Stores y in alua and the low address byte in
 // alub to be added together next cycle.
 void op_T2_abs_y()
 {
-	address_low_bus = (program_counter + 1) & 0x00FF;
-	address_high_bus = ((program_counter + 1) >> 8) & 0x00FF;
-	alu_in_a = y_register;
-	alu_in_b = data_bus;
+	nes->address_low_bus = (nes->program_counter + 1) & 0x00FF;
+	nes->address_high_bus = ((nes->program_counter + 1) >> 8) & 0x00FF;
+	nes->alu_in_a = nes->y_register;
+	nes->alu_in_b = nes->data_bus;
 }
 
 // Zero page opcodes reset the timing cycle at T2.
 void op_T2_mem_zp()
 {
-	address_low_bus = data_bus;
-	address_high_bus = 0;
+	nes->address_low_bus = nes->data_bus;
+	nes->address_high_bus = 0;
 	if (!is_rmw_instruction())
 	{
-		next_timing_cycle = 0b000001;
+		nes->next_timing_cycle = 0b000001;
 	}
 }
 
 void op_T2_ind_y()
 {
-	address_low_bus = data_bus;
-	address_high_bus = 0;
+	nes->address_low_bus = nes->data_bus;
+	nes->address_high_bus = 0;
 }
 
 void op_T3_ind_y()
 {
-	address_low_bus++;
-	alu_in_b = data_bus;
+	nes->address_low_bus++;
+	nes->alu_in_b = nes->data_bus;
 }
 
 void op_T4_ind_y()
 {
-	address_low_bus = y_register + alu_in_b;
-	address_high_bus = data_bus;
+	nes->address_low_bus = nes->y_register + nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
 	// Add an extra cycle if the sum overflowed or in write instructions.
-	if ((address_low_bus >= alu_in_b) && ((0b11100001 & execute_bus) != 0b10000001))
+	if ((nes->address_low_bus >= nes->alu_in_b) && ((0b11100001 & nes->execute_bus) != 0b10000001))
 	{
-		next_timing_cycle = 0b000001;
+		nes->next_timing_cycle = 0b000001;
 	}
 }
 
@@ -771,43 +738,43 @@ void op_T5_ind_y()
 {
 	// Confirm that the sum overflowed, since the extra cycle also might be
 	// for a write.
-	if (address_low_bus < alu_in_b)
+	if (nes->address_low_bus < nes->alu_in_b)
 	{
-		address_high_bus++;
+		nes->address_high_bus++;
 	}
-	next_timing_cycle = 0b000001;
+	nes->next_timing_cycle = 0b000001;
 }
 
 void op_T2_ind_x()
 {
-	address_low_bus = data_bus;
-	address_high_bus = 0;
-	alu_in_b = data_bus;
-	alu_in_a = x_register;
+	nes->address_low_bus = nes->data_bus;
+	nes->address_high_bus = 0;
+	nes->alu_in_b = nes->data_bus;
+	nes->alu_in_a = nes->x_register;
 }
 
 void op_T3_ind_x()
 {
-	address_low_bus = alu_in_a + alu_in_b;
+	nes->address_low_bus = nes->alu_in_a + nes->alu_in_b;
 }
 
 void op_T4_ind_x()
 {
-	alu_in_b = data_bus;
-	address_low_bus++;
+	nes->alu_in_b = nes->data_bus;
+	nes->address_low_bus++;
 }
 
 void op_T5_ind_x()
 {
-	address_low_bus = alu_in_b;
-	address_high_bus = data_bus;
-	next_timing_cycle = 0b000001;
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
+	nes->next_timing_cycle = 0b000001;
 }
 
 void op_T2_mem_zp_idx()
 {
-	address_low_bus = data_bus;
-	address_high_bus = 0;
+	nes->address_low_bus = nes->data_bus;
+	nes->address_high_bus = 0;
 }
 
 // Add X register to address low for indexed zero page. Timing cycle also
@@ -815,17 +782,17 @@ void op_T2_mem_zp_idx()
 void op_T3_mem_zp_idx()
 {
 	// LDX and STX need to use Y for indexing instead.
-	if ((execute_bus & 0b11011110) == 0b10010110)
+	if ((nes->execute_bus & 0b11011110) == 0b10010110)
 	{
-		address_low_bus += y_register;
+		nes->address_low_bus += nes->y_register;
 	}
 	else
 	{
-		address_low_bus += x_register;
+		nes->address_low_bus += nes->x_register;
 	}
 	if (!is_rmw_instruction())
 	{
-		next_timing_cycle = 0b000001;
+		nes->next_timing_cycle = 0b000001;
 	}
 }
 
@@ -833,29 +800,29 @@ void op_T3_mem_zp_idx()
 // Timing cycle also resets here.
 void op_T3_mem_abs()
 {
-	address_low_bus = alu_in_b;
-	address_high_bus = data_bus;
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
 	// Continue to next cycle on RMW instructions or JMP indirect.
-	if ((!is_rmw_instruction()) && (execute_bus != 0b01101100))
+	if ((!is_rmw_instruction()) && (nes->execute_bus != 0b01101100))
 	{
-		next_timing_cycle = 0b000001;
+		nes->next_timing_cycle = 0b000001;
 	}
-	program_counter++;
+	nes->program_counter++;
 }
 
 // Sum the low address byte with X to get the indexed address. Check if
 // we need to spend another cycle on page crossing.
 void op_T3_abs_idx()
 {
-	address_low_bus = alu_in_a + alu_in_b;
-	address_high_bus = data_bus;
+	nes->address_low_bus = nes->alu_in_a + nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
 	// Add an extra cycle if the sum overflowed or in STA instructions.
-	if ((address_low_bus >= alu_in_b) && ((0b11100001 & execute_bus) != 0b10000001)
+	if ((nes->address_low_bus >= nes->alu_in_b) && ((0b11100001 & nes->execute_bus) != 0b10000001)
 		&& (!is_rmw_instruction()))
 	{
-		next_timing_cycle = 0b000001;
+		nes->next_timing_cycle = 0b000001;
 	}
-	program_counter++;
+	nes->program_counter++;
 }
 
 // Extra cycle for indexed absolute, for handling page crossing.
@@ -863,343 +830,343 @@ void op_T4_abs_idx()
 {
 	// Confirm that the sum overflowed, since the extra cycle also might be
 	// for a write.
-	if (address_low_bus < alu_in_b)
+	if (nes->address_low_bus < nes->alu_in_b)
 	{
-		address_high_bus++;
+		nes->address_high_bus++;
 	}
 	if (!is_rmw_instruction())
 	{
-		next_timing_cycle = 0b000001;
+		nes->next_timing_cycle = 0b000001;
 	}
 }
 
 void op_T2_branch()
 {
-	address_low_bus = program_counter & 0x00FF;
-	address_high_bus = (program_counter >> 8) & 0x00FF;
+	nes->address_low_bus = nes->program_counter & 0x00FF;
+	nes->address_high_bus = (nes->program_counter >> 8) & 0x00FF;
 	
-	unsigned char op_bit_7 = (execute_bus >> 7) & 0b1;
-	unsigned char op_bit_6 = (execute_bus >> 6) & 0b1;
-	unsigned char flag_compare = (execute_bus >> 5) & 0b1;
+	unsigned char op_bit_7 = (nes->execute_bus >> 7) & 0b1;
+	unsigned char op_bit_6 = (nes->execute_bus >> 6) & 0b1;
+	unsigned char flag_compare = (nes->execute_bus >> 5) & 0b1;
 	// Determines which bit from the status flags to compare to.
 	unsigned char flag_select = (0b111 ^ op_bit_6) ^ (0b111 * op_bit_7);
-	unsigned char flag_bit = (status_flags >> flag_select) & 0b1;
+	unsigned char flag_bit = (nes->status_flags >> flag_select) & 0b1;
 	if (flag_compare != flag_bit)
 	{
-		next_timing_cycle = 0b000010;
+		nes->next_timing_cycle = 0b000010;
 	}
-	program_counter++;
+	nes->program_counter++;
 }
 
 void op_T3_branch()
 {
-	alu_in_a = data_bus;
-	alu_in_b = address_low_bus;
-	alu_out = alu_in_a + alu_in_b;
-	address_low_bus = alu_out;
+	nes->alu_in_a = nes->data_bus;
+	nes->alu_in_b = nes->address_low_bus;
+	nes->alu_out = nes->alu_in_a + nes->alu_in_b;
+	nes->address_low_bus = nes->alu_out;
 	// Check overflow as a signed number. If it did overflow, need to add a cycle
 	// for page crossing.
-	if ((alu_out >= alu_in_a) == ((alu_in_a & 0b10000000) == 0b10000000))
+	if ((nes->alu_out >= nes->alu_in_a) == ((nes->alu_in_a & 0b10000000) == 0b10000000))
 	{
-		next_timing_cycle = 0b00000001;
+		nes->next_timing_cycle = 0b00000001;
 	}
 	else
 	{
-		next_timing_cycle = 0b00000010;
+		nes->next_timing_cycle = 0b00000010;
 	}
-	program_counter = address_low_bus | (address_high_bus << 8);
-	program_counter++;
+	nes->program_counter = nes->address_low_bus | (nes->address_high_bus << 8);
+	nes->program_counter++;
 }
 
 void op_T0_branch()
 {
 	// Decrement adh if the branch amount was negative. Otherwise increment it.
-	if ((alu_in_a & 0b10000000) == 0b10000000)
+	if ((nes->alu_in_a & 0b10000000) == 0b10000000)
 	{
-		address_high_bus--;
+		nes->address_high_bus--;
 	}
 	else
 	{
-		address_high_bus++;
+		nes->address_high_bus++;
 	}
-	program_counter = address_low_bus | (address_high_bus << 8);
-	program_counter++;
+	nes->program_counter = nes->address_low_bus | (nes->address_high_bus << 8);
+	nes->program_counter++;
 }
 
 void op_T2_jmp_abs()
 {
-	next_timing_cycle = 0b000001;
-	address_low_bus = (program_counter + 1) & 0x00FF;
-	address_high_bus = ((program_counter + 1) >> 8) & 0x00FF;
+	nes->next_timing_cycle = 0b000001;
+	nes->address_low_bus = (nes->program_counter + 1) & 0x00FF;
+	nes->address_high_bus = ((nes->program_counter + 1) >> 8) & 0x00FF;
 }
 
 void op_T0_jmp()
 {
-	address_low_bus = alu_in_b;
-	address_high_bus = data_bus;
-	address_bus = address_low_bus | (address_high_bus << 8);
-	program_counter = address_bus;
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
+	nes->address_bus = nes->address_low_bus | (nes->address_high_bus << 8);
+	nes->program_counter = nes->address_bus;
 }
 
 void op_T3_jmp()
 {
-	address_low_bus = alu_in_b;
-	address_high_bus = data_bus;
-	address_bus = address_low_bus | (address_high_bus << 8);
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
+	nes->address_bus = nes->address_low_bus | (nes->address_high_bus << 8);
 }
 
 void op_T4_jmp()
 {
-	alu_in_b = data_bus;
-	address_low_bus++;
-	next_timing_cycle = 0b000001;
+	nes->alu_in_b = nes->data_bus;
+	nes->address_low_bus++;
+	nes->next_timing_cycle = 0b000001;
 }
 
 void op_T0_bit()
 {
-	test_zero_flag(data_bus & accumulator);
-	status_flags = (status_flags & 0b00111111) | (data_bus & 0b11000000);
+	test_zero_flag(nes->data_bus & nes->accumulator);
+	nes->status_flags = (nes->status_flags & 0b00111111) | (nes->data_bus & 0b11000000);
 }
 
 void op_T2_imm()
 {
-	program_counter++;
+	nes->program_counter++;
 }
 
 void op_T2_php_pha()
 {
-	read_write = 0;
-	next_timing_cycle = 0b000001;
-	address_low_bus = stack_pointer;
-	address_high_bus = 0x01;
+	nes->read_write = 0;
+	nes->next_timing_cycle = 0b000001;
+	nes->address_low_bus = nes->stack_pointer;
+	nes->address_high_bus = 0x01;
 }
 
 void op_T0_pha()
 {
-	data_bus = accumulator;
-	stack_pointer--;
+	nes->data_bus = nes->accumulator;
+	nes->stack_pointer--;
 }
 
 void op_T0_php()
 {
-	data_bus = (status_flags | 0b00110000);
-	stack_pointer--;
+	nes->data_bus = (nes->status_flags | 0b00110000);
+	nes->stack_pointer--;
 }
 
 void op_T2_stack_pull()
 {
-	address_low_bus = stack_pointer;
-	address_high_bus = 0x01;
+	nes->address_low_bus = nes->stack_pointer;
+	nes->address_high_bus = 0x01;
 }
 
 void op_T3_pla_pha()
 {
-	stack_pointer++;
-	address_low_bus = stack_pointer;
-	next_timing_cycle = 0b000001;
+	nes->stack_pointer++;
+	nes->address_low_bus = nes->stack_pointer;
+	nes->next_timing_cycle = 0b000001;
 }
 
 void op_T0_plp()
 {
-	status_flags = data_bus;
+	nes->status_flags = nes->data_bus;
 }
 
 void op_T0_pla()
 {
-	accumulator = data_bus;
-	test_zero_flag(accumulator);
-	test_negative_flag(accumulator);
+	nes->accumulator = nes->data_bus;
+	test_zero_flag(nes->accumulator);
+	test_negative_flag(nes->accumulator);
 }
 
 void op_T3_rti_rts()
 {
-	stack_pointer++;
-	address_low_bus = stack_pointer;
+	nes->stack_pointer++;
+	nes->address_low_bus = nes->stack_pointer;
 }
 
 void op_T4_rti_rts()
 {
-	alu_in_b = data_bus;
-	stack_pointer++;
-	address_low_bus = stack_pointer;
+	nes->alu_in_b = nes->data_bus;
+	nes->stack_pointer++;
+	nes->address_low_bus = nes->stack_pointer;
 }
 
 void op_T5_rts()
 {
-	address_low_bus = alu_in_b;
-	address_high_bus = data_bus;
-	address_bus = address_low_bus | (address_high_bus << 8);
-	program_counter = address_bus;
-	next_timing_cycle = 0b000001;
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
+	nes->address_bus = nes->address_low_bus | (nes->address_high_bus << 8);
+	nes->program_counter = nes->address_bus;
+	nes->next_timing_cycle = 0b000001;
 }
 
 void op_T0_rts()
 {
-	program_counter++;
+	nes->program_counter++;
 }
 
 void op_T5_rti()
 {
-	status_flags = alu_in_b;
-	alu_in_b = data_bus;
-	stack_pointer++;
-	address_low_bus = stack_pointer;
-	next_timing_cycle = 0b000001;
+	nes->status_flags = nes->alu_in_b;
+	nes->alu_in_b = nes->data_bus;
+	nes->stack_pointer++;
+	nes->address_low_bus = nes->stack_pointer;
+	nes->next_timing_cycle = 0b000001;
 }
 
 void op_T0_rti()
 {
-	address_low_bus = alu_in_b;
-	address_high_bus = data_bus;
-	address_bus = address_low_bus | (address_high_bus << 8);
-	program_counter = address_bus;
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
+	nes->address_bus = nes->address_low_bus | (nes->address_high_bus << 8);
+	nes->program_counter = nes->address_bus;
 }
 
 void op_T2_jsr()
 {
-	alu_in_b = stack_pointer;
-	stack_pointer = data_bus;
-	address_low_bus = alu_in_b;
-	address_high_bus = 0x01;
-	program_counter++;
+	nes->alu_in_b = nes->stack_pointer;
+	nes->stack_pointer = nes->data_bus;
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = 0x01;
+	nes->program_counter++;
 }
 
 void op_T3_jsr()
 {
-	read_write = 0;
+	nes->read_write = 0;
 }
 
 void op_T4_jsr()
 {
-	data_bus = (program_counter >> 8) & 0xFF;
-	address_low_bus--;
+	nes->data_bus = (nes->program_counter >> 8) & 0xFF;
+	nes->address_low_bus--;
 }
 
 void op_T5_jsr_first_half()
 {
-	data_bus = program_counter & 0xFF;
-	alu_in_a = address_bus & 0xFF;
-	alu_in_a--;
-	next_timing_cycle = 0b000001;
+	nes->data_bus = nes->program_counter & 0xFF;
+	nes->alu_in_a = nes->address_bus & 0xFF;
+	nes->alu_in_a--;
+	nes->next_timing_cycle = 0b000001;
 }
 
 void op_T5_jsr_second_half()
 {
-	address_low_bus = program_counter & 0xFF;;
-	address_high_bus = (program_counter >> 8) & 0xFF;;
-	address_bus = address_low_bus | (address_high_bus << 8);
-	read_write = 1;
+	nes->address_low_bus = nes->program_counter & 0xFF;;
+	nes->address_high_bus = (nes->program_counter >> 8) & 0xFF;;
+	nes->address_bus = nes->address_low_bus | (nes->address_high_bus << 8);
+	nes->read_write = 1;
 }
 
 void op_T0_jsr()
 {
-	program_counter = (data_bus << 8) | stack_pointer;
-	stack_pointer = alu_in_a;
+	nes->program_counter = (nes->data_bus << 8) | nes->stack_pointer;
+	nes->stack_pointer = nes->alu_in_a;
 }
 
 void op_T0_txa()
 {
-	load_register(&accumulator, x_register);
+	load_register(&nes->accumulator, nes->x_register);
 }
 
 void op_T0_tax()
 {
-	load_register(&x_register, accumulator);
+	load_register(&nes->x_register, nes->accumulator);
 }
 
 void op_T0_txs()
 {
-	stack_pointer = x_register;
+	nes->stack_pointer = nes->x_register;
 }
 
 void op_T0_tsx()
 {
-	x_register = stack_pointer;
-	test_negative_flag(x_register);
-	test_zero_flag(x_register);
+	nes->x_register = nes->stack_pointer;
+	test_negative_flag(nes->x_register);
+	test_zero_flag(nes->x_register);
 }
 
 void op_T0_dex()
 {
-	x_register--;
-	test_negative_flag(x_register);
-	test_zero_flag(x_register);
+	nes->x_register--;
+	test_negative_flag(nes->x_register);
+	test_zero_flag(nes->x_register);
 }
 
 void op_T0_inx()
 {
-	x_register++;
-	test_negative_flag(x_register);
-	test_zero_flag(x_register);
+	nes->x_register++;
+	test_negative_flag(nes->x_register);
+	test_zero_flag(nes->x_register);
 }
 
 void op_T0_tya()
 {
-	load_register(&accumulator, y_register);
+	load_register(&nes->accumulator, nes->y_register);
 }
 
 void op_T0_tay()
 {
-	load_register(&y_register, accumulator);
+	load_register(&nes->y_register, nes->accumulator);
 }
 
 void op_T0_dey()
 {
-	y_register--;
-	test_negative_flag(y_register);
-	test_zero_flag(y_register);
+	nes->y_register--;
+	test_negative_flag(nes->y_register);
+	test_zero_flag(nes->y_register);
 }
 
 void op_T0_iny()
 {
-	y_register++;
-	test_negative_flag(y_register);
-	test_zero_flag(y_register);
+	nes->y_register++;
+	test_negative_flag(nes->y_register);
+	test_zero_flag(nes->y_register);
 }
 
 void op_brk_stack()
 {
-	address_low_bus = stack_pointer;
-	address_high_bus = 0x01;
-	stack_pointer--;
-	read_write = 0;
+	nes->address_low_bus = nes->stack_pointer;
+	nes->address_high_bus = 0x01;
+	nes->stack_pointer--;
+	nes->read_write = 0;
 }
 
 void op_T3_brk()
 {
-	data_bus = ((program_counter + 1) >> 8) & 0xFF;
+	nes->data_bus = ((nes->program_counter + 1) >> 8) & 0xFF;
 }
 
 void op_T4_brk()
 {
-	data_bus = (program_counter + 1) & 0xFF;
+	nes->data_bus = (nes->program_counter + 1) & 0xFF;
 }
 
 void op_T5_brk()
 {
-	data_bus = (status_flags | 0b00110000);
-	address_low_bus = 0xFE;
-	address_high_bus = 0xFF;
-	read_write = 1;
-	status_flags = status_flags | 0b00000100;
+	nes->data_bus = (nes->status_flags | 0b00110000);
+	nes->address_low_bus = 0xFE;
+	nes->address_high_bus = 0xFF;
+	nes->read_write = 1;
+	nes->status_flags = nes->status_flags | 0b00000100;
 }
 
 void op_brk()
 {
-	if (timing_cycle == 0)
+	if (nes->timing_cycle == 0)
 	{
-		address_low_bus = 0xFF;
-		address_high_bus = 0xFF;
-		alu_in_b = data_bus;
-		next_timing_cycle = 0b000001;
+		nes->address_low_bus = 0xFF;
+		nes->address_high_bus = 0xFF;
+		nes->alu_in_b = nes->data_bus;
+		nes->next_timing_cycle = 0b000001;
 	}
 }
 
 void op_T0_brk()
 {
-	address_low_bus = alu_in_b;
-	address_high_bus = data_bus;
-	program_counter = address_low_bus | (address_high_bus << 8);
+	nes->address_low_bus = nes->alu_in_b;
+	nes->address_high_bus = nes->data_bus;
+	nes->program_counter = nes->address_low_bus | (nes->address_high_bus << 8);
 }
 
 // Two-cycle instructions have an odd behavior where T0 and T2 run at the
@@ -1207,38 +1174,38 @@ void op_T0_brk()
 // instructions, which is reproduced here.
 void activate_T0_for_two_cycle_op()
 {
-	if (((execute_bus & 0b00011101) == 0b00001001)
-		|| ((execute_bus & 0b10011101) == 0b10000000)
-		|| (((execute_bus & 0b00001101) == 0b00001000) && !((execute_bus & 0b10010010) == 0b00000000)))
+	if (((nes->execute_bus & 0b00011101) == 0b00001001)
+		|| ((nes->execute_bus & 0b10011101) == 0b10000000)
+		|| (((nes->execute_bus & 0b00001101) == 0b00001000) && !((nes->execute_bus & 0b10010010) == 0b00000000)))
 	{
-		timing_cycle = timing_cycle | 0b000001;
+		nes->timing_cycle = nes->timing_cycle | 0b000001;
 	}
 }
 
 // Carries out the operations of the current opcode for this cycle.
 void execute_opcode()
 {
-	if ((timing_cycle & 0b0000100) == 0b0000100)
+	if ((nes->timing_cycle & 0b0000100) == 0b0000100)
 	{
-		access_cpu_memory(&execute_bus, program_counter, READ);
-		program_counter++;
-		address_bus = program_counter;
+		access_cpu_memory(&nes->execute_bus, nes->program_counter, READ);
+		nes->program_counter++;
+		nes->address_bus = nes->program_counter;
 	}
 	
-	unsigned char prev_read_write = read_write;
+	unsigned char prev_read_write = nes->read_write;
 	
 	if (prev_read_write == 1)
 	{
-		access_cpu_memory(&data_bus, address_bus, READ);
+		access_cpu_memory(&nes->data_bus, nes->address_bus, READ);
 	}
 	
 	//printf("%04X: OP:%02X A:%02X X:%02X Y:%02X D:%02X ADL:%02X ADH:%02X ADB:%04X RW:%02X T:%02X CYC:%d\n", program_counter - 1, execute_bus, accumulator, x_register, y_register, data_bus, address_low_bus, address_high_bus, address_bus, prev_read_write, timing_cycle, total_cycles);
 	
 	// Assuming the default behavior is to shift to the next timing cycle.
-	next_timing_cycle = (timing_cycle << 1) & 0b111111;
+	nes->next_timing_cycle = (nes->timing_cycle << 1) & 0b111111;
 	
 	// This should go earlier, but this is kinda necessary for now.
-	if ((timing_cycle & 0b000100) == 0b000100)
+	if ((nes->timing_cycle & 0b000100) == 0b000100)
 	{
 		activate_T0_for_two_cycle_op();
 	}
@@ -1246,7 +1213,7 @@ void execute_opcode()
 	for (unsigned int i = 0; i < FIRST_HALF_DECODE_LINES; i++)
 	{
 		// Activate this op if we're on the right timing cycle, and the current opcode matches the pattern.
-		if (((execute_bus & decode_lines_first_half[i].opcode_mask) == decode_lines_first_half[i].opcode_bits) && ((timing_cycle & decode_lines_first_half[i].timing) == decode_lines_first_half[i].timing))
+		if (((nes->execute_bus & decode_lines_first_half[i].opcode_mask) == decode_lines_first_half[i].opcode_bits) && ((nes->timing_cycle & decode_lines_first_half[i].timing) == decode_lines_first_half[i].timing))
 		{
 			decode_lines_first_half[i].rom_op();
 		}
@@ -1254,30 +1221,43 @@ void execute_opcode()
 	
 	if (prev_read_write == 0)
 	{
-		access_cpu_memory(&data_bus, address_bus, WRITE);
+		access_cpu_memory(&nes->data_bus, nes->address_bus, WRITE);
 	}
 	
-	if ((timing_cycle & 0b000010) == 0b000010)
+	if ((nes->timing_cycle & 0b000010) == 0b000010)
 	{
-		address_low_bus = program_counter & 0x00FF;
-		address_high_bus = (program_counter >> 8) & 0x00FF;
+		nes->address_low_bus = nes->program_counter & 0x00FF;
+		nes->address_high_bus = (nes->program_counter >> 8) & 0x00FF;
 	}
 	
 	for (unsigned int i = 0; i < SECOND_HALF_DECODE_LINES; i++)
 	{
 		// Activate this op if we're on the right timing cycle, and the current opcode matches the pattern.
-		if (((execute_bus & decode_lines_second_half[i].opcode_mask) == decode_lines_second_half[i].opcode_bits) && ((timing_cycle & decode_lines_second_half[i].timing) == decode_lines_second_half[i].timing))
+		if (((nes->execute_bus & decode_lines_second_half[i].opcode_mask) == decode_lines_second_half[i].opcode_bits) && ((nes->timing_cycle & decode_lines_second_half[i].timing) == decode_lines_second_half[i].timing))
 		{
 			decode_lines_second_half[i].rom_op();
 		}
 	}
 	
-	address_bus = address_low_bus | (address_high_bus << 8);
+	nes->address_bus = nes->address_low_bus | (nes->address_high_bus << 8);
 	
-	timing_cycle = next_timing_cycle;
+	nes->timing_cycle = nes->next_timing_cycle;
 	
 }
 
+// Holds the IRQ line down for source, or lets go of it. The line stays down while any source is holding it.
+void set_irq(unsigned char source, unsigned char raised)
+{
+	if (raised)
+	{
+		nes->irq_line |= source;
+	}
+	else
+	{
+		nes->irq_line &= ~source;
+	}
+}
+
 // Runs a single cycle of the CPU.
 // This means that, unlike run_opcode, it's necessary to break down what each
 // opcode does on each cycle, and perform only those operations on the
@@ -1287,116 +1267,126 @@ void execute_opcode()
 // behaving correctly on every cycle.
 void cpu_tick()
 {
-	// If an interrupt is pending, the CPU is set to react to it (IRQ enabled, or it's an NMI) and we aren't in the middle of
-	// an interrupt already, begin the interrupt process.
-	if (pending_interrupt && ((timing_cycle & 0b0000010) == 0b0000010) && ((interrupt_type == NMI) || ((status_flags &0b00000100) == 0)))
+	// At an instruction boundary, and not in the middle of an interrupt already, begin the interrupt process.
+	// A pending NMI goes first. Otherwise the IRQ line's taken if it's down and I is clear.
+	if (((nes->timing_cycle & 0b0000010) == 0b0000010) && (nes->interrupt_cycle == 0))
 	{
-		if (interrupt_cycle == 0)
+		if (nes->pending_interrupt)
 		{
-			interrupt_cycle = 1;
-			if (interrupt_type == NMI)
-			{
-				pending_interrupt--;
-			}
+			nes->interrupt_cycle = 1;
+			nes->interrupt_type = NMI;
+			nes->pending_interrupt--;
+		}
+		else if (nes->irq_line && ((nes->status_flags & 0b00000100) == 0))
+		{
+			nes->interrupt_cycle = 1;
+			nes->interrupt_type = IRQ;
 		}
 	}
 	
-	if (oam_dma_active && ((timing_cycle & 0b0000100) == 0b0000100))
+	if (nes->oam_dma_active && ((nes->timing_cycle & 0b0000100) == 0b0000100))
 	{
-		if (oam_dma_write)
+		if (nes->oam_dma_write)
 		{
-			access_cpu_memory(&data_bus, 0x2004, WRITE);
-			if (oam_dma_low == 0)
+			access_cpu_memory(&nes->data_bus, 0x2004, WRITE);
+			if (nes->oam_dma_low == 0)
 			{
-				oam_dma_active = 0;
+				nes->oam_dma_active = 0;
 			}
 		}
 		else
 		{
-			address_bus = oam_dma_low | (oam_dma_page << 8);
-			access_cpu_memory(&data_bus, address_bus, READ);
-			oam_dma_low++;
+			nes->address_bus = nes->oam_dma_low | (nes->oam_dma_page << 8);
+			access_cpu_memory(&nes->data_bus, nes->address_bus, READ);
+			nes->oam_dma_low++;
 		}
-		oam_dma_write = !oam_dma_write;
+		nes->oam_dma_write = !nes->oam_dma_write;
 	}
 	// A lot of this is covered by the existing ops, but I think for this,
 	// it would be easier to simply keep it self-contained.
-	else if (interrupt_cycle > 0)
+	else if (nes->interrupt_cycle > 0)
 	{
-		switch (interrupt_cycle)
+		switch (nes->interrupt_cycle)
 		{
 			case 0b0000001:
 			{
-				address_low_bus = stack_pointer;
-				address_high_bus = 0x01;
+				nes->address_low_bus = nes->stack_pointer;
+				nes->address_high_bus = 0x01;
 				break;
 			}
 			case 0b0000010:
 			{
-				data_bus = (program_counter >> 8) & 0xFF;
-				access_cpu_memory(&data_bus, address_bus, WRITE);
-				stack_pointer--;
-				address_low_bus = stack_pointer;
+				nes->data_bus = (nes->program_counter >> 8) & 0xFF;
+				access_cpu_memory(&nes->data_bus, nes->address_bus, WRITE);
+				nes->stack_pointer--;
+				nes->address_low_bus = nes->stack_pointer;
 				break;
 			}
 			case 0b0000100:
 			{
-				data_bus = program_counter & 0xFF;
-				access_cpu_memory(&data_bus, address_bus, WRITE);
-				stack_pointer--;
-				address_low_bus = stack_pointer;
+				nes->data_bus = nes->program_counter & 0xFF;
+				access_cpu_memory(&nes->data_bus, nes->address_bus, WRITE);
+				nes->stack_pointer--;
+				nes->address_low_bus = nes->stack_pointer;
 				break;
 			}
 			case 0b0001000:
 			{
-				data_bus = status_flags | 0b00100000;
-				access_cpu_memory(&status_flags, address_bus, WRITE);
-				stack_pointer--;
+				nes->data_bus = nes->status_flags | 0b00100000;
+				access_cpu_memory(&nes->status_flags, nes->address_bus, WRITE);
+				nes->stack_pointer--;
 				break;
 			}
 			case 0b0010000:
 			{
-				if (interrupt_type == NMI)
+				// An NMI that comes in before the vector's fetched takes over the IRQ, which is still
+				// down afterwards if nobody let go of it, so it gets taken again after the NMI handler.
+				if ((nes->interrupt_type == IRQ) && nes->pending_interrupt)
 				{
-					address_low_bus = 0xFA;
+					nes->interrupt_type = NMI;
+					nes->pending_interrupt--;
 				}
-				else if (interrupt_type == IRQ)
+				if (nes->interrupt_type == NMI)
 				{
-					address_low_bus = 0xFE;
+					nes->address_low_bus = 0xFA;
 				}
-				address_high_bus = 0xFF;
-				status_flags = status_flags | 0b00000100;
+				else if (nes->interrupt_type == IRQ)
+				{
+					nes->address_low_bus = 0xFE;
+				}
+				nes->address_high_bus = 0xFF;
+				nes->status_flags = nes->status_flags | 0b00000100;
 				break;
 			}
 			case 0b0100000:
 			{
-				access_cpu_memory(&alu_in_b, address_bus, READ);
-				if (interrupt_type == NMI)
+				access_cpu_memory(&nes->alu_in_b, nes->address_bus, READ);
+				if (nes->interrupt_type == NMI)
 				{
-					address_low_bus = 0xFB;
+					nes->address_low_bus = 0xFB;
 				}
-				else if (interrupt_type == IRQ)
+				else if (nes->interrupt_type == IRQ)
 				{
-					address_low_bus = 0xFF;
+					nes->address_low_bus = 0xFF;
 				}
 				break;
 			}
 			case 0b1000000:
 			{ 
-				access_cpu_memory(&data_bus, address_bus, READ);
-				program_counter = alu_in_b | (data_bus << 8);
+				access_cpu_memory(&nes->data_bus, nes->address_bus, READ);
+				nes->program_counter = nes->alu_in_b | (nes->data_bus << 8);
 				break;
 			}
 		}
-		address_bus = address_low_bus | (address_high_bus << 8);
-		interrupt_cycle = (interrupt_cycle << 1) & 0b1111111;
+		nes->address_bus = nes->address_low_bus | (nes->address_high_bus << 8);
+		nes->interrupt_cycle = (nes->interrupt_cycle << 1) & 0b1111111;
 	}
 	else
 	{
 		execute_opcode();
 	}
 	
-	total_cycles++;
+	nes->total_cycles++;
 }
 
 void reset_cpu()
@@ -1406,17 +1396,12 @@ void reset_cpu()
 	access_cpu_memory(&low_byte, 0xFFFC, READ);
 	unsigned char high_byte;
 	access_cpu_memory(&high_byte, 0xFFFD, READ);
-	program_counter = low_byte | (high_byte << 8);
+	nes->program_counter = low_byte | (high_byte << 8);
 }
 
-void cpu_init()
+// The decode lines are the same for every NES, so they're only built once, before any context is set up.
+void cpu_build_tables()
 {
-	cpu_ram = malloc(sizeof(char) * RAM_SIZE);
-	for (unsigned int i = 0; i < RAM_SIZE; i++)
-	{
-		cpu_ram[i] = 0;
-	}
-	
 	// Two lists of decode lines, containing all the information needed to
 	// determine when it fires. The first list is for half cycle 1, the second
 	// list is for half cycle 2.
@@ -1529,6 +1514,44 @@ void cpu_init()
 	decode_lines_second_half[76] = (struct DecodeLine) { .rom_op = op_brk_stack, .opcode_bits = 0b00000000, .opcode_mask = 0b11111111, .timing = 0b010000};
 	decode_lines_second_half[77] = (struct DecodeLine) { .rom_op = op_brk, .opcode_bits = 0b00000000, .opcode_mask = 0b11111111, .timing = 0b000000};
 	decode_lines_second_half[78] = (struct DecodeLine) { .rom_op = op_T0_brk, .opcode_bits = 0b00000000, .opcode_mask = 0b11111111, .timing = 0b000001};
+}
+
+void cpu_init()
+{
+	nes->accumulator = 0;
+	nes->x_register = 0;
+	nes->y_register = 0;
+	nes->program_counter = 0;
+	nes->stack_pointer = 0xFF;
+	nes->status_flags = 0;
+
+	nes->oam_dma_active = 0;
+	nes->oam_dma_page = 0;
+	nes->oam_dma_write = 0;
+	nes->oam_dma_low = 0;
+
+	nes->timing_cycle = 0b000010;
+	nes->next_timing_cycle = 0;
+	nes->address_bus = 0;
+	nes->address_low_bus = 0;
+	nes->address_high_bus = 0;
+	nes->data_bus = 0;
+	nes->execute_bus = 0;
+	nes->alu_in_a = 0;
+	nes->alu_in_b = 0;
+	nes->alu_out = 0;
+	nes->read_write = 1;
+
+	nes->pending_interrupt = 0;
+	nes->interrupt_cycle = 0;
+	nes->interrupt_type = 0;
+	nes->irq_line = 0;
+	nes->total_cycles = 0;
+
+	for (unsigned int i = 0; i < RAM_SIZE; i++)
+	{
+		nes->cpu_ram[i] = 0;
+	}
 	
 	reset_cpu();
 }
\ No newline at end of file
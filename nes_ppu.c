@@ -3,62 +3,106 @@
 #include<stdlib.h>
 #include "nes_ppu.h"
 #include "nes_cpu.h"
-#include "emu_nes.h"
 #include "cartridge.h"
+#include "ppu_renderer.h"
+#include "nes_context.h"
 
-unsigned char* ppu_ram;
-unsigned char* palette_ram;
-unsigned char* oam;
-unsigned char* secondary_oam;
-
-unsigned char ppu_bus;
-
-unsigned int vram_address;
-unsigned int vram_temp;
-unsigned char fine_x_scroll;
-
-// PPU registers
-unsigned char ppu_control;
-unsigned char ppu_mask;
-unsigned char ppu_status;
-unsigned char oam_address;
-// When the CPU reads PPUDATA, what it gets
-// is the contents of this buffer, which is only updated
-// after the read. Okay???
-unsigned char ppu_data_buffer;
-
-unsigned int register_accessed;
-// Flag to indicate whether PPUSTATUS was just read. Due to
-// a quirk of the PPU, if the vblank flag would be set during
-// this period, it is immediately cleared.
-unsigned char status_read = 0;
-unsigned char reset_cycle = 1;
-// FCEUX seems to skip the first vblank, so I should too in order to be
-// compatible with FCEUX movies.
-unsigned char vblank_skip = 1;
-
-// Controls the write mode of PPUSCROLL and PPUADDRESS
-unsigned char write_toggle;
-unsigned char odd_frame;
+// What the PPU does on each dot, looked up by scanline class and dot rather than
+// worked out from the scanline and dot every tick.
+const unsigned int DOTS_PER_SCANLINE = 341;
+const unsigned int SCANLINES_PER_FRAME = 262;
+enum
+{
+	SCANLINE_VISIBLE,
+	SCANLINE_IDLE,
+	SCANLINE_VBLANK_START,
+	SCANLINE_PRE_RENDER,
+	SCANLINE_CLASS_COUNT
+};
+unsigned char* scanline_classes;
+unsigned short* dot_actions;
 
-unsigned int scanline;
-unsigned int scan_pixel;
+// Fills in the dot action table. Anything besides clearing and setting the status flags
+// and drawing pixels only happens while rendering is enabled, which is checked in ppu_tick.
+// It's the same for every NES, so it's only built once.
+void ppu_build_tables()
+{
+	scanline_classes = malloc(sizeof(char) * SCANLINES_PER_FRAME);
+	for (unsigned int i = 0; i < SCANLINES_PER_FRAME; i++)
+	{
+		if (i < 240)
+		{
+			scanline_classes[i] = SCANLINE_VISIBLE;
+		}
+		else if (i == 241)
+		{
+			scanline_classes[i] = SCANLINE_VBLANK_START;
+		}
+		else if (i == 261)
+		{
+			scanline_classes[i] = SCANLINE_PRE_RENDER;
+		}
+		else
+		{
+			scanline_classes[i] = SCANLINE_IDLE;
+		}
+	}
+	
+	dot_actions = calloc(SCANLINE_CLASS_COUNT * DOTS_PER_SCANLINE, sizeof(short));
+	
+	unsigned short* visible = &dot_actions[SCANLINE_VISIBLE * DOTS_PER_SCANLINE];
+	for (unsigned int dot = 1; dot <= 256; dot++)
+	{
+		visible[dot] = PPU_DRAW_PIXEL;
+		if (dot <= 8)
+		{
+			visible[dot] |= PPU_LEFT_COLUMN;
+		}
+		// Load the next tile every 8 cycles.
+		if (((dot % 8) == 1) && (dot > 1))
+		{
+			visible[dot] |= PPU_FETCH_TILE;
+		}
+	}
+	visible[257] = PPU_RESET_HORZ | PPU_INCREMENT_VERT | PPU_EVALUATE_SPRITES;
+	visible[284] = PPU_LOAD_SPRITES;
+	// Load the first two tiles of the next scanline.
+	visible[321] = PPU_FETCH_TILE;
+	visible[329] = PPU_SHIFT_TILE | PPU_FETCH_TILE;
+	
+	dot_actions[(SCANLINE_VBLANK_START * DOTS_PER_SCANLINE) + 1] = PPU_SET_VBLANK;
+	
+	unsigned short* pre_render = &dot_actions[SCANLINE_PRE_RENDER * DOTS_PER_SCANLINE];
+	pre_render[1] = PPU_CLEAR_FLAGS;
+	pre_render[257] = PPU_RESET_HORZ | PPU_INCREMENT_VERT;
+	pre_render[279] = PPU_RESET_VERT;
+	pre_render[284] = PPU_LOAD_SPRITES;
+	pre_render[321] = PPU_FETCH_TILE;
+	pre_render[329] = PPU_FETCH_TILE;
+}
 
-unsigned int bitmap_register_low;
-unsigned int bitmap_register_high;
-unsigned char palette_register_low;
-unsigned char palette_register_high;
-unsigned char palette_latch;
-unsigned char* sprite_bitmaps_low;
-unsigned char* sprite_bitmaps_high;
-unsigned char* sprite_attributes;
-unsigned char* sprite_x_positions;
-unsigned char sprite_count;
-unsigned char sprite_0_selected;
+unsigned int get_dot_actions(unsigned int line, unsigned int dot)
+{
+	return dot_actions[(scanline_classes[line] * DOTS_PER_SCANLINE) + dot];
+}
 
-// Treated as two-bit shift registers to detect edges.
-unsigned char nmi_occurred;
-unsigned char nmi_output;
+// Moves a scanline and dot position along by one dot.
+void advance_dot(unsigned int* line, unsigned int* dot, unsigned char* odd)
+{
+	(*dot)++;
+	// Jump to the next scanline once we hit the end. The dummy scanline ends one frame early on odd frames.
+	if ((*dot > 340) || ((*line == 261) && (*dot == 339) && *odd))
+	{
+		(*line)++;
+		*dot = 0;
+	}
+	
+	if (*line > 261)
+	{
+		*line = 0;
+		*odd = !(*odd);
+	}
+}
 
 // Credit to sth at Stack Overflow for this one.
 unsigned char reverse_byte(unsigned char byte)
@@ -69,6 +113,54 @@ unsigned char reverse_byte(unsigned char byte)
    return byte;
 }
 
+// Follows PPU address line 12 for mappers that count its rising edges.
+void watch_a12(unsigned int address)
+{
+	unsigned char address_bit_12 = (address >> 12) & 0b1;
+	if ((address_bit_12 == 1) && (nes->ppu_address_bit_12 == 0))
+	{
+		nes->a12_rise_hook(nes->ppu_dot_count);
+	}
+	nes->ppu_address_bit_12 = address_bit_12;
+}
+
+// Pattern table fetch, straight through the cartridge's CHR windows.
+unsigned char fetch_chr(unsigned int address)
+{
+	unsigned char data = nes->chr_windows[address >> 10][address & 0x3FF];
+	if (nes->a12_exact_line && (nes->a12_rise_hook != NULL))
+	{
+		watch_a12(address);
+	}
+	if ((nes->tile_fetch_hook != NULL) && nes->watched_tiles[address >> 4])
+	{
+		nes->tile_fetch_hook(address);
+	}
+	return data;
+}
+
+// Nametable (or attribute table) fetch, straight through the cartridge's nametable windows.
+unsigned char fetch_nametable(unsigned int address)
+{
+	unsigned char data = nes->nametable_windows[(address >> 10) & 0b11][address & 0x3FF];
+	if (nes->a12_exact_line && (nes->a12_rise_hook != NULL))
+	{
+		watch_a12(0x2000 | (address & 0xFFF));
+	}
+	return data;
+}
+
+void write_palette(unsigned char* palette, unsigned int address, unsigned char data)
+{
+	palette[address & 0x1F] = data;
+	// Sprite background colors are mirrors of tile background colors.
+	// Write both copies, so reads never have to resolve the mirror.
+	if ((address & 0b11) == 0)
+	{
+		palette[(address & 0x1F) ^ 0x10] = data;
+	}
+}
+
 void get_pointer_at_ppu_address(unsigned char* data, unsigned int address, unsigned char access_type)
 {
 	address = address & 0x3FFF;
@@ -84,29 +176,39 @@ void get_pointer_at_ppu_address(unsigned char* data, unsigned int address, unsig
 	}
 	else if (address >= 0x3F00 && address <= 0x3FFF)
 	{
-		// Sprite background colors are mirrors of tile background colors.
-		if ((address & 0b11) == 0)
-		{
-			address = address & 0b1111111111101111;
-		}
 		// Handle mirroring of 0x3F00 through 0x3F1F.
 		if (access_type == READ)
 		{
-			*data = palette_ram[address & 0x1F];
+			*data = nes->palette_ram[address & 0x1F];
 		}
 		else // access_type == WRITE
 		{
-			palette_ram[address & 0x1F] = *data;
+			write_palette(nes->palette_ram, address, *data);
+			if (nes->ppu_render_threaded)
+			{
+				log_render_event(RENDER_PALETTE, address & 0x1F, *data, 0, 0);
+			}
 		}
+		return;
 	}
 	else
 	{
-		printf("PPU address %04X out of range\n", address);
+		core_log("PPU address %04X out of range", address);
 		exit_emulator();
 	}
+	
+	if (nes->a12_rise_hook != NULL)
+	{
+		watch_a12(address);
+	}
+	if ((nes->tile_fetch_hook != NULL) && (access_type == READ) && (address <= 0x1FFF) && nes->watched_tiles[address >> 4])
+	{
+		nes->tile_fetch_hook(address);
+	}
 }
 
-void get_pointer_at_attribute_table_address(unsigned char* data, int address, unsigned char access_type)
+// Fetches the attribute byte for the tile at the given VRAM address.
+unsigned char fetch_attribute(unsigned int address)
 {
 	// This is a bit tricky. The VRAM address is structured like this:
 	// yyy NN YYYYY XXXXX
@@ -115,47 +217,47 @@ void get_pointer_at_attribute_table_address(unsigned char* data, int address, un
 	//     NN 1111 YYY XXX
 	// N for nametable select, Y for the high 3 bits of the coarse Y-scroll, X for the high 3 bits of the coarse X-scroll.
 	// We want to strip out yyy, keep NN, set the next 4 bits to 1, set the top 3 Y bits shifted down by 4, set the top 3 X bits shifted down by 2.
-	get_pointer_at_ppu_address(data, 0x23C0 | (address & 0b110000000000) | ((address >> 4) & 0b111000) | ((address >> 2) & 0b111), access_type);
+	return fetch_nametable(0x23C0 | (address & 0b110000000000) | ((address >> 4) & 0b111000) | ((address >> 2) & 0b111));
 }
 
 // Increments the coarse X-scroll in VRAM.
 void increment_vram_horz()
 {
-	unsigned char tile_x = ((vram_address + 1) & 0b11111);
+	unsigned char tile_x = ((nes->vram_address + 1) & 0b11111);
 	// Move to the next nametable when the scroll value wraps.
 	if (tile_x == 0)
 	{
-		vram_address = vram_address ^ 0b10000000000;
+		nes->vram_address = nes->vram_address ^ 0b10000000000;
 	}
-	vram_address = (vram_address & 0b111111111100000) | tile_x;
+	nes->vram_address = (nes->vram_address & 0b111111111100000) | tile_x;
 }
 
 // Overwrite VRAM's X-scroll bits with the ones from temp VRAM.
 void reset_vram_horz()
 {
-	vram_address = (vram_address & 0b111101111100000) | (vram_temp & 0b10000011111);
+	nes->vram_address = (nes->vram_address & 0b111101111100000) | (nes->vram_temp & 0b10000011111);
 }
 
 // Increments the fine Y-scroll in VRAM.
 void increment_vram_vert()
 {
-	unsigned int scroll_y = ((vram_address >> 12) + ((vram_address >> 2) & 0b11111000) + 1) & 0b11111111;
+	unsigned int scroll_y = ((nes->vram_address >> 12) + ((nes->vram_address >> 2) & 0b11111000) + 1) & 0b11111111;
 	// Move down one nametable when we hit the bottom of the screen.
 	// Note that this is not the bottom of the nametable, row 31, but row 29. Thus, we should check
 	// if the row hits 30 when wrapping, and set it to the top of the next nametable.
 	// Wrapping inside 'out of bounds' rows DOES NOT move to the next nametable.
 	if (scroll_y == 0b11110000)
 	{
-		vram_address = vram_address ^ 0b100000000000;
+		nes->vram_address = nes->vram_address ^ 0b100000000000;
 		scroll_y = 0;
 	}
-	vram_address = (vram_address & 0b110000011111) | ((scroll_y << 12) & 0b111000000000000) | ((scroll_y << 2) & 0b1111100000);
+	nes->vram_address = (nes->vram_address & 0b110000011111) | ((scroll_y << 12) & 0b111000000000000) | ((scroll_y << 2) & 0b1111100000);
 }
 
 // Overwrite VRAM's Y-scroll bits with the ones from temp VRAM.
 void reset_vram_vert()
 {
-	vram_address = (vram_address & 0b10000011111) | (vram_temp & 0b111101111100000);
+	nes->vram_address = (nes->vram_address & 0b10000011111) | (nes->vram_temp & 0b111101111100000);
 }
 
 // Notifies the PPU that the CPU accessed the PPU bus.
@@ -174,32 +276,32 @@ void access_ppu_register(unsigned char* data, unsigned int ppu_register, unsigne
 			{
 				if (access_type == READ)
 				{
-					write_toggle = 0;
-					ppu_bus = ppu_status;
+					nes->write_toggle = 0;
+					nes->ppu_bus = nes->ppu_status;
 					// Clear the vblank flag after PPUSTATUS read.
-					ppu_status = ppu_status & 0b01111111;
-					nmi_occurred = nmi_occurred & 0b10;
+					nes->ppu_status = nes->ppu_status & 0b01111111;
+					nes->nmi_occurred = nes->nmi_occurred & 0b10;
 					// Right now I'm assuming that the vblank can be cleared prematurely as long as
 					// the CPU is 'pointing at' PPUSTATUS. It doesn't appear to work otherwise.
 					// We'll see in due time if I'm proven wrong.
-					status_read = 3;
+					nes->status_read = 3;
 				}
 				break;
 			}
 			// OAMADDR
 			case 0x2003:
 			{
-				ppu_bus = oam_address;
-				register_accessed = ppu_register;
+				nes->ppu_bus = nes->oam_address;
+				nes->register_accessed = ppu_register;
 				break;
 			}
 			// OAMDATA
 			case 0x2004:
 			{
-				ppu_bus = oam[oam_address];
+				nes->ppu_bus = nes->oam[nes->oam_address];
 				if (access_type == WRITE)
 				{
-					register_accessed = ppu_register;
+					nes->register_accessed = ppu_register;
 				}
 				break;
 			}
@@ -213,19 +315,19 @@ void access_ppu_register(unsigned char* data, unsigned int ppu_register, unsigne
 					// after the read. Except for palettes, which are read directly, except
 					// the buffer is still updated, but with the nametable byte that /would/
 					// be there if the address wasn't a palette.
-					if (vram_address <= 0x3EFF)
+					if (nes->vram_address <= 0x3EFF)
 					{
-						ppu_bus = ppu_data_buffer;
+						nes->ppu_bus = nes->ppu_data_buffer;
 					}
 					else
 					{
-						get_pointer_at_ppu_address(&ppu_bus, vram_address, READ);
+						get_pointer_at_ppu_address(&nes->ppu_bus, nes->vram_address, READ);
 					}
-					get_pointer_at_ppu_address(&ppu_data_buffer, vram_address, READ);
+					get_pointer_at_ppu_address(&nes->ppu_data_buffer, nes->vram_address, READ);
 					
 					// Increment the vram address.
-					unsigned char render_disable = (ppu_mask & 0b00011000) == 0;
-					if ((!render_disable) && ((scanline < 240) || (scanline == 261)))
+					unsigned char render_disable = (nes->ppu_mask & 0b00011000) == 0;
+					if ((!render_disable) && ((nes->scanline < 240) || (nes->scanline == 261)))
 					{
 						// During rendering, the coarse X and fine Y are both incremented.
 						increment_vram_horz();
@@ -234,115 +336,127 @@ void access_ppu_register(unsigned char* data, unsigned int ppu_register, unsigne
 					else
 					{
 						// Check VRAM address increment flag
-						if ((ppu_control & 0b00000100) == 0b00000100)
+						if ((nes->ppu_control & 0b00000100) == 0b00000100)
 						{
-							vram_address = (vram_address + 32) & 0x3FFF;
+							nes->vram_address = (nes->vram_address + 32) & 0x3FFF;
 						}
 						else
 						{
-							vram_address = (vram_address + 1) & 0x3FFF;
+							nes->vram_address = (nes->vram_address + 1) & 0x3FFF;
 						}
 					}
 				}
 				else
 				{
-					register_accessed = ppu_register;
+					nes->register_accessed = ppu_register;
 				}
 				break;
 			}
 			default:
 			{
-				register_accessed = ppu_register;
+				nes->register_accessed = ppu_register;
 				break;
 			}
 		}
-		*data = ppu_bus;
+		*data = nes->ppu_bus;
 	}
 	else // access_type == WRITE
 	{
-		ppu_bus = *data;
+		nes->ppu_bus = *data;
 		switch(ppu_register)
 		{
 			// PPUCTRL
 			case 0x2000:
 			{
-				ppu_control = ppu_bus;
+				if (((nes->ppu_control ^ nes->ppu_bus) & 0b10000) != 0)
+				{
+					nes->a12_exact_line = 1;
+				}
+				nes->ppu_control = nes->ppu_bus;
 				// Set the nametable select bits to the temp vram address.
-				vram_temp = (vram_temp & 0b1111001111111111) | ((ppu_control & 0b11) << 10);
+				nes->vram_temp = (nes->vram_temp & 0b1111001111111111) | ((nes->ppu_control & 0b11) << 10);
 				// Track current state of nmi output on its low bit.
-				if ((ppu_control & 0b10000000) == 0b10000000)
+				if ((nes->ppu_control & 0b10000000) == 0b10000000)
 				{
-					nmi_output = nmi_output | 0b01;
+					nes->nmi_output = nes->nmi_output | 0b01;
 				}
 				else
 				{
-					nmi_output = nmi_output & 0b10;
+					nes->nmi_output = nes->nmi_output & 0b10;
 				}
 				break;
 			}
 			// PPUMASK
 			case 0x2001:
 			{
-				ppu_mask = ppu_bus;
+				nes->ppu_mask = nes->ppu_bus;
+				if (nes->ppu_render_threaded)
+				{
+					log_render_event(RENDER_MASK, nes->ppu_mask, 0, 0, 0);
+				}
 				break;
 			}
 			// OAMADDR
 			case 0x2003:
 			{
-				oam_address = ppu_bus;
+				nes->oam_address = nes->ppu_bus;
 				break;
 			}
 			// OAMDATA
 			case 0x2004:
 			{
-				oam[oam_address] = ppu_bus;
-				oam_address++;
+				nes->oam[nes->oam_address] = nes->ppu_bus;
+				nes->oam_address++;
 				break;
 			}
 			// PPUSCROLL
 			case 0x2005:
 			{
-				if (write_toggle) // == 1
+				if (nes->write_toggle) // == 1
 				{
 					// Write to the Y-scroll.
-					vram_temp = (vram_temp & 0b000110000011111) | ((ppu_bus & 0b111) << 12) | ((ppu_bus & 0b11111000) << 2);
-					write_toggle = 0;
+					nes->vram_temp = (nes->vram_temp & 0b000110000011111) | ((nes->ppu_bus & 0b111) << 12) | ((nes->ppu_bus & 0b11111000) << 2);
+					nes->write_toggle = 0;
 				}
 				else
 				{
 					// Write to the X-scroll.
-					fine_x_scroll = ppu_bus & 0b111;
-					vram_temp = (vram_temp & 0b1111111111100000) | ((ppu_bus >> 3) & 0b11111);
-					write_toggle = 1;
+					nes->fine_x_scroll = nes->ppu_bus & 0b111;
+					if (nes->ppu_render_threaded)
+					{
+						log_render_event(RENDER_FINE_X, nes->fine_x_scroll, 0, 0, 0);
+					}
+					nes->vram_temp = (nes->vram_temp & 0b1111111111100000) | ((nes->ppu_bus >> 3) & 0b11111);
+					nes->write_toggle = 1;
 				}
 				break;
 			}
 			// PPUADDR
 			case 0x2006:
 			{
-				if (write_toggle) // == 1
+				if (nes->write_toggle) // == 1
 				{
 					// Write the ppu bus data to the low byte.
-					vram_temp = (vram_temp & 0xFF00) | ppu_bus;
-					vram_address = vram_temp;
-					write_toggle = 0;
+					nes->vram_temp = (nes->vram_temp & 0xFF00) | nes->ppu_bus;
+					nes->vram_address = nes->vram_temp;
+					nes->write_toggle = 0;
 				}
 				else
 				{
 					// Write the ppu bus data to the high byte.
-					vram_temp = (vram_temp & 0x00FF) | ((ppu_bus & 0x3F) << 8);
-					write_toggle = 1;
+					nes->vram_temp = (nes->vram_temp & 0x00FF) | ((nes->ppu_bus & 0x3F) << 8);
+					nes->write_toggle = 1;
 				}
 				break;
 			}
 			// PPUDATA
 			case 0x2007:
 			{
-				get_pointer_at_ppu_address(&ppu_bus, vram_address, WRITE);
+				get_pointer_at_ppu_address(&nes->ppu_bus, nes->vram_address, WRITE);
 				
 				// Increment the vram address.
-				unsigned char render_disable = (ppu_mask & 0b00011000) == 0;
-				if ((!render_disable) && ((scanline < 240) || (scanline == 261)))
+				unsigned char render_disable = (nes->ppu_mask & 0b00011000) == 0;
+				if ((!render_disable) && ((nes->scanline < 240) || (nes->scanline == 261)))
 				{
 					// During rendering, the coarse X and fine Y are both incremented.
 					increment_vram_horz();
@@ -351,46 +465,81 @@ void access_ppu_register(unsigned char* data, unsigned int ppu_register, unsigne
 				else
 				{
 					// Check VRAM address increment flag
-					if ((ppu_control & 0b00000100) == 0b00000100)
+					if ((nes->ppu_control & 0b00000100) == 0b00000100)
 					{
-						vram_address = (vram_address + 32) & 0x3FFF;
+						nes->vram_address = (nes->vram_address + 32) & 0x3FFF;
 					}
 					else
 					{
-						vram_address = (vram_address + 1) & 0x3FFF;
+						nes->vram_address = (nes->vram_address + 1) & 0x3FFF;
 					}
 				}
 				break;
 			}
 		}
-		register_accessed = 0;
+		nes->register_accessed = 0;
+	}
+}
+
+// Moves the background registers along by one pixel, feeding in the latched palette bits.
+void shift_background(struct pixel_pipeline* pipeline)
+{
+	pipeline->bitmap_register_low = (pipeline->bitmap_register_low << 1) & 0xFFFF;
+	pipeline->bitmap_register_high = (pipeline->bitmap_register_high << 1) & 0xFFFF;
+	pipeline->palette_register_low = ((pipeline->palette_register_low << 1) & 0xFF) | (pipeline->palette_latch & 0b1);
+	pipeline->palette_register_high = ((pipeline->palette_register_high << 1) & 0xFF) | ((pipeline->palette_latch & 0b10) >> 1);
+}
+
+// Shifts a whole tile's worth of pixels at once.
+void shift_tile(struct pixel_pipeline* pipeline)
+{
+	// Shift the first tile to be rendered before loading the second tile of the next scanline.
+	// This probably isn't how the NES really handles it, but it should work?
+	for (int i = 0; i < 8; i++)
+	{
+		shift_background(pipeline);
 	}
 }
 
+// Puts a freshly fetched tile into the low bytes of the background registers.
+void load_tile(struct pixel_pipeline* pipeline, unsigned char low_pattern_data, unsigned char high_pattern_data, unsigned char palette_select)
+{
+	pipeline->bitmap_register_low = (pipeline->bitmap_register_low & 0xFF00) | low_pattern_data;
+	pipeline->bitmap_register_high = (pipeline->bitmap_register_high & 0xFF00) | high_pattern_data;
+	pipeline->palette_latch = palette_select;
+}
+
 void load_render_registers()
 {
-	unsigned fine_y_scroll = (vram_address >> 12) & 0b111;
-	unsigned char pattern_byte;
-	get_pointer_at_nametable_address(&pattern_byte, vram_address & 0b111111111111, READ);
+	unsigned fine_y_scroll = (nes->vram_address >> 12) & 0b111;
+	unsigned char pattern_byte = fetch_nametable(nes->vram_address & 0b111111111111);
 	// An address in the pattern table is encoded thus:
 	// 0HRRRR CCCCPTTT
 	// H is which half of the sprite table.
 	// P is which bit plane we're in. We need both the low and the high one.
 	// TTT is the fine y offset. We get that from which scanline is being drawn.
 	// It seems that the part stored in the nametable is RRRR CCCC, indicating the tile row and column.
-	unsigned int pattern_address = ((ppu_control & 0b10000) << 8) | (pattern_byte * 0b10000) | fine_y_scroll;
+	unsigned int pattern_address = ((nes->ppu_control & 0b10000) << 8) | (pattern_byte * 0b10000) | fine_y_scroll;
 	// Write the low byte from the pattern table to the low byte of the low bitmap register.
-	unsigned char low_pattern_data;
-	get_pointer_at_ppu_address(&low_pattern_data, pattern_address, READ);
-	bitmap_register_low = (bitmap_register_low & 0xFF00) | low_pattern_data;
+	unsigned char low_pattern_data = fetch_chr(pattern_address);
 	// Write the high byte from the pattern table to the low byte of the high bitmap register.
-	unsigned char high_pattern_data;
-	get_pointer_at_ppu_address(&high_pattern_data, pattern_address | 0b1000, READ);
-	bitmap_register_high = (bitmap_register_high & 0xFF00) | high_pattern_data;
-	unsigned char attribute_byte;
-	get_pointer_at_attribute_table_address(&attribute_byte, vram_address & 0b111111111111, READ);
-	unsigned char attribute_tile_select = ((vram_address >> 1) & 0b1) + ((vram_address >> 5) & 0b10);
-	palette_latch = (attribute_byte >> (attribute_tile_select * 2)) & 0b11;
+	unsigned char high_pattern_data = fetch_chr(pattern_address | 0b1000);
+	unsigned char attribute_byte = fetch_attribute(nes->vram_address & 0b111111111111);
+	unsigned char attribute_tile_select = ((nes->vram_address >> 1) & 0b1) + ((nes->vram_address >> 5) & 0b10);
+	unsigned char palette_select = (attribute_byte >> (attribute_tile_select * 2)) & 0b11;
+	load_tile(&nes->ppu_pipeline, low_pattern_data, high_pattern_data, palette_select);
+	if (!nes->a12_exact_line && (nes->a12_rise_hook != NULL))
+	{
+		if (nes->a12_tile_rise)
+		{
+			nes->a12_rise_hook(nes->ppu_dot_count);
+		}
+		nes->ppu_address_bit_12 = 0;
+	}
+	if (nes->ppu_render_threaded)
+	{
+		log_render_event(RENDER_TILE, low_pattern_data, high_pattern_data, palette_select, 0);
+	}
 	
 	increment_vram_horz();
 }
@@ -401,18 +550,18 @@ void load_render_registers()
 // any noticable effects (this might affect some games, though).
 void evaluate_sprites()
 {
-	sprite_0_selected = 0;
+	nes->ppu_pipeline.sprite_0_selected = 0;
 	
 	for (int i = 0; i < 0x40; i++)
 	{
-		secondary_oam[i] = 0xFF;
+		nes->secondary_oam[i] = 0xFF;
 	}
-	sprite_count = 0;
-	for (int i = 0; (i < 0x40) && (sprite_count < 0x8); i++)
+	nes->ppu_pipeline.sprite_count = 0;
+	for (int i = 0; (i < 0x40) && (nes->ppu_pipeline.sprite_count < 0x8); i++)
 	{
 		unsigned char sprite_height;
 		// Check for 8x16 sprite mode
-		if ((ppu_control & 0b00100000) == 0b00100000)
+		if ((nes->ppu_control & 0b00100000) == 0b00100000)
 		{
 			sprite_height = 16;
 		}
@@ -421,18 +570,18 @@ void evaluate_sprites()
 			sprite_height = 8;
 		}
 		
-		secondary_oam[sprite_count * 4] = oam[i * 4];
+		nes->secondary_oam[nes->ppu_pipeline.sprite_count * 4] = nes->oam[i * 4];
 		// If the sprite falls on the scanline, load it into the secondary OAM for rendering.
-		if ((secondary_oam[sprite_count * 4] <= scanline) && ((secondary_oam[sprite_count * 4] + sprite_height) > scanline))
+		if ((nes->secondary_oam[nes->ppu_pipeline.sprite_count * 4] <= nes->scanline) && ((nes->secondary_oam[nes->ppu_pipeline.sprite_count * 4] + sprite_height) > nes->scanline))
 		{
 			if (i == 0)
 			{
-				sprite_0_selected = 1;
+				nes->ppu_pipeline.sprite_0_selected = 1;
 			}
-			secondary_oam[(sprite_count * 4) + 1] = oam[(i * 4) + 1];
-			secondary_oam[(sprite_count * 4) + 2] = oam[(i * 4) + 2];
-			secondary_oam[(sprite_count * 4) + 3] = oam[(i * 4) + 3];
-			sprite_count++;
+			nes->secondary_oam[(nes->ppu_pipeline.sprite_count * 4) + 1] = nes->oam[(i * 4) + 1];
+			nes->secondary_oam[(nes->ppu_pipeline.sprite_count * 4) + 2] = nes->oam[(i * 4) + 2];
+			nes->secondary_oam[(nes->ppu_pipeline.sprite_count * 4) + 3] = nes->oam[(i * 4) + 3];
+			nes->ppu_pipeline.sprite_count++;
 		}
 	}
 }
@@ -443,15 +592,15 @@ void load_sprites()
 	// 8x16 sprite flag.
 	// Tall sprites use the top 7 bits for the top tile number of their sprite,
 	// and bit 0 for their pattern table select. PPUCTRL's table select is ignored.
-	unsigned char tall_sprites = (ppu_control & 0b00100000) == 0b00100000;
+	unsigned char tall_sprites = (nes->ppu_control & 0b00100000) == 0b00100000;
 	
 	for (int i = 0; i < 0x8; i++)
 	{
-		unsigned char fine_y = (scanline + 1) - (secondary_oam[i * 4] + 1);
-		unsigned char sprite_attribute_byte = secondary_oam[(i * 4) + 2];
-		unsigned char tile_number = secondary_oam[(i * 4) + 1];
+		unsigned char fine_y = (nes->scanline + 1) - (nes->secondary_oam[i * 4] + 1);
+		unsigned char sprite_attribute_byte = nes->secondary_oam[(i * 4) + 2];
+		unsigned char tile_number = nes->secondary_oam[(i * 4) + 1];
 		unsigned char flip_vertical = (sprite_attribute_byte & 0b10000000) == 0b10000000;
-		unsigned char pattern_table_select = (ppu_control & 0b1000) == 0b1000;
+		unsigned char pattern_table_select = (nes->ppu_control & 0b1000) == 0b1000;
 		if (tall_sprites)
 		{
 			pattern_table_select = tile_number & 0b1;
@@ -474,10 +623,17 @@ void load_sprites()
 		// TTT is the fine y offset. We get that from which scanline is being drawn.
 		// RRRR indicates row, and CCCC indicates column.
 		unsigned int pattern_address = (pattern_table_select << 12) | (tile_number << 4) | fine_y;
-		unsigned char sprite_bitmap_low;
-		get_pointer_at_ppu_address(&sprite_bitmap_low, pattern_address, READ);
-		unsigned char sprite_bitmap_high;
-		get_pointer_at_ppu_address(&sprite_bitmap_high, pattern_address | 0b1000, READ);
+		unsigned char sprite_bitmap_low = fetch_chr(pattern_address);
+		unsigned char sprite_bitmap_high = fetch_chr(pattern_address | 0b1000);
+		// Both bytes come from the same table, so A12 can only rise on the first one.
+		if (!nes->a12_exact_line && (nes->a12_rise_hook != NULL))
+		{
+			if (pattern_table_select && !nes->ppu_address_bit_12)
+			{
+				nes->a12_rise_hook(nes->ppu_dot_count);
+			}
+			nes->ppu_address_bit_12 = pattern_table_select;
+		}
 		
 		// Check for horizontal flip attribute.
 		if ((sprite_attribute_byte & 0b1000000) == 0b1000000)
@@ -485,306 +641,363 @@ void load_sprites()
 			sprite_bitmap_low = reverse_byte(sprite_bitmap_low);
 			sprite_bitmap_high = reverse_byte(sprite_bitmap_high);
 		}
-		sprite_bitmaps_low[i] = sprite_bitmap_low;
-		sprite_bitmaps_high[i] = sprite_bitmap_high;
-		sprite_attributes[i] = sprite_attribute_byte;
-		sprite_x_positions[i] = secondary_oam[(i * 4) + 3];
+		nes->ppu_pipeline.sprite_bitmaps_low[i] = sprite_bitmap_low;
+		nes->ppu_pipeline.sprite_bitmaps_high[i] = sprite_bitmap_high;
+		nes->ppu_pipeline.sprite_attributes[i] = sprite_attribute_byte;
+		nes->ppu_pipeline.sprite_x_positions[i] = nes->secondary_oam[(i * 4) + 3];
+	}
+	
+	if (nes->ppu_render_threaded)
+	{
+		log_render_sprites(&nes->ppu_pipeline);
 	}
 }
 
 void ppu_save_state(FILE* save_file)
 {
-	fwrite(&ppu_bus, sizeof(char), 1, save_file);
-	fwrite(&vram_address, sizeof(int), 1, save_file);
-	fwrite(&vram_temp, sizeof(int), 1, save_file);
-	fwrite(&fine_x_scroll, sizeof(char), 1, save_file);
-	fwrite(&ppu_control, sizeof(char), 1, save_file);
-	fwrite(&ppu_mask, sizeof(char), 1, save_file);
-	fwrite(&ppu_status, sizeof(char), 1, save_file);
-	fwrite(&oam_address, sizeof(char), 1, save_file);
-	fwrite(&ppu_data_buffer, sizeof(char), 1, save_file);
-	fwrite(&write_toggle, sizeof(char), 1, save_file);
-	fwrite(&odd_frame, sizeof(char), 1, save_file);
-	fwrite(&scanline, sizeof(int), 1, save_file);
-	fwrite(&scan_pixel, sizeof(int), 1, save_file);
-	fwrite(&bitmap_register_low, sizeof(int), 1, save_file);
-	fwrite(&bitmap_register_high, sizeof(int), 1, save_file);
-	fwrite(&palette_register_low, sizeof(char), 1, save_file);
-	fwrite(&palette_register_high, sizeof(char), 1, save_file);
-	fwrite(&palette_latch, sizeof(char), 1, save_file);
-	fwrite(&sprite_count, sizeof(char), 1, save_file);
-	fwrite(&sprite_0_selected, sizeof(char), 1, save_file);
-	fwrite(&pending_interrupt, sizeof(char), 1, save_file);
-	fwrite(&nmi_occurred, sizeof(char), 1, save_file);
-	fwrite(&nmi_output, sizeof(char), 1, save_file);
-	fwrite(&status_read, sizeof(char), 1, save_file);
-	fwrite(&reset_cycle, sizeof(char), 1, save_file);
+	// The sprites are only all up to date on the render thread.
+	if (nes->ppu_render_threaded)
+	{
+		ppu_renderer_drain();
+	}
+	
+	fwrite(&nes->ppu_bus, sizeof(char), 1, save_file);
+	fwrite(&nes->vram_address, sizeof(int), 1, save_file);
+	fwrite(&nes->vram_temp, sizeof(int), 1, save_file);
+	fwrite(&nes->fine_x_scroll, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_control, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_mask, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_status, sizeof(char), 1, save_file);
+	fwrite(&nes->oam_address, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_data_buffer, sizeof(char), 1, save_file);
+	fwrite(&nes->write_toggle, sizeof(char), 1, save_file);
+	fwrite(&nes->odd_frame, sizeof(char), 1, save_file);
+	fwrite(&nes->scanline, sizeof(int), 1, save_file);
+	fwrite(&nes->scan_pixel, sizeof(int), 1, save_file);
+	fwrite(&nes->ppu_pipeline.bitmap_register_low, sizeof(int), 1, save_file);
+	fwrite(&nes->ppu_pipeline.bitmap_register_high, sizeof(int), 1, save_file);
+	fwrite(&nes->ppu_pipeline.palette_register_low, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_pipeline.palette_register_high, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_pipeline.palette_latch, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_pipeline.sprite_count, sizeof(char), 1, save_file);
+	fwrite(&nes->ppu_pipeline.sprite_0_selected, sizeof(char), 1, save_file);
+	fwrite(&nes->pending_interrupt, sizeof(char), 1, save_file);
+	fwrite(&nes->nmi_occurred, sizeof(char), 1, save_file);
+	fwrite(&nes->nmi_output, sizeof(char), 1, save_file);
+	fwrite(&nes->status_read, sizeof(char), 1, save_file);
+	fwrite(&nes->reset_cycle, sizeof(char), 1, save_file);
 	
-	fwrite(ppu_ram, sizeof(char), 0x800, save_file);
-	fwrite(palette_ram, sizeof(char), 0x20, save_file);
-	fwrite(oam, sizeof(char), 0x100, save_file);
-	fwrite(secondary_oam, sizeof(char), 0x40, save_file);
-	fwrite(sprite_bitmaps_low, sizeof(char), 0x8, save_file);
-	fwrite(sprite_bitmaps_high, sizeof(char), 0x8, save_file);
-	fwrite(sprite_attributes, sizeof(char), 0x8, save_file);
-	fwrite(sprite_x_positions, sizeof(char), 0x8, save_file);
+	fwrite(nes->ppu_ram, sizeof(char), 0x800, save_file);
+	fwrite(nes->palette_ram, sizeof(char), 0x20, save_file);
+	fwrite(nes->oam, sizeof(char), 0x100, save_file);
+	fwrite(nes->secondary_oam, sizeof(char), 0x40, save_file);
+	fwrite(nes->ppu_pipeline.sprite_bitmaps_low, sizeof(char), 0x8, save_file);
+	fwrite(nes->ppu_pipeline.sprite_bitmaps_high, sizeof(char), 0x8, save_file);
+	fwrite(nes->ppu_pipeline.sprite_attributes, sizeof(char), 0x8, save_file);
+	fwrite(nes->ppu_pipeline.sprite_x_positions, sizeof(char), 0x8, save_file);
 }
 
 void ppu_load_state(FILE* save_file)
 {
-	fread(&ppu_bus, sizeof(char), 1, save_file);
-	fread(&vram_address, sizeof(int), 1, save_file);
-	fread(&vram_temp, sizeof(int), 1, save_file);
-	fread(&fine_x_scroll, sizeof(char), 1, save_file);
-	fread(&ppu_control, sizeof(char), 1, save_file);
-	fread(&ppu_mask, sizeof(char), 1, save_file);
-	fread(&ppu_status, sizeof(char), 1, save_file);
-	fread(&oam_address, sizeof(char), 1, save_file);
-	fread(&ppu_data_buffer, sizeof(char), 1, save_file);
-	fread(&write_toggle, sizeof(char), 1, save_file);
-	fread(&odd_frame, sizeof(char), 1, save_file);
-	fread(&scanline, sizeof(int), 1, save_file);
-	fread(&scan_pixel, sizeof(int), 1, save_file);
-	fread(&bitmap_register_low, sizeof(int), 1, save_file);
-	fread(&bitmap_register_high, sizeof(int), 1, save_file);
-	fread(&palette_register_low, sizeof(char), 1, save_file);
-	fread(&palette_register_high, sizeof(char), 1, save_file);
-	fread(&palette_latch, sizeof(char), 1, save_file);
-	fread(&sprite_count, sizeof(char), 1, save_file);
-	fread(&sprite_0_selected, sizeof(char), 1, save_file);
-	fread(&pending_interrupt, sizeof(char), 1, save_file);
-	fread(&nmi_occurred, sizeof(char), 1, save_file);
-	fread(&nmi_output, sizeof(char), 1, save_file);
-	fread(&status_read, sizeof(char), 1, save_file);
-	fread(&reset_cycle, sizeof(char), 1, save_file);
+	fread(&nes->ppu_bus, sizeof(char), 1, save_file);
+	fread(&nes->vram_address, sizeof(int), 1, save_file);
+	fread(&nes->vram_temp, sizeof(int), 1, save_file);
+	fread(&nes->fine_x_scroll, sizeof(char), 1, save_file);
+	fread(&nes->ppu_control, sizeof(char), 1, save_file);
+	fread(&nes->ppu_mask, sizeof(char), 1, save_file);
+	fread(&nes->ppu_status, sizeof(char), 1, save_file);
+	fread(&nes->oam_address, sizeof(char), 1, save_file);
+	fread(&nes->ppu_data_buffer, sizeof(char), 1, save_file);
+	fread(&nes->write_toggle, sizeof(char), 1, save_file);
+	fread(&nes->odd_frame, sizeof(char), 1, save_file);
+	fread(&nes->scanline, sizeof(int), 1, save_file);
+	fread(&nes->scan_pixel, sizeof(int), 1, save_file);
+	fread(&nes->ppu_pipeline.bitmap_register_low, sizeof(int), 1, save_file);
+	fread(&nes->ppu_pipeline.bitmap_register_high, sizeof(int), 1, save_file);
+	fread(&nes->ppu_pipeline.palette_register_low, sizeof(char), 1, save_file);
+	fread(&nes->ppu_pipeline.palette_register_high, sizeof(char), 1, save_file);
+	fread(&nes->ppu_pipeline.palette_latch, sizeof(char), 1, save_file);
+	fread(&nes->ppu_pipeline.sprite_count, sizeof(char), 1, save_file);
+	fread(&nes->ppu_pipeline.sprite_0_selected, sizeof(char), 1, save_file);
+	fread(&nes->pending_interrupt, sizeof(char), 1, save_file);
+	fread(&nes->nmi_occurred, sizeof(char), 1, save_file);
+	fread(&nes->nmi_output, sizeof(char), 1, save_file);
+	fread(&nes->status_read, sizeof(char), 1, save_file);
+	fread(&nes->reset_cycle, sizeof(char), 1, save_file);
+	
+	fread(nes->ppu_ram, sizeof(char), 0x800, save_file);
+	fread(nes->palette_ram, sizeof(char), 0x20, save_file);
+	// Older save states only kept the background copy of the mirrored palette entries.
+	for (int i = 0; i < 0x10; i += 4)
+	{
+		nes->palette_ram[i | 0x10] = nes->palette_ram[i];
+	}
+	fread(nes->oam, sizeof(char), 0x100, save_file);
+	fread(nes->secondary_oam, sizeof(char), 0x40, save_file);
+	fread(nes->ppu_pipeline.sprite_bitmaps_low, sizeof(char), 0x8, save_file);
+	fread(nes->ppu_pipeline.sprite_bitmaps_high, sizeof(char), 0x8, save_file);
+	fread(nes->ppu_pipeline.sprite_attributes, sizeof(char), 0x8, save_file);
+	fread(nes->ppu_pipeline.sprite_x_positions, sizeof(char), 0x8, save_file);
 	
-	fread(ppu_ram, sizeof(char), 0x800, save_file);
-	fread(palette_ram, sizeof(char), 0x20, save_file);
-	fread(oam, sizeof(char), 0x100, save_file);
-	fread(secondary_oam, sizeof(char), 0x40, save_file);
-	fread(sprite_bitmaps_low, sizeof(char), 0x8, save_file);
-	fread(sprite_bitmaps_high, sizeof(char), 0x8, save_file);
-	fread(sprite_attributes, sizeof(char), 0x8, save_file);
-	fread(sprite_x_positions, sizeof(char), 0x8, save_file);
+	// Not saved, so watch every fetch until the next line starts.
+	nes->a12_exact_line = 1;
+	
+	if (nes->ppu_render_threaded)
+	{
+		ppu_renderer_restart();
+	}
 }
 
-// Returns the pixel data to be rendered. 255 indicates no render.
-// This will probably have to be made a bit more complex as more parts of the PPU are implemented.
-unsigned char ppu_tick()
+// Renders the pixel for the current dot of a visible scanline, and shifts the background
+// and sprite registers along. left_column is set for the first eight pixels, which PPUMASK can hide.
+// This works on whichever pipeline it's given, so the render thread can draw with its own copy.
+// A sprite 0 hit gets set in status.
+unsigned char draw_pixel(struct pixel_pipeline* pipeline, unsigned char mask, unsigned char fine_x, unsigned char* palette, unsigned char left_column, unsigned char* status)
 {
-	unsigned char pixel_data = 255;
-	
-	unsigned char render_disable = (ppu_mask & 0b00011000) == 0;
-	unsigned char background_enable = (ppu_mask & 0b1000) == 0b1000;
-	unsigned char sprite_enable = (ppu_mask & 0b10000) == 0b10000;
+	unsigned char background_enable = (mask & 0b1000) == 0b1000;
+	unsigned char sprite_enable = (mask & 0b10000) == 0b10000;
+	unsigned char show_left_sprites = 1;
+	if (left_column)
+	{
+		background_enable = background_enable & ((mask >> 1) & 0b1);
+		show_left_sprites = (mask >> 2) & 0b1;
+	}
+	// Default to backdrop color if nothing else gets rendered
+	unsigned char pixel_data = palette[0];
+	// It seems that fine x scroll selects bits in the opposite order of my implementation.
+	// I still don't understand exactly how the rendering pipeline works. But this should work fine.
+	unsigned char fixed_fine_x_scroll = 7 - fine_x;
+	unsigned char background_bitmap_palette =
+		  ((pipeline->bitmap_register_low >> (8 + fixed_fine_x_scroll)) & 0b1)
+		| ((pipeline->bitmap_register_high >> (7 + fixed_fine_x_scroll)) & 0b10);
+	unsigned char palette_address = 0;
+	// All palettes show the same default background color.
+	if (background_bitmap_palette > 0)
+	{
+		palette_address = background_bitmap_palette
+			| (((pipeline->palette_register_low >> fixed_fine_x_scroll) << 2) & 0b100)
+			| (((pipeline->palette_register_high >> fixed_fine_x_scroll) << 3) & 0b1000);
+	}
+	unsigned char background_pixel = palette[palette_address];
+	if (background_enable)
+	{
+		pixel_data = background_pixel;
+	}
+	shift_background(pipeline);
 	
-	// pre-render scanline
-	if (scanline == 261)
+	if (sprite_enable)
 	{
-		if (scan_pixel == 1)
+		// Evaluate in reverse order to make sure lower index sprites are drawn on top.
+		for (int i = (pipeline->sprite_count - 1); i >= 0; i--)
 		{
-			// Clear the vblank and sprite 0 hit flags.
-			ppu_status = ppu_status & 0b00111111;
-			nmi_occurred = nmi_occurred & 0b10;
+			if (pipeline->sprite_x_positions[i] > 0)
+			{
+				pipeline->sprite_x_positions[i]--;
+			}
+			else
+			{
+				unsigned char sprite_priority = (pipeline->sprite_attributes[i] >> 5) & 0b1;
+				unsigned char sprite_palette = ((pipeline->sprite_bitmaps_low[i] >> 7) & 0b1) | ((pipeline->sprite_bitmaps_high[i] >> 6) & 0b10);
+				// Only load in sprite pixel if it's non-transparent and it isn't being masked in the leftmost column.
+				if ((sprite_palette > 0) && show_left_sprites)
+				{
+					// Check for sprite 0 hit
+					if (background_enable && (background_bitmap_palette > 0) && (i == 0) && pipeline->sprite_0_selected)
+					{
+						*status = *status | 0b01000000;
+					}
+					
+					if (background_enable && (background_bitmap_palette > 0) && (sprite_priority == 1))
+					{
+						pixel_data = background_pixel;
+					}
+					else
+					{
+						sprite_palette = sprite_palette | ((pipeline->sprite_attributes[i] & 0b11) << 2);
+						pixel_data = palette[0x10 | sprite_palette];
+					}
+				}
+				pipeline->sprite_bitmaps_low[i] = (pipeline->sprite_bitmaps_low[i] << 1) & 0xFF;
+				pipeline->sprite_bitmaps_high[i] = (pipeline->sprite_bitmaps_high[i] << 1) & 0xFF;
+			}
 		}
-		else if (scan_pixel == 257 && (!render_disable))
+	}
+	// Only the lower six pixels contain color data. Garbage data should be truncated
+	// to six bits, so it can't be erroneously read as a 255 'no render' pixel.
+	return pixel_data & 0b111111;
+}
+
+// What's left of draw_pixel when the render thread is doing the drawing: shifting the registers
+// and checking for sprite 0 hits. Only sprite 0 matters for that, so the other sprites are left alone here.
+void track_sprite_0_hit(unsigned char left_column)
+{
+	unsigned char background_enable = (nes->ppu_mask & 0b1000) == 0b1000;
+	unsigned char sprite_enable = (nes->ppu_mask & 0b10000) == 0b10000;
+	unsigned char show_left_sprites = 1;
+	if (left_column)
+	{
+		background_enable = background_enable & ((nes->ppu_mask >> 1) & 0b1);
+		show_left_sprites = (nes->ppu_mask >> 2) & 0b1;
+	}
+	unsigned char fixed_fine_x_scroll = 7 - nes->fine_x_scroll;
+	unsigned char background_bitmap_palette =
+		  ((nes->ppu_pipeline.bitmap_register_low >> (8 + fixed_fine_x_scroll)) & 0b1)
+		| ((nes->ppu_pipeline.bitmap_register_high >> (7 + fixed_fine_x_scroll)) & 0b10);
+	shift_background(&nes->ppu_pipeline);
+	
+	if (sprite_enable && nes->ppu_pipeline.sprite_0_selected && (nes->ppu_pipeline.sprite_count > 0))
+	{
+		if (nes->ppu_pipeline.sprite_x_positions[0] > 0)
 		{
-			reset_vram_horz();
-			increment_vram_vert();
+			nes->ppu_pipeline.sprite_x_positions[0]--;
 		}
-		else if (scan_pixel == 279 && (!render_disable))
+		else
 		{
-			reset_vram_vert();
+			unsigned char sprite_palette = ((nes->ppu_pipeline.sprite_bitmaps_low[0] >> 7) & 0b1) | ((nes->ppu_pipeline.sprite_bitmaps_high[0] >> 6) & 0b10);
+			if ((sprite_palette > 0) && show_left_sprites && background_enable && (background_bitmap_palette > 0))
+			{
+				nes->ppu_status = nes->ppu_status | 0b01000000;
+			}
+			nes->ppu_pipeline.sprite_bitmaps_low[0] = (nes->ppu_pipeline.sprite_bitmaps_low[0] << 1) & 0xFF;
+			nes->ppu_pipeline.sprite_bitmaps_high[0] = (nes->ppu_pipeline.sprite_bitmaps_high[0] << 1) & 0xFF;
 		}
-		else if (scan_pixel == 284 && (!render_disable))
+	}
+}
+
+// Returns the pixel data to be rendered. 255 indicates no render.
+// This will probably have to be made a bit more complex as more parts of the PPU are implemented.
+unsigned char ppu_tick()
+{
+	unsigned char pixel_data = 255;
+	
+	unsigned int actions = get_dot_actions(nes->scanline, nes->scan_pixel);
+	if (actions != 0)
+	{
+		if (actions & PPU_CLEAR_FLAGS)
 		{
-			load_sprites();
+			// Clear the vblank and sprite 0 hit flags.
+			nes->ppu_status = nes->ppu_status & 0b00111111;
+			nes->nmi_occurred = nes->nmi_occurred & 0b10;
 		}
-		// Load the first two tiles of the next scanline.
-		else if ((scan_pixel >= 320) && (scan_pixel <= 336) && ((scan_pixel % 8) == 1) && (!render_disable))
+		
+		if (actions & PPU_SET_VBLANK)
 		{
-			load_render_registers();
+			if (nes->reset_cycle)
+			{
+				nes->reset_cycle = 0;
+			}
+			else
+			{
+				
+				if (!nes->vblank_skip)
+				{
+					nes->ppu_status = nes->ppu_status | 0b10000000;
+					nes->nmi_occurred = nes->nmi_occurred | 0b01;
+				}
+				else
+				{
+					nes->vblank_skip = 0;
+				}
+			}
 		}
-	}
-	// visible scanline
-	else if (scanline < 240)
-	{
-		// Send up a black pixel during visible pixels to keep rendering aligned properly.
-		// Should probably find a better way to make sure that can't actually happen.
+		
+		unsigned char render_disable = (nes->ppu_mask & 0b00011000) == 0;
 		if (render_disable)
 		{
-			if ((scan_pixel > 0) && (scan_pixel <= 256))
+			// Send up a black pixel during visible pixels to keep rendering aligned properly.
+			// Should probably find a better way to make sure that can't actually happen.
+			if ((actions & PPU_DRAW_PIXEL) && !nes->ppu_render_threaded && !nes->ppu_audio_only)
 			{
-				get_pointer_at_ppu_address(&pixel_data, 0x3F00, READ);
+				pixel_data = nes->palette_ram[0];
 			}
 		}
 		else
 		{
-			// Rendering cycles
-			if ((scan_pixel > 0) && (scan_pixel <= 256))
+			if (actions & PPU_SHIFT_TILE)
 			{
-				unsigned char show_left_sprites = 1;
-				if (scan_pixel <= 8)
-				{
-					background_enable = background_enable & ((ppu_mask >> 1) & 0b1);
-					show_left_sprites = (ppu_mask >> 2) & 0b1;
-				}
-				// Default to backdrop color if nothing else gets rendered
-				get_pointer_at_ppu_address(&pixel_data, 0x3F00, READ);
-				// Load the next tile every 8 cycles.
-				if (((scan_pixel % 8) == 1) && (scan_pixel > 1))
-				{
-					load_render_registers();
-				}
-				// It seems that fine x scroll selects bits in the opposite order of my implementation.
-				// I still don't understand exactly how the rendering pipeline works. But this should work fine.
-				unsigned char fixed_fine_x_scroll = 7 - fine_x_scroll;
-				unsigned char background_bitmap_palette =
-					  ((bitmap_register_low >> (8 + fixed_fine_x_scroll)) & 0b1)
-					| ((bitmap_register_high >> (7 + fixed_fine_x_scroll)) & 0b10);
-				unsigned char palette_address = 0;
-				// All palettes show the same default background color.
-				if (background_bitmap_palette > 0)
+				shift_tile(&nes->ppu_pipeline);
+			}
+			if (actions & PPU_FETCH_TILE)
+			{
+				load_render_registers();
+			}
+			if (actions & PPU_DRAW_PIXEL)
+			{
+				if (nes->ppu_audio_only)
 				{
-					palette_address = background_bitmap_palette
-						| (((palette_register_low >> fixed_fine_x_scroll) << 2) & 0b100)
-						| (((palette_register_high >> fixed_fine_x_scroll) << 3) & 0b1000);
+					// The tile fetches at the end of each line fill the background registers all over again,
+					// so on lines where sprite 0 can't hit (or already has), they don't need shifting either.
+					if (nes->ppu_pipeline.sprite_0_selected && ((nes->ppu_status & 0b01000000) == 0))
+					{
+						track_sprite_0_hit(actions & PPU_LEFT_COLUMN);
+					}
 				}
-				unsigned char background_pixel;
-				get_pointer_at_ppu_address(&background_pixel, 0x3F00 + palette_address, READ);
-				if (background_enable)
+				else if (nes->ppu_render_threaded)
 				{
-					pixel_data = background_pixel;
+					track_sprite_0_hit(actions & PPU_LEFT_COLUMN);
 				}
-				bitmap_register_low = (bitmap_register_low << 1) & 0xFFFF;
-				bitmap_register_high = (bitmap_register_high << 1) & 0xFFFF;
-				palette_register_low = ((palette_register_low << 1) & 0xFF) | (palette_latch & 0b1);
-				palette_register_high = ((palette_register_high << 1) & 0xFF) | ((palette_latch & 0b10) >> 1);
-				
-				if (sprite_enable)
+				else
 				{
-					// Evaluate in reverse order to make sure lower index sprites are drawn on top.
-					for (int i = (sprite_count - 1); i >= 0; i--)
-					{
-						if (sprite_x_positions[i] > 0)
-						{
-							sprite_x_positions[i]--;
-						}
-						else
-						{
-							unsigned char sprite_priority = (sprite_attributes[i] >> 5) & 0b1;
-							unsigned char sprite_palette = ((sprite_bitmaps_low[i] >> 7) & 0b1) | ((sprite_bitmaps_high[i] >> 6) & 0b10);
-							// Only load in sprite pixel if it's non-transparent and it isn't being masked in the leftmost column.
-							if ((sprite_palette > 0) && show_left_sprites)
-							{
-								// Check for sprite 0 hit
-								if (background_enable && (background_bitmap_palette > 0) && (i == 0) && sprite_0_selected)
-								{
-									ppu_status = ppu_status | 0b01000000;
-								}
-								
-								if (background_enable && (background_bitmap_palette > 0) && (sprite_priority == 1))
-								{
-									pixel_data = background_pixel;
-								}
-								else
-								{
-									sprite_palette = sprite_palette | ((sprite_attributes[i] & 0b11) << 2);
-									get_pointer_at_ppu_address(&pixel_data, 0x3F10 + sprite_palette, READ);
-								}
-							}
-							sprite_bitmaps_low[i] = (sprite_bitmaps_low[i] << 1) & 0xFF;
-							sprite_bitmaps_high[i] = (sprite_bitmaps_high[i] << 1) & 0xFF;
-						}
-					}
+					pixel_data = draw_pixel(&nes->ppu_pipeline, nes->ppu_mask, nes->fine_x_scroll, nes->palette_ram, actions & PPU_LEFT_COLUMN, &nes->ppu_status);
 				}
-				// Only the lower six pixels contain color data. Garbage data should be truncated
-				// to six bits, so it can't be erroneously read as a 255 'no render' pixel.
-				pixel_data = (pixel_data & 0b111111);
 			}
-			else if (scan_pixel == 257)
+			if (actions & PPU_RESET_HORZ)
 			{
 				reset_vram_horz();
+			}
+			if (actions & PPU_INCREMENT_VERT)
+			{
 				increment_vram_vert();
-				// Evaluating sprites here for now, in preparation for the next scanline.
-				evaluate_sprites();
 			}
-			else if (scan_pixel == 284)
+			if (actions & PPU_RESET_VERT)
 			{
-				load_sprites();
+				reset_vram_vert();
 			}
-			else if (scan_pixel == 321)
+			if (actions & PPU_EVALUATE_SPRITES)
 			{
-				// Load the first tile of the next scanline.
-				load_render_registers();
+				// Evaluating sprites here for now, in preparation for the next scanline.
+				evaluate_sprites();
 			}
-			else if (scan_pixel == 329)
+			if (actions & PPU_LOAD_SPRITES)
 			{
-				// Shift the first tile to be rendered and load the second tile of the next scanline.
-				// This probably isn't how the NES really handles it, but it should work?
-				for (int i = 0; i < 8; i++)
-				{
-					bitmap_register_low = (bitmap_register_low << 1) & 0xFFFF;
-					bitmap_register_high = (bitmap_register_high << 1) & 0xFFFF;
-					palette_register_low = ((palette_register_low << 1) & 0xFF) | (palette_latch & 0b1);
-					palette_register_high = ((palette_register_high << 1) & 0xFF) | ((palette_latch & 0b10) >> 1);
-				}
-				load_render_registers();
+				load_sprites();
 			}
 		}
-	}
-	// Start of vblank.
-	else if (scanline == 241)
-	{
-		if (scan_pixel == 1)
+		
+		// The render thread has everything it needs for the frame once the last pixel is due,
+		// which is also when the frontend finishes the frame when it draws the pixels itself.
+		// With nothing drawn, it's just where the frame ends.
+		if ((actions & PPU_DRAW_PIXEL) && (nes->ppu_render_threaded || nes->ppu_audio_only) && (nes->scanline == 239) && (nes->scan_pixel == 256))
 		{
-			if (reset_cycle)
-			{
-				reset_cycle = 0;
-			}
-			else
+			if (!nes->ppu_audio_only)
 			{
-				
-				if (!vblank_skip)
-				{
-					ppu_status = ppu_status | 0b10000000;
-					nmi_occurred = nmi_occurred | 0b01;
-				}
-				else
-				{
-					vblank_skip = 0;
-				}
+				ppu_renderer_end_frame();
 			}
+			nes->ppu_frame_drawn = 1;
 		}
 	}
 	
-	scan_pixel++;
-	// Jump to the next scanline once we hit the end. The dummy scanline ends one frame early on odd frames.
-	if (scan_pixel > 340 || ((scanline == 261) && (scan_pixel == 339) && odd_frame))
-	{
-		scanline++;
-		scan_pixel = 0;
-	}
+	advance_dot(&nes->scanline, &nes->scan_pixel, &nes->odd_frame);
+	nes->ppu_dot_count++;
 	
-	if (scanline > 261)
+	if (nes->scan_pixel == 0)
 	{
-		scanline = 0;
-		odd_frame = !odd_frame;
+		nes->a12_tile_rise = (nes->ppu_control >> 4) & 0b1;
+		nes->a12_exact_line = 0;
 	}
 	
-	if (((nmi_occurred & 0b1) == 1) && ((nmi_output & 0b1) == 1) && ((nmi_occurred == 0b01) || (nmi_output == 0b01)))
+	if (((nes->nmi_occurred & 0b1) == 1) && ((nes->nmi_output & 0b1) == 1) && ((nes->nmi_occurred == 0b01) || (nes->nmi_output == 0b01)))
 	{
-		pending_interrupt++;
-		interrupt_type = NMI;
+		nes->pending_interrupt++;
 	}
 	
 	// Shift the NMI bits into the 'previous frame' bits.
-	nmi_occurred = ((nmi_occurred & 0b1) << 1) | (nmi_occurred & 0b1);
-	nmi_output = ((nmi_output & 0b1) << 1) | (nmi_output & 0b1);
+	nes->nmi_occurred = ((nes->nmi_occurred & 0b1) << 1) | (nes->nmi_occurred & 0b1);
+	nes->nmi_output = ((nes->nmi_output & 0b1) << 1) | (nes->nmi_output & 0b1);
 	
-	if (status_read > 0)
+	if (nes->status_read > 0)
 	{
-		status_read--;
+		nes->status_read--;
 	}
 	
 	return pixel_data;
@@ -792,41 +1005,39 @@ unsigned char ppu_tick()
 
 void ppu_init()
 {
-	vram_address = 0;
-	vram_temp = 0;
-	fine_x_scroll = 0;
+	nes->vram_address = 0;
+	nes->vram_temp = 0;
+	nes->fine_x_scroll = 0;
 	
-	ppu_control = 0;
-	ppu_mask = 0;
-	ppu_status = 0;
-	oam_address = 0;
-	ppu_data_buffer = 0;
-	register_accessed = 0;
+	nes->ppu_control = 0;
+	nes->ppu_mask = 0;
+	nes->ppu_status = 0;
+	nes->oam_address = 0;
+	nes->ppu_data_buffer = 0;
+	nes->register_accessed = 0;
 	
-	write_toggle = 0;
-	odd_frame = 0;
+	nes->write_toggle = 0;
+	nes->odd_frame = 0;
 	
-	scanline = 240;
-	scan_pixel = 0;
+	nes->scanline = 240;
+	nes->scan_pixel = 0;
+	nes->ppu_dot_count = 0;
+	nes->ppu_frame_drawn = 0;
+	nes->ppu_address_bit_12 = 0;
 	
-	nmi_occurred = 0;
+	nes->nmi_occurred = 0;
 	
-	ppu_ram = malloc(sizeof(char) * 0x800);
-	for (int i = 0; i < 0x800; i++)
-	{
-		ppu_ram[i] = 0;
-	}
-	palette_ram = malloc(sizeof(char) * 0x20);
-	for (int i = 0; i < 0x20; i++)
-	{
-		palette_ram[i] = 0;
-	}
-	oam = malloc(sizeof(char) * 0x100);
-	secondary_oam = malloc(sizeof(char) * 0x40);
-	sprite_bitmaps_low = malloc(sizeof(char) * 0x8);
-	sprite_bitmaps_high = malloc(sizeof(char) * 0x8);
-	sprite_attributes = malloc(sizeof(char) * 0x8);
-	sprite_x_positions = malloc(sizeof(char) * 0x8);
-	sprite_count = 0;
-	sprite_0_selected = 0;
+	nes->ppu_bus = 0;
+	nes->status_read = 0;
+	nes->reset_cycle = 1;
+	nes->vblank_skip = 1;
+	nes->nmi_output = 0;
+	nes->a12_tile_rise = 0;
+	nes->a12_exact_line = 0;
+	
+	memset(nes->ppu_ram, 0, 0x800);
+	memset(nes->palette_ram, 0, 0x20);
+	memset(nes->oam, 0, 0x100);
+	memset(nes->secondary_oam, 0, 0x40);
+	memset(&nes->ppu_pipeline, 0, sizeof(struct pixel_pipeline));
 }
\ No newline at end of file
@@ -3,21 +3,49 @@
 
 extern const unsigned int KB;
 
-extern unsigned char* ppu_ram;
-extern unsigned char* palette_ram;
-extern unsigned char* oam;
-
-extern unsigned char ppu_bus;
-
-extern unsigned char pending_interrupt;
-extern unsigned int scanline;
-extern unsigned int scan_pixel;
+// What the PPU does on a given dot, from get_dot_actions.
+enum
+{
+	PPU_CLEAR_FLAGS      = 0b00000000001,
+	PPU_SET_VBLANK       = 0b00000000010,
+	PPU_DRAW_PIXEL       = 0b00000000100,
+	PPU_LEFT_COLUMN      = 0b00000001000,
+	PPU_SHIFT_TILE       = 0b00000010000,
+	PPU_FETCH_TILE       = 0b00000100000,
+	PPU_RESET_HORZ       = 0b00001000000,
+	PPU_INCREMENT_VERT   = 0b00010000000,
+	PPU_RESET_VERT       = 0b00100000000,
+	PPU_EVALUATE_SPRITES = 0b01000000000,
+	PPU_LOAD_SPRITES     = 0b10000000000
+};
+
+struct pixel_pipeline
+{
+	unsigned int bitmap_register_low;
+	unsigned int bitmap_register_high;
+	unsigned char palette_register_low;
+	unsigned char palette_register_high;
+	unsigned char palette_latch;
+	unsigned char sprite_bitmaps_low[8];
+	unsigned char sprite_bitmaps_high[8];
+	unsigned char sprite_attributes[8];
+	unsigned char sprite_x_positions[8];
+	unsigned char sprite_count;
+	unsigned char sprite_0_selected;
+};
 
 void exit_emulator();
 
+void ppu_build_tables();
 void ppu_init();
 void access_ppu_register(unsigned char* data, unsigned int ppu_register, unsigned char access_type);
 unsigned char ppu_tick();
+unsigned int get_dot_actions(unsigned int line, unsigned int dot);
+void advance_dot(unsigned int* line, unsigned int* dot, unsigned char* odd);
+void write_palette(unsigned char* palette, unsigned int address, unsigned char data);
+void shift_tile(struct pixel_pipeline* pipeline);
+void load_tile(struct pixel_pipeline* pipeline, unsigned char low_pattern_data, unsigned char high_pattern_data, unsigned char palette_select);
+unsigned char draw_pixel(struct pixel_pipeline* pipeline, unsigned char mask, unsigned char fine_x, unsigned char* palette, unsigned char left_column, unsigned char* status);
 
 void ppu_save_state(FILE* save_file);
 void ppu_load_state(FILE* save_file);
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <SDL.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#include <immintrin.h>
+#define NTSC_AVX2
+#endif
+#endif
+#include "ntsc_filter.h"
+
+// Simulates the NES composite video signal and a TV decoding it again, which gets the color bleed
+// and the artifact fringes that games were drawn with in mind. Based on the signal description at
+// http://wiki.nesdev.com/w/index.php/NTSC_video and Bisqwit's decoder.
+//
+// The PPU outputs 8 signal samples per pixel, and the color subcarrier is 12 samples long,
+// so every 3 pixels the chroma lines back up with where it started. Those 3 pixels become 7 output
+// pixels, which is what makes the output 602 wide (86 groups of 3, the last group being padded with black).
+//
+// Decoding is linear (until the final clamp), so the output is just the sum of what each input
+// pixel contributes to the output pixels around it. Those contributions get precalculated
+// for every pixel value, position within the group and scanline phase, and filtering
+// a frame is only adding them up. That part is what the SSE2/AVX2 versions do.
+
+const unsigned int NTSC_INPUT_WIDTH = 256;
+const unsigned int NTSC_INPUT_HEIGHT = 240;
+const unsigned int NTSC_OUTPUT_WIDTH = 602;
+
+// Palette index in bits 0-5, PPUMASK emphasis bits in bits 6-8.
+const unsigned int NTSC_PIXEL_VALUES = 512;
+const unsigned int NTSC_SAMPLES_PER_PIXEL = 8;
+const unsigned int NTSC_GROUP_INPUT = 3;
+const unsigned int NTSC_GROUP_OUTPUT = 7;
+// Scanlines start a third of a subcarrier cycle apart from each other, so there's 3 phases.
+const unsigned int NTSC_PHASES = 3;
+// How many output pixels a single input pixel can reach. Really 6, but 8 keeps the kernels in whole vectors.
+#define NTSC_KERNEL_PIXELS 8
+#define NTSC_KERNEL_SIZE (NTSC_KERNEL_PIXELS * 4)
+// Room on either side of the accumulator for kernels hanging off the edge of the line.
+const unsigned int NTSC_MARGIN = 8;
+// Fixed point fraction bits of the kernels.
+const unsigned int NTSC_FRACTION_BITS = 8;
+
+// Signal voltages of the 4 luma levels, low half of the wave then high half. Normalized so black is 0 and white is 1.
+const float ntsc_black = 0.312f;
+const float ntsc_white = 1.100f;
+const float ntsc_levels[8] = { 0.228f, 0.312f, 0.552f, 0.880f, 0.616f, 0.840f, 1.100f, 1.100f };
+const float ntsc_emphasis_attenuation = 0.746f;
+// Luma is averaged over a pixel's worth of samples, chroma over a full subcarrier cycle.
+const int NTSC_LUMA_WINDOW = 8;
+const int NTSC_CHROMA_WINDOW = 12;
+const float NTSC_PI = 3.14159265f;
+// Tuned so flat areas of color come out close to palettes/ntscpalette.pal.
+const float ntsc_hue = 3.9f;
+const float ntsc_saturation = 1.1f;
+
+// Kernels are indexed by ((pixel value * 3 + position in group) * 3 + phase), each one
+// holding 8 output pixels of B, G, R, unused as 32 bit fixed point.
+int32_t* ntsc_kernels;
+// The first output pixel each position in the group reaches, relative to the group's first output pixel.
+int ntsc_kernel_start[3];
+int32_t* ntsc_accumulator;
+
+typedef void (*ntsc_line_filter) (unsigned short*, unsigned char*, unsigned char);
+ntsc_line_filter ntsc_filter_line;
+
+SDL_Thread* ntsc_thread = NULL;
+SDL_mutex* ntsc_lock;
+SDL_cond* ntsc_frame_waiting;
+// The emulator copies finished frames into the pending frame, and the worker swaps it with the working frame when it starts on it.
+unsigned short* ntsc_pending_frame;
+unsigned short* ntsc_working_frame;
+unsigned char ntsc_pending_ready;
+unsigned char ntsc_pending_phase;
+unsigned char ntsc_burst_phase;
+// Triple buffered output: the worker draws into the back buffer, the newest finished
+// output waits in the ready buffer, and the front buffer belongs to whoever took it last.
+unsigned char* ntsc_outputs[3];
+unsigned char ntsc_back;
+unsigned char ntsc_ready;
+unsigned char ntsc_front;
+unsigned char ntsc_output_ready;
+
+unsigned char ntsc_in_color_phase(unsigned int color, int phase)
+{
+	return ((color + phase) % 12) < 6;
+}
+
+// The signal level of one sample of a pixel, phase being the sample's position in the subcarrier cycle.
+float ntsc_signal(unsigned int pixel, int phase)
+{
+	unsigned int color = pixel & 0x0F;
+	// Colors $xE and $xF are always black.
+	unsigned int level = (color < 0x0E) ? ((pixel >> 4) & 0b11) : 1;
+	// Color $x0 is high for the whole cycle and $xD is low for the whole cycle, which makes them grays.
+	float low = ntsc_levels[level + ((color == 0x00) ? 4 : 0)];
+	float high = ntsc_levels[level + ((color < 0x0D) ? 4 : 0)];
+	float signal = ntsc_in_color_phase(color, phase) ? high : low;
+
+	// Each emphasis bit darkens a third of the cycle.
+	if (((pixel & 0x040) && ntsc_in_color_phase(0x0C, phase))
+		|| ((pixel & 0x080) && ntsc_in_color_phase(0x04, phase))
+		|| ((pixel & 0x100) && ntsc_in_color_phase(0x08, phase)))
+	{
+		signal = signal * ntsc_emphasis_attenuation;
+	}
+
+	return (signal - ntsc_black) / (ntsc_white - ntsc_black);
+}
+
+// Where the center of an output pixel lands in the samples, counting from the start of its group.
+int ntsc_output_center(int output_pixel)
+{
+	return (int)floorf((output_pixel + 0.5f) * (NTSC_GROUP_INPUT * NTSC_SAMPLES_PER_PIXEL) / NTSC_GROUP_OUTPUT);
+}
+
+void ntsc_build_kernel(int32_t* kernel, unsigned int pixel, int position, int phase)
+{
+	float signal[8];
+	int first_sample = position * NTSC_SAMPLES_PER_PIXEL;
+	for (int i = 0; i < 8; i++)
+	{
+		signal[i] = ntsc_signal(pixel, (first_sample + i + (4 * phase)) % 12);
+	}
+
+	for (int i = 0; i < NTSC_KERNEL_PIXELS; i++)
+	{
+		int center = ntsc_output_center(ntsc_kernel_start[position] + i);
+		float luma = 0;
+		float in_phase = 0;
+		float quadrature = 0;
+		for (int sample = first_sample; sample < first_sample + 8; sample++)
+		{
+			float value = signal[sample - first_sample];
+			if ((sample >= center - (NTSC_LUMA_WINDOW / 2)) && (sample < center + (NTSC_LUMA_WINDOW / 2)))
+			{
+				luma += value / NTSC_LUMA_WINDOW;
+			}
+			if ((sample >= center - (NTSC_CHROMA_WINDOW / 2)) && (sample < center + (NTSC_CHROMA_WINDOW / 2)))
+			{
+				float angle = NTSC_PI * (sample + (4 * phase) + ntsc_hue) / 6;
+				in_phase += value * cosf(angle) * 2 / NTSC_CHROMA_WINDOW;
+				quadrature += value * sinf(angle) * 2 / NTSC_CHROMA_WINDOW;
+			}
+		}
+		in_phase = in_phase * ntsc_saturation;
+		quadrature = quadrature * ntsc_saturation;
+
+		// YIQ to RGB, per the FCC's matrix.
+		float red = luma + (0.946882f * in_phase) + (0.623557f * quadrature);
+		float green = luma - (0.274788f * in_phase) - (0.635691f * quadrature);
+		float blue = luma - (1.108545f * in_phase) + (1.709007f * quadrature);
+		float scale = 255.0f * (1 << NTSC_FRACTION_BITS);
+		kernel[(i * 4) + 0] = (int32_t)lroundf(blue * scale);
+		kernel[(i * 4) + 1] = (int32_t)lroundf(green * scale);
+		kernel[(i * 4) + 2] = (int32_t)lroundf(red * scale);
+		kernel[(i * 4) + 3] = 0;
+	}
+}
+
+int32_t* ntsc_get_kernel(unsigned int pixel, unsigned int position, unsigned int phase)
+{
+	return ntsc_kernels + (((((pixel * NTSC_GROUP_INPUT) + position) * NTSC_PHASES) + phase) * NTSC_KERNEL_SIZE);
+}
+
+unsigned char ntsc_clamp(int32_t value)
+{
+	value = value >> NTSC_FRACTION_BITS;
+	if (value < 0)
+	{
+		return 0;
+	}
+	else if (value > 255)
+	{
+		return 255;
+	}
+	return value;
+}
+
+// Returns where the kernel of the pixel at x goes in the accumulator.
+int32_t* ntsc_accumulator_at(unsigned int x)
+{
+	unsigned int group = x / NTSC_GROUP_INPUT;
+	int output_pixel = (group * NTSC_GROUP_OUTPUT) + ntsc_kernel_start[x % NTSC_GROUP_INPUT] + NTSC_MARGIN;
+	return ntsc_accumulator + (output_pixel * 4);
+}
+
+void ntsc_filter_line_scalar(unsigned short* line, unsigned char* output, unsigned char phase)
+{
+	memset(ntsc_accumulator, 0, sizeof(int32_t) * 4 * (NTSC_OUTPUT_WIDTH + (2 * NTSC_MARGIN)));
+	for (unsigned int x = 0; x < NTSC_INPUT_WIDTH; x++)
+	{
+		int32_t* kernel = ntsc_get_kernel(line[x], x % NTSC_GROUP_INPUT, phase);
+		int32_t* destination = ntsc_accumulator_at(x);
+		for (int i = 0; i < NTSC_KERNEL_SIZE; i++)
+		{
+			destination[i] += kernel[i];
+		}
+	}
+
+	int32_t* source = ntsc_accumulator + (NTSC_MARGIN * 4);
+	for (unsigned int i = 0; i < NTSC_OUTPUT_WIDTH * 4; i++)
+	{
+		output[i] = ntsc_clamp(source[i]);
+	}
+}
+
+#ifdef __SSE2__
+// Shifts out the fraction and saturates four output pixels at a time down to bytes.
+void ntsc_pack_line_sse2(unsigned char* output)
+{
+	int32_t* source = ntsc_accumulator + (NTSC_MARGIN * 4);
+	unsigned int i = 0;
+	for (; i + 16 <= NTSC_OUTPUT_WIDTH * 4; i += 16)
+	{
+		__m128i pixel_0 = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(source + i)), NTSC_FRACTION_BITS);
+		__m128i pixel_1 = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(source + i + 4)), NTSC_FRACTION_BITS);
+		__m128i pixel_2 = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(source + i + 8)), NTSC_FRACTION_BITS);
+		__m128i pixel_3 = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(source + i + 12)), NTSC_FRACTION_BITS);
+		__m128i words_0 = _mm_packs_epi32(pixel_0, pixel_1);
+		__m128i words_1 = _mm_packs_epi32(pixel_2, pixel_3);
+		_mm_storeu_si128((__m128i*)(output + i), _mm_packus_epi16(words_0, words_1));
+	}
+	for (; i < NTSC_OUTPUT_WIDTH * 4; i++)
+	{
+		output[i] = ntsc_clamp(source[i]);
+	}
+}
+
+void ntsc_filter_line_sse2(unsigned short* line, unsigned char* output, unsigned char phase)
+{
+	memset(ntsc_accumulator, 0, sizeof(int32_t) * 4 * (NTSC_OUTPUT_WIDTH + (2 * NTSC_MARGIN)));
+	for (unsigned int x = 0; x < NTSC_INPUT_WIDTH; x++)
+	{
+		__m128i* kernel = (__m128i*)ntsc_get_kernel(line[x], x % NTSC_GROUP_INPUT, phase);
+		__m128i* destination = (__m128i*)ntsc_accumulator_at(x);
+		for (int i = 0; i < NTSC_KERNEL_PIXELS; i++)
+		{
+			_mm_storeu_si128(destination + i, _mm_add_epi32(_mm_loadu_si128(destination + i), _mm_loadu_si128(kernel + i)));
+		}
+	}
+
+	ntsc_pack_line_sse2(output);
+}
+#endif
+
+#ifdef NTSC_AVX2
+__attribute__ ((target ("avx2")))
+void ntsc_filter_line_avx2(unsigned short* line, unsigned char* output, unsigned char phase)
+{
+	memset(ntsc_accumulator, 0, sizeof(int32_t) * 4 * (NTSC_OUTPUT_WIDTH + (2 * NTSC_MARGIN)));
+	for (unsigned int x = 0; x < NTSC_INPUT_WIDTH; x++)
+	{
+		__m256i* kernel = (__m256i*)ntsc_get_kernel(line[x], x % NTSC_GROUP_INPUT, phase);
+		__m256i* destination = (__m256i*)ntsc_accumulator_at(x);
+		for (int i = 0; i < NTSC_KERNEL_PIXELS / 2; i++)
+		{
+			_mm256_storeu_si256(destination + i, _mm256_add_epi32(_mm256_loadu_si256(destination + i), _mm256_loadu_si256(kernel + i)));
+		}
+	}
+
+	ntsc_pack_line_sse2(output);
+}
+#endif
+
+// Filters a whole frame of pixel values into NTSC_OUTPUT_WIDTH * NTSC_INPUT_HEIGHT pixels of B, G, R, unused.
+// The burst phase should alternate every frame to get the same dot crawl as the real thing.
+void ntsc_filter_frame(unsigned short* frame, unsigned char* output, unsigned char burst_phase)
+{
+	for (unsigned int line = 0; line < NTSC_INPUT_HEIGHT; line++)
+	{
+		ntsc_filter_line(frame + (line * NTSC_INPUT_WIDTH), output + (line * NTSC_OUTPUT_WIDTH * 4), (burst_phase + line) % NTSC_PHASES);
+	}
+}
+
+int ntsc_worker(void* data)
+{
+	while (1)
+	{
+		SDL_LockMutex(ntsc_lock);
+		while (!ntsc_pending_ready)
+		{
+			SDL_CondWait(ntsc_frame_waiting, ntsc_lock);
+		}
+		unsigned short* next_frame = ntsc_pending_frame;
+		ntsc_pending_frame = ntsc_working_frame;
+		ntsc_working_frame = next_frame;
+		ntsc_pending_ready = 0;
+		unsigned char phase = ntsc_pending_phase;
+		SDL_UnlockMutex(ntsc_lock);
+
+		ntsc_filter_frame(ntsc_working_frame, ntsc_outputs[ntsc_back], phase);
+
+		SDL_LockMutex(ntsc_lock);
+		unsigned char finished = ntsc_back;
+		ntsc_back = ntsc_ready;
+		ntsc_ready = finished;
+		ntsc_output_ready = 1;
+		SDL_UnlockMutex(ntsc_lock);
+	}
+
+	return 0;
+}
+
+void ntsc_filter_start_worker()
+{
+	if (ntsc_thread != NULL)
+	{
+		return;
+	}
+
+	unsigned int frame_size = NTSC_INPUT_WIDTH * NTSC_INPUT_HEIGHT;
+	ntsc_pending_frame = malloc(sizeof(short) * frame_size);
+	ntsc_working_frame = malloc(sizeof(short) * frame_size);
+	ntsc_pending_ready = 0;
+	ntsc_pending_phase = 0;
+	ntsc_burst_phase = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		ntsc_outputs[i] = calloc(NTSC_OUTPUT_WIDTH * NTSC_INPUT_HEIGHT * 4, sizeof(char));
+	}
+	ntsc_back = 0;
+	ntsc_ready = 1;
+	ntsc_front = 2;
+	ntsc_output_ready = 0;
+
+	ntsc_lock = SDL_CreateMutex();
+	ntsc_frame_waiting = SDL_CreateCond();
+	ntsc_thread = SDL_CreateThread(ntsc_worker, "NTSC filter", NULL);
+	if (ntsc_thread == NULL)
+	{
+		printf("Could not start the NTSC filter thread: %s\n", SDL_GetError());
+	}
+}
+
+// Hands a finished frame to the worker. If the worker is still busy with an older frame,
+// the frame waiting behind it just gets replaced, so the emulator never waits on the filter.
+void ntsc_filter_submit(unsigned short* frame)
+{
+	SDL_LockMutex(ntsc_lock);
+	memcpy(ntsc_pending_frame, frame, sizeof(short) * NTSC_INPUT_WIDTH * NTSC_INPUT_HEIGHT);
+	ntsc_pending_ready = 1;
+	ntsc_pending_phase = ntsc_burst_phase;
+	ntsc_burst_phase = !ntsc_burst_phase;
+	SDL_CondSignal(ntsc_frame_waiting);
+	SDL_UnlockMutex(ntsc_lock);
+}
+
+// Returns the newest filtered frame, or NULL if nothing new has finished since the last call.
+// The returned buffer stays valid until the next call.
+unsigned char* ntsc_filter_take_output()
+{
+	unsigned char* output = NULL;
+	SDL_LockMutex(ntsc_lock);
+	if (ntsc_output_ready)
+	{
+		unsigned char newest = ntsc_ready;
+		ntsc_ready = ntsc_front;
+		ntsc_front = newest;
+		ntsc_output_ready = 0;
+		output = ntsc_outputs[ntsc_front];
+	}
+	SDL_UnlockMutex(ntsc_lock);
+
+	return output;
+}
+
+void ntsc_filter_init()
+{
+	// Find the first output pixel whose chroma window reaches into each pixel position of the group.
+	for (unsigned int position = 0; position < NTSC_GROUP_INPUT; position++)
+	{
+		int first_sample = position * NTSC_SAMPLES_PER_PIXEL;
+		int output_pixel = -(int)NTSC_MARGIN;
+		while (ntsc_output_center(output_pixel) + (NTSC_CHROMA_WINDOW / 2) <= first_sample)
+		{
+			output_pixel++;
+		}
+		ntsc_kernel_start[position] = output_pixel;
+	}
+
+	ntsc_kernels = malloc(sizeof(int32_t) * NTSC_PIXEL_VALUES * NTSC_GROUP_INPUT * NTSC_PHASES * NTSC_KERNEL_SIZE);
+	for (unsigned int pixel = 0; pixel < NTSC_PIXEL_VALUES; pixel++)
+	{
+		for (unsigned int position = 0; position < NTSC_GROUP_INPUT; position++)
+		{
+			for (unsigned int phase = 0; phase < NTSC_PHASES; phase++)
+			{
+				ntsc_build_kernel(ntsc_get_kernel(pixel, position, phase), pixel, position, phase);
+			}
+		}
+	}
+
+	ntsc_accumulator = malloc(sizeof(int32_t) * 4 * (NTSC_OUTPUT_WIDTH + (2 * NTSC_MARGIN)));
+
+	ntsc_filter_line = ntsc_filter_line_scalar;
+#ifdef __SSE2__
+	ntsc_filter_line = ntsc_filter_line_sse2;
+#endif
+#ifdef NTSC_AVX2
+	if (__builtin_cpu_supports("avx2"))
+	{
+		ntsc_filter_line = ntsc_filter_line_avx2;
+	}
+#endif
+}
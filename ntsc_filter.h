@@ -0,0 +1,14 @@
+#ifndef NTSC_FILTER_HEADER
+#define NTSC_FILTER_HEADER
+
+extern const unsigned int NTSC_INPUT_WIDTH;
+extern const unsigned int NTSC_INPUT_HEIGHT;
+extern const unsigned int NTSC_OUTPUT_WIDTH;
+
+void ntsc_filter_init();
+void ntsc_filter_frame(unsigned short* frame, unsigned char* output, unsigned char burst_phase);
+void ntsc_filter_start_worker();
+void ntsc_filter_submit(unsigned short* frame);
+unsigned char* ntsc_filter_take_output();
+
+#endif
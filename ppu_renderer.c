@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "nes_cpu.h"
+#include "nes_ppu.h"
+#include "ppu_renderer.h"
+#include "nes_context.h"
+
+// Draws the PPU's pixels on a thread of its own. With this on, the PPU on the emulation thread
+// still does all of its fetches (mappers watch those for their IRQs and latches) and tracks sprite 0 hits,
+// but instead of drawing it logs everything that feeds the pixel pipeline, stamped with the dot it happened on:
+// PPUMASK, fine X scroll and palette writes, fetched tiles and loaded sprites. The render thread
+// replays the log through its own copy of the pipeline with the same draw_pixel, so the frame comes out the same.
+//
+// Events stamped with a dot either happen before that dot (register writes, which come from the CPU
+// between PPU ticks), or during it (tiles and sprites, which the PPU loads as part of the dot).
+
+const unsigned int RENDER_FRAME_WIDTH = 256;
+const unsigned int RENDER_FRAME_HEIGHT = 240;
+const unsigned int RENDER_LOG_START_SIZE = 0x4000;
+
+void log_render_event(unsigned char type, unsigned char data_0, unsigned char data_1, unsigned char data_2, unsigned char data_3)
+{
+	if (nes->filling_log->length == nes->filling_log->capacity)
+	{
+		nes->filling_log->capacity = nes->filling_log->capacity * 2;
+		nes->filling_log->events = realloc(nes->filling_log->events, sizeof(struct render_event) * nes->filling_log->capacity);
+	}
+
+	struct render_event* event = &nes->filling_log->events[nes->filling_log->length];
+	event->time = nes->ppu_dot_count;
+	event->type = type;
+	event->data[0] = data_0;
+	event->data[1] = data_1;
+	event->data[2] = data_2;
+	event->data[3] = data_3;
+	nes->filling_log->length++;
+}
+
+// Sprite loads are a header followed by one event for each of the 8 slots.
+void log_render_sprites(struct pixel_pipeline* pipeline)
+{
+	log_render_event(RENDER_SPRITES, pipeline->sprite_count, pipeline->sprite_0_selected, 0, 0);
+	for (int i = 0; i < 8; i++)
+	{
+		log_render_event(RENDER_SPRITE_SLOT, pipeline->sprite_bitmaps_low[i], pipeline->sprite_bitmaps_high[i], pipeline->sprite_attributes[i], pipeline->sprite_x_positions[i]);
+	}
+}
+
+void publish_render_frame()
+{
+	pthread_mutex_lock(&nes->render_lock);
+	unsigned char finished = nes->render_back;
+	nes->render_back = nes->render_ready;
+	nes->render_ready = finished;
+	nes->render_frame_ready = 1;
+	pthread_mutex_unlock(&nes->render_lock);
+}
+
+// Runs the pixel side of one PPU dot. event is the tile or sprite load that happened on this dot, if there was one.
+void render_dot(struct render_event* event)
+{
+	unsigned int actions = get_dot_actions(nes->render_scanline, nes->render_scan_pixel);
+	if (actions != 0)
+	{
+		unsigned char pixel_data = 0;
+		unsigned char render_disable = (nes->render_mask & 0b00011000) == 0;
+		if (render_disable)
+		{
+			pixel_data = nes->render_palette[0];
+		}
+		else
+		{
+			if (actions & PPU_SHIFT_TILE)
+			{
+				shift_tile(&nes->render_pipeline);
+			}
+			if ((actions & PPU_FETCH_TILE) && (event != NULL) && (event->type == RENDER_TILE))
+			{
+				load_tile(&nes->render_pipeline, event->data[0], event->data[1], event->data[2]);
+			}
+			if (actions & PPU_DRAW_PIXEL)
+			{
+				// Sprite 0 hits were already handled on the emulation thread.
+				unsigned char status = 0;
+				pixel_data = draw_pixel(&nes->render_pipeline, nes->render_mask, nes->render_fine_x, nes->render_palette, actions & PPU_LEFT_COLUMN, &status);
+			}
+			if ((actions & PPU_LOAD_SPRITES) && (event != NULL) && (event->type == RENDER_SPRITES))
+			{
+				nes->render_pipeline.sprite_count = event->data[0];
+				nes->render_pipeline.sprite_0_selected = event->data[1];
+				for (int i = 0; i < 8; i++)
+				{
+					struct render_event* slot = event + 1 + i;
+					nes->render_pipeline.sprite_bitmaps_low[i] = slot->data[0];
+					nes->render_pipeline.sprite_bitmaps_high[i] = slot->data[1];
+					nes->render_pipeline.sprite_attributes[i] = slot->data[2];
+					nes->render_pipeline.sprite_x_positions[i] = slot->data[3];
+				}
+			}
+		}
+
+		if (actions & PPU_DRAW_PIXEL)
+		{
+			unsigned int index = (nes->render_scanline * RENDER_FRAME_WIDTH) + (nes->render_scan_pixel - 1);
+			nes->render_frames[nes->render_back][index] = pixel_data | ((nes->render_mask & 0b11100000) << 1);
+			if (index == (RENDER_FRAME_WIDTH * RENDER_FRAME_HEIGHT) - 1)
+			{
+				publish_render_frame();
+			}
+		}
+	}
+
+	advance_dot(&nes->render_scanline, &nes->render_scan_pixel, &nes->render_odd_frame);
+	nes->render_time++;
+}
+
+// Catches the render thread's PPU up to the given dot.
+void render_until(unsigned int time)
+{
+	// Compared as a difference so the dot count wrapping around doesn't matter.
+	while ((int)(time - nes->render_time) > 0)
+	{
+		render_dot(NULL);
+	}
+}
+
+void replay_render_log(struct render_log* log)
+{
+	unsigned int i = 0;
+	while (i < log->length)
+	{
+		struct render_event* event = &log->events[i];
+		render_until(event->time);
+		switch (event->type)
+		{
+			case RENDER_MASK:
+			{
+				nes->render_mask = event->data[0];
+				i++;
+				break;
+			}
+			case RENDER_FINE_X:
+			{
+				nes->render_fine_x = event->data[0];
+				i++;
+				break;
+			}
+			case RENDER_PALETTE:
+			{
+				write_palette(nes->render_palette, event->data[0], event->data[1]);
+				i++;
+				break;
+			}
+			case RENDER_TILE:
+			{
+				render_dot(event);
+				i++;
+				break;
+			}
+			case RENDER_SPRITES:
+			{
+				render_dot(event);
+				i += 9;
+				break;
+			}
+			default:
+			{
+				i++;
+				break;
+			}
+		}
+	}
+	render_until(log->end_time);
+}
+
+// Started with the context it draws for.
+void* render_thread_loop(void* data)
+{
+	nes = data;
+	while (1)
+	{
+		pthread_mutex_lock(&nes->render_lock);
+		while (!nes->render_log_handed && !nes->render_thread_quit)
+		{
+			pthread_cond_wait(&nes->render_log_waiting, &nes->render_lock);
+		}
+		pthread_mutex_unlock(&nes->render_lock);
+		if (nes->render_thread_quit)
+		{
+			break;
+		}
+
+		replay_render_log(nes->handed_log);
+
+		pthread_mutex_lock(&nes->render_lock);
+		nes->handed_log->length = 0;
+		nes->render_log_handed = 0;
+		pthread_cond_broadcast(&nes->render_idle);
+		pthread_mutex_unlock(&nes->render_lock);
+	}
+
+	return NULL;
+}
+
+// Gives the filled log to the render thread, to be drawn up to end_time. Must be called with render_lock held,
+// and only once the render thread is done with the last log.
+void hand_over_log(unsigned int end_time)
+{
+	struct render_log* next_log = nes->handed_log;
+	nes->handed_log = nes->filling_log;
+	nes->filling_log = next_log;
+	nes->handed_log->end_time = end_time;
+	nes->render_log_handed = 1;
+	pthread_cond_signal(&nes->render_log_waiting);
+}
+
+void wait_for_render_thread()
+{
+	while (nes->render_log_handed)
+	{
+		pthread_cond_wait(&nes->render_idle, &nes->render_lock);
+	}
+}
+
+// Called by the PPU on the last pixel of the frame. The frame is drawn in the background, unless
+// the render thread is still on an older one, in which case this frame waits in the log with the next.
+void ppu_renderer_end_frame()
+{
+	pthread_mutex_lock(&nes->render_lock);
+	if (!nes->render_log_handed)
+	{
+		// This dot is still being run, so it needs drawing too.
+		hand_over_log(nes->ppu_dot_count + 1);
+	}
+	pthread_mutex_unlock(&nes->render_lock);
+}
+
+// Waits for the render thread to draw everything up to now, and copies its sprite registers back,
+// since the emulation thread only keeps sprite 0's up to date. After this the PPU's state is complete again.
+void ppu_renderer_drain()
+{
+	pthread_mutex_lock(&nes->render_lock);
+	wait_for_render_thread();
+	hand_over_log(nes->ppu_dot_count);
+	wait_for_render_thread();
+	pthread_mutex_unlock(&nes->render_lock);
+
+	memcpy(nes->ppu_pipeline.sprite_bitmaps_low, nes->render_pipeline.sprite_bitmaps_low, 8);
+	memcpy(nes->ppu_pipeline.sprite_bitmaps_high, nes->render_pipeline.sprite_bitmaps_high, 8);
+	memcpy(nes->ppu_pipeline.sprite_x_positions, nes->render_pipeline.sprite_x_positions, 8);
+}
+
+// Throws away anything logged so far and starts the render thread over from the PPU's current state,
+// for when the PPU state was replaced (loading a state, or turning the render thread on).
+void ppu_renderer_restart()
+{
+	pthread_mutex_lock(&nes->render_lock);
+	wait_for_render_thread();
+	nes->filling_log->length = 0;
+	pthread_mutex_unlock(&nes->render_lock);
+
+	nes->render_pipeline = nes->ppu_pipeline;
+	nes->render_mask = nes->ppu_mask;
+	nes->render_fine_x = nes->fine_x_scroll;
+	memcpy(nes->render_palette, nes->palette_ram, 0x20);
+	nes->render_scanline = nes->scanline;
+	nes->render_scan_pixel = nes->scan_pixel;
+	nes->render_odd_frame = nes->odd_frame;
+	nes->render_time = nes->ppu_dot_count;
+}
+
+void ppu_renderer_start()
+{
+	if (!nes->render_thread_started)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			nes->render_logs[i].capacity = RENDER_LOG_START_SIZE;
+			nes->render_logs[i].events = malloc(sizeof(struct render_event) * nes->render_logs[i].capacity);
+			nes->render_logs[i].length = 0;
+			nes->render_logs[i].end_time = 0;
+		}
+		nes->filling_log = &nes->render_logs[0];
+		nes->handed_log = &nes->render_logs[1];
+		nes->render_log_handed = 0;
+
+		for (int i = 0; i < 3; i++)
+		{
+			nes->render_frames[i] = calloc(RENDER_FRAME_WIDTH * RENDER_FRAME_HEIGHT, sizeof(short));
+		}
+		nes->render_back = 0;
+		nes->render_ready = 1;
+		nes->render_front = 2;
+		nes->render_frame_ready = 0;
+
+		pthread_mutex_init(&nes->render_lock, NULL);
+		pthread_cond_init(&nes->render_log_waiting, NULL);
+		pthread_cond_init(&nes->render_idle, NULL);
+		if (pthread_create(&nes->render_thread, NULL, render_thread_loop, nes) != 0)
+		{
+			core_log("Could not start the render thread.");
+			return;
+		}
+		nes->render_thread_started = 1;
+	}
+
+	ppu_renderer_restart();
+	nes->ppu_render_threaded = 1;
+}
+
+void ppu_renderer_stop()
+{
+	if (nes->ppu_render_threaded)
+	{
+		ppu_renderer_drain();
+		nes->ppu_render_threaded = 0;
+	}
+}
+
+// Returns the newest frame the render thread finished, or NULL if there's nothing new since the last call.
+// The returned frame stays valid until the next call.
+unsigned short* ppu_renderer_take_frame()
+{
+	unsigned short* frame = NULL;
+	pthread_mutex_lock(&nes->render_lock);
+	if (nes->render_frame_ready)
+	{
+		unsigned char newest = nes->render_ready;
+		nes->render_ready = nes->render_front;
+		nes->render_front = newest;
+		nes->render_frame_ready = 0;
+		frame = nes->render_frames[nes->render_front];
+	}
+	pthread_mutex_unlock(&nes->render_lock);
+
+	return frame;
+}
+
+// Stops the render thread and frees everything it had, for when the context is thrown away.
+void ppu_renderer_free()
+{
+	if (!nes->render_thread_started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&nes->render_lock);
+	nes->render_thread_quit = 1;
+	pthread_cond_signal(&nes->render_log_waiting);
+	pthread_mutex_unlock(&nes->render_lock);
+	pthread_join(nes->render_thread, NULL);
+	pthread_mutex_destroy(&nes->render_lock);
+	pthread_cond_destroy(&nes->render_log_waiting);
+	pthread_cond_destroy(&nes->render_idle);
+	for (int i = 0; i < 2; i++)
+	{
+		free(nes->render_logs[i].events);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		free(nes->render_frames[i]);
+	}
+	nes->render_thread_started = 0;
+	nes->ppu_render_threaded = 0;
+}
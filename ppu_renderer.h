@@ -0,0 +1,41 @@
+#ifndef PPU_RENDERER_HEADER
+#define PPU_RENDERER_HEADER
+
+enum render_event_types
+{
+	RENDER_MASK,
+	RENDER_FINE_X,
+	RENDER_PALETTE,
+	RENDER_TILE,
+	RENDER_SPRITES,
+	RENDER_SPRITE_SLOT
+};
+
+struct render_event
+{
+	unsigned int time;
+	unsigned char type;
+	unsigned char data[4];
+};
+
+struct render_log
+{
+	struct render_event* events;
+	unsigned int length;
+	unsigned int capacity;
+	// The render thread draws up to (but not including) this dot.
+	unsigned int end_time;
+};
+
+void ppu_renderer_start();
+void ppu_renderer_stop();
+void ppu_renderer_drain();
+void ppu_renderer_restart();
+void ppu_renderer_end_frame();
+unsigned short* ppu_renderer_take_frame();
+void ppu_renderer_free();
+
+void log_render_event(unsigned char type, unsigned char data_0, unsigned char data_1, unsigned char data_2, unsigned char data_3);
+void log_render_sprites(struct pixel_pipeline* pipeline);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "rom_image.h"
+
+// Every ROM loaded in the process, so that a hundred instances of the same game all read from one copy
+// instead of a hundred. They're looked up by a hash of their contents, not their file name, so the same game
+// under two names (or two games under one) still comes out right. The list's short, so it's just a list.
+struct rom_image* loaded_roms = NULL;
+pthread_mutex_t loaded_roms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a, which is plenty to tell ROMs apart, and the contents get compared too before anything's shared.
+unsigned long long hash_rom(const unsigned char* data, unsigned int size)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Reads the next size bytes of rom, and returns the shared copy of them, which stays put until it's released.
+// A ROM that's shorter than its header says comes out padded with zeroes.
+const struct rom_image* rom_image_load(FILE* rom, unsigned int size)
+{
+	unsigned char* data = calloc(size > 0 ? size : 1, sizeof(char));
+	fread(data, 1, size, rom);
+	unsigned long long hash = hash_rom(data, size);
+
+	pthread_mutex_lock(&loaded_roms_lock);
+	for (struct rom_image* image = loaded_roms; image != NULL; image = image->next)
+	{
+		if (image->hash == hash && image->size == size && memcmp(image->data, data, size) == 0)
+		{
+			image->references++;
+			pthread_mutex_unlock(&loaded_roms_lock);
+			free(data);
+			return image;
+		}
+	}
+
+	struct rom_image* image = malloc(sizeof(struct rom_image));
+	image->data = data;
+	image->size = size;
+	image->hash = hash;
+	image->references = 1;
+	image->next = loaded_roms;
+	loaded_roms = image;
+	pthread_mutex_unlock(&loaded_roms_lock);
+	return image;
+}
+
+// Frees the ROM once the last instance using it lets go.
+void rom_image_release(const struct rom_image* image)
+{
+	if (image == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&loaded_roms_lock);
+	struct rom_image** link = &loaded_roms;
+	while (*link != image)
+	{
+		link = &(*link)->next;
+	}
+	struct rom_image* released = *link;
+	released->references--;
+	if (released->references == 0)
+	{
+		*link = released->next;
+		free((unsigned char*)released->data);
+		free(released);
+	}
+	pthread_mutex_unlock(&loaded_roms_lock);
+}
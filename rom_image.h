@@ -0,0 +1,20 @@
+#ifndef ROM_IMAGE_HEADER
+#define ROM_IMAGE_HEADER
+
+#include <stdio.h>
+
+// A ROM's contents (PRG then CHR), shared by every instance that loaded the same bytes. Never written to.
+struct rom_image
+{
+	const unsigned char* data;
+	unsigned int size;
+	unsigned long long hash;
+	// How many instances are using it. Only touched with the cache locked.
+	unsigned int references;
+	struct rom_image* next;
+};
+
+const struct rom_image* rom_image_load(FILE* rom, unsigned int size);
+void rom_image_release(const struct rom_image* image);
+
+#endif
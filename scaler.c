@@ -0,0 +1,548 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <SDL.h>
+#include "scaler.h"
+
+// Software scalers for the 256x240 frame. A coordinator thread picks up each frame and splits it
+// into bands of rows, one per worker thread, so even a 4K nearest neighbour scale is quick and
+// none of it happens on the emulation thread.
+
+const unsigned int SCALER_INPUT_WIDTH = 256;
+const unsigned int SCALER_INPUT_HEIGHT = 240;
+const unsigned int SCALER_MAX_THREADS = 8;
+// Below this YUV distance xBR treats two colors as the same.
+const unsigned int XBR_EQUAL_THRESHOLD = 155;
+
+typedef void (*scaler_band_function) (unsigned int, unsigned int);
+
+unsigned char scaler_mode = SCALER_OFF;
+unsigned int scaler_factor;
+unsigned int scaler_output_width;
+unsigned int scaler_output_height;
+
+SDL_Thread* scaler_thread = NULL;
+SDL_mutex* scaler_lock;
+SDL_cond* scaler_frame_waiting;
+SDL_cond* scaler_idle;
+unsigned char scaler_busy;
+// Same handoff as the NTSC filter: the emulator fills the pending input, the coordinator swaps it for the working input.
+Uint32* scaler_pending_input;
+Uint32* scaler_input;
+unsigned char scaler_pending_ready;
+// Frame output is double buffered between the workers and the screen, with a third buffer
+// holding the newest finished frame so neither side ever waits for the other.
+Uint32* scaler_outputs[3];
+unsigned char scaler_back;
+unsigned char scaler_ready;
+unsigned char scaler_front;
+unsigned char scaler_output_ready;
+// The back buffer, while the workers are on it.
+Uint32* scaler_output;
+// YUV of every input pixel, for xBR's color distances.
+Uint32* scaler_yuv;
+
+unsigned int scaler_thread_count;
+SDL_sem** scaler_band_start;
+SDL_sem* scaler_band_done;
+scaler_band_function scaler_band_job;
+
+// The 5x5 neighbourhood xBR looks at, minus the corners, as x and y offsets:
+//       A1 B1 C1
+//    A0 A  B  C  C4
+//    D0 D  E  F  F4
+//    G0 G  H  I  I4
+//       G5 H5 I5
+enum xbr_neighbours { XBR_A1, XBR_B1, XBR_C1, XBR_A0, XBR_A, XBR_B, XBR_C, XBR_C4, XBR_D0, XBR_D, XBR_E, XBR_F, XBR_F4, XBR_G0, XBR_G, XBR_H, XBR_I, XBR_I4, XBR_G5, XBR_H5, XBR_I5, XBR_NEIGHBOURS };
+const signed char xbr_offsets[XBR_NEIGHBOURS][2] =
+{
+	{ -1, -2 }, { 0, -2 }, { 1, -2 },
+	{ -2, -1 }, { -1, -1 }, { 0, -1 }, { 1, -1 }, { 2, -1 },
+	{ -2, 0 }, { -1, 0 }, { 0, 0 }, { 1, 0 }, { 2, 0 },
+	{ -2, 1 }, { -1, 1 }, { 0, 1 }, { 1, 1 }, { 2, 1 },
+	{ -1, 2 }, { 0, 2 }, { 1, 2 }
+};
+// xBR works out one corner of the output at a time. These are the neighbourhood rotated so that
+// the corner being worked on is always the bottom right, and the output pixels in the same order.
+const unsigned char xbr_rotations[4][XBR_NEIGHBOURS] =
+{
+	{ XBR_E, XBR_I, XBR_H, XBR_F, XBR_G, XBR_C, XBR_D, XBR_B, XBR_A, XBR_G5, XBR_C4, XBR_G0, XBR_D0, XBR_C1, XBR_B1, XBR_F4, XBR_I4, XBR_H5, XBR_I5, XBR_A0, XBR_A1 },
+	{ XBR_E, XBR_C, XBR_F, XBR_B, XBR_I, XBR_A, XBR_H, XBR_D, XBR_G, XBR_I4, XBR_A1, XBR_I5, XBR_H5, XBR_A0, XBR_D0, XBR_B1, XBR_C1, XBR_F4, XBR_C4, XBR_G5, XBR_G0 },
+	{ XBR_E, XBR_A, XBR_B, XBR_D, XBR_C, XBR_G, XBR_F, XBR_H, XBR_I, XBR_C1, XBR_G0, XBR_C4, XBR_F4, XBR_G5, XBR_H5, XBR_D0, XBR_A0, XBR_B1, XBR_A1, XBR_I4, XBR_I5 },
+	{ XBR_E, XBR_G, XBR_D, XBR_H, XBR_A, XBR_I, XBR_B, XBR_F, XBR_C, XBR_A0, XBR_I5, XBR_A1, XBR_B1, XBR_I4, XBR_F4, XBR_H5, XBR_G5, XBR_D0, XBR_G0, XBR_C1, XBR_C4 }
+};
+const unsigned char xbr_corners[4][4] =
+{
+	{ 0, 1, 2, 3 },
+	{ 2, 0, 3, 1 },
+	{ 3, 2, 1, 0 },
+	{ 1, 3, 0, 2 }
+};
+
+// Pixels off the edge of the frame are treated as copies of the nearest edge pixel.
+unsigned int scaler_index(int x, int y)
+{
+	if (x < 0)
+	{
+		x = 0;
+	}
+	else if (x >= (int)SCALER_INPUT_WIDTH)
+	{
+		x = SCALER_INPUT_WIDTH - 1;
+	}
+	if (y < 0)
+	{
+		y = 0;
+	}
+	else if (y >= (int)SCALER_INPUT_HEIGHT)
+	{
+		y = SCALER_INPUT_HEIGHT - 1;
+	}
+	return (y * SCALER_INPUT_WIDTH) + x;
+}
+
+Uint32 scaler_pixel(int x, int y)
+{
+	return scaler_input[scaler_index(x, y)];
+}
+
+void scale_nearest_band(unsigned int first_row, unsigned int last_row)
+{
+	for (unsigned int y = first_row; y < last_row; y++)
+	{
+		Uint32* source = scaler_input + (y * SCALER_INPUT_WIDTH);
+		Uint32* line = scaler_output + (y * scaler_factor * scaler_output_width);
+		for (unsigned int x = 0; x < SCALER_INPUT_WIDTH; x++)
+		{
+			for (unsigned int i = 0; i < scaler_factor; i++)
+			{
+				line[(x * scaler_factor) + i] = source[x];
+			}
+		}
+		// The rest of the rows are just copies of the first.
+		for (unsigned int i = 1; i < scaler_factor; i++)
+		{
+			memcpy(line + (i * scaler_output_width), line, sizeof(Uint32) * scaler_output_width);
+		}
+	}
+}
+
+void scale_2x_band(unsigned int first_row, unsigned int last_row)
+{
+	for (unsigned int y = first_row; y < last_row; y++)
+	{
+		Uint32* top = scaler_output + (y * 2 * scaler_output_width);
+		Uint32* bottom = top + scaler_output_width;
+		for (unsigned int x = 0; x < SCALER_INPUT_WIDTH; x++)
+		{
+			Uint32 b = scaler_pixel((int)x, (int)y - 1);
+			Uint32 d = scaler_pixel((int)x - 1, (int)y);
+			Uint32 e = scaler_pixel((int)x, (int)y);
+			Uint32 f = scaler_pixel((int)x + 1, (int)y);
+			Uint32 h = scaler_pixel((int)x, (int)y + 1);
+
+			if ((b != h) && (d != f))
+			{
+				top[x * 2] = (d == b) ? d : e;
+				top[(x * 2) + 1] = (b == f) ? f : e;
+				bottom[x * 2] = (d == h) ? d : e;
+				bottom[(x * 2) + 1] = (h == f) ? f : e;
+			}
+			else
+			{
+				top[x * 2] = e;
+				top[(x * 2) + 1] = e;
+				bottom[x * 2] = e;
+				bottom[(x * 2) + 1] = e;
+			}
+		}
+	}
+}
+
+void scale_3x_band(unsigned int first_row, unsigned int last_row)
+{
+	for (unsigned int y = first_row; y < last_row; y++)
+	{
+		Uint32* top = scaler_output + (y * 3 * scaler_output_width);
+		Uint32* middle = top + scaler_output_width;
+		Uint32* bottom = middle + scaler_output_width;
+		for (unsigned int x = 0; x < SCALER_INPUT_WIDTH; x++)
+		{
+			Uint32 a = scaler_pixel((int)x - 1, (int)y - 1);
+			Uint32 b = scaler_pixel((int)x, (int)y - 1);
+			Uint32 c = scaler_pixel((int)x + 1, (int)y - 1);
+			Uint32 d = scaler_pixel((int)x - 1, (int)y);
+			Uint32 e = scaler_pixel((int)x, (int)y);
+			Uint32 f = scaler_pixel((int)x + 1, (int)y);
+			Uint32 g = scaler_pixel((int)x - 1, (int)y + 1);
+			Uint32 h = scaler_pixel((int)x, (int)y + 1);
+			Uint32 i = scaler_pixel((int)x + 1, (int)y + 1);
+			unsigned int column = x * 3;
+
+			if ((b != h) && (d != f))
+			{
+				top[column] = (d == b) ? d : e;
+				top[column + 1] = (((d == b) && (e != c)) || ((b == f) && (e != a))) ? b : e;
+				top[column + 2] = (b == f) ? f : e;
+				middle[column] = (((d == b) && (e != g)) || ((d == h) && (e != a))) ? d : e;
+				middle[column + 1] = e;
+				middle[column + 2] = (((b == f) && (e != i)) || ((h == f) && (e != c))) ? f : e;
+				bottom[column] = (d == h) ? d : e;
+				bottom[column + 1] = (((d == h) && (e != i)) || ((h == f) && (e != g))) ? h : e;
+				bottom[column + 2] = (h == f) ? f : e;
+			}
+			else
+			{
+				for (unsigned int j = 0; j < 3; j++)
+				{
+					top[column + j] = e;
+					middle[column + j] = e;
+					bottom[column + j] = e;
+				}
+			}
+		}
+	}
+}
+
+void xbr_yuv_band(unsigned int first_row, unsigned int last_row)
+{
+	for (unsigned int i = first_row * SCALER_INPUT_WIDTH; i < last_row * SCALER_INPUT_WIDTH; i++)
+	{
+		int red = (scaler_input[i] >> 16) & 0xFF;
+		int green = (scaler_input[i] >> 8) & 0xFF;
+		int blue = scaler_input[i] & 0xFF;
+		int luma = ((299 * red) + (587 * green) + (114 * blue)) / 1000;
+		int u = ((-169 * red) - (331 * green) + (500 * blue)) / 1000 + 128;
+		int v = ((500 * red) - (419 * green) - (81 * blue)) / 1000 + 128;
+		scaler_yuv[i] = (luma << 16) | (u << 8) | v;
+	}
+}
+
+unsigned int xbr_distance(Uint32 yuv_1, Uint32 yuv_2)
+{
+	return abs((int)((yuv_1 >> 16) & 0xFF) - (int)((yuv_2 >> 16) & 0xFF))
+		+ abs((int)((yuv_1 >> 8) & 0xFF) - (int)((yuv_2 >> 8) & 0xFF))
+		+ abs((int)(yuv_1 & 0xFF) - (int)(yuv_2 & 0xFF));
+}
+
+// Moves a pixel toward a color by amount / 256.
+Uint32 xbr_blend(Uint32 pixel, Uint32 color, int amount)
+{
+	Uint32 result = 0;
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		int from = (pixel >> shift) & 0xFF;
+		int to = (color >> shift) & 0xFF;
+		result |= (Uint32)(from + (((to - from) * amount) >> 8)) << shift;
+	}
+	return result;
+}
+
+// One corner of Hyllian's 2xBR, on a rotated neighbourhood. The names are as if the corner is the bottom right.
+void xbr_corner(Uint32* pixels, Uint32* yuv, const unsigned char* rotation, const unsigned char* corner, Uint32* block)
+{
+	#define P(n) pixels[rotation[n]]
+	#define DIFF(n1, n2) xbr_distance(yuv[rotation[n1]], yuv[rotation[n2]])
+	#define SAME(n1, n2) (DIFF(n1, n2) < XBR_EQUAL_THRESHOLD)
+	// Rotated positions, in the order of xbr_rotations.
+	enum { RE, RI, RH, RF, RG, RC, RD, RB, RA, RG5, RC4, RG0, RD0, RC1, RB1, RF4, RI4, RH5, RI5, RA0, RA1 };
+
+	if ((P(RE) == P(RH)) || (P(RE) == P(RF)))
+	{
+		return;
+	}
+
+	// Weigh up whether the edge runs along H-F or along E-I.
+	unsigned int edge_e = DIFF(RE, RC) + DIFF(RE, RG) + DIFF(RI, RH5) + DIFF(RI, RF4) + (DIFF(RH, RF) << 2);
+	unsigned int edge_i = DIFF(RH, RD) + DIFF(RH, RI5) + DIFF(RF, RI4) + DIFF(RF, RB) + (DIFF(RE, RI) << 2);
+	if (edge_e > edge_i)
+	{
+		return;
+	}
+
+	Uint32 color = (DIFF(RE, RF) <= DIFF(RE, RH)) ? P(RF) : P(RH);
+	if ((edge_e < edge_i)
+		&& ((!SAME(RF, RB) && !SAME(RH, RD))
+			|| (SAME(RE, RI) && !SAME(RF, RI4) && !SAME(RH, RI5))
+			|| SAME(RE, RG) || SAME(RE, RC)))
+	{
+		unsigned int shallow = DIFF(RF, RG);
+		unsigned int steep = DIFF(RH, RC);
+		unsigned char left = ((shallow << 1) <= steep) && (P(RE) != P(RG)) && (P(RD) != P(RG));
+		unsigned char up = (shallow >= (steep << 1)) && (P(RE) != P(RC)) && (P(RB) != P(RC));
+		if (left && up)
+		{
+			block[corner[3]] = xbr_blend(block[corner[3]], color, 224);
+			block[corner[2]] = xbr_blend(block[corner[2]], color, 64);
+			block[corner[1]] = block[corner[2]];
+		}
+		else if (left)
+		{
+			block[corner[3]] = xbr_blend(block[corner[3]], color, 192);
+			block[corner[2]] = xbr_blend(block[corner[2]], color, 64);
+		}
+		else if (up)
+		{
+			block[corner[3]] = xbr_blend(block[corner[3]], color, 192);
+			block[corner[1]] = xbr_blend(block[corner[1]], color, 64);
+		}
+		else
+		{
+			block[corner[3]] = xbr_blend(block[corner[3]], color, 128);
+		}
+	}
+	else
+	{
+		block[corner[3]] = xbr_blend(block[corner[3]], color, 128);
+	}
+
+	#undef P
+	#undef DIFF
+	#undef SAME
+}
+
+void scale_xbr_band(unsigned int first_row, unsigned int last_row)
+{
+	Uint32 pixels[XBR_NEIGHBOURS];
+	Uint32 yuv[XBR_NEIGHBOURS];
+	for (unsigned int y = first_row; y < last_row; y++)
+	{
+		Uint32* top = scaler_output + (y * 2 * scaler_output_width);
+		Uint32* bottom = top + scaler_output_width;
+		for (unsigned int x = 0; x < SCALER_INPUT_WIDTH; x++)
+		{
+			for (int n = 0; n < XBR_NEIGHBOURS; n++)
+			{
+				unsigned int index = scaler_index((int)x + xbr_offsets[n][0], (int)y + xbr_offsets[n][1]);
+				pixels[n] = scaler_input[index];
+				yuv[n] = scaler_yuv[index];
+			}
+
+			Uint32 block[4] = { pixels[XBR_E], pixels[XBR_E], pixels[XBR_E], pixels[XBR_E] };
+			for (int rotation = 0; rotation < 4; rotation++)
+			{
+				xbr_corner(pixels, yuv, xbr_rotations[rotation], xbr_corners[rotation], block);
+			}
+
+			top[x * 2] = block[0];
+			top[(x * 2) + 1] = block[1];
+			bottom[x * 2] = block[2];
+			bottom[(x * 2) + 1] = block[3];
+		}
+	}
+}
+
+// Has every worker do its band of the frame with the given function, and waits until they're all done.
+void scaler_run_bands(scaler_band_function function)
+{
+	scaler_band_job = function;
+	for (unsigned int i = 0; i < scaler_thread_count; i++)
+	{
+		SDL_SemPost(scaler_band_start[i]);
+	}
+	for (unsigned int i = 0; i < scaler_thread_count; i++)
+	{
+		SDL_SemWait(scaler_band_done);
+	}
+}
+
+int scaler_worker(void* data)
+{
+	unsigned int band = (unsigned int)(uintptr_t)data;
+	unsigned int first_row = (band * SCALER_INPUT_HEIGHT) / scaler_thread_count;
+	unsigned int last_row = ((band + 1) * SCALER_INPUT_HEIGHT) / scaler_thread_count;
+	while (1)
+	{
+		SDL_SemWait(scaler_band_start[band]);
+		scaler_band_job(first_row, last_row);
+		SDL_SemPost(scaler_band_done);
+	}
+
+	return 0;
+}
+
+int scaler_coordinator(void* data)
+{
+	while (1)
+	{
+		SDL_LockMutex(scaler_lock);
+		while (!scaler_pending_ready)
+		{
+			SDL_CondWait(scaler_frame_waiting, scaler_lock);
+		}
+		Uint32* next_input = scaler_pending_input;
+		scaler_pending_input = scaler_input;
+		scaler_input = next_input;
+		scaler_pending_ready = 0;
+		scaler_busy = 1;
+		scaler_output = scaler_outputs[scaler_back];
+		unsigned char mode = scaler_mode;
+		SDL_UnlockMutex(scaler_lock);
+
+		switch (mode)
+		{
+			case SCALER_NEAREST:
+			{
+				scaler_run_bands(scale_nearest_band);
+				break;
+			}
+			case SCALER_SCALE2X:
+			{
+				scaler_run_bands(scale_2x_band);
+				break;
+			}
+			case SCALER_SCALE3X:
+			{
+				scaler_run_bands(scale_3x_band);
+				break;
+			}
+			case SCALER_XBR:
+			{
+				scaler_run_bands(xbr_yuv_band);
+				scaler_run_bands(scale_xbr_band);
+				break;
+			}
+		}
+
+		SDL_LockMutex(scaler_lock);
+		unsigned char finished = scaler_back;
+		scaler_back = scaler_ready;
+		scaler_ready = finished;
+		scaler_output_ready = 1;
+		scaler_busy = 0;
+		SDL_CondBroadcast(scaler_idle);
+		SDL_UnlockMutex(scaler_lock);
+	}
+
+	return 0;
+}
+
+// Changes the scaler, waiting for the frame in progress to finish first. Factor only matters for nearest neighbour.
+// Any output taken before this is no longer valid.
+void scaler_set_mode(unsigned char mode, unsigned int factor)
+{
+	SDL_LockMutex(scaler_lock);
+	while (scaler_busy)
+	{
+		SDL_CondWait(scaler_idle, scaler_lock);
+	}
+
+	scaler_mode = mode;
+	switch (mode)
+	{
+		case SCALER_NEAREST:
+		{
+			scaler_factor = (factor > 0) ? factor : 1;
+			break;
+		}
+		case SCALER_SCALE2X:
+		case SCALER_XBR:
+		{
+			scaler_factor = 2;
+			break;
+		}
+		case SCALER_SCALE3X:
+		{
+			scaler_factor = 3;
+			break;
+		}
+		default:
+		{
+			scaler_factor = 1;
+			break;
+		}
+	}
+	scaler_output_width = SCALER_INPUT_WIDTH * scaler_factor;
+	scaler_output_height = SCALER_INPUT_HEIGHT * scaler_factor;
+
+	for (int i = 0; i < 3; i++)
+	{
+		free(scaler_outputs[i]);
+		scaler_outputs[i] = NULL;
+		if (mode != SCALER_OFF)
+		{
+			scaler_outputs[i] = malloc(sizeof(Uint32) * scaler_output_width * scaler_output_height);
+		}
+	}
+	scaler_output_ready = 0;
+	SDL_UnlockMutex(scaler_lock);
+}
+
+// Hands the frame (256x240 pixels, as in the screen texture) to the scaler. A frame the scaler
+// hasn't started on yet gets replaced, so this never waits for the scaler to catch up.
+void scaler_submit(Uint32* frame)
+{
+	SDL_LockMutex(scaler_lock);
+	memcpy(scaler_pending_input, frame, sizeof(Uint32) * SCALER_INPUT_WIDTH * SCALER_INPUT_HEIGHT);
+	scaler_pending_ready = 1;
+	SDL_CondSignal(scaler_frame_waiting);
+	SDL_UnlockMutex(scaler_lock);
+}
+
+// Returns the newest scaled frame, or NULL if nothing new has finished since the last call.
+// The returned frame stays valid until the next call.
+Uint32* scaler_take_output()
+{
+	Uint32* output = NULL;
+	SDL_LockMutex(scaler_lock);
+	if (scaler_output_ready)
+	{
+		unsigned char newest = scaler_ready;
+		scaler_ready = scaler_front;
+		scaler_front = newest;
+		scaler_output_ready = 0;
+		output = scaler_outputs[scaler_front];
+	}
+	SDL_UnlockMutex(scaler_lock);
+
+	return output;
+}
+
+void scaler_init()
+{
+	if (scaler_thread != NULL)
+	{
+		return;
+	}
+
+	unsigned int input_size = SCALER_INPUT_WIDTH * SCALER_INPUT_HEIGHT;
+	scaler_pending_input = malloc(sizeof(Uint32) * input_size);
+	scaler_input = malloc(sizeof(Uint32) * input_size);
+	scaler_yuv = malloc(sizeof(Uint32) * input_size);
+	scaler_pending_ready = 0;
+	scaler_busy = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		scaler_outputs[i] = NULL;
+	}
+	scaler_back = 0;
+	scaler_ready = 1;
+	scaler_front = 2;
+	scaler_output_ready = 0;
+
+	// Leave a core for the emulator.
+	int cpu_count = SDL_GetCPUCount();
+	scaler_thread_count = (cpu_count > 2) ? (cpu_count - 1) : 1;
+	if (scaler_thread_count > SCALER_MAX_THREADS)
+	{
+		scaler_thread_count = SCALER_MAX_THREADS;
+	}
+
+	scaler_lock = SDL_CreateMutex();
+	scaler_frame_waiting = SDL_CreateCond();
+	scaler_idle = SDL_CreateCond();
+	scaler_band_done = SDL_CreateSemaphore(0);
+	scaler_band_start = malloc(sizeof(SDL_sem*) * scaler_thread_count);
+	for (unsigned int i = 0; i < scaler_thread_count; i++)
+	{
+		scaler_band_start[i] = SDL_CreateSemaphore(0);
+		SDL_CreateThread(scaler_worker, "Scaler worker", (void*)(uintptr_t)i);
+	}
+
+	scaler_thread = SDL_CreateThread(scaler_coordinator, "Scaler", NULL);
+	if (scaler_thread == NULL)
+	{
+		printf("Could not start the scaler thread: %s\n", SDL_GetError());
+	}
+}
@@ -0,0 +1,15 @@
+#ifndef SCALER_HEADER
+#define SCALER_HEADER
+
+enum scaler_modes { SCALER_OFF, SCALER_NEAREST, SCALER_SCALE2X, SCALER_SCALE3X, SCALER_XBR, SCALER_MODE_COUNT };
+
+extern unsigned char scaler_mode;
+extern unsigned int scaler_output_width;
+extern unsigned int scaler_output_height;
+
+void scaler_init();
+void scaler_set_mode(unsigned char mode, unsigned int factor);
+void scaler_submit(Uint32* frame);
+Uint32* scaler_take_output();
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include "step_buffer.h"
+
+// Band-limited step synthesis. Instead of producing a sample on every APU clock and resampling them down,
+// the APU only reports when its output level changes, and by how much. Each change is drawn into the
+// buffer as a band-limited step (a windowed sinc impulse, picked from a table by where the change falls
+// between two output samples), and the output samples are the running sum of those impulses.
+// That gets rid of the aliasing from averaging, and the work only happens when the level actually changes.
+
+// Taps in each step, and how many sub-sample positions the step can be placed at.
+#define STEP_KERNEL_WIDTH 16
+#define STEP_PHASE_BITS 6
+const unsigned int STEP_PHASES = 1 << STEP_PHASE_BITS;
+// Each step's taps add up to 1 << STEP_KERNEL_BITS, so the running sum is the level shifted up by that much.
+const int STEP_KERNEL_BITS = 12;
+// The running sum leaks a little each sample, which takes out any DC offset (below about 15 Hz at 48 KHz).
+const int STEP_BASS_SHIFT = 9;
+// The cutoff, as a fraction of the output's Nyquist frequency.
+const double STEP_CUTOFF = 0.9;
+const double STEP_PI = 3.14159265358979323846;
+
+// Shared by every buffer, and built by whichever one is made first, on whatever thread that happens on.
+short* step_kernel = NULL;
+pthread_once_t step_kernel_built = PTHREAD_ONCE_INIT;
+
+void build_step_kernel()
+{
+	step_kernel = malloc(sizeof(short) * STEP_PHASES * STEP_KERNEL_WIDTH);
+	const double half_width = STEP_KERNEL_WIDTH / 2;
+	for (unsigned int phase = 0; phase < STEP_PHASES; phase++)
+	{
+		double taps[STEP_KERNEL_WIDTH];
+		double total = 0;
+		for (int i = 0; i < STEP_KERNEL_WIDTH; i++)
+		{
+			// Distance from the step to this tap, in output samples.
+			// The whole kernel is delayed by half its width so no tap lands before the step's sample.
+			double x = i - half_width + 1 - ((double)phase / STEP_PHASES);
+			double sinc = (x == 0) ? 1 : sin(STEP_PI * x * STEP_CUTOFF) / (STEP_PI * x * STEP_CUTOFF);
+			double window = 0.42 + (0.5 * cos(STEP_PI * x / half_width)) + (0.08 * cos(2 * STEP_PI * x / half_width));
+			taps[i] = sinc * window;
+			total += taps[i];
+		}
+
+		// Scale so the taps sum to exactly 1 << STEP_KERNEL_BITS, otherwise every step would leave a little error behind.
+		short* kernel = &step_kernel[phase * STEP_KERNEL_WIDTH];
+		int sum = 0;
+		for (int i = 0; i < STEP_KERNEL_WIDTH; i++)
+		{
+			kernel[i] = (short)floor(((taps[i] / total) * (1 << STEP_KERNEL_BITS)) + 0.5);
+			sum += kernel[i];
+		}
+		kernel[(STEP_KERNEL_WIDTH / 2) - 1] += (1 << STEP_KERNEL_BITS) - sum;
+	}
+}
+
+// capacity is the most output samples the buffer can hold between reads.
+struct step_buffer* step_buffer_create(unsigned int clock_rate, unsigned int sample_rate, unsigned int capacity)
+{
+	pthread_once(&step_kernel_built, build_step_kernel);
+
+	struct step_buffer* buffer = malloc(sizeof(struct step_buffer));
+	buffer->capacity = capacity;
+	buffer->deltas = malloc(sizeof(int) * (capacity + STEP_KERNEL_WIDTH));
+	step_buffer_set_rates(buffer, clock_rate, sample_rate);
+	step_buffer_clear(buffer);
+	return buffer;
+}
+
+void step_buffer_free(struct step_buffer* buffer)
+{
+	free(buffer->deltas);
+	free(buffer);
+}
+
+void step_buffer_set_rates(struct step_buffer* buffer, double clock_rate, double sample_rate)
+{
+	buffer->factor = (unsigned long long)floor(((sample_rate / clock_rate) * 4294967296.0) + 0.5);
+}
+
+void step_buffer_clear(struct step_buffer* buffer)
+{
+	memset(buffer->deltas, 0, sizeof(int) * (buffer->capacity + STEP_KERNEL_WIDTH));
+	buffer->offset = 0;
+	buffer->integrator = 0;
+}
+
+// Adds a change in level at the given clock, counted from the start of the frame.
+void step_buffer_add_delta(struct step_buffer* buffer, unsigned int time, int delta)
+{
+	unsigned long long position = buffer->offset + (time * buffer->factor);
+	unsigned int index = position >> 32;
+	if (index >= buffer->capacity)
+	{
+		// Nobody's reading, so there's nowhere for it to go.
+		return;
+	}
+
+	unsigned int phase = (position >> (32 - STEP_PHASE_BITS)) & (STEP_PHASES - 1);
+	short* kernel = &step_kernel[phase * STEP_KERNEL_WIDTH];
+	int* output = &buffer->deltas[index];
+	for (int i = 0; i < STEP_KERNEL_WIDTH; i++)
+	{
+		output[i] += kernel[i] * delta;
+	}
+}
+
+// Ends the frame after the given number of clocks. Their samples can be read out now,
+// and the next frame's times start from 0 again. Returns how many samples are ready.
+unsigned int step_buffer_end_frame(struct step_buffer* buffer, unsigned int clocks)
+{
+	buffer->offset += clocks * buffer->factor;
+	if ((buffer->offset >> 32) > buffer->capacity)
+	{
+		buffer->offset = (unsigned long long)buffer->capacity << 32;
+	}
+	return step_buffer_samples_available(buffer);
+}
+
+unsigned int step_buffer_samples_available(struct step_buffer* buffer)
+{
+	return buffer->offset >> 32;
+}
+
+// Reads up to count signed 16 bit samples out of the buffer. Returns how many were read.
+unsigned int step_buffer_read_samples(struct step_buffer* buffer, short* output, unsigned int count)
+{
+	unsigned int available = step_buffer_samples_available(buffer);
+	if (count > available)
+	{
+		count = available;
+	}
+
+	int integrator = buffer->integrator;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		int sample = integrator >> STEP_KERNEL_BITS;
+		integrator += buffer->deltas[i];
+		if (sample > 32767)
+		{
+			sample = 32767;
+		}
+		else if (sample < -32768)
+		{
+			sample = -32768;
+		}
+		output[i] = sample;
+		integrator -= sample * (1 << (STEP_KERNEL_BITS - STEP_BASS_SHIFT));
+	}
+	buffer->integrator = integrator;
+
+	// Shift what's left (including the tails of steps past the end) down to the start.
+	unsigned int remaining = available - count + STEP_KERNEL_WIDTH;
+	memmove(buffer->deltas, &buffer->deltas[count], sizeof(int) * remaining);
+	memset(&buffer->deltas[remaining], 0, sizeof(int) * count);
+	buffer->offset -= (unsigned long long)count << 32;
+	return count;
+}
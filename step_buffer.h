@@ -0,0 +1,24 @@
+#ifndef STEP_BUFFER_HEADER
+#define STEP_BUFFER_HEADER
+
+struct step_buffer
+{
+	// Amplitude changes, already spread out by the band-limited step kernel. Output samples are the running sum.
+	int* deltas;
+	unsigned int capacity;
+	// Output samples per clock, and the position of the frame's first clock, both with 32 fractional bits.
+	unsigned long long factor;
+	unsigned long long offset;
+	int integrator;
+};
+
+struct step_buffer* step_buffer_create(unsigned int clock_rate, unsigned int sample_rate, unsigned int capacity);
+void step_buffer_free(struct step_buffer* buffer);
+void step_buffer_set_rates(struct step_buffer* buffer, double clock_rate, double sample_rate);
+void step_buffer_clear(struct step_buffer* buffer);
+void step_buffer_add_delta(struct step_buffer* buffer, unsigned int time, int delta);
+unsigned int step_buffer_end_frame(struct step_buffer* buffer, unsigned int clocks);
+unsigned int step_buffer_samples_available(struct step_buffer* buffer);
+unsigned int step_buffer_read_samples(struct step_buffer* buffer, short* output, unsigned int count);
+
+#endif